@@ -3,13 +3,23 @@ import json
 import datetime
 import threading
 import time
-from flask import Flask, request, jsonify
+import collections
+import zlib
+import struct
+from flask import Flask, Response, request, jsonify
 from flask_cors import CORS
 from flask_socketio import SocketIO, emit
 import paho.mqtt.client as mqtt
 from pymongo import MongoClient
 from dotenv import load_dotenv
 
+# Shared firmware control core (app/native). Without it the backend cannot
+# recompute device state; it then runs only with TRUST_DEVICE_STATE=1.
+try:
+    import streetlight_core
+except ImportError:
+    streetlight_core = None
+
 load_dotenv()
 
 # --- CONFIGURATION ---
@@ -20,12 +30,43 @@ if not MONGO_URI:
 MQTT_BROKER = os.getenv("MQTT_BROKER", "localhost")
 MQTT_PORT = int(os.getenv("MQTT_PORT", 1883))
 MQTT_TOPIC = os.getenv("MQTT_TOPIC", "smartcity/streetlight/+/data")
+MQTT_DIAG_TOPIC = os.getenv("MQTT_DIAG_TOPIC", "smartcity/streetlight/+/diag")
+MQTT_FLIGHT_TOPIC = os.getenv("MQTT_FLIGHT_TOPIC", "smartcity/streetlight/+/flight")
+MQTT_BATCH_TOPIC = os.getenv("MQTT_BATCH_TOPIC", "smartcity/streetlight/+/batch")
+MQTT_COMMAND_TOPIC = os.getenv("MQTT_COMMAND_TOPIC", "smartcity/streetlight/{device}/command")
+
+# Take smooth_ldr/is_night/brightness from the payload instead of recomputing
+TRUST_DEVICE_STATE = os.getenv("TRUST_DEVICE_STATE", "0") == "1"
+if streetlight_core is None and not TRUST_DEVICE_STATE:
+    raise SystemExit("streetlight_core is not installed (pip install ./native); "
+                     "install it or set TRUST_DEVICE_STATE=1")
+
+# Controller policy each device was built with (firmware STREETLIGHT_POLICY):
+# LDR_POLICY for all, DEVICE_POLICIES="3=arterial,7=residential" per device
+LDR_POLICY = os.getenv("LDR_POLICY", "default")
+DEVICE_POLICIES = dict(entry.split("=", 1) for entry in os.getenv("DEVICE_POLICIES", "").split(",") if entry)
+if not TRUST_DEVICE_STATE:
+    for policy in {LDR_POLICY, *DEVICE_POLICIES.values()}:
+        if policy not in streetlight_core.POLICIES:
+            raise SystemExit(f"Unknown LDR policy '{policy}' (one of {', '.join(streetlight_core.POLICIES)})")
 
 TRADITIONAL_LIGHT_POWER_W = 100.0
 MAX_SMART_LIGHT_POWER_W = 20.0
 
-# --- PROCESSING CONSTANTS (From C++) ---
-WINDOW_SIZE = 10
+# --- INGEST PIPELINE LIMITS ---
+EVENT_QUEUE_SIZE = int(os.getenv("EVENT_QUEUE_SIZE", 1000))
+HEARTBEAT_QUEUE_SIZE = int(os.getenv("HEARTBEAT_QUEUE_SIZE", 200))
+LATENCY_WINDOW = 1024  # Samples kept per lane for percentile stats
+SEQ_WINDOW = 64  # Dedup bitmap width (messages) per device
+DIAG_HISTORY = 1440  # Diagnostics kept per device (1 day at one per minute)
+FLIGHT_DUMPS = 4  # Flight recorder dumps kept per device
+
+# --- DEVICE TIMESTAMP PLAUSIBILITY ---
+MAX_CAPTURE_AGE = datetime.timedelta(days=7)      # Replayed/spooled samples
+MAX_CLOCK_AHEAD = datetime.timedelta(seconds=60)  # Device clock running fast
+
+# --- PROCESSING CONSTANTS ---
+# (LDR window/thresholds come from the firmware core: streetlight_core)
 MOTION_HISTORY_SIZE = 60  # 2-3 mins of history
 
 # --- IN-MEMORY STATE (Replaces C++ State Files) ---
@@ -37,40 +78,39 @@ def get_device_state(device_id):
     with state_lock:
         if device_id not in device_states:
             device_states[device_id] = {
-                'ldr_readings': [0] * WINDOW_SIZE,
-                'ldr_index': 0,
-                'ldr_sum': 0,
-                'is_night': False,
+                'ldr_filter': None if TRUST_DEVICE_STATE else
+                              streetlight_core.LdrFilter(DEVICE_POLICIES.get(device_id, LDR_POLICY)),
+                'ldr_time': None,  # Sample time of the last reading pushed
                 'motion_history': [0] * MOTION_HISTORY_SIZE,
                 'motion_index': 0,
                 'motion_sum': 0
             }
         return device_states[device_id]
 
-def process_sensor_data(device_id, raw_ldr, motion, power):
+def process_sensor_data(device_id, raw_ldr, motion, power, device_state=None, sampled_at=None):
     """
-    Python implementation of the C++ processing logic.
-    Sliding window smoothing, hysteresis, traffic analytics.
+    Sliding window smoothing + hysteresis (firmware core), traffic analytics.
+    device_state: (smooth_ldr, is_night, brightness) already computed by the
+    device; used as-is in trust mode, skipping steps 1, 2 and 4.
+    sampled_at: capture time of the reading; the filter replays the samples
+    the device took since the previous one.
     """
     state = get_device_state(device_id)
     
     with state_lock:
-        # 1. Sliding Window (LDR) - for smoothing digital readings
-        state['ldr_sum'] -= state['ldr_readings'][state['ldr_index']]
-        state['ldr_readings'][state['ldr_index']] = raw_ldr
-        state['ldr_sum'] += raw_ldr
-        state['ldr_index'] = (state['ldr_index'] + 1) % WINDOW_SIZE
-        smooth_ldr = state['ldr_sum']  # Sum of 10 readings (0-10 for digital sensor)
-        
-        # 2. Night Detection for DIGITAL LDR (0=day, 1=night)
-        # If more than half the readings are "night" (1), consider it night
-        if smooth_ldr > (WINDOW_SIZE // 2):
-            state['is_night'] = True
-        elif smooth_ldr < (WINDOW_SIZE // 2):
-            state['is_night'] = False
-        # If exactly half, maintain previous state (hysteresis)
-        
-        is_night = state['is_night']
+        if device_state is not None:
+            smooth_ldr, is_night, target_brightness = device_state
+        else:
+            # 1 + 2. Sliding Window + Hysteresis (same code and policy as
+            # the device, at its sampling rate)
+            ldr_filter = state['ldr_filter']
+            if state['ldr_time'] is None or sampled_at is None:
+                smooth_ldr, is_night = ldr_filter.prime(raw_ldr)
+            else:
+                elapsed_ms = int((sampled_at - state['ldr_time']).total_seconds() * 1000)
+                smooth_ldr, is_night = ldr_filter.push(raw_ldr, max(elapsed_ms, 0))
+            if sampled_at is not None:
+                state['ldr_time'] = max(sampled_at, state['ldr_time'] or sampled_at)
         
         # 3. Traffic Analytics (Motion Intensity)
         state['motion_sum'] -= state['motion_history'][state['motion_index']]
@@ -81,9 +121,8 @@ def process_sensor_data(device_id, raw_ldr, motion, power):
         traffic_intensity = (state['motion_sum'] / MOTION_HISTORY_SIZE) * 100.0
         
         # 4. Logic (Target Brightness)
-        target_brightness = 0
-        if is_night:
-            target_brightness = 100 if motion > 0 else 30
+        if device_state is None:
+            target_brightness = ldr_filter.brightness(motion > 0)
         
         # 5. Anomaly Detection
         anomaly = 0
@@ -117,22 +156,104 @@ try:
 except Exception as e:
     print(f"❌ MongoDB Connection Failed: {e}")
 
-# --- CORE LOGIC (Unified, Python-Only) ---
-def process_data(device_id, raw_ldr, motion, power, source):
+# --- END-TO-END LATENCY TRACING ---
+class LatencyTracer:
+    """
+    Per-hop latency histograms for the motion path:
+    PIR edge -> decision -> PWM write -> publish (device, micros offsets)
+    -> ingest receive -> processed -> persisted -> pushed (backend, wall clock).
+    The publish -> ingest hop compares the device's SNTP epoch with ours,
+    so it is only recorded when the device reported a synced timestamp.
+    Buckets are powers of two in microseconds.
+    """
+    HOPS = ['edge_to_decision', 'decision_to_pwm', 'pwm_to_publish', 'publish_to_ingest',
+            'ingest_to_processed', 'processed_to_persisted', 'persisted_to_pushed', 'edge_to_pushed']
+    BUCKETS = 32
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.histograms = {hop: [0] * self.BUCKETS for hop in self.HOPS}
+        self.maxima = {hop: 0 for hop in self.HOPS}
+
+    def _add(self, hop, us):
+        us = max(0, int(us))
+        bucket = min(self.BUCKETS - 1, us.bit_length())
+        self.histograms[hop][bucket] += 1
+        self.maxima[hop] = max(self.maxima[hop], us)
+
+    def record(self, trace):
+        hops = {
+            'edge_to_decision': trace['dec'],
+            'decision_to_pwm': trace['pwm'] - trace['dec'],
+            'pwm_to_publish': trace['pub'] - trace['pwm'],
+            'ingest_to_processed': (trace['processed'] - trace['recv']) * 1e6,
+            'processed_to_persisted': (trace['persisted'] - trace['processed']) * 1e6,
+            'persisted_to_pushed': (trace['pushed'] - trace['persisted']) * 1e6
+        }
+        if 't' in trace:
+            published = trace['t'] / 1000.0
+            hops['publish_to_ingest'] = (trace['recv'] - published) * 1e6
+            hops['edge_to_pushed'] = trace['pub'] + (trace['pushed'] - published) * 1e6
+        with self.lock:
+            for hop, us in hops.items():
+                self._add(hop, us)
+
+    def stats(self):
+        with self.lock:
+            result = {}
+            for hop in self.HOPS:
+                counts = self.histograms[hop]
+                total = sum(counts)
+                entry = {'count': total, 'max_us': self.maxima[hop],
+                         'buckets_us': {str(1 << i): c for i, c in enumerate(counts) if c}}
+                # Percentiles reported as the upper bound of their bucket
+                for name, q in (('p50_us', 0.50), ('p99_us', 0.99)):
+                    running, value = 0, 0
+                    for i, c in enumerate(counts):
+                        running += c
+                        if total and running >= q * total:
+                            value = 1 << i
+                            break
+                    entry[name] = value
+                result[hop] = entry
+            return result
+
+tracer = LatencyTracer()
+
+def resolve_timestamp(captured_at_ms, ingested):
+    """Device SNTP capture time when plausible, otherwise ingest time."""
+    if captured_at_ms:
+        captured = datetime.datetime.utcfromtimestamp(captured_at_ms / 1000.0)
+        if ingested - MAX_CAPTURE_AGE <= captured <= ingested + MAX_CLOCK_AHEAD:
+            return captured, "device"
+    return ingested, "ingest"
+
+# --- CORE LOGIC (Unified) ---
+def process_data(device_id, raw_ldr, motion, power, source, trace=None, captured_at=None, clock=None,
+                 device_state=None, boot_timeline=None, heads=None):
     """
     Unified logic channel. Used by both HTTP (Manual) and MQTT (Live).
     1. Caller invokes this function.
-    2. Data is processed in Python (no C++ dependency).
+    2. Data is processed (shared firmware core, or trusted device state).
     3. Result is saved to DB.
     4. Result is emitted to WebSockets.
+    A device trace (motion events only) is stamped at each stage.
+    'timestamp' is the device capture time (epoch ms) when it sent one.
+    The first message after a device reset carries its boot timeline.
+    A multi-head board adds its per-head state ('power' is then the total).
     """
     try:
-        # 1. PROCESS VIA PYTHON
-        processed = process_sensor_data(device_id, raw_ldr, motion, power)
+        # 1. PROCESS
+        ingested = datetime.datetime.utcnow()
+        timestamp, time_source = resolve_timestamp(captured_at, ingested)
+        processed = process_sensor_data(device_id, raw_ldr, motion, power, device_state, timestamp)
+        if trace: trace['processed'] = time.time()
         
         # 2. PREPARE DB DOCUMENT (field names match frontend expectations)
         document = {
-            "timestamp": datetime.datetime.utcnow(),
+            "timestamp": timestamp,
+            "ingest_timestamp": ingested,
+            "time_source": time_source,
             "device_id": device_id,
             "ldr": raw_ldr,  # Frontend expects 'ldr'
             "smooth_ldr": processed['smooth_ldr'],  # Frontend expects 'smooth_ldr'
@@ -144,17 +265,36 @@ def process_data(device_id, raw_ldr, motion, power, source):
             "anomaly": processed['anomaly'],
             "source": source
         }
+        if clock:
+            document["clock"] = clock
+        if boot_timeline:
+            document["boot_timeline"] = boot_timeline
+        if heads:
+            document["heads"] = heads
         
         # 3. SAVE TO DB
         collection.insert_one(document)
+        if trace: trace['persisted'] = time.time()
         # Convert ObjectId
         doc_json = document.copy()
         doc_json['_id'] = str(doc_json['_id'])
         doc_json['timestamp'] = document['timestamp'].isoformat()
+        doc_json['ingest_timestamp'] = document['ingest_timestamp'].isoformat()
+        if boot_timeline:
+            print(f"🔌 {device_id} booted (reset reason {boot_timeline.get('rst')}): "
+                  f"light at {boot_timeline.get('pwm', 0) / 1000:.1f} ms, "
+                  f"MQTT at {boot_timeline.get('mqtt', 0) / 1000:.0f} ms")
+            rtc = boot_timeline.get('rtc') or {}
+            if rtc.get('st') == 'ok':
+                print(f"♻️  {device_id} restored state after warm reset #{rtc.get('n')}: "
+                      f"night={rtc.get('night')} ldr={rtc.get('ldr')} hold={rtc.get('hold')}s")
 
         # 4. EMIT REAL-TIME UPDATE (WebSockets)
         print(f"📡 Emitting WebSocket update: brightness={document.get('brightness')}, is_night={document.get('is_night')}")
         socketio.emit('update', doc_json) 
+        if trace:
+            trace['pushed'] = time.time()
+            tracer.record(trace)
         
         return doc_json
 
@@ -162,31 +302,391 @@ def process_data(device_id, raw_ldr, motion, power, source):
         print(f"❌ Processing Error: {e}")
         return None
 
+# --- SEQUENCE TRACKING (Dedup + Loss Accounting) ---
+class SequenceTracker:
+    """
+    Per-device sliding bitmaps over the last SEQ_WINDOW sequence numbers.
+    Bit i of 'bitmap' set => (highest - i) has been received; bit i of
+    'missing' set => (highest - i) was skipped and counted as lost. Every
+    check is O(1).
+    - Newer seq: shift the window, count the skipped numbers as lost.
+    - Seq inside the window: duplicate if its bit is set, otherwise a late
+      arrival; it is taken off 'lost' only if it was counted there.
+    - Seq older than the window: cannot be told apart from a duplicate;
+      counted as stale but still ingested.
+    A new boot id restarts the window.
+    """
+    MASK = (1 << SEQ_WINDOW) - 1
+
+    def __init__(self):
+        self.devices = {}
+        self.lock = threading.Lock()
+
+    def accept(self, device_id, boot, seq):
+        """Returns False if the message should be dropped."""
+        with self.lock:
+            d = self.devices.get(device_id)
+            if d is None:
+                d = self.devices[device_id] = {
+                    'boot': None, 'highest': 0, 'bitmap': 0, 'missing': 0,
+                    'received': 0, 'lost': 0, 'duplicates': 0, 'late': 0, 'stale': 0, 'reboots': 0
+                }
+            if d['boot'] != boot:
+                if d['boot'] is not None:
+                    d['reboots'] += 1
+                d['boot'], d['highest'], d['bitmap'], d['missing'] = boot, seq, 1, 0
+                d['received'] += 1
+                return True
+
+            delta = seq - d['highest']
+            if delta > 0:
+                d['lost'] += delta - 1
+                if delta < SEQ_WINDOW:
+                    d['bitmap'] = ((d['bitmap'] << delta) | 1) & self.MASK
+                    skipped = ((1 << delta) - 1) & ~1  # Bits 1..delta-1
+                    d['missing'] = ((d['missing'] << delta) | skipped) & self.MASK
+                else:
+                    d['bitmap'] = 1
+                    d['missing'] = self.MASK & ~1
+                d['highest'] = seq
+            elif -delta >= SEQ_WINDOW:
+                d['stale'] += 1
+            else:
+                bit = 1 << -delta
+                if d['bitmap'] & bit:
+                    d['duplicates'] += 1
+                    return False
+                d['bitmap'] |= bit
+                if d['missing'] & bit:
+                    d['missing'] &= ~bit
+                    d['lost'] = max(d['lost'] - 1, 0)
+                d['late'] += 1
+            d['received'] += 1
+            return True
+
+    def stats(self):
+        with self.lock:
+            result = {}
+            for device_id, d in self.devices.items():
+                expected = d['received'] + d['lost']
+                entry = {k: v for k, v in d.items() if k not in ('bitmap', 'missing', 'boot')}
+                entry['loss_rate'] = round(d['lost'] / expected, 4) if expected else 0.0
+                result[device_id] = entry
+            return result
+
+sequences = SequenceTracker()
+
+# --- DEVICE DIAGNOSTICS (Memory, stacks) ---
+class DiagnosticsStore:
+    """
+    Recent diagnostics messages per device, newest last, plus the drift of
+    free heap and largest free block over that window: flat memory shows
+    as ~0 for both. Loop SLO violations and MQTT TLS handshakes are counted
+    since boot.
+    """
+    def __init__(self, history):
+        self.lock = threading.Lock()
+        self.history = history
+        self.devices = {}
+
+    def record(self, device_id, payload):
+        payload['received'] = datetime.datetime.utcnow().isoformat()
+        with self.lock:
+            samples = self.devices.setdefault(device_id, collections.deque(maxlen=self.history))
+            # A new boot starts a new baseline
+            if samples and samples[-1].get('boot') != payload.get('boot'):
+                samples.clear()
+            samples.append(payload)
+
+    def stats(self):
+        with self.lock:
+            result = {}
+            for device_id, samples in self.devices.items():
+                first, last = samples[0].get('heap', {}), samples[-1].get('heap', {})
+                tls = samples[-1].get('tls', {})
+                result[device_id] = {
+                    'latest': samples[-1],
+                    'samples': len(samples),
+                    'heap_free_delta': last.get('free', 0) - first.get('free', 0),
+                    'largest_block_delta': last.get('big', 0) - first.get('big', 0),
+                    'slo_violations': samples[-1].get('slo', {}).get('n', 0),
+                    # Share of TLS reconnects that resumed a session (None: plain MQTT or no reconnect yet)
+                    'tls_resume_rate': round(tls['resumed'] / (tls['n'] - 1), 3) if tls.get('n', 0) > 1 else None,
+                    'downlink_latency_ms': radio_latency(samples[-1].get('radio', {})),
+                }
+            return result
+
+
+def radio_latency(radio):
+    """Downlink command latency in ms from a diag "radio" block ("cmd": [n, avg, max, last])"""
+    cmd = radio.get('cmd')
+    return {'n': cmd[0], 'avg': cmd[1], 'max': cmd[2], 'last': cmd[3]} if cmd else None
+
+diagnostics = DiagnosticsStore(DIAG_HISTORY)
+
+# --- FLIGHT RECORDER DUMPS (binary chunks, firmware flight_log.h) ---
+FLIGHT_MAGIC = b'SLF1'
+FLIGHT_HEADER = struct.Struct('<4sIHHHBB')
+FLIGHT_RECORD = struct.Struct('<IBBH')
+FLIGHT_TYPES = {1: 'ldr', 2: 'pir', 3: 'pwm', 4: 'loop', 5: 'mark'}
+FLIGHT_REASONS = ['none', 'anomaly', 'reset', 'request']
+
+class FlightStore:
+    """
+    Flight recorder dumps per device, reassembled from their chunks (keyed
+    by boot and dump number) and decoded once complete. Times are the
+    device's micros() unwrapped across 32-bit rollover, made relative to
+    the newest record (0 = freeze, negative = before it).
+    """
+    def __init__(self, keep):
+        self.lock = threading.Lock()
+        self.keep = keep
+        self.partial = {}  # (device, boot, dump) -> {chunk: records bytes}
+        self.devices = {}
+
+    def add_chunk(self, device_id, data):
+        if len(data) < FLIGHT_HEADER.size:
+            raise ValueError("short flight chunk")
+        magic, boot, dump, chunk, chunks, reason, record_size = FLIGHT_HEADER.unpack_from(data)
+        if magic != FLIGHT_MAGIC or record_size != FLIGHT_RECORD.size:
+            raise ValueError("not a flight chunk")
+        key = (device_id, boot, dump)
+        with self.lock:
+            parts = self.partial.setdefault(key, {})
+            parts[chunk] = data[FLIGHT_HEADER.size:]
+            if len(parts) < chunks:
+                return
+            del self.partial[key]
+            # Dumps that never completed (device reset mid-upload) go with the next one
+            for stale in [k for k in self.partial if k[0] == device_id]:
+                del self.partial[stale]
+            body = b''.join(parts[i] for i in range(chunks))
+            dumps = self.devices.setdefault(device_id, collections.deque(maxlen=self.keep))
+            dumps.append({
+                'boot': boot,
+                'dump': dump,
+                'reason': FLIGHT_REASONS[reason] if reason < len(FLIGHT_REASONS) else 'unknown',
+                'received': datetime.datetime.utcnow().isoformat(),
+                'records': self.decode(body),
+            })
+        print(f"🛩️ Flight dump {dump} from {device_id} ({chunks} chunks)")
+
+    @staticmethod
+    def decode(body):
+        raw = [FLIGHT_RECORD.unpack_from(body, i) for i in range(0, len(body) - FLIGHT_RECORD.size + 1, FLIGHT_RECORD.size)]
+        times, wraps, previous = [], 0, None
+        for t, _, _, _ in raw:
+            if previous is not None and t < previous and previous - t > 0x80000000:
+                wraps += 1
+            previous = t
+            times.append(t + (wraps << 32))
+        end = times[-1] if times else 0
+        return [{'t_us': t - end, 'type': FLIGHT_TYPES.get(kind, str(kind)), 'a': a, 'b': b}
+                for t, (_, kind, a, b) in zip(times, raw)]
+
+    def summaries(self):
+        with self.lock:
+            result = {}
+            for device_id, dumps in self.devices.items():
+                result[device_id] = [{
+                    'boot': d['boot'], 'dump': d['dump'], 'reason': d['reason'], 'received': d['received'],
+                    'records': len(d['records']),
+                    'span_s': round(-d['records'][0]['t_us'] / 1e6, 1) if d['records'] else 0,
+                } for d in dumps]
+            return result
+
+    def latest(self, device_id):
+        with self.lock:
+            dumps = self.devices.get(device_id)
+            return dumps[-1] if dumps else None
+
+flights = FlightStore(FLIGHT_DUMPS)
+
+# --- INGEST PIPELINE (Priority Lanes) ---
+class IngestPipeline:
+    """
+    Two bounded lanes in front of process_data(), drained by one worker.
+    - Events (state changes) are FIFO and always processed first.
+    - Heartbeats are coalesced per device: a newer heartbeat (or any event)
+      supersedes one still waiting. When the lane is full the oldest
+      device's heartbeat is shed.
+    """
+    def __init__(self, event_size, heartbeat_size):
+        self.event_size = event_size
+        self.heartbeat_size = heartbeat_size
+        self.events = collections.deque()
+        self.heartbeats = collections.OrderedDict()  # device_id -> item
+        self.cond = threading.Condition()
+        self.counters = {
+            'event_in': 0, 'event_dropped': 0,
+            'heartbeat_in': 0, 'heartbeat_coalesced': 0, 'heartbeat_shed': 0
+        }
+        self.latency = {
+            'event': collections.deque(maxlen=LATENCY_WINDOW),
+            'heartbeat': collections.deque(maxlen=LATENCY_WINDOW)
+        }
+
+    def submit(self, msg_class, device_id, **kwargs):
+        item = (time.monotonic(), device_id, kwargs)
+        with self.cond:
+            if msg_class == 'heartbeat':
+                self.counters['heartbeat_in'] += 1
+                if self.heartbeats.pop(device_id, None) is not None:
+                    self.counters['heartbeat_coalesced'] += 1
+                elif len(self.heartbeats) >= self.heartbeat_size:
+                    self.heartbeats.popitem(last=False)
+                    self.counters['heartbeat_shed'] += 1
+                self.heartbeats[device_id] = item
+            else:
+                self.counters['event_in'] += 1
+                # A pending heartbeat is older than this event; drop it so the
+                # device's state is never rolled back
+                if self.heartbeats.pop(device_id, None) is not None:
+                    self.counters['heartbeat_coalesced'] += 1
+                if len(self.events) >= self.event_size:
+                    self.events.popleft()
+                    self.counters['event_dropped'] += 1
+                self.events.append(item)
+            self.cond.notify()
+
+    def _next(self):
+        with self.cond:
+            while not self.events and not self.heartbeats:
+                self.cond.wait()
+            if self.events:
+                return 'event', self.events.popleft()
+            return 'heartbeat', self.heartbeats.popitem(last=False)[1]
+
+    def run(self):
+        while True:
+            msg_class, (enqueued, device_id, kwargs) = self._next()
+            process_data(device_id, **kwargs)
+            with self.cond:
+                self.latency[msg_class].append(time.monotonic() - enqueued)
+
+    def stats(self):
+        with self.cond:
+            result = dict(self.counters)
+            result['event_depth'] = len(self.events)
+            result['heartbeat_depth'] = len(self.heartbeats)
+            for lane, samples in self.latency.items():
+                ordered = sorted(samples)
+                for name, q in (('p50', 0.50), ('p99', 0.99)):
+                    value = ordered[min(len(ordered) - 1, int(q * len(ordered)))] if ordered else 0.0
+                    result[f"{lane}_{name}_ms"] = round(value * 1000.0, 2)
+        return result
+
+ingest = IngestPipeline(EVENT_QUEUE_SIZE, HEARTBEAT_QUEUE_SIZE)
+
+def start_ingest():
+    worker = threading.Thread(target=ingest.run, name="ingest-worker", daemon=True)
+    worker.start()
+
+def trusted_device_state(payload):
+    """(smooth_ldr, is_night, brightness) from the payload in trust mode, else None."""
+    if not TRUST_DEVICE_STATE:
+        return None
+    brightness = int(payload.get('brightness', 0))
+    # Firmware before 'night' was added: any light output means night
+    is_night = bool(payload.get('night', brightness > 0))
+    return int(payload.get('ldr', 0)), is_night, brightness
+
 # --- MQTT CLIENT (Background Thread) ---
 def on_mqtt_connect(client, userdata, flags, rc, properties=None):
     print(f"✅ MQTT Connected (rc={rc})")
     client.subscribe(MQTT_TOPIC)
+    client.subscribe(MQTT_DIAG_TOPIC)
+    client.subscribe(MQTT_FLIGHT_TOPIC)
+    client.subscribe(MQTT_BATCH_TOPIC)
+
+def ingest_telemetry(device_id, payload, received, transport):
+    """Queue one device telemetry message, however it arrived (MQTT live or HTTP bulk)"""
+    # Extract inputs ('ldr' is the device's window sum, 'raw' the latest reading)
+    ldr = int(payload.get('raw', payload.get('ldr', 0)))
+    motion = int(payload.get('motion', 0))
+    power = float(payload.get('power', 0.0))
+    device_state = trusted_device_state(payload)
+    # Older firmware sends no class; treat as event so nothing is shed
+    msg_class = payload.get('class', 'event')
+    boot_timeline = payload.get('boot_tl')
+    if boot_timeline:
+        msg_class = 'event'  # Sent once per reset: never coalesce it away
+    
+    # Drop duplicates before they take a queue slot
+    if 'seq' in payload and not sequences.accept(device_id, payload.get('boot'), int(payload['seq'])):
+        return
+    
+    trace = payload.get('trace')
+    if trace:
+        trace['recv'] = received
+    
+    # QUEUE FOR UNIFIED PROCESSING (events ahead of heartbeats)
+    # Same source either way: the dashboard queries do not care about the transport
+    ingest.submit(msg_class, device_id, raw_ldr=ldr, motion=motion, power=power, source="gcp_vm_mqtt", trace=trace,
+                  captured_at=payload.get('ts'), clock=payload.get('clk'), device_state=device_state,
+                  boot_timeline=boot_timeline, heads=payload.get('heads'))
+    
+    print(f"📥 Queued {transport} {msg_class} from {device_id}")
+
+def ingest_batch(payload, received):
+    """Unpack a gateway pole's batch: a {"gw":...} line, then one line per neighbour's message,
+    as it would have published it. Lines parse on their own: a malformed one is skipped, not the batch."""
+    lines = payload.decode(errors='replace').split('\n')
+    try:
+        gateway = json.loads(lines[0]).get('gw', '?')
+    except (ValueError, AttributeError):
+        gateway = '?'
+    rejected = 0
+    for line in lines[1:]:
+        try:
+            entry = json.loads(line)
+            device_id = str(entry.get('d', 'unknown'))
+            message = entry.get('m')
+        except (ValueError, AttributeError):
+            rejected += 1
+            continue
+        if not isinstance(message, dict):
+            rejected += 1
+            continue
+        if entry.get('k') == 'diag':
+            diagnostics.record(device_id, message)
+        else:
+            ingest_telemetry(device_id, message, received, f"gateway {gateway}")
+    if rejected:
+        print(f"⚠️ Batch from gateway {gateway}: skipped {rejected} malformed entries")
 
 def on_mqtt_message(client, userdata, msg):
+    received = time.time()
     try:
-        payload = json.loads(msg.payload.decode())
         topic_parts = msg.topic.split('/')
         device_id = topic_parts[2] if len(topic_parts) > 2 else 'unknown'
         
-        # Extract inputs
-        ldr = int(payload.get('ldr', 0))
-        motion = int(payload.get('motion', 0))
-        power = float(payload.get('power', 0.0))
+        # Flight recorder chunks are binary
+        if len(topic_parts) > 3 and topic_parts[3] == 'flight':
+            flights.add_chunk(device_id, msg.payload)
+            return
+        
+        # Neighbours' messages relayed by a gateway pole, one JSON document per line
+        if len(topic_parts) > 3 and topic_parts[3] == 'batch':
+            ingest_batch(msg.payload, received)
+            return
         
-        # UNIFIED PROCESSING CALL
-        process_data(device_id, ldr, motion, power, source="gcp_vm_mqtt")
+        payload = json.loads(msg.payload.decode())
         
-        print(f"📥 Processed MQTT from {device_id}")
+        # Diagnostics bypass the sensor pipeline
+        if len(topic_parts) > 3 and topic_parts[3] == 'diag':
+            diagnostics.record(device_id, payload)
+            return
+        
+        ingest_telemetry(device_id, payload, received, "MQTT")
         
     except Exception as e:
         print(f"❌ MQTT Message Error: {e}")
 
+mqtt_client = None  # Set by start_mqtt(), also publishes downlink commands
+
 def start_mqtt():
+    global mqtt_client
     mqtt_client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
     mqtt_client.on_connect = on_mqtt_connect
     mqtt_client.on_message = on_mqtt_message
@@ -201,6 +701,29 @@ def start_mqtt():
 
 # --- API ENDPOINTS ---
 
+@app.route('/data/<device_id>', methods=['POST'])
+def bulk_upload(device_id):
+    """HTTP fallback from the device while MQTT is down: buffered telemetry as
+    NDJSON (one message per line), usually with Content-Encoding: deflate."""
+    received = time.time()
+    body = request.get_data()
+    try:
+        if request.headers.get('Content-Encoding', '').lower() == 'deflate':
+            body = zlib.decompress(body)
+        lines = body.decode().splitlines()
+    except (zlib.error, UnicodeDecodeError):
+        return jsonify({"error": "Bad body"}), 400
+    accepted = 0
+    for line in lines:
+        if not line.strip():
+            continue
+        try:
+            ingest_telemetry(device_id, json.loads(line), received, "HTTP")
+            accepted += 1
+        except (ValueError, TypeError) as e:
+            print(f"❌ Bulk Upload Line Error: {e}")  # Skip it; the rest of the batch still counts
+    return jsonify({"status": "ok", "accepted": accepted}), 200
+
 @app.route('/api/manual', methods=['POST'])
 def manual_data():
     """Manual Injection Endpoint (Test/Demo)"""
@@ -211,7 +734,8 @@ def manual_data():
     motion = int(data.get('motion', 0))
     power = float(data.get('power', 0.0))
     
-    result = process_data("http_manual", ldr, motion, power, source="http_app")
+    result = process_data("http_manual", ldr, motion, power, source="http_app",
+                          device_state=trusted_device_state(data))
     
     if result:
         return jsonify({"status": "success", "data": result}), 201
@@ -238,6 +762,8 @@ def get_latest():
         latest['_id'] = str(latest['_id'])
         if 'timestamp' in latest:
             latest['timestamp'] = latest['timestamp'].isoformat()
+        if 'ingest_timestamp' in latest:
+            latest['ingest_timestamp'] = latest['ingest_timestamp'].isoformat()
         
         return jsonify(latest)
     except Exception as e:
@@ -254,11 +780,62 @@ def get_data():
             doc['_id'] = str(doc['_id'])
             if 'timestamp' in doc:
                 doc['timestamp'] = doc['timestamp'].isoformat()
+            if 'ingest_timestamp' in doc:
+                doc['ingest_timestamp'] = doc['ingest_timestamp'].isoformat()
             results.append(doc)
         return jsonify(results)
     except Exception as e:
         return jsonify({"error": str(e)}), 500
 
+@app.route('/api/ingest/stats', methods=['GET'])
+def get_ingest_stats():
+    """Queue depths, shed/coalesce counters and per-lane latency percentiles"""
+    return jsonify(ingest.stats())
+
+@app.route('/api/ingest/loss', methods=['GET'])
+def get_ingest_loss():
+    """Per-device received/lost/duplicate counts and loss rate"""
+    return jsonify(sequences.stats())
+
+@app.route('/api/trace/latency', methods=['GET'])
+def get_trace_latency():
+    """Per-hop motion-to-dashboard latency histograms"""
+    return jsonify(tracer.stats())
+
+@app.route('/api/diag', methods=['GET'])
+def get_diagnostics():
+    """Latest memory/stack diagnostics and heap drift per device"""
+    return jsonify(diagnostics.stats())
+
+@app.route('/api/flight', methods=['GET'])
+def get_flight_dumps():
+    """Flight recorder dumps per device (reason, boot, record count, time span)"""
+    return jsonify(flights.summaries())
+
+@app.route('/api/flight/<device_id>', methods=['GET'])
+def get_flight_dump(device_id):
+    """Latest flight recorder dump of a device as JSON, or ?format=csv"""
+    dump = flights.latest(device_id)
+    if dump is None: return jsonify({"error": "No flight dump"}), 404
+    if request.args.get('format') == 'csv':
+        lines = ['t_us,type,a,b'] + [f"{r['t_us']},{r['type']},{r['a']},{r['b']}" for r in dump['records']]
+        return Response('\n'.join(lines) + '\n', mimetype='text/csv')
+    return jsonify(dump)
+
+@app.route('/api/command', methods=['POST'])
+def send_command():
+    """Downlink command, e.g. {"device": "1", "cmd": "report"}. Stamped with our
+    epoch ms as "ts" so the device can report downlink latency (diag radio.cmd)."""
+    data = request.json
+    if not data or not data.get('cmd'): return jsonify({"error": "No cmd"}), 400
+    if mqtt_client is None or not mqtt_client.is_connected():
+        return jsonify({"error": "MQTT not connected"}), 503
+    command = {k: v for k, v in data.items() if k != 'device'}
+    command['ts'] = int(time.time() * 1000)
+    topic = MQTT_COMMAND_TOPIC.format(device=data.get('device', '1'))
+    mqtt_client.publish(topic, json.dumps(command))
+    return jsonify({"status": "sent", "topic": topic, "ts": command['ts']}), 202
+
 @app.route('/api/status', methods=['GET'])
 def get_status_card():
     # Only return the VERY latest reading regardless of history
@@ -389,7 +966,9 @@ def get_mode_analytics():
 
 # --- MAIN ---
 if __name__ == '__main__':
-    print(f"🚀 Backend Starting (Python Processing - No C++ Required)...")
+    mode = "trusting device state" if TRUST_DEVICE_STATE else f"recomputing with streetlight_core, {LDR_POLICY} policy"
+    print(f"🚀 Backend Starting ({mode})...")
+    start_ingest()
     start_mqtt()
     # Use socketio.run instead of app.run
     socketio.run(app, host='0.0.0.0', port=5000, debug=True)
\ No newline at end of file
@@ -0,0 +1,24 @@
+"""
+Builds the streetlight_core extension from the firmware's header-only core.
+
+    pip install ./native        (from app/)
+"""
+import os
+from setuptools import setup, Extension
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+CORE_DIR = os.path.normpath(os.path.join(HERE, '..', '..', 'firmware', 'lib', 'StreetLightCore', 'src'))
+
+setup(
+    name='streetlight_core',
+    version='1.0.0',
+    ext_modules=[
+        Extension(
+            'streetlight_core',
+            sources=['streetlight_core.cpp'],
+            include_dirs=[CORE_DIR],
+            depends=[os.path.join(CORE_DIR, 'light_control.h')],
+            extra_compile_args=['-std=c++17', '-O2'],
+        )
+    ],
+)
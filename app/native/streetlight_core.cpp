@@ -0,0 +1,226 @@
+/*
+ * streetlight_core - CPython binding of the firmware's light control core.
+ *
+ * Compiles firmware/lib/StreetLightCore/src/light_control.h directly, so the
+ * backend's smoothing/hysteresis/brightness are the device's code, not a port.
+ *
+ *   LdrFilter(policy="default")           one device's controller (POLICIES)
+ *   .prime(raw)                           first reading fills the window (boot)
+ *   .push(raw, elapsed_ms=-1)             -> (smooth_ldr, is_night)
+ *   .brightness(motion_active)            -> percent under the filter's policy
+ *   target_brightness(is_night, motion_active) -> percent (DefaultPolicy)
+ *
+ * A message carries one reading, but the device samples every 100/1000 ms
+ * (ldrIntervalMs). push() with elapsed_ms replays the samples the device
+ * took since the previous message, holding the reading; without it, one
+ * sample is pushed.
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <string.h>
+#include "light_control.h"
+
+// === Policy-erased controller ===
+struct CoreFilter {
+    virtual ~CoreFilter() {}
+    virtual void prime(int raw) = 0;
+    virtual void advance(int raw, long elapsedMs) = 0;
+    virtual void sample(int raw) = 0;
+    virtual int sum() const = 0;
+    virtual bool isNight() const = 0;
+    virtual int brightness(bool motionActive) const = 0;
+};
+
+template <typename Policy>
+struct CoreFilterT : CoreFilter {
+    LightControllerT<Policy> controller;
+    unsigned long nowMs = 0;
+    unsigned long carryMs = 0; // Elapsed time not yet worth a sample
+
+    CoreFilterT() { controller.reset(); }
+
+    void prime(int raw) override {
+        controller.primeLdr(nowMs, raw);
+        carryMs = 0;
+    }
+
+    void advance(int raw, long elapsedMs) override {
+        carryMs += (unsigned long)elapsedMs;
+        // A changed reading is a pin edge: the device samples it at once
+        if (controller.ldr.saturated() && controller.ldr.latest() != raw) {
+            controller.onLdrEdge();
+            controller.sampleLdr(nowMs, raw);
+        }
+        for (;;) {
+            // Held reading already fills the window: further samples change nothing
+            if (controller.ldr.saturated() && controller.ldr.latest() == raw) {
+                carryMs = 0;
+                return;
+            }
+            unsigned long interval = controller.ldrIntervalMs();
+            if (carryMs < interval) return;
+            carryMs -= interval;
+            nowMs += interval;
+            controller.sampleLdr(nowMs, raw);
+        }
+    }
+
+    void sample(int raw) override { controller.sampleLdr(nowMs, raw); }
+    int sum() const override { return controller.ldr.sum; }
+    bool isNight() const override { return controller.ldr.isNight; }
+    int brightness(bool motionActive) const override {
+        bool active = Policy::motionBoost && controller.ldr.isNight && motionActive;
+        return brightnessPercent(selectPwm(controller.ldr.isNight, active, controller.policy.pwmFull,
+                                           controller.policy.pwmDim));
+    }
+};
+
+static const char* const POLICY_NAMES[] = {"default", "residential", "arterial", "no_motion"};
+
+static CoreFilter* makeFilter(const char* policy) {
+    if (!strcmp(policy, "default")) return new CoreFilterT<DefaultPolicy>();
+    if (!strcmp(policy, "residential")) return new CoreFilterT<ResidentialPolicy>();
+    if (!strcmp(policy, "arterial")) return new CoreFilterT<ArterialPolicy>();
+    if (!strcmp(policy, "no_motion")) return new CoreFilterT<NoMotionPolicy>();
+    return nullptr;
+}
+
+// === LdrFilter type ===
+struct PyLdrFilter {
+    PyObject_HEAD
+    CoreFilter* filter;
+};
+
+static int LdrFilter_init(PyLdrFilter* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"policy", nullptr};
+    const char* policy = "default";
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|s", (char**)kwlist, &policy)) return -1;
+    CoreFilter* filter = makeFilter(policy);
+    if (!filter) {
+        PyErr_Format(PyExc_ValueError, "unknown policy '%s'", policy);
+        return -1;
+    }
+    delete self->filter;
+    self->filter = filter;
+    return 0;
+}
+
+static void LdrFilter_dealloc(PyLdrFilter* self) {
+    delete self->filter;
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static bool parseRaw(PyObject* arg, long* raw) {
+    *raw = PyLong_AsLong(arg);
+    if (*raw == -1 && PyErr_Occurred()) return false;
+    if (*raw < 0 || *raw > 255) {
+        PyErr_SetString(PyExc_ValueError, "raw LDR reading must be 0-255");
+        return false;
+    }
+    return true;
+}
+
+static PyObject* LdrFilter_result(PyLdrFilter* self) {
+    return Py_BuildValue("(iO)", self->filter->sum(), self->filter->isNight() ? Py_True : Py_False);
+}
+
+static PyObject* LdrFilter_prime(PyLdrFilter* self, PyObject* arg) {
+    long raw;
+    if (!parseRaw(arg, &raw)) return nullptr;
+    self->filter->prime((int)raw);
+    return LdrFilter_result(self);
+}
+
+static PyObject* LdrFilter_push(PyLdrFilter* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"raw", "elapsed_ms", nullptr};
+    PyObject* rawArg;
+    long elapsedMs = -1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|l", (char**)kwlist, &rawArg, &elapsedMs)) return nullptr;
+    long raw;
+    if (!parseRaw(rawArg, &raw)) return nullptr;
+    if (elapsedMs < 0) {
+        self->filter->sample((int)raw);
+    } else {
+        self->filter->advance((int)raw, elapsedMs);
+    }
+    return LdrFilter_result(self);
+}
+
+static PyObject* LdrFilter_brightness(PyLdrFilter* self, PyObject* arg) {
+    int motionActive = PyObject_IsTrue(arg);
+    if (motionActive < 0) return nullptr;
+    return PyLong_FromLong(self->filter->brightness(motionActive));
+}
+
+static PyObject* LdrFilter_get_sum(PyLdrFilter* self, void*) {
+    return PyLong_FromLong(self->filter->sum());
+}
+
+static PyObject* LdrFilter_get_is_night(PyLdrFilter* self, void*) {
+    return PyBool_FromLong(self->filter->isNight());
+}
+
+static PyMethodDef LdrFilter_methods[] = {
+    {"prime", (PyCFunction)LdrFilter_prime, METH_O, "Fill the window with one reading; returns (smooth_ldr, is_night)."},
+    {"push", (PyCFunction)(void (*)(void))LdrFilter_push, METH_VARARGS | METH_KEYWORDS,
+     "Push one reading, or replay the device's samples over elapsed_ms; returns (smooth_ldr, is_night)."},
+    {"brightness", (PyCFunction)LdrFilter_brightness, METH_O, "Brightness percent the device would drive."},
+    {nullptr, nullptr, 0, nullptr}
+};
+
+static PyGetSetDef LdrFilter_getset[] = {
+    {"sum", (getter)LdrFilter_get_sum, nullptr, "Window sum (smooth_ldr)", nullptr},
+    {"is_night", (getter)LdrFilter_get_is_night, nullptr, "Hysteresis state", nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr}
+};
+
+static PyTypeObject LdrFilterType = {PyVarObject_HEAD_INIT(nullptr, 0)};
+
+// === Module functions ===
+static PyObject* target_brightness(PyObject*, PyObject* args) {
+    int isNight = 0, motionActive = 0;
+    if (!PyArg_ParseTuple(args, "pp", &isNight, &motionActive)) return nullptr;
+    return PyLong_FromLong(brightnessPercent(selectPwm(isNight, isNight && motionActive)));
+}
+
+static PyMethodDef module_methods[] = {
+    {"target_brightness", target_brightness, METH_VARARGS, "Brightness percent the device would drive."},
+    {nullptr, nullptr, 0, nullptr}
+};
+
+static struct PyModuleDef module_def = {
+    PyModuleDef_HEAD_INIT, "streetlight_core", "Shared firmware light control core.", -1, module_methods
+};
+
+PyMODINIT_FUNC PyInit_streetlight_core(void) {
+    LdrFilterType.tp_name = "streetlight_core.LdrFilter";
+    LdrFilterType.tp_basicsize = sizeof(PyLdrFilter);
+    LdrFilterType.tp_flags = Py_TPFLAGS_DEFAULT;
+    LdrFilterType.tp_doc = "Sliding-window + hysteresis LDR filter of one policy (firmware LightControllerT).";
+    LdrFilterType.tp_new = PyType_GenericNew;
+    LdrFilterType.tp_init = (initproc)LdrFilter_init;
+    LdrFilterType.tp_dealloc = (destructor)LdrFilter_dealloc;
+    LdrFilterType.tp_methods = LdrFilter_methods;
+    LdrFilterType.tp_getset = LdrFilter_getset;
+    if (PyType_Ready(&LdrFilterType) < 0) return nullptr;
+
+    PyObject* module = PyModule_Create(&module_def);
+    if (!module) return nullptr;
+
+    Py_INCREF(&LdrFilterType);
+    if (PyModule_AddObject(module, "LdrFilter", (PyObject*)&LdrFilterType) < 0) {
+        Py_DECREF(&LdrFilterType);
+        Py_DECREF(module);
+        return nullptr;
+    }
+    PyModule_AddIntConstant(module, "WINDOW_SIZE", WINDOW_SIZE);
+    PyModule_AddIntConstant(module, "NIGHT_THRESHOLD", NIGHT_THRESHOLD);
+    PyModule_AddIntConstant(module, "DAY_THRESHOLD", DAY_THRESHOLD);
+    PyObject* policies = PyTuple_New(sizeof(POLICY_NAMES) / sizeof(POLICY_NAMES[0]));
+    if (!policies) return nullptr;
+    for (size_t i = 0; i < sizeof(POLICY_NAMES) / sizeof(POLICY_NAMES[0]); i++) {
+        PyTuple_SET_ITEM(policies, i, PyUnicode_FromString(POLICY_NAMES[i]));
+    }
+    PyModule_AddObject(module, "POLICIES", policies);
+    return module;
+}
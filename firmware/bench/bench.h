@@ -0,0 +1,159 @@
+/*
+ * Minimal Google-Benchmark-style harness for the host build.
+ *
+ * BENCHMARK(fn) registers `void fn(BenchState&)`; the body loops on
+ * `while (state.keepRunning())`. Each benchmark is auto-calibrated to
+ * ~BENCH_MIN_TIME_S per repetition and the median of BENCH_REPETITIONS is
+ * reported. Counters (e.g. bytes per message) are attached with
+ * state.counter(). Output is a console table, plus Google Benchmark
+ * compatible JSON with --benchmark_out=<file>.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+const double BENCH_MIN_TIME_S = 0.2;
+const int BENCH_REPETITIONS = 5;
+
+class BenchState {
+public:
+    explicit BenchState(uint64_t iterations) : iterations_(iterations), remaining_(iterations) {}
+
+    bool keepRunning() {
+        if (remaining_ == iterations_) start_ = std::chrono::steady_clock::now();
+        if (remaining_ == 0) {
+            end_ = std::chrono::steady_clock::now();
+            return false;
+        }
+        remaining_--;
+        return true;
+    }
+
+    void counter(const char* name, double value) {
+        for (auto& c : counters_) {
+            if (c.first == name) { c.second = value; return; }
+        }
+        counters_.push_back({name, value});
+    }
+
+    uint64_t iterations() const { return iterations_; }
+    double elapsedNs() const { return std::chrono::duration<double, std::nano>(end_ - start_).count(); }
+    const std::vector<std::pair<std::string, double>>& counters() const { return counters_; }
+
+private:
+    uint64_t iterations_;
+    uint64_t remaining_;
+    std::chrono::steady_clock::time_point start_, end_;
+    std::vector<std::pair<std::string, double>> counters_;
+};
+
+// Keeps the compiler from discarding a computed value
+template <typename T>
+inline void doNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+inline void clobberMemory() {
+    asm volatile("" : : : "memory");
+}
+
+typedef void (*BenchFn)(BenchState&);
+
+struct BenchEntry {
+    const char* name;
+    BenchFn fn;
+};
+
+inline std::vector<BenchEntry>& benchRegistry() {
+    static std::vector<BenchEntry> registry;
+    return registry;
+}
+
+struct BenchRegistrar {
+    BenchRegistrar(const char* name, BenchFn fn) { benchRegistry().push_back({name, fn}); }
+};
+
+#define BENCHMARK(fn) static BenchRegistrar benchRegistrar_##fn(#fn, fn)
+#define BENCHMARK_TEMPLATE(fn, T) static BenchRegistrar benchRegistrar_##fn##_##T(#fn "<" #T ">", fn<T>)
+
+struct BenchResult {
+    std::string name;
+    uint64_t iterations;
+    double nsPerOp;
+    std::vector<std::pair<std::string, double>> counters;
+};
+
+inline BenchResult runBenchmark(const BenchEntry& entry) {
+    // Calibrate: grow the iteration count until one run takes long enough
+    uint64_t iterations = 1;
+    for (;;) {
+        BenchState probe(iterations);
+        entry.fn(probe);
+        double seconds = probe.elapsedNs() / 1e9;
+        if (seconds >= BENCH_MIN_TIME_S || iterations >= (1ULL << 40)) break;
+        double scale = seconds > 0 ? (BENCH_MIN_TIME_S * 1.4) / seconds : 10.0;
+        iterations = (uint64_t)(iterations * std::min(std::max(scale, 2.0), 10.0));
+    }
+
+    std::vector<double> samples;
+    std::vector<std::pair<std::string, double>> counters;
+    for (int rep = 0; rep < BENCH_REPETITIONS; rep++) {
+        BenchState state(iterations);
+        entry.fn(state);
+        samples.push_back(state.elapsedNs() / (double)iterations);
+        counters = state.counters();
+    }
+    std::sort(samples.begin(), samples.end());
+    return {entry.name, iterations, samples[samples.size() / 2], counters};
+}
+
+inline void writeJson(FILE* out, const std::vector<BenchResult>& results) {
+    fprintf(out, "{\n  \"context\": {\"executable\": \"streetlight_bench\", \"repetitions\": %d},\n", BENCH_REPETITIONS);
+    fprintf(out, "  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"run_type\": \"aggregate\", \"aggregate_name\": \"median\", "
+                     "\"iterations\": %llu, \"real_time\": %.3f, \"cpu_time\": %.3f, \"time_unit\": \"ns\"",
+                r.name.c_str(), (unsigned long long)r.iterations, r.nsPerOp, r.nsPerOp);
+        for (const auto& c : r.counters) fprintf(out, ", \"%s\": %.3f", c.first.c_str(), c.second);
+        fprintf(out, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+// Flags: --benchmark_filter=<substring> --benchmark_out=<file.json>
+inline int benchMain(int argc, char** argv) {
+    const char* filter = "";
+    const char* outPath = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--benchmark_filter=", 19) == 0) filter = argv[i] + 19;
+        else if (strncmp(argv[i], "--benchmark_out=", 16) == 0) outPath = argv[i] + 16;
+    }
+
+    std::vector<BenchResult> results;
+    printf("%-40s %14s %14s\n", "Benchmark", "Time (ns)", "Iterations");
+    for (const BenchEntry& entry : benchRegistry()) {
+        if (!strstr(entry.name, filter)) continue;
+        BenchResult r = runBenchmark(entry);
+        printf("%-40s %14.2f %14llu", r.name.c_str(), r.nsPerOp, (unsigned long long)r.iterations);
+        for (const auto& c : r.counters) printf("  %s=%g", c.first.c_str(), c.second);
+        printf("\n");
+        results.push_back(r);
+    }
+
+    if (outPath) {
+        FILE* out = fopen(outPath, "w");
+        if (!out) {
+            fprintf(stderr, "Cannot write %s\n", outPath);
+            return 1;
+        }
+        writeJson(out, results);
+        fclose(out);
+    }
+    return 0;
+}
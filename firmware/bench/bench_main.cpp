@@ -0,0 +1,174 @@
+/*
+ * Host microbenchmarks for the firmware hot paths.
+ *
+ *   pio run -e native && .pio/build/native/program --benchmark_out=bench.json
+ *
+ * Inputs are fixed pseudo-random sequences so runs are comparable.
+ */
+#include "bench.h"
+#include "light_control.h"
+#include "channel_bank.h"
+#include "telemetry.h"
+#include "command.h"
+#include "flight_log.h"
+
+// xorshift32: cheap, deterministic input generator
+static inline uint32_t nextRandom(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// One LDR sample through the sliding window + hysteresis, noisy dusk input
+static void BM_LdrFilterPush(BenchState& state) {
+    LdrFilter filter;
+    filter.reset();
+    uint32_t rng = 0x12345678;
+    while (state.keepRunning()) {
+        filter.push((nextRandom(rng) & 3) == 0 ? 0 : 1);
+        doNotOptimize(filter.isNight);
+    }
+}
+BENCHMARK(BM_LdrFilterPush);
+
+// Retriggerable timer evaluation (active/expired mix)
+static void BM_MotionTimerEvaluate(BenchState& state) {
+    MotionTimer timer;
+    timer.reset();
+    unsigned long now = 0;
+    while (state.keepRunning()) {
+        now += 997;
+        if ((now & 0xFFFF) < 997) timer.trigger(now);
+        doNotOptimize(timer.countdownSec(now));
+    }
+}
+BENCHMARK(BM_MotionTimerEvaluate);
+
+static void BM_SelectPwm(BenchState& state) {
+    uint32_t rng = 0x9E3779B9;
+    while (state.keepRunning()) {
+        uint32_t r = nextRandom(rng);
+        doNotOptimize(selectPwm(r & 1, r & 2));
+    }
+}
+BENCHMARK(BM_SelectPwm);
+
+// Full loop() control pass: LDR (when due), motion, evaluate, report decision.
+// Kept out of line so policy_report.py can read its size per variant.
+template <typename Policy>
+__attribute__((noinline)) MessageClass controlStep(LightControllerT<Policy>& controller, unsigned long now,
+                                                   uint32_t r, LightOutput& out) {
+    if (controller.ldrDue(now)) controller.sampleLdr(now, (r & 7) != 0);
+    if ((r & 0xFFF) == 0) controller.onMotion(now);
+    out = controller.evaluate(now);
+    return controller.report.due(now, out);
+}
+
+template <typename Policy>
+static void BM_ControlStep(BenchState& state) {
+    LightControllerT<Policy> controller;
+    controller.reset();
+    uint32_t rng = 0xC0FFEE;
+    unsigned long now = 0;
+    LightOutput out;
+    while (state.keepRunning()) {
+        now += 7; // ~140 passes per LDR sample
+        doNotOptimize(controlStep(controller, now, nextRandom(rng), out));
+        doNotOptimize(out);
+    }
+}
+BENCHMARK_TEMPLATE(BM_ControlStep, DefaultPolicy);
+BENCHMARK_TEMPLATE(BM_ControlStep, ResidentialPolicy);
+BENCHMARK_TEMPLATE(BM_ControlStep, ArterialPolicy);
+BENCHMARK_TEMPLATE(BM_ControlStep, NoMotionPolicy);
+BENCHMARK_TEMPLATE(BM_ControlStep, RuntimePolicy); // Same values as DefaultPolicy, loaded from memory
+
+// Per-head pass of a full multi-head board, on top of the control step
+static void BM_ChannelBankEvaluate(BenchState& state) {
+    DefaultPolicy policy;
+    ChannelBank heads;
+    heads.reset(MAX_CHANNELS);
+    uint32_t rng = 0xBADC0DE;
+    unsigned long now = 0;
+    while (state.keepRunning()) {
+        now += 7;
+        uint32_t r = nextRandom(rng);
+        if ((r & 0xFFF) == 0) heads.onMotion(now, (uint8_t)(r >> 24));
+        heads.evaluate(now, true, policy);
+        doNotOptimize(heads.activeMask);
+    }
+}
+BENCHMARK(BM_ChannelBankEvaluate);
+
+static TelemetrySample makeSample(MessageClass msgClass) {
+    TelemetrySample sample = {};
+    sample.msgClass = msgClass;
+    sample.bootId = 0xDEADBEEF;
+    sample.seq = 123456;
+    sample.captureEpochMs = 1760000000123ULL;
+    sample.captureMonoUs = 86400000000ULL;
+    sample.out = {true, msgClass == MSG_EVENT, msgClass == MSG_EVENT ? PWM_FULL : PWM_DIM, 8, 29};
+    sample.rawLdr = 1;
+    if (msgClass == MSG_HEARTBEAT) {
+        sample.hasClock = true;
+        sample.clock = {42, 1800, -3, 1.25f};
+    } else {
+        sample.hasTrace = true;
+        sample.trace = {35, 52, 410, 1760000000124ULL};
+    }
+    return sample;
+}
+
+// sendTelemetry() serialization path; bytes_per_message tracks payload growth
+static void serializeBench(BenchState& state, MessageClass msgClass) {
+    TelemetrySample sample = makeSample(msgClass);
+    char payload[TELEMETRY_MAX_BYTES];
+    size_t length = 0;
+    while (state.keepRunning()) {
+        sample.seq++;
+        length = serializeTelemetry(sample, payload, sizeof(payload));
+        doNotOptimize(length);
+        clobberMemory();
+    }
+    state.counter("bytes_per_message", (double)length);
+}
+
+static void BM_SerializeHeartbeat(BenchState& state) { serializeBench(state, MSG_HEARTBEAT); }
+BENCHMARK(BM_SerializeHeartbeat);
+
+static void BM_SerializeEvent(BenchState& state) { serializeBench(state, MSG_EVENT); }
+BENCHMARK(BM_SerializeEvent);
+
+static void BM_ParseCommand(BenchState& state) {
+    static const char payload[] = "{\"cmd\":\"report\",\"ts\":1760000000000}";
+    Command command;
+    while (state.keepRunning()) {
+        doNotOptimize(parseCommand((const uint8_t*)payload, sizeof(payload) - 1, command));
+        doNotOptimize(command.type);
+    }
+}
+BENCHMARK(BM_ParseCommand);
+
+// Flight recorder cost per loop pass: the pass hook plus one record
+// (an LDR sample or PWM change) into a ring the size of the firmware's
+static void BM_FlightRecord(BenchState& state) {
+    static FlightRecord storage[16384];
+    FlightLog log = {};
+    log.begin(storage, 16384, 1);
+    uint32_t rng = 0xF117;
+    uint32_t nowUs = 0;
+    while (state.keepRunning()) {
+        nowUs += 150;
+        uint32_t r = nextRandom(rng);
+        log.record(nowUs, FR_LDR, r & 1, r & 0xF);
+        log.loopPass(nowUs);
+        clobberMemory();
+    }
+    doNotOptimize(log.head);
+}
+BENCHMARK(BM_FlightRecord);
+
+int main(int argc, char** argv) {
+    return benchMain(argc, argv);
+}
@@ -0,0 +1,56 @@
+"""Per-policy code size and step cost of the controller.
+
+    pio run -e native
+    .pio/build/native/program --benchmark_filter=ControlStep --benchmark_out=bench.json
+    python bench/policy_report.py .pio/build/native/program bench.json
+
+Size is the out-of-line controlStep<Policy> instantiation (host code, via nm);
+the ESP32 image size per variant comes from `pio run -e <variant env>`.
+"""
+import json
+import re
+import subprocess
+import sys
+
+STEP_SYMBOL = re.compile(r"^[0-9a-f]+ ([0-9a-f]+) \w .*\bcontrolStep<(\w+)>\(")
+BENCH_NAME = re.compile(r"^BM_ControlStep<(\w+)>$")
+
+
+def code_sizes(program):
+    listing = subprocess.run(["nm", "-C", "-S", program], capture_output=True, text=True, check=True).stdout
+    sizes = {}
+    for line in listing.splitlines():
+        match = STEP_SYMBOL.match(line)
+        if match:
+            sizes[match.group(2)] = int(match.group(1), 16)
+    return sizes
+
+
+def step_costs(bench_json):
+    with open(bench_json) as f:
+        results = json.load(f)["benchmarks"]
+    costs = {}
+    for entry in results:
+        match = BENCH_NAME.match(entry["name"])
+        if match:
+            costs[match.group(1)] = entry["cpu_time"]
+    return costs
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__)
+        return 1
+    sizes = code_sizes(sys.argv[1])
+    costs = step_costs(sys.argv[2])
+    print(f"{'Policy':<20} {'Step code (B)':>14} {'Step (ns)':>10}")
+    for policy in sorted(set(sizes) | set(costs)):
+        size = sizes.get(policy)
+        cost = costs.get(policy)
+        print(f"{policy:<20} {size if size is not None else '-':>14} "
+              f"{f'{cost:.2f}' if cost is not None else '-':>10}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
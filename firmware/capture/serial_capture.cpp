@@ -0,0 +1,180 @@
+/*
+ * Lab capture of the binary serial stream (serial_frame.h) into a sensor
+ * trace the golden harness and the simulator replay.
+ *
+ *   pio run -e native_capture
+ *   .pio/build/native_capture/program --port=/dev/ttyACM0 --seconds=600 \
+ *       --out=golden/traces/dusk_lab.csv [--samples=raw.csv] [--no-toggle]
+ *
+ * Sends 's' to start streaming (and again to stop, unless --no-toggle),
+ * splits the input on 0x00, and keeps frames that decode and pass their
+ * CRC. Text frames (the device's log while streaming) go to stderr.
+ * --port may also be a file of raw bytes saved earlier.
+ *
+ * The trace (sensor_trace.h) holds LDR level changes and PIR rising edges
+ * in ms from the first sample; --samples keeps every sample as
+ * t_us,ldr,pir,pwm. The summary counts bad frames and seq gaps.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include "sensor_trace.h"
+#include "serial_frame.h"
+
+struct CaptureStats {
+    uint64_t frames = 0;
+    uint64_t badFrames = 0;
+    uint64_t badCrc = 0;
+    uint64_t lost = 0;  // seq gaps
+};
+
+// Raw 8N1, no echo or line discipline; a plain file is read as is
+static int openPort(const char* path, bool& isTty) {
+    int fd = open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0) fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct termios tio;
+    isTty = tcgetattr(fd, &tio) == 0;
+    if (isTty) {
+        cfmakeraw(&tio);
+        cfsetspeed(&tio, B115200); // Ignored by USB CDC, which runs at USB speed
+        tio.c_cc[VMIN] = 0;
+        tio.c_cc[VTIME] = 1;       // Reads return after 100 ms without data
+        tcsetattr(fd, TCSANOW, &tio);
+        tcflush(fd, TCIFLUSH);
+    }
+    return fd;
+}
+
+static double monotonicS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage() {
+    printf("serial_capture --port=DEV|FILE --out=trace.csv [--seconds=N] [--samples=raw.csv] [--no-toggle]\n");
+}
+
+int main(int argc, char** argv) {
+    const char* port = nullptr;
+    const char* outPath = nullptr;
+    const char* samplesPath = nullptr;
+    double seconds = 60;
+    bool toggle = true;
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        if (strncmp(a, "--port=", 7) == 0) port = a + 7;
+        else if (strncmp(a, "--out=", 6) == 0) outPath = a + 6;
+        else if (strncmp(a, "--samples=", 10) == 0) samplesPath = a + 10;
+        else if (strncmp(a, "--seconds=", 10) == 0) seconds = atof(a + 10);
+        else if (strcmp(a, "--no-toggle") == 0) toggle = false;
+        else {
+            usage();
+            return strcmp(a, "--help") == 0 ? 0 : 1;
+        }
+    }
+    if (!port || !outPath) {
+        usage();
+        return 1;
+    }
+
+    bool isTty = false;
+    int fd = openPort(port, isTty);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", port, strerror(errno));
+        return 1;
+    }
+    FILE* samplesFile = samplesPath ? fopen(samplesPath, "w") : nullptr;
+    if (samplesPath && !samplesFile) {
+        fprintf(stderr, "Cannot write %s\n", samplesPath);
+        return 1;
+    }
+    if (samplesFile) fprintf(samplesFile, "t_us,ldr,pir,pwm\n");
+    if (isTty && toggle && write(fd, "s", 1) != 1) fprintf(stderr, "Could not start the stream\n");
+
+    SensorTrace trace = {"capture", 0, {}};
+    CaptureStats stats;
+    std::vector<uint8_t> frame;
+    bool started = false, discard = true; // Bytes before the first delimiter are a partial frame
+    uint16_t lastSeq = 0;
+    uint32_t lastUs = 0;
+    uint64_t firstUs = 0, nowUs = 0;
+    int lastLdr = -1, lastPir = 0;
+    double deadline = monotonicS() + seconds;
+
+    uint8_t buffer[4096];
+    while (!isTty || monotonicS() < deadline) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno != EINTR && errno != EAGAIN) break;
+        if (n == 0 && !isTty) break; // End of file
+        for (ssize_t i = 0; i < n; i++) {
+            if (buffer[i]) {
+                if (frame.size() < STREAM_FRAME_MAX) frame.push_back(buffer[i]);
+                else discard = true; // Text or garbage: wait for the next delimiter
+                continue;
+            }
+            if (discard || frame.empty()) {
+                discard = false;
+                frame.clear();
+                continue;
+            }
+            StreamSample s;
+            char text[STREAM_TEXT_MAX + 1];
+            StreamDecodeResult result = decodeStreamFrame(frame.data(), frame.size(), s, text, sizeof(text));
+            frame.clear();
+            if (result == STREAM_TEXT_OK) {
+                fputs(text, stderr);
+                continue;
+            }
+            if (result == STREAM_BAD_CRC) stats.badCrc++;
+            if (result != STREAM_OK) {
+                if (result != STREAM_BAD_CRC) stats.badFrames++;
+                continue;
+            }
+
+            // micros() wraps every ~71 min: extend to 64 bits
+            if (!started) {
+                nowUs = firstUs = s.tUs;
+                started = true;
+            } else {
+                nowUs += (uint32_t)(s.tUs - lastUs);
+                stats.lost += (uint16_t)(s.seq - lastSeq - 1);
+            }
+            lastUs = s.tUs;
+            lastSeq = s.seq;
+            stats.frames++;
+            if (samplesFile) {
+                fprintf(samplesFile, "%llu,%u,%u,%u\n", (unsigned long long)(nowUs - firstUs), s.ldr, s.pir, s.pwm);
+            }
+
+            uint32_t tMs = (uint32_t)((nowUs - firstUs) / 1000);
+            int8_t ldr = s.ldr != lastLdr ? (int8_t)(s.ldr ? 1 : 0) : -1;
+            uint8_t pir = s.pir && !lastPir ? 1 : 0;
+            if (ldr >= 0 || pir) trace.events.push_back({tMs, ldr, pir});
+            lastLdr = s.ldr;
+            lastPir = s.pir;
+            trace.durationMs = tMs;
+        }
+    }
+    if (isTty && toggle && write(fd, "s", 1) != 1) fprintf(stderr, "Could not stop the stream\n");
+    close(fd);
+    if (samplesFile) fclose(samplesFile);
+
+    if (!saveTrace(outPath, trace)) {
+        fprintf(stderr, "Cannot write %s\n", outPath);
+        return 1;
+    }
+    double spanS = (nowUs - firstUs) / 1e6;
+    printf("%llu frames over %.1f s (%.0f Hz), %llu lost, %llu bad CRC, %llu malformed -> %zu trace events in %s\n",
+           (unsigned long long)stats.frames, spanS, spanS > 0 ? stats.frames / spanS : 0.0,
+           (unsigned long long)stats.lost, (unsigned long long)stats.badCrc, (unsigned long long)stats.badFrames,
+           trace.events.size(), outPath);
+    return stats.frames ? 0 : 1;
+}
@@ -0,0 +1,345 @@
+/*
+ * Delta patch builder for OTA (format in lib/StreetLightCore/src/delta_patch.h).
+ *
+ *   pio run -e native_delta
+ *   .pio/build/native_delta/program old.bin new.bin update.sld
+ *   .pio/build/native_delta/program --apply old.bin update.sld check.bin
+ *
+ * old.bin is the image running on the poles (the build output of the
+ * deployed release), new.bin the release to roll out. Matching follows
+ * bsdiff: a suffix array of the old image finds long approximate matches,
+ * each extended forwards and backwards while more than half the bytes
+ * agree. Recompiled code moves, so a match usually differs only in the
+ * addresses it references; those land in an ADD record as a sparse byte
+ * difference instead of being shipped again.
+ *
+ * --apply runs the patch through the same decoder as the device, fed in
+ * random chunk sizes, and checks the result against the SHA-256 in the
+ * header.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "delta_patch.h"
+#include "sha256.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+const size_t MIN_LITERAL_GAP = 3; // Zero runs shorter than this stay inside an ADD literal run
+
+static bool readFile(const char* path, Bytes& out) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+    uint8_t buffer[65536];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) out.insert(out.end(), buffer, buffer + n);
+    fclose(f);
+    return true;
+}
+
+static bool writeFile(const char* path, const Bytes& data) {
+    FILE* f = fopen(path, "wb");
+    if (!f || fwrite(data.data(), 1, data.size(), f) != data.size()) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        if (f) fclose(f);
+        return false;
+    }
+    fclose(f);
+    return true;
+}
+
+static void sha256(const Bytes& data, uint8_t digest[SHA256_BYTES]) {
+    Sha256 h;
+    h.begin();
+    h.update(data.data(), data.size());
+    h.finish(digest);
+}
+
+// === SUFFIX ARRAY (prefix doubling) ===
+// sa[0] is the empty suffix (= size), as bsdiff's search() expects
+static std::vector<int32_t> suffixArray(const Bytes& s) {
+    int32_t n = (int32_t)s.size();
+    std::vector<int32_t> sa(n + 1), rank(n + 1), next(n + 1);
+    for (int32_t i = 0; i <= n; i++) {
+        sa[i] = i;
+        rank[i] = i < n ? s[i] + 1 : 0;
+    }
+    for (int32_t k = 1;; k <<= 1) {
+        auto key = [&](int32_t i) { return std::make_pair(rank[i], i + k <= n ? rank[i + k] : -1); };
+        std::sort(sa.begin(), sa.end(), [&](int32_t a, int32_t b) { return key(a) < key(b); });
+        next[sa[0]] = 0;
+        for (int32_t i = 1; i <= n; i++) next[sa[i]] = next[sa[i - 1]] + (key(sa[i - 1]) < key(sa[i]) ? 1 : 0);
+        rank.swap(next);
+        if (rank[sa[n]] == n) break;
+    }
+    return sa;
+}
+
+static int32_t matchLen(const uint8_t* a, int32_t aLen, const uint8_t* b, int32_t bLen) {
+    int32_t i = 0;
+    while (i < aLen && i < bLen && a[i] == b[i]) i++;
+    return i;
+}
+
+// Longest match of target[0..] anywhere in old
+static int32_t search(const std::vector<int32_t>& sa, const Bytes& old, const uint8_t* target, int32_t targetLen,
+                      int32_t& pos) {
+    int32_t oldSize = (int32_t)old.size();
+    int32_t st = 0, en = oldSize;
+    while (en - st >= 2) {
+        int32_t mid = st + (en - st) / 2;
+        if (memcmp(old.data() + sa[mid], target, std::min(oldSize - sa[mid], targetLen)) < 0) st = mid;
+        else en = mid;
+    }
+    int32_t x = matchLen(old.data() + sa[st], oldSize - sa[st], target, targetLen);
+    int32_t y = matchLen(old.data() + sa[en], oldSize - sa[en], target, targetLen);
+    pos = x > y ? sa[st] : sa[en];
+    return std::max(x, y);
+}
+
+// === PATCH WRITER ===
+struct PatchWriter {
+    Bytes out;
+    int64_t cursor = 0; // Old-image position the decoder is at
+    size_t copies = 0, adds = 0, inserts = 0, insertBytes = 0, diffBytes = 0;
+
+    void varint(uint32_t v) {
+        while (v >= 0x80) {
+            out.push_back((uint8_t)(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back((uint8_t)v);
+    }
+
+    void seek(int64_t pos) {
+        int32_t delta = (int32_t)(pos - cursor);
+        varint(((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+    }
+
+    // new[i] = old[pos + i] + diff[i]
+    void add(int64_t pos, const uint8_t* diff, uint32_t len) {
+        bool anyDiff = false;
+        for (uint32_t i = 0; i < len && !anyDiff; i++) anyDiff = diff[i] != 0;
+        out.push_back(anyDiff ? DELTA_ADD : DELTA_COPY);
+        seek(pos);
+        varint(len);
+        cursor = pos + len;
+        if (!anyDiff) {
+            copies++;
+            return;
+        }
+        adds++;
+        uint32_t i = 0;
+        while (i < len) {
+            uint32_t zeros = 0;
+            while (i + zeros < len && diff[i + zeros] == 0) zeros++;
+            varint(zeros);
+            i += zeros;
+            if (i == len) break;
+            // Literal run: up to the next gap of MIN_LITERAL_GAP zeros
+            uint32_t end = i;
+            while (end < len) {
+                uint32_t gap = 0;
+                while (end + gap < len && diff[end + gap] == 0) gap++;
+                if (end + gap == len || gap >= MIN_LITERAL_GAP) break;
+                end += gap + 1;
+            }
+            varint(end - i);
+            out.insert(out.end(), diff + i, diff + end);
+            diffBytes += end - i;
+            i = end;
+        }
+    }
+
+    void insert(const uint8_t* data, uint32_t len) {
+        out.push_back(DELTA_INSERT);
+        varint(len);
+        out.insert(out.end(), data, data + len);
+        inserts++;
+        insertBytes += len;
+    }
+};
+
+// === DIFF (bsdiff 4 matching) ===
+static void diff(const Bytes& old, const Bytes& cur, PatchWriter& patch) {
+    std::vector<int32_t> sa = suffixArray(old);
+    const uint8_t* o = old.data();
+    const uint8_t* n = cur.data();
+    int32_t oldSize = (int32_t)old.size(), newSize = (int32_t)cur.size();
+    int32_t scan = 0, len = 0, pos = 0, lastScan = 0, lastPos = 0, lastOffset = 0;
+    Bytes diffBuf;
+
+    while (scan < newSize) {
+        int32_t oldScore = 0;
+        int32_t scsc = scan += len;
+        for (; scan < newSize; scan++) {
+            len = search(sa, old, n + scan, newSize - scan, pos);
+            for (; scsc < scan + len; scsc++)
+                if (scsc + lastOffset < oldSize && o[scsc + lastOffset] == n[scsc]) oldScore++;
+            if ((len == oldScore && len != 0) || len > oldScore + 8) break;
+            if (scan + lastOffset < oldSize && o[scan + lastOffset] == n[scan]) oldScore--;
+        }
+        if (len == oldScore && scan != newSize) continue;
+
+        // Extend the previous match forwards and this one backwards (>50% agreement)
+        int32_t s = 0, best = 0, lenF = 0;
+        for (int32_t i = 0; lastScan + i < scan && lastPos + i < oldSize;) {
+            if (o[lastPos + i] == n[lastScan + i]) s++;
+            i++;
+            if (s * 2 - i > best * 2 - lenF) {
+                best = s;
+                lenF = i;
+            }
+        }
+        int32_t lenB = 0;
+        if (scan < newSize) {
+            s = 0;
+            best = 0;
+            for (int32_t i = 1; scan >= lastScan + i && pos >= i; i++) {
+                if (o[pos - i] == n[scan - i]) s++;
+                if (s * 2 - i > best * 2 - lenB) {
+                    best = s;
+                    lenB = i;
+                }
+            }
+        }
+        if (lastScan + lenF > scan - lenB) {
+            int32_t overlap = (lastScan + lenF) - (scan - lenB);
+            int32_t split = 0;
+            s = 0;
+            best = 0;
+            for (int32_t i = 0; i < overlap; i++) {
+                if (n[lastScan + lenF - overlap + i] == o[lastPos + lenF - overlap + i]) s++;
+                if (n[scan - lenB + i] == o[pos - lenB + i]) s--;
+                if (s > best) {
+                    best = s;
+                    split = i + 1;
+                }
+            }
+            lenF += split - overlap;
+            lenB -= split;
+        }
+
+        if (lenF > 0) {
+            diffBuf.resize(lenF);
+            for (int32_t i = 0; i < lenF; i++) diffBuf[i] = (uint8_t)(n[lastScan + i] - o[lastPos + i]);
+            patch.add(lastPos, diffBuf.data(), (uint32_t)lenF);
+        }
+        int32_t extra = (scan - lenB) - (lastScan + lenF);
+        if (extra > 0) patch.insert(n + lastScan + lenF, (uint32_t)extra);
+
+        lastScan = scan - lenB;
+        lastPos = pos - lenB;
+        lastOffset = pos - scan;
+    }
+}
+
+// === APPLY (device decoder, host I/O) ===
+struct MemoryOld {
+    const Bytes* data;
+    bool read(uint32_t offset, uint8_t* buffer, size_t length) {
+        if (offset + length > data->size()) return false;
+        memcpy(buffer, data->data() + offset, length);
+        return true;
+    }
+};
+
+struct MemoryOut {
+    Bytes data;
+    Sha256 sha;
+    bool write(const uint8_t* buffer, size_t length) {
+        data.insert(data.end(), buffer, buffer + length);
+        sha.update(buffer, length);
+        return true;
+    }
+};
+
+static int apply(const char* oldPath, const char* patchPath, const char* outPath) {
+    Bytes old, patch;
+    if (!readFile(oldPath, old) || !readFile(patchPath, patch)) return 1;
+
+    static DeltaPatcher<MemoryOld, MemoryOut> patcher;
+    MemoryOld source = {&old};
+    MemoryOut sink;
+    sink.sha.begin();
+    patcher.begin();
+
+    // Random chunking, as HTTP reads deliver it
+    std::mt19937 rng(1);
+    DeltaStatus status = DELTA_MORE;
+    size_t offset = 0;
+    bool baseChecked = false;
+    while (offset < patch.size() && status == DELTA_MORE) {
+        size_t chunk = std::min(patch.size() - offset, (size_t)(1 + rng() % 4096));
+        status = patcher.feed(patch.data() + offset, chunk, source, sink);
+        offset += chunk;
+        if (patcher.headerReady() && !baseChecked) {
+            uint8_t digest[SHA256_BYTES];
+            sha256(old, digest);
+            if (patcher.header.oldSize != old.size() || memcmp(digest, patcher.header.oldSha, SHA256_BYTES) != 0) {
+                fprintf(stderr, "Patch was built against a different base image than %s\n", oldPath);
+                return 1;
+            }
+            baseChecked = true;
+        }
+    }
+    if (status != DELTA_DONE || offset != patch.size()) {
+        fprintf(stderr, "Patch decode failed at byte %zu (%s)\n", offset,
+                status == DELTA_ERROR ? "malformed or wrong base" : "truncated");
+        return 1;
+    }
+    uint8_t digest[SHA256_BYTES];
+    sink.sha.finish(digest);
+    if (memcmp(digest, patcher.header.newSha, SHA256_BYTES) != 0) {
+        fprintf(stderr, "SHA-256 mismatch: output differs from the image the patch was built for\n");
+        return 1;
+    }
+    if (outPath && !writeFile(outPath, sink.data)) return 1;
+    printf("OK: %zu-byte patch -> %zu-byte image, SHA-256 verified\n", patch.size(), sink.data.size());
+    return 0;
+}
+
+static void usage() {
+    printf("mkdelta old.bin new.bin patch.sld        build a delta patch\n"
+           "mkdelta --apply old.bin patch.sld [out]  decode it as the device does and verify\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc >= 4 && strcmp(argv[1], "--apply") == 0) return apply(argv[2], argv[3], argc > 4 ? argv[4] : nullptr);
+    if (argc != 4) {
+        usage();
+        return argc == 2 && strcmp(argv[1], "--help") == 0 ? 0 : 1;
+    }
+
+    Bytes old, cur;
+    if (!readFile(argv[1], old) || !readFile(argv[2], cur)) return 1;
+    if (old.empty() || cur.empty() || old.size() > 0x7FFFFFFF || cur.size() > 0x7FFFFFFF) {
+        fprintf(stderr, "Images must be non-empty and under 2 GB\n");
+        return 1;
+    }
+
+    DeltaHeader header;
+    header.oldSize = (uint32_t)old.size();
+    header.newSize = (uint32_t)cur.size();
+    sha256(old, header.oldSha);
+    sha256(cur, header.newSha);
+
+    PatchWriter patch;
+    patch.out.resize(DELTA_HEADER_BYTES);
+    encodeDeltaHeader(header, patch.out.data());
+    diff(old, cur, patch);
+    if (!writeFile(argv[3], patch.out)) return 1;
+
+    printf("old %zu B, new %zu B -> patch %zu B (%.1fx smaller than the full image)\n", old.size(), cur.size(),
+           patch.out.size(), (double)cur.size() / patch.out.size());
+    printf("records: %zu copy, %zu add (%zu diff bytes), %zu insert (%zu bytes)\n", patch.copies, patch.adds,
+           patch.diffBytes, patch.inserts, patch.insertBytes);
+    return 0;
+}
@@ -0,0 +1,414 @@
+/*
+ * Gateway aggregation simulator - neighbours uplinking through one gateway
+ * pole over a simulated local link, on a virtual clock.
+ *
+ *   pio run -e native_gwsim
+ *   .pio/build/native_gwsim/program                        # all presets
+ *   .pio/build/native_gwsim/program --scenario=rs485_bus --hours=6
+ *   .pio/build/native_gwsim/program --link=rs485 --nodes=16 --baud=57600 \
+ *       --loss=0.02 --traffic=300 --outage-s=120 --cmds=60
+ *
+ * Each neighbour runs the controller and telemetry serializer of the
+ * firmware (night, one pass per ms) and the core LocalNodeT; the gateway
+ * runs GatewayT (gateway.h). They talk over SimLocalMedium
+ * (sim_local_link.h): ESP-NOW-like radio with loss, or an RS-485 bus with
+ * collisions. Traffic passes along the street, tripping pole after pole.
+ * The broker side accepts batches except during scheduled outages.
+ * Commands for random neighbours are fanned out through the gateway.
+ * gateway_reboot restarts the gateway once an hour, at a quiet moment,
+ * with its downlink numbering back where the last command left it: the
+ * next command, to the same neighbour, differs only by the boot epoch.
+ *
+ * Checks, per message: delivered exactly once and in order, or accounted
+ * for (still queued, or overwritten in a full outbox); per command:
+ * delivered once or reported failed. Exits 1 if any check fails.
+ * Reports latency from capture to the broker (events, heartbeats), batch
+ * sizes, publishes per hour against one connection per pole, link airtime,
+ * retransmits and collisions.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include "light_control.h"
+#include "telemetry.h"
+#include "gateway.h"
+#include "sensor_trace.h"
+#include "sim_local_link.h"
+
+const uint8_t GATEWAY_NUMBER = 1;           // The gateway's own pole; neighbours are 2..N+1
+const uint32_t DIAG_PERIOD_MS = 60000;
+const size_t SIM_DIAG_BYTES = 1100;         // Diagnostics-sized: five fragments
+const uint32_t CAR_MS_PER_POLE = 2000;      // 30 m spacing at ~50 km/h
+const uint32_t WALK_MS_PER_POLE = 20000;
+const double CAR_SHARE = 0.6;
+const uint32_t DRAIN_MS = 120000;           // After the run: let queues empty
+
+struct Scenario {
+    const char* name;
+    SimMediumKind kind;
+    int nodes;
+    double loss;
+    uint32_t baud;
+    double passersPerHour;
+    uint32_t outageS;           // Broker away this long, once per hour (0: never)
+    double cmdsPerHour;
+    bool gatewayReboots;        // Once per hour
+};
+
+struct SimPole {
+    uint8_t id;
+    SimLocalLink link;
+    LocalNodeT<SimLocalLink> node;
+    std::vector<uint8_t> storage;
+    LightControllerT<DefaultPolicy> controller;
+    std::vector<uint32_t> pirMs;
+    size_t nextPir = 0;
+    uint32_t lastDiagMs = 0;
+    uint32_t seq = 0;
+    std::vector<uint32_t> capturedMs;   // By telemetry seq
+    std::vector<uint8_t> isEvent;
+    std::vector<uint8_t> seen;
+    int64_t lastDelivered = -1;
+    uint32_t diagGenerated = 0;
+    std::vector<uint32_t> commands;     // Command numbers received
+};
+
+struct RunResult {
+    uint64_t generated = 0;     // Telemetry + diagnostics
+    uint64_t delivered = 0;
+    uint64_t duplicates = 0;
+    uint64_t outOfOrder = 0;
+    uint64_t queued = 0;
+    uint64_t overwritten = 0;
+    int64_t unexplained = 0;
+    std::vector<uint32_t> eventLatency;
+    std::vector<uint32_t> heartbeatLatency;
+    uint64_t batches = 0;
+    uint64_t batchBytes = 0;
+    uint64_t messages = 0;      // Telemetry only (a pole's own publishes without a gateway)
+    LocalLinkStats gw = {};
+    uint64_t retries = 0;
+    uint64_t backoffs = 0;
+    uint64_t badFrames = 0;
+    double airShare = 0;
+    uint64_t collided = 0;
+    uint32_t cmdsQueued = 0;
+    uint32_t cmdsReceived = 0;
+    uint32_t cmdsDuplicated = 0;
+    uint32_t cmdsFailed = 0;
+    uint32_t gatewayReboots = 0;
+    std::vector<uint32_t> cmdLatency;
+    bool ok = true;
+};
+
+static uint32_t percentile(std::vector<uint32_t>& v, double p) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, (size_t)(v.size() * p))];
+}
+
+// Passers along the street: each trips every pole in turn
+static void buildStreet(std::vector<std::unique_ptr<SimPole>>& poles, uint32_t durationMs, double perHour,
+                        TraceRng& rng) {
+    if (perHour <= 0) return;
+    double t = 0;
+    for (;;) {
+        t += -3600000.0 / perHour * log(1.0 - rng.uniform());
+        if (t >= durationMs) break;
+        uint32_t step = rng.uniform() < CAR_SHARE ? CAR_MS_PER_POLE : WALK_MS_PER_POLE;
+        bool reverse = rng.next() & 1;
+        int n = (int)poles.size();
+        for (int k = 0; k < n; k++) {
+            uint64_t at = (uint64_t)t + (uint64_t)k * step;
+            if (at < durationMs) poles[reverse ? n - 1 - k : k]->pirMs.push_back((uint32_t)at);
+        }
+    }
+    for (auto& p : poles) std::sort(p->pirMs.begin(), p->pirMs.end());
+}
+
+static RunResult run(const Scenario& sc, double hours, uint32_t seed) {
+    RunResult r;
+    uint32_t durationMs = (uint32_t)(hours * 3600000.0);
+    SimClock clock = {0};
+    SimLocalMedium medium;
+    if (sc.kind == SIM_MEDIUM_BUS) medium.beginBus(&clock, sc.baud, sc.loss, seed);
+    else medium.beginRadio(&clock, sc.loss, seed);
+
+    SimLocalLink gatewayLink;
+    gatewayLink.begin(&medium, LOCAL_GATEWAY_ID);
+    std::vector<uint8_t> gatewayStorage(GATEWAY_STORAGE_BYTES);
+    GatewayT<SimLocalLink> gateway;
+    uint32_t gatewaySeed = seed * 7919 + sc.nodes;
+    gateway.begin(&gatewayLink, GATEWAY_NUMBER, gatewayStorage.data(), gatewayStorage.size(), gatewaySeed);
+    LocalLinkStats earlierBoots = {}; // Gateway counters from before a reboot
+
+    std::vector<std::unique_ptr<SimPole>> poles;
+    for (int i = 0; i < sc.nodes; i++) {
+        auto p = std::make_unique<SimPole>();
+        p->id = (uint8_t)(GATEWAY_NUMBER + 1 + i);
+        p->link.begin(&medium, p->id);
+        p->storage.resize(LOCAL_NODE_STORAGE_BYTES);
+        p->node.begin(&p->link, p->id, p->storage.data(), p->storage.size(), seed * 7919 + i);
+        p->controller.reset();
+        p->controller.primeLdr(0, 1); // Night throughout
+        p->lastDiagMs = (uint32_t)(i * DIAG_PERIOD_MS / sc.nodes); // Staggered, as boots would be
+        poles.push_back(std::move(p));
+    }
+    TraceRng rng = {seed ^ 0xA5A5A5A5u};
+    buildStreet(poles, durationMs, sc.passersPerHour, rng);
+
+    std::vector<uint32_t> cmdQueuedMs;
+    bool rebootDue = false;
+    int lastCmdPole = -1;
+    int forcePole = -1;
+    double nextCmdMs = sc.cmdsPerHour > 0 ? -3600000.0 / sc.cmdsPerHour * log(1.0 - rng.uniform()) : 1e300;
+    char diag[SIM_DIAG_BYTES + 64];
+
+    auto publish = [&](const char* json, size_t length) -> bool {
+        uint32_t now = clock.ms();
+        if (sc.outageS && now % 3600000 >= 1200000 && now % 3600000 < 1200000 + sc.outageS * 1000) return false;
+        r.batches++;
+        r.batchBytes += length;
+        std::string text(json, length);
+        size_t at = 0;
+        while ((at = text.find("{\"d\":\"", at)) != std::string::npos) {
+            at += 6;
+            int id = atoi(text.c_str() + at);
+            size_t end = text.find("{\"d\":\"", at);
+            std::string entry = text.substr(at, end == std::string::npos ? std::string::npos : end - at);
+            if (id <= GATEWAY_NUMBER || id > GATEWAY_NUMBER + (int)poles.size()) {
+                r.ok = false;
+                continue;
+            }
+            SimPole& p = *poles[id - GATEWAY_NUMBER - 1];
+            r.delivered++;
+            if (entry.find("\"k\":\"diag\"") != std::string::npos) continue;
+            size_t s = entry.find("\"seq\":");
+            if (s == std::string::npos) {
+                r.ok = false;
+                continue;
+            }
+            uint32_t seq = (uint32_t)strtoul(entry.c_str() + s + 6, nullptr, 10);
+            if (seq >= p.seen.size() || p.seen[seq]) {
+                r.duplicates++;
+                continue;
+            }
+            p.seen[seq] = 1;
+            if ((int64_t)seq < p.lastDelivered) r.outOfOrder++;
+            p.lastDelivered = seq;
+            (p.isEvent[seq] ? r.eventLatency : r.heartbeatLatency).push_back(now - p.capturedMs[seq]);
+        }
+        return true;
+    };
+
+    for (uint32_t now = 1; now <= durationMs + DRAIN_MS; now++) {
+        clock.us = (uint64_t)now * 1000;
+        bool generating = now <= durationMs;
+        for (auto& pp : poles) {
+            SimPole& p = *pp;
+            if (generating) {
+                while (p.nextPir < p.pirMs.size() && p.pirMs[p.nextPir] <= now) {
+                    p.nextPir++;
+                    p.controller.onMotion(now);
+                }
+                if (p.controller.ldrDue(now)) p.controller.sampleLdr(now, 1);
+                LightOutput out = p.controller.evaluate(now);
+                MessageClass msg = p.controller.report.due(now, out);
+                if (msg != MSG_NONE) {
+                    TelemetrySample sample = {};
+                    sample.msgClass = msg;
+                    sample.bootId = 0x1000 + p.id;
+                    sample.seq = p.seq;
+                    sample.captureMonoUs = clock.us;
+                    sample.out = out;
+                    sample.rawLdr = 1;
+                    char payload[TELEMETRY_MAX_BYTES];
+                    size_t length = serializeTelemetry(sample, payload, sizeof(payload));
+                    if (length && p.node.enqueue(payload, length, msg == MSG_EVENT ? LF_EVENT : 0)) {
+                        p.capturedMs.push_back(now);
+                        p.isEvent.push_back(msg == MSG_EVENT);
+                        p.seen.push_back(0);
+                        p.seq++;
+                        r.generated++;
+                        r.messages++;
+                    }
+                }
+                if (now - p.lastDiagMs >= DIAG_PERIOD_MS) {
+                    p.lastDiagMs = now;
+                    int n = snprintf(diag, sizeof(diag), "{\"boot\":%u,\"up\":%u,\"pad\":\"", 0x1000 + p.id, now / 1000);
+                    while (n < (int)SIM_DIAG_BYTES - 2) diag[n++] = 'x';
+                    diag[n++] = '"';
+                    diag[n++] = '}';
+                    if (p.node.enqueue(diag, n, LF_DIAG)) {
+                        p.diagGenerated++;
+                        r.generated++;
+                    }
+                }
+            }
+            p.node.poll(now, [&](const uint8_t* json, size_t length) {
+                std::string text((const char*)json, length);
+                size_t at = text.find("\"n\":");
+                if (at == std::string::npos) return;
+                uint32_t k = (uint32_t)strtoul(text.c_str() + at + 4, nullptr, 10);
+                if (std::find(p.commands.begin(), p.commands.end(), k) != p.commands.end()) r.cmdsDuplicated++;
+                p.commands.push_back(k);
+                r.cmdsReceived++;
+                if (k < cmdQueuedMs.size()) r.cmdLatency.push_back(now - cmdQueuedMs[k]);
+            });
+        }
+        gateway.poll(now, publish);
+
+        if (sc.gatewayReboots && generating && now % 3600000 == 2400000) rebootDue = true;
+        if (rebootDue && lastCmdPole >= 0 && !gateway.pendingBatch()) {
+            // Quiet: nothing batched, no command or uplink in flight, so the reboot loses nothing
+            bool quiet = true;
+            for (int i = 0; i < GATEWAY_DOWNLINK_SLOTS; i++) quiet = quiet && !gateway.downlinks[i].used;
+            for (auto& pp : poles) quiet = quiet && !pp->node.inFlight;
+            if (quiet) {
+                earlierBoots.messages += gateway.stats.messages;
+                earlierBoots.held += gateway.stats.held;
+                earlierBoots.downlinks += gateway.stats.downlinks;
+                earlierBoots.downFailed += gateway.stats.downFailed;
+                gatewaySeed = (gatewaySeed & 0xFFFF0000u) + 0x10000u + (uint16_t)(gateway.downSeq - 1);
+                gateway.begin(&gatewayLink, GATEWAY_NUMBER, gatewayStorage.data(), gatewayStorage.size(), gatewaySeed);
+                forcePole = lastCmdPole;
+                rebootDue = false;
+                r.gatewayReboots++;
+            }
+        }
+
+        if (generating && now >= nextCmdMs) {
+            nextCmdMs += -3600000.0 / sc.cmdsPerHour * log(1.0 - rng.uniform());
+            int pole = forcePole >= 0 ? forcePole : (int)(rng.next() % poles.size());
+            forcePole = -1;
+            SimPole& p = *poles[pole];
+            char cmd[64];
+            int n = snprintf(cmd, sizeof(cmd), "{\"cmd\":\"report\",\"n\":%u}", (unsigned)cmdQueuedMs.size());
+            cmdQueuedMs.push_back(now);
+            r.cmdsQueued++;
+            if (!gateway.queueDownlink(p.id, (const uint8_t*)cmd, n)) r.cmdsFailed++;
+            lastCmdPole = pole;
+        }
+    }
+
+    for (auto& pp : poles) {
+        r.queued += pp->node.stats.queued;
+        r.overwritten += pp->node.stats.dropped;
+        r.retries += pp->node.stats.retries;
+        r.backoffs += pp->node.stats.backoffs;
+        r.badFrames += pp->node.stats.badFrames;
+    }
+    r.gw = gateway.stats;
+    r.gw.messages += earlierBoots.messages;
+    r.gw.held += earlierBoots.held;
+    r.gw.downlinks += earlierBoots.downlinks;
+    r.gw.downFailed += earlierBoots.downFailed;
+    r.badFrames += gateway.stats.badFrames;
+    r.cmdsFailed = r.gw.downFailed;
+    r.airShare = (double)medium.airUs / clock.us;
+    r.collided = medium.collided;
+    r.unexplained = (int64_t)r.generated - (int64_t)(r.delivered - r.duplicates) - (int64_t)r.queued -
+                    (int64_t)r.overwritten - (gateway.pendingBatch() ? gateway.batchCount : 0);
+    uint32_t cmdsPending = 0;
+    for (int i = 0; i < GATEWAY_DOWNLINK_SLOTS; i++) cmdsPending += gateway.downlinks[i].used;
+    if (r.duplicates || r.outOfOrder || r.unexplained || r.cmdsDuplicated || (sc.gatewayReboots && !r.gatewayReboots) ||
+        r.cmdsReceived + r.cmdsFailed + cmdsPending != r.cmdsQueued) {
+        r.ok = false;
+    }
+    return r;
+}
+
+static void printResult(const Scenario& sc, RunResult& r, double hours) {
+    double perBatch = r.batches ? (double)r.gw.messages / r.batches : 0;
+    printf("%-14s %5d %8llu %5llu %4llu %4llu %6llu %6llu   %6u %6u %6u %6u   %7.0f %5.1f %6.0f   %5.1f%% %6llu %5llu %5u   "
+           "%4u %4u %4u %6u   %s\n",
+           sc.name, sc.nodes, (unsigned long long)r.generated, (unsigned long long)r.unexplained,
+           (unsigned long long)r.duplicates, (unsigned long long)r.outOfOrder, (unsigned long long)r.queued,
+           (unsigned long long)r.overwritten, percentile(r.eventLatency, 0.5), percentile(r.eventLatency, 0.99),
+           percentile(r.heartbeatLatency, 0.99), percentile(r.heartbeatLatency, 1.0), r.batches / hours, perBatch,
+           r.messages / hours, r.airShare * 100, (unsigned long long)r.retries, (unsigned long long)r.collided,
+           r.gw.held, r.cmdsQueued, r.cmdsReceived, r.cmdsFailed, percentile(r.cmdLatency, 0.99),
+           r.ok ? "ok" : "FAIL");
+}
+
+static std::vector<Scenario> presets() {
+    return {
+        {"espnow_clean", SIM_MEDIUM_RADIO, 12, 0.01, 0, 120, 0, 30, false},
+        {"espnow_lossy", SIM_MEDIUM_RADIO, 12, 0.15, 0, 120, 0, 30, false},
+        {"rs485_bus", SIM_MEDIUM_BUS, 12, 0.001, 115200, 120, 0, 30, false},
+        {"broker_outage", SIM_MEDIUM_RADIO, 12, 0.01, 0, 120, 120, 30, false},
+        {"large_cluster", SIM_MEDIUM_RADIO, 30, 0.05, 0, 300, 0, 60, false},
+        {"gateway_reboot", SIM_MEDIUM_RADIO, 12, 0.01, 0, 120, 0, 30, true},
+    };
+}
+
+static void usage() {
+    printf("gwsim [--scenario=NAME] [--hours=H] [--seed=N]\n"
+           "      [--link=espnow|rs485] [--nodes=N] [--loss=P] [--baud=B] [--traffic=PER_H] [--outage-s=S] [--cmds=PER_H]\n"
+           "      [--gateway-reboots]\n"
+           "presets:");
+    for (const Scenario& s : presets()) printf(" %s", s.name);
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    double hours = 1;
+    uint32_t seed = 0x5EED;
+    const char* only = nullptr;
+    Scenario custom = {"custom", SIM_MEDIUM_RADIO, 12, 0.01, 115200, 120, 0, 30, false};
+    bool isCustom = false;
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        if (strncmp(a, "--scenario=", 11) == 0) only = a + 11;
+        else if (strncmp(a, "--hours=", 8) == 0) hours = atof(a + 8);
+        else if (strncmp(a, "--seed=", 7) == 0) seed = (uint32_t)strtoul(a + 7, nullptr, 0);
+        else if (strcmp(a, "--link=rs485") == 0) custom.kind = SIM_MEDIUM_BUS, isCustom = true;
+        else if (strcmp(a, "--link=espnow") == 0) custom.kind = SIM_MEDIUM_RADIO, isCustom = true;
+        else if (strncmp(a, "--nodes=", 8) == 0) custom.nodes = atoi(a + 8), isCustom = true;
+        else if (strncmp(a, "--loss=", 7) == 0) custom.loss = atof(a + 7), isCustom = true;
+        else if (strncmp(a, "--baud=", 7) == 0) custom.baud = (uint32_t)atol(a + 7), isCustom = true;
+        else if (strncmp(a, "--traffic=", 10) == 0) custom.passersPerHour = atof(a + 10), isCustom = true;
+        else if (strncmp(a, "--outage-s=", 11) == 0) custom.outageS = (uint32_t)atol(a + 11), isCustom = true;
+        else if (strncmp(a, "--cmds=", 7) == 0) custom.cmdsPerHour = atof(a + 7), isCustom = true;
+        else if (strcmp(a, "--gateway-reboots") == 0) custom.gatewayReboots = true, isCustom = true;
+        else {
+            usage();
+            return strcmp(a, "--help") == 0 ? 0 : 1;
+        }
+    }
+    if (custom.nodes < 1 || custom.nodes > GATEWAY_MAX_NODES || custom.baud == 0) {
+        usage();
+        return 1;
+    }
+
+    std::vector<Scenario> scenarios;
+    if (isCustom) {
+        scenarios.push_back(custom);
+    } else {
+        for (const Scenario& s : presets()) {
+            if (!only || strcmp(only, s.name) == 0) scenarios.push_back(s);
+        }
+        if (scenarios.empty()) {
+            usage();
+            return 1;
+        }
+    }
+
+    printf("%.1f h per scenario; latency capture -> broker in ms; publishes per hour via the gateway vs one connection per pole\n",
+           hours);
+    printf("%-14s %5s %8s %5s %4s %4s %6s %6s   %6s %6s %6s %6s   %7s %5s %6s   %6s %6s %5s %5s   %4s %4s %4s %6s\n",
+           "scenario", "nodes", "msgs", "lost", "dup", "ooo", "queued", "overwr", "ev_p50", "ev_p99", "hb_p99",
+           "hb_max", "batch/h", "msg/b", "direct", "air", "retry", "coll", "held", "cmds", "ok", "fail", "cmd99");
+    bool allOk = true;
+    for (const Scenario& s : scenarios) {
+        RunResult r = run(s, hours, seed);
+        printResult(s, r, hours);
+        allOk = allOk && r.ok;
+    }
+    return allOk ? 0 : 1;
+}
@@ -0,0 +1,21 @@
+/*
+ * Broker address - where the plain-TCP MQTT client connects.
+ *
+ * MQTT_SERVER_IP given as an address is used as is. A host name is looked
+ * up on a core-0 task instead of inside connect(): an unanswered DNS query
+ * blocks for seconds, past the loop watchdog's hard limit. loop() starts
+ * the lookup when an attempt is due, connects with the cached address once
+ * it is known, and forgets it after a failed connect so the next attempt
+ * looks the name up again (the broker may have moved).
+ */
+#pragma once
+#include <Arduino.h>
+#include <IPAddress.h>
+
+void brokerBegin(const char* server); // setup()
+bool brokerKnown();                   // Address to connect to
+IPAddress brokerIp();
+bool brokerLookupStart();             // Only while not known; false if the task could not start
+bool brokerLookupBusy();
+bool brokerLookupDone();              // True once, after a lookup that found the address
+void brokerForget();                  // After a failed connect; an address is kept
@@ -0,0 +1,34 @@
+/*
+ * Flight recorder - the last ~10 minutes of full-rate LDR samples, PIR
+ * edges, PWM changes and loop timing (lib/StreetLightCore/src/flight_log.h)
+ * in a PSRAM ring. loop() records straight into flightLog; a record costs
+ * well under a microsecond.
+ *
+ * flightTrigger() freezes it (an anomaly after FLIGHT_POST_TRIGGER_MS more,
+ * so the aftermath is in too), then flightPoll() uploads it in binary
+ * chunks on .../flight, one per loop pass, and recording resumes. If MQTT
+ * takes no chunk for FLIGHT_UPLOAD_TIMEOUT_MS the frozen dump is copied to
+ * PSRAM and uploaded from there once MQTT is back, while recording goes on.
+ *
+ * With CONFIG_SPIRAM_ALLOW_NOINIT_SEG_EXTERNAL_MEMORY the ring sits in
+ * no-init PSRAM: after a warm reset (watchdog, panic, brownout) the history
+ * that led up to it is uploaded first. Otherwise it comes from bootAlloc().
+ */
+#pragma once
+#include <Arduino.h>
+#include "flight_log.h"
+
+const uint32_t FLIGHT_RECORD_SLOTS = 16384;               // 128 KB, ~20 records/s
+const unsigned long FLIGHT_POST_TRIGGER_MS = 5000;
+const unsigned long FLIGHT_ANOMALY_MIN_INTERVAL_MS = 600000; // At most one anomaly dump per 10 min
+const size_t FLIGHT_CHUNK_BYTES = 1024;                   // Fits the MQTT buffer
+const unsigned long FLIGHT_UPLOAD_TIMEOUT_MS = 60000;     // Without progress; then parked, recording again
+
+extern FlightLog flightLog;
+
+// Sink for one binary chunk; false = not sent (retried next pass)
+typedef bool (*FlightChunkSink)(const uint8_t* data, size_t length);
+
+void flightBegin(uint32_t bootId, bool warmReset); // setup(), before memorySeal()
+bool flightTrigger(uint8_t reason);               // false if an upload is pending or rate-limited
+void flightPoll(FlightChunkSink sink);            // loop(): freeze when due, upload a chunk
@@ -0,0 +1,31 @@
+/*
+ * HTTP bulk upload - the fallback transport for telemetry (transport.h).
+ *
+ * While MQTT is not the live path, loop() hands serialized messages to
+ * uploaderEnqueue(); they wait in a ring buffer from the boot arena
+ * (heartbeats thinned to one per UPLOAD_HEARTBEAT_THIN_MS, events all
+ * kept). Once HTTP is the active transport, a task on core 0 POSTs them as
+ * deflate-compressed NDJSON batches over one keep-alive connection to
+ * serverUrl, so loop() never waits on a socket. A batch leaves the buffer
+ * only after a 2xx. Back on MQTT, loop() drains the rest with
+ * uploaderDrainOne().
+ */
+#pragma once
+#include <Arduino.h>
+#include "transport.h"
+
+const size_t UPLOAD_BUFFER_BYTES = 32768;      // Boot arena; ~15 min of an outage at night
+const size_t UPLOAD_BATCH_BYTES = 4096;        // Raw NDJSON per POST
+const unsigned long UPLOAD_HEARTBEAT_THIN_MS = 30000;
+const uint32_t UPLOAD_TIMEOUT_MS = 5000;       // Connect and response
+const uint32_t UPLOAD_RETRY_MAX_MS = 60000;    // Backoff cap after failed POSTs
+const uint32_t UPLOAD_IDLE_CLOSE_MS = 30000;   // Close the kept-alive connection after this
+
+typedef bool (*UploadSink)(const char* json, size_t length);
+
+void uploaderBegin(const char* url);            // setup(), before memorySeal()
+// loop(): MQTT state in, active transport out (also tells the task)
+Transport uploaderUpdate(unsigned long now, bool mqttConnected);
+bool uploaderEnqueue(const char* json, size_t length, bool heartbeat, unsigned long now);
+bool uploaderDrainOne(UploadSink sink);         // Oldest buffered message over MQTT
+void uploaderStats(UploadStats& out);
@@ -0,0 +1,71 @@
+/*
+ * Local link - gateway aggregation on the device (gateway.h).
+ *
+ * STREETLIGHT_ROLE_GATEWAY (env streetlight_gateway): this pole keeps its
+ * own MQTT connection and also publishes its neighbours' messages, batched,
+ * on smartcity/streetlight/<id>/batch. Commands for a neighbour arrive on
+ * its own command topic, which the gateway subscribes to while it knows
+ * the neighbour (localSubscriptions()), and go down the link.
+ * STREETLIGHT_ROLE_NODE (env streetlight_node): no WiFi association and no
+ * MQTT; telemetry and diagnostics go to the gateway, commands come back
+ * from it.
+ *
+ * STREETLIGHT_LOCAL_LINK picks the medium:
+ *   LOCAL_LINK_ESPNOW (default): peers learned from the frames they send
+ *     (broadcast until then). Neighbours sit on LOCAL_LINK_CHANNEL, which
+ *     must be the channel of the gateway's access point.
+ *   LOCAL_LINK_RS485: Serial1 in RS-485 half-duplex mode (DE on the RTS
+ *     pin), frames COBS-encoded; listen-before-talk on the last byte heard.
+ * Frames are received and sent from loop() only; the ESP-NOW receive
+ * callback just queues them.
+ */
+#pragma once
+#include <Arduino.h>
+#include "gateway.h"
+
+#ifndef STREETLIGHT_ROLE
+#define STREETLIGHT_ROLE STREETLIGHT_ROLE_POLE
+#endif
+
+#define LOCAL_LINK_ESPNOW 0
+#define LOCAL_LINK_RS485 1
+#ifndef STREETLIGHT_LOCAL_LINK
+#define STREETLIGHT_LOCAL_LINK LOCAL_LINK_ESPNOW
+#endif
+
+#ifndef STREETLIGHT_NODE_ID
+#define STREETLIGHT_NODE_ID 1          // Device number in the topics; a neighbour's link address (1-254)
+#endif
+#ifndef LOCAL_LINK_CHANNEL
+#define LOCAL_LINK_CHANNEL 1           // ESP-NOW neighbours: the gateway's WiFi channel
+#endif
+#ifndef LOCAL_RS485_BAUD
+#define LOCAL_RS485_BAUD 115200
+#endif
+#ifndef LOCAL_RS485_RX_PIN
+#define LOCAL_RS485_RX_PIN 44
+#endif
+#ifndef LOCAL_RS485_TX_PIN
+#define LOCAL_RS485_TX_PIN 43
+#endif
+#ifndef LOCAL_RS485_DE_PIN
+#define LOCAL_RS485_DE_PIN 42
+#endif
+
+static_assert(STREETLIGHT_NODE_ID >= 1 && STREETLIGHT_NODE_ID <= 254, "link address 0 is the gateway");
+
+// Gateway: one batch out; false = not published (kept, retried)
+typedef bool (*LocalPublish)(const char* json, size_t length);
+// Neighbour: one command from the gateway
+typedef void (*LocalCommandSink)(const uint8_t* json, size_t length);
+// Gateway: (un)subscribe a neighbour's command topic; false = not taken (retried)
+typedef bool (*LocalSubscribe)(uint8_t node, bool subscribe);
+
+bool localBegin(int deviceNumber, uint32_t seed);   // setup(), before memorySeal(); no-op for a pole
+bool localUplink(const char* json, size_t length, uint8_t flags); // Neighbour: into the outbox
+bool localDownlink(uint8_t node, const uint8_t* json, size_t length); // Gateway: command for a neighbour
+void localPoll(uint32_t now, LocalPublish publish, LocalCommandSink onCommand); // loop()
+void localSubscriptions(LocalSubscribe subscribe);  // Gateway, loop() while MQTT is up
+void localSubscriptionsLost();                      // Gateway: after each MQTT (re)connect
+bool localActive();                                 // Began as gateway or neighbour
+void localStats(LocalLinkStats& out);
@@ -0,0 +1,28 @@
+/*
+ * Loop watchdog - enforces the control-loop latency SLO (see loop_slo.h).
+ *
+ * - Budget (LOOP_BUDGET_MS, default 20): overruns are counted per stage
+ *   and reported in the diagnostics message.
+ * - Hard limit (LOOP_HARD_LIMIT_S, default 5): the loop task is subscribed
+ *   to the task WDT and only fed by a control step, so a stall this long
+ *   resets the device. The stalled stage is kept in RTC memory and
+ *   reported after the reset.
+ */
+#pragma once
+#include <Arduino.h>
+#include "loop_slo.h"
+
+#ifndef LOOP_BUDGET_MS
+#define LOOP_BUDGET_MS 20
+#endif
+#ifndef LOOP_HARD_LIMIT_S
+#define LOOP_HARD_LIMIT_S 5
+#endif
+
+extern LoopSlo loopSlo;
+
+inline void loopStage(LoopStage stage) { loopSlo.mark(stage); }
+
+void watchdogBegin();      // End of setup(), from the loop task
+bool watchdogStep();       // Once per control step; true if the SLO was violated
+int watchdogResetStage();  // Stage that stalled into the last WDT reset, -1 if none
@@ -0,0 +1,32 @@
+/*
+ * Memory mode - where long-lived buffers come from.
+ *
+ * STREETLIGHT_STATIC_MEMORY=1 (env streetlight_static_mem):
+ * - bootAlloc() carves from one arena fixed at boot (PSRAM when present,
+ *   otherwise a static array) and fails once setup() has sealed it. It
+ *   holds the publish JSON document and payload, the upload ring and batch
+ *   buffers, the flight recorder ring, the local link storage and the TLS
+ *   context. The profiler allocates per capture and frees afterwards,
+ *   like a flight dump parked while MQTT is down.
+ * - Buffers libraries allocate themselves (PubSubClient's packet buffer,
+ *   sized once in setup(); lwIP; mbedTLS records) cannot be handed an
+ *   arena block. Those above PSRAM_MALLOC_THRESHOLD are steered to PSRAM,
+ *   leaving internal RAM to short-lived ones.
+ * Default: bootAlloc() is plain malloc().
+ */
+#pragma once
+#include <Arduino.h>
+#include "diagnostics.h"
+
+#ifndef STREETLIGHT_STATIC_MEMORY
+#define STREETLIGHT_STATIC_MEMORY 0
+#endif
+
+const size_t BOOT_ARENA_PSRAM_BYTES = 256 * 1024; // Flight recorder 128 KB, upload ~45 KB, local link, TLS
+const size_t BOOT_ARENA_INTERNAL_BYTES = 16 * 1024; // No PSRAM fitted
+const size_t PSRAM_MALLOC_THRESHOLD = 512;
+
+void memoryBegin();             // Early in setup(), before any bootAlloc()
+void* bootAlloc(size_t bytes);  // Buffer that lives until reset; nullptr if refused
+void memorySeal();              // End of setup(): no more boot allocations
+void memoryStats(MemoryStats& out);
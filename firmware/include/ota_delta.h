@@ -0,0 +1,36 @@
+/*
+ * Delta OTA - started by the "ota" command with the URL of an SLD1 patch
+ * (lib/StreetLightCore/src/delta_patch.h, built by delta/mkdelta), or by an
+ * offer from the OTA server (ota_server/) at a periodic check-in. The patch
+ * is fetched in HTTP Range requests and decoded against the running
+ * partition straight into the next OTA slot; neither image is held in RAM.
+ * A plain ESP image is written through as is (bases without a patch).
+ *
+ * All of it runs on a low-priority task on core 0 (with the WiFi stack), so
+ * loop() on core 1 keeps control. A dropped connection resumes from the
+ * last applied byte. SHA-256 of the base is checked before anything is
+ * written and of the new image while it streams to flash; only a verified
+ * image becomes the boot partition. loop() publishes progress on .../ota
+ * and reboots; the RTC checkpoint carries the light state across.
+ */
+#pragma once
+#include <Arduino.h>
+#include "ota_status.h"
+
+const uint32_t OTA_RANGE_BYTES = 16384;          // Per HTTP request
+const uint32_t OTA_MAX_FAILURES = 10;            // Consecutive failed requests before giving up
+const uint32_t OTA_RETRY_DELAY_MS = 5000;
+const unsigned long OTA_REPORT_INTERVAL_MS = 5000;
+const unsigned long OTA_REBOOT_GRACE_MS = 10000; // Reboot unannounced if the final status cannot be sent
+const unsigned long OTA_FIRST_CHECK_MS = 60000;    // First server check-in after boot (reports the new image)
+const unsigned long OTA_CHECK_INTERVAL_MS = 3600000;
+
+// Sink for one status message; true if it went out
+typedef bool (*OtaStatusSink)(const char* json, size_t length);
+
+bool otaStart(const char* url);                   // false if one is already running
+// Reports the running image and health to the OTA server and starts the
+// update it offers, if any. false if busy.
+bool otaCheckIn(const char* serverUrl, const char* deviceId, bool healthy);
+bool otaPoll(uint32_t bootId, OtaStatusSink sink); // loop(): report progress; true = reboot now
+bool otaActive();                                  // Download task running (keeps the radio awake)
@@ -0,0 +1,29 @@
+/*
+ * Sampling profiler - a hardware timer interrupt records the interrupted
+ * program counter (and its caller) on the loop core. Started by the
+ * "profile" command; when the capture ends the samples go out in chunks
+ * over MQTT (.../profile) and Serial, a few per loop pass so the upload
+ * does not stall control. Serial gets every chunk; the "# end" line counts
+ * those MQTT did not take (unsent=), and profile_fold.py refuses a capture
+ * with samples missing. The sample buffer (192 KB) is allocated in PSRAM
+ * when a capture starts and freed once it is uploaded, so it costs nothing
+ * while profiling is off.
+ *
+ * Host side: tools/profile_fold.py symbolizes them into folded stacks.
+ */
+#pragma once
+#include <Arduino.h>
+#include "profile_buffer.h"
+
+const uint32_t PROFILE_DEFAULT_HZ = 1000;     // ~0.2% of one core at 240 MHz
+const uint32_t PROFILE_MAX_HZ = 10000;
+const uint32_t PROFILE_DEFAULT_S = 10;
+const uint32_t PROFILE_CAPACITY = 16384;      // Samples (12 B each, allocated per capture)
+const uint32_t PROFILE_LINES_PER_CHUNK = 16;  // <= ~700 B per MQTT message
+
+// Sink for one upload chunk (text), e.g. MQTT publish + Serial; false if
+// it was not published (counted as unsent)
+typedef bool (*ProfileChunkSink)(const char* text, size_t length);
+
+bool profilerStart(uint32_t rateHz, uint32_t durationS); // false if busy or no buffer
+void profilerPoll(ProfileChunkSink sink);               // loop(): stop on time, upload a chunk
@@ -0,0 +1,26 @@
+/*
+ * Binary serial streaming for lab capture - 's' on the serial console
+ * toggles it. While on, loop() sends a COBS-framed, CRC-checked sample of
+ * the raw LDR and PIR pin levels and the lamp PWM (serial_frame.h) at up to
+ * STREAM_RATE_HZ. A frame the USB CDC buffer cannot take right now is
+ * dropped, not waited for (the host sees the seq gap).
+ * capture/serial_capture.cpp records the stream.
+ *
+ * All human-readable output goes through logPrintf()/logWrite(): plain text
+ * normally, STREAM_TEXT frames while streaming, so a log line never breaks
+ * a sample frame. Callable from any task.
+ */
+#pragma once
+#include <Arduino.h>
+#include "serial_frame.h"
+
+#ifndef STREAM_RATE_HZ
+#define STREAM_RATE_HZ STREAM_DEFAULT_RATE_HZ
+#endif
+
+void streamToggle();              // Start (from seq 0) or stop, with a summary line
+bool streamDue(uint32_t nowUs);   // A sample is due this pass
+void streamSample(uint32_t tUs, uint8_t ldr, uint8_t pir, uint16_t pwm);
+
+void logWrite(const char* text, size_t length);
+void logPrintf(const char* format, ...) __attribute__((format(printf, 1, 2)));
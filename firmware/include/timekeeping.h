@@ -0,0 +1,26 @@
+/*
+ * Timekeeping - SNTP wall clock + 64-bit monotonic time base.
+ *
+ * - monoUs(): esp_timer microseconds since boot, never wraps or jumps.
+ * - Wall clock: SNTP-disciplined; every sync is compared with the time we
+ *   predicted from the previous sync to estimate drift.
+ * - Samples are stamped with monoUs() at capture and converted to epoch ms
+ *   at serialization, so queueing/replay delay does not shift them.
+ */
+#pragma once
+#include <Arduino.h>
+
+struct ClockStats {
+    bool synced;
+    uint32_t syncCount;
+    uint32_t lastSyncAgeS;     // Seconds since the last SNTP sync
+    int32_t lastCorrectionMs;  // Step applied at the last sync (predicted vs actual)
+    float driftPpm;            // Correction / elapsed between the last two syncs
+};
+
+void timeBegin(const char* ntpServer1, const char* ntpServer2);
+uint64_t monoUs();
+bool timeSynced();
+uint64_t epochMs();                         // 0 until the first sync
+uint64_t monoToEpochMs(uint64_t captureUs); // 0 until the first sync
+ClockStats clockStats();
@@ -0,0 +1,85 @@
+/*
+ * TLS transport for MQTT on 8883 (STREETLIGHT_MQTT_TLS=1, env streetlight_tls).
+ *
+ * An Arduino Client over mbedtls (hardware AES/SHA/MPI on the S3) that:
+ * - runs TCP connect + handshake on its own task on core 0, so loop() never
+ *   waits on it; PubSubClient finds the client already connected and only
+ *   sends CONNECT,
+ * - keeps the last session (ticket or ID) and offers it on reconnect, so a
+ *   dropped link costs an abbreviated handshake instead of a full one,
+ * - times every handshake and counts resumptions (reported in diagnostics),
+ * - records the longest loop step from handshake start to the end of MQTT
+ *   CONNECT, so the cost to the control loop is measured, not assumed.
+ *
+ * The CA certificate comes from secrets.h (MQTT_CA_CERT, PEM). Certificate
+ * hostname check: MQTT_TLS_HOSTNAME if defined, else the server string.
+ */
+#pragma once
+#include <Arduino.h>
+#include <Client.h>
+#include "diagnostics.h"
+
+#ifndef STREETLIGHT_MQTT_TLS
+#define STREETLIGHT_MQTT_TLS 0
+#endif
+
+const uint32_t TLS_HANDSHAKE_TIMEOUT_MS = 15000;
+const uint32_t TLS_WRITE_TIMEOUT_MS = 500; // loop() waits this long on a stalled link, well inside the WDT
+const size_t TLS_RX_BUFFER = 256;
+
+struct TlsContext; // mbedtls state, in the .cpp
+
+class TlsSessionClient : public Client {
+public:
+    TlsSessionClient();
+
+    // In setup() before memorySeal(): mbedtls state from bootAlloc(), CA parsed.
+    // hostname is the certificate name to check (nullptr: the server string).
+    bool begin(const char* caPem, const char* hostname);
+
+    // Starts the handshake task; false if one is running or already connected
+    bool connectInBackground(const char* host, uint16_t port);
+    bool busy() const { return state_ == TLS_CONNECTING; }
+    const TlsStats& stats() const { return stats_; }
+
+    // loop(): after the MQTT CONNECT attempt on a fresh session, and after
+    // every control step with the gap it closed (loopSlo.lastGapUs)
+    void connectDone();
+    void noteLoopGap(uint32_t gapUs);
+
+    // Client (loop() side; connect() is the blocking fallback)
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char* host, uint16_t port) override;
+    size_t write(uint8_t b) override;
+    size_t write(const uint8_t* buf, size_t size) override;
+    int available() override;
+    int read() override;
+    int read(uint8_t* buf, size_t size) override;
+    int peek() override;
+    void flush() override {}
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override { return connected(); }
+
+private:
+    enum State { TLS_IDLE, TLS_CONNECTING, TLS_READY };
+    enum LoopWindow { WINDOW_NONE, WINDOW_OPEN, WINDOW_CLOSING };
+
+    TlsContext* ctx_;
+    volatile State state_;
+    TlsStats stats_;
+    char host_[64];
+    uint16_t port_;
+    const char* hostname_;
+    uint8_t rx_[TLS_RX_BUFFER];
+    size_t rxLen_;
+    size_t rxPos_;
+    LoopWindow window_;   // Loop steps being watched for the current connect
+    uint32_t windowMaxUs_;
+    bool lastResumed_;    // Kind of the last completed handshake
+
+    bool handshake(); // Blocking; on the TLS task (or the caller for connect())
+    bool fill();      // Non-blocking read into rx_
+    void close(bool notify);
+    static void taskEntry(void* self);
+};
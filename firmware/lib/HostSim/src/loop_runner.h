@@ -0,0 +1,83 @@
+/*
+ * Host replica of main.cpp loop() wiring around LightControllerT.
+ *
+ * Steps the controller every loopPeriodMs of simulated time, feeding it the
+ * LDR level and PIR edges from a SensorTrace, in the same order loop() does:
+ * LDR pin edge -> LDR sample (when due) -> consume motion flag -> evaluate
+ * (controller, then the head bank) -> PWM -> report. A trace has one PIR,
+ * so the bank has one head, as in the default build.
+ * The first pass primes the LDR window, as setup() does.
+ * Keep this in step with loop() whenever the wiring there changes.
+ *
+ * Observer needs:
+ *   void onLdrSample(uint32_t nowMs, bool edge);                 // LDR sampled (edge: pin-change wakeup)
+ *   void onPwm(uint32_t nowMs, const LightOutput& out);          // PWM changed
+ *   void onTelemetry(uint32_t nowMs, MessageClass msg, const LightOutput& out);
+ *
+ * Policy selects the controller variant: replayTrace<ArterialPolicy>(trace, obs).
+ */
+#pragma once
+#include "light_control.h"
+#include "channel_bank.h"
+#include "sensor_trace.h"
+
+const uint32_t HOST_LOOP_PERIOD_MS = 1;
+
+template <typename Policy = DefaultPolicy, typename Observer>
+inline void replayTrace(const SensorTrace& trace, Observer& observer, uint32_t loopPeriodMs = HOST_LOOP_PERIOD_MS) {
+    LightControllerT<Policy> controller;
+    controller.reset();
+    ChannelBank heads;
+    heads.reset(1);
+
+    int ldrLevel = 0;
+    bool motionFlag = false;
+    bool ldrEdgeFlag = false;
+    int lastPwm = -1;
+    size_t next = 0;
+
+    for (uint32_t now = 0; now <= trace.durationMs; now += loopPeriodMs) {
+        // Pin level / ISR flag as the hardware would present them at `now`
+        while (next < trace.events.size() && trace.events[next].tMs <= now) {
+            const TraceEvent& e = trace.events[next++];
+            if (e.ldr >= 0 && e.ldr != ldrLevel) {
+                ldrLevel = e.ldr;
+                ldrEdgeFlag = true; // CHANGE interrupt
+            }
+            if (e.pir) motionFlag = true;
+        }
+
+        if (ldrEdgeFlag) {
+            ldrEdgeFlag = false;
+            controller.onLdrEdge();
+        }
+        if (now == 0) {
+            controller.primeLdr(now, ldrLevel);
+        } else if (controller.ldrDue(now)) {
+            observer.onLdrSample(now, controller.ldrEdgeWake());
+            controller.sampleLdr(now, ldrLevel);
+        }
+        if (motionFlag) {
+            motionFlag = false;
+            controller.onMotion(now);
+            heads.onMotion(now, 1);
+        }
+
+        LightOutput out = controller.evaluate(now);
+        heads.evaluate(now, out.isNight, controller.policy);
+        if (out.pwm != lastPwm) {
+            lastPwm = out.pwm;
+            observer.onPwm(now, out);
+        }
+
+        MessageClass msg = controller.report.due(now, out);
+        if (msg == MSG_NONE && heads.changed()) {
+            msg = MSG_EVENT;
+            controller.report.lastReportTime = now;
+        }
+        if (msg != MSG_NONE) {
+            heads.markReported();
+            observer.onTelemetry(now, msg, out);
+        }
+    }
+}
@@ -0,0 +1,141 @@
+/*
+ * Sensor traces for host replay - LDR level changes and PIR edges.
+ *
+ * CSV format, one event per line (header and '#' comments allowed):
+ *   t_ms,ldr,pir
+ * ldr: digital LDR level from t_ms on (0=bright, 1=dark, -1=unchanged)
+ * pir: 1 = rising edge at t_ms
+ */
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct TraceEvent {
+    uint32_t tMs;
+    int8_t ldr;  // -1 = unchanged
+    uint8_t pir; // 1 = rising edge
+};
+
+struct SensorTrace {
+    std::string name;
+    uint32_t durationMs;
+    std::vector<TraceEvent> events; // Sorted by tMs
+};
+
+inline bool loadTrace(const char* path, SensorTrace& trace) {
+    FILE* f = fopen(path, "r");
+    if (!f) return false;
+    trace.events.clear();
+    trace.durationMs = 0;
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] < '0' || line[0] > '9') continue;
+        unsigned long t = 0;
+        int ldr = -1, pir = 0;
+        if (sscanf(line, "%lu,%d,%d", &t, &ldr, &pir) < 2) continue;
+        trace.events.push_back({(uint32_t)t, (int8_t)ldr, (uint8_t)(pir ? 1 : 0)});
+        if (t > trace.durationMs) trace.durationMs = (uint32_t)t;
+    }
+    fclose(f);
+    return true;
+}
+
+inline bool saveTrace(const char* path, const SensorTrace& trace) {
+    FILE* f = fopen(path, "w");
+    if (!f) return false;
+    fprintf(f, "t_ms,ldr,pir\n");
+    for (const TraceEvent& e : trace.events) fprintf(f, "%lu,%d,%d\n", (unsigned long)e.tMs, e.ldr, e.pir);
+    fclose(f);
+    return true;
+}
+
+// === SYNTHETIC SCENARIOS ===
+// Deterministic (fixed seed) so golden output is stable across runs/hosts.
+struct TraceRng {
+    uint32_t state;
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    double uniform() { return (next() >> 8) * (1.0 / 16777216.0); }
+};
+
+// LDR sampled-level changes: noisy twilight ramp between startMs and endMs.
+// darkFrom/darkTo: probability of reading dark before/after the ramp.
+inline void addTwilight(SensorTrace& trace, TraceRng& rng, uint32_t startMs, uint32_t endMs,
+                        double darkFrom, double darkTo, uint32_t stepMs = 50) {
+    int8_t level = darkFrom >= 0.5 ? 1 : 0;
+    trace.events.push_back({0, level, 0});
+    for (uint32_t t = startMs; t < endMs; t += stepMs) {
+        double p = darkFrom + (darkTo - darkFrom) * (double)(t - startMs) / (double)(endMs - startMs);
+        int8_t next = rng.uniform() < p ? 1 : 0;
+        if (next != level) {
+            trace.events.push_back({t, next, 0});
+            level = next;
+        }
+    }
+    int8_t final = darkTo >= 0.5 ? 1 : 0;
+    if (final != level) trace.events.push_back({endMs, final, 0});
+}
+
+// Pedestrians: exponential inter-arrival, some arrive in small groups
+inline void addPedestrians(SensorTrace& trace, TraceRng& rng, uint32_t startMs, uint32_t endMs, double meanGapMs) {
+    double t = startMs;
+    for (;;) {
+        t += -meanGapMs * log(1.0 - rng.uniform());
+        if (t >= endMs) break;
+        trace.events.push_back({(uint32_t)t, -1, 1});
+        if (rng.uniform() < 0.3) trace.events.push_back({(uint32_t)t + 1500 + (rng.next() % 4000), -1, 1});
+    }
+}
+
+inline void sortTrace(SensorTrace& trace) {
+    // Stable insertion sort: traces are short and mostly ordered
+    for (size_t i = 1; i < trace.events.size(); i++) {
+        TraceEvent e = trace.events[i];
+        size_t j = i;
+        while (j > 0 && trace.events[j - 1].tMs > e.tMs) {
+            trace.events[j] = trace.events[j - 1];
+            j--;
+        }
+        trace.events[j] = e;
+    }
+}
+
+inline std::vector<SensorTrace> syntheticScenarios() {
+    std::vector<SensorTrace> scenarios;
+    const uint32_t MIN = 60000;
+
+    // Day -> noisy dusk -> night with occasional pedestrians
+    SensorTrace dusk = {"dusk_noisy", 20 * MIN, {}};
+    TraceRng rng1 = {0x1234567u};
+    addTwilight(dusk, rng1, 8 * MIN, 12 * MIN, 0.0, 1.0);
+    addPedestrians(dusk, rng1, 2 * MIN, 20 * MIN, 90000.0);
+    sortTrace(dusk);
+    scenarios.push_back(dusk);
+
+    // Full night with busy traffic (many retriggers inside the 30 s timer)
+    SensorTrace night = {"night_traffic", 20 * MIN, {}};
+    TraceRng rng2 = {0x89ABCDEu};
+    night.events.push_back({0, 1, 0});
+    addPedestrians(night, rng2, 0, 20 * MIN, 20000.0);
+    sortTrace(night);
+    scenarios.push_back(night);
+
+    // Night -> flickering dawn (noise hovering around the thresholds) -> day
+    SensorTrace dawn = {"dawn_flicker", 20 * MIN, {}};
+    TraceRng rng3 = {0x0F1E2D3u};
+    addTwilight(dawn, rng3, 5 * MIN, 15 * MIN, 0.8, 0.2, 20);
+    addPedestrians(dawn, rng3, 0, 20 * MIN, 120000.0);
+    sortTrace(dawn);
+    scenarios.push_back(dawn);
+
+    return scenarios;
+}
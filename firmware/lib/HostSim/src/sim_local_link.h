@@ -0,0 +1,231 @@
+/*
+ * Simulated local link between a gateway and its neighbours (gateway.h),
+ * on the virtual clock of sim_network.h.
+ *
+ * SimLocalMedium carries frames with their airtime, from one transmit
+ * queue per endpoint (send() never blocks the loop, as on the device):
+ *   radio (ESP-NOW): carrier sense serialises senders, unicast to the
+ *     addressed endpoint, each frame lost with probability `loss`
+ *   bus (RS-485, half duplex): every endpoint hears every frame. Senders
+ *     listen before talking (idle for LOCAL_BUS_IDLE_BYTES byte times plus
+ *     a slot more, local_frame.h), but a start is only heard one
+ *     byte time later: two senders starting within that window collide and
+ *     both frames are corrupted (CRC fails at the receivers), as is a frame
+ *     lost to `loss`. Fragments queued together go out back to back, like
+ *     one UART write, so a sender keeps the bus for its whole message
+ * A send happens somewhere within the current ms (device loops are not in
+ * step). SimLocalLink is one endpoint, addressed like the device link
+ * (gateway 0, neighbours by id).
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <deque>
+#include <map>
+#include <vector>
+#include "sim_network.h"
+#include "local_frame.h" // LOCAL_BUS_*
+
+enum SimMediumKind { SIM_MEDIUM_RADIO, SIM_MEDIUM_BUS };
+
+const uint32_t SIM_ESPNOW_OVERHEAD_US = 200;  // Preamble, MAC header, SIFS + ACK at 1 Mbps
+const uint32_t SIM_ESPNOW_US_PER_BYTE = 8;
+
+struct SimLocalMedium;
+
+struct SimLocalLink {
+    struct Queued {
+        uint8_t to;
+        uint64_t readyUs;
+        std::vector<uint8_t> bytes;
+    };
+
+    SimLocalMedium* medium;
+    uint8_t address;
+    uint64_t txFreeUs = 0;        // Own transmit queue drains at airtime
+    std::deque<Queued> txQueue;   // Bus: waiting for the medium
+    uint64_t backoffFor = 0;      // Busy period the slot below was drawn for
+    uint32_t slot = 0;
+    std::deque<std::vector<uint8_t>> inbox;
+
+    void begin(SimLocalMedium* m, uint8_t addr);
+    bool send(uint8_t to, const uint8_t* frame, size_t length);
+    size_t receive(uint8_t* frame, size_t capacity);
+    bool busy();
+};
+
+struct SimLocalMedium {
+    SimMediumKind kind;
+    double nsPerByte;
+    uint32_t overheadUs;
+    double loss;
+    SimClock* clock;
+    TraceRng rng;
+    uint64_t busyUntilUs;        // Carrier sense
+    uint64_t lastStartUs;
+    SimLocalLink* holder;        // Sender of the last frame started
+    std::vector<SimLocalLink*> endpoints;
+    uint64_t frames = 0;
+    uint64_t collided = 0;
+    uint64_t lost = 0;
+    uint64_t airUs = 0;
+
+    struct Transmission {
+        SimLocalLink* from;
+        uint8_t to;
+        uint64_t startUs;
+        std::vector<uint8_t> bytes;
+        bool corrupt;
+    };
+    std::multimap<uint64_t, Transmission> air; // By end time
+    std::multimap<uint64_t, Transmission>::iterator last;
+
+    void beginRadio(SimClock* c, double lossRate, uint32_t seed) {
+        kind = SIM_MEDIUM_RADIO;
+        nsPerByte = SIM_ESPNOW_US_PER_BYTE * 1000.0;
+        overheadUs = SIM_ESPNOW_OVERHEAD_US;
+        begin(c, lossRate, seed);
+    }
+
+    // 8N1 framing, COBS + delimiter on the wire
+    void beginBus(SimClock* c, uint32_t baud, double lossRate, uint32_t seed) {
+        kind = SIM_MEDIUM_BUS;
+        nsPerByte = 10e9 / baud;
+        overheadUs = 0;
+        begin(c, lossRate, seed);
+    }
+
+    void begin(SimClock* c, double lossRate, uint32_t seed) {
+        clock = c;
+        loss = lossRate;
+        rng = {seed ? seed : 1};
+        busyUntilUs = 0;
+        lastStartUs = 0;
+        holder = nullptr;
+        last = air.end();
+    }
+
+    uint64_t byteUs() const { return (uint64_t)(nsPerByte / 1000.0) + 1; }
+
+    uint64_t airtimeUs(size_t length) const {
+        size_t wire = kind == SIM_MEDIUM_BUS ? length + length / 254 + 2 : length;
+        return overheadUs + (uint64_t)(wire * nsPerByte / 1000.0) + 1;
+    }
+
+    uint64_t start(SimLocalLink* from, uint8_t to, std::vector<uint8_t>&& bytes, uint64_t startUs, bool collides) {
+        uint64_t end = startUs + airtimeUs(bytes.size());
+        Transmission t = {from, to, startUs, std::move(bytes), collides};
+        if (collides) {
+            if (!last->second.corrupt) collided++;
+            last->second.corrupt = true;
+            collided++;
+        }
+        if (rng.uniform() < loss) {
+            t.corrupt = true;
+            lost++;
+        }
+        if (end > busyUntilUs) busyUntilUs = end;
+        lastStartUs = startUs;
+        holder = from;
+        airUs += end - startUs;
+        frames++;
+        last = air.emplace(end, std::move(t));
+        return end;
+    }
+
+    // Radio: carrier sense at send time is enough (CSMA/CA, no collisions modelled)
+    void sendRadio(SimLocalLink* from, uint8_t to, const uint8_t* frame, size_t length) {
+        uint64_t at = from->txFreeUs > clock->us ? from->txFreeUs : clock->us + rng.next() % 1000;
+        if (busyUntilUs > at) at = busyUntilUs;
+        from->txFreeUs = start(from, to, std::vector<uint8_t>(frame, frame + length), at, false);
+    }
+
+    // Bus: starts queued frames in time order up to `untilUs`
+    void runBus(uint64_t untilUs) {
+        uint64_t byte = byteUs();
+        for (;;) {
+            SimLocalLink* next = nullptr;
+            uint64_t nextAt = UINT64_MAX;
+            for (SimLocalLink* e : endpoints) {
+                if (e->txQueue.empty()) continue;
+                uint64_t at = e->txQueue.front().readyUs > e->txFreeUs ? e->txQueue.front().readyUs : e->txFreeUs;
+                if (e == holder && at == busyUntilUs) { // Next fragment of the same write
+                    next = e;
+                    nextAt = at;
+                    break;
+                }
+                bool unheard = last != air.end() && at >= lastStartUs && at < lastStartUs + byte;
+                if (!unheard && at < busyUntilUs + LOCAL_BUS_IDLE_BYTES * byte) {
+                    if (e->backoffFor != busyUntilUs) {
+                        e->backoffFor = busyUntilUs;
+                        e->slot = e->address == LOCAL_GATEWAY_ID ? 0 : 1 + rng.next() % (LOCAL_BUS_SLOTS - 1);
+                    }
+                    at = busyUntilUs + (LOCAL_BUS_IDLE_BYTES + e->slot) * byte;
+                }
+                if (at < nextAt) {
+                    next = e;
+                    nextAt = at;
+                }
+            }
+            if (!next || nextAt > untilUs) return;
+            // Another sender's start not heard yet (same slot, or within one byte time)
+            bool collides = last != air.end() && nextAt < lastStartUs + byte && last->second.from != next;
+            SimLocalLink::Queued q = std::move(next->txQueue.front());
+            next->txQueue.pop_front();
+            next->txFreeUs = start(next, q.to, std::move(q.bytes), nextAt, collides);
+        }
+    }
+
+    // Frames whose airtime is over reach their receivers (a corrupted one with
+    // a flipped byte on the bus; the radio drops it)
+    void deliver() {
+        if (kind == SIM_MEDIUM_BUS) runBus(clock->us);
+        while (!air.empty() && air.begin()->first <= clock->us) {
+            if (last == air.begin()) last = air.end();
+            Transmission t = std::move(air.begin()->second);
+            air.erase(air.begin());
+            if (t.corrupt && kind == SIM_MEDIUM_RADIO) continue;
+            if (t.corrupt) t.bytes[rng.next() % t.bytes.size()] ^= 0x5A;
+            for (SimLocalLink* e : endpoints) {
+                if (e == t.from) continue;
+                if (kind == SIM_MEDIUM_RADIO && e->address != t.to) continue;
+                e->inbox.push_back(t.bytes);
+            }
+        }
+    }
+};
+
+inline void SimLocalLink::begin(SimLocalMedium* m, uint8_t addr) {
+    medium = m;
+    address = addr;
+    medium->endpoints.push_back(this);
+}
+
+inline bool SimLocalLink::send(uint8_t to, const uint8_t* frame, size_t length) {
+    if (medium->kind == SIM_MEDIUM_RADIO) {
+        medium->sendRadio(this, to, frame, length);
+        return true;
+    }
+    uint64_t ready = medium->clock->us + medium->rng.next() % 1000;
+    if (!txQueue.empty() && txQueue.back().readyUs > ready) ready = txQueue.back().readyUs;
+    txQueue.push_back({to, ready, std::vector<uint8_t>(frame, frame + length)});
+    return true;
+}
+
+inline size_t SimLocalLink::receive(uint8_t* frame, size_t capacity) {
+    medium->deliver();
+    while (!inbox.empty()) {
+        std::vector<uint8_t> bytes = std::move(inbox.front());
+        inbox.pop_front();
+        if (bytes.size() > capacity) continue;
+        memcpy(frame, bytes.data(), bytes.size());
+        return bytes.size();
+    }
+    return 0;
+}
+
+inline bool SimLocalLink::busy() {
+    medium->deliver();
+    return !txQueue.empty() || txFreeUs > medium->clock->us;
+}
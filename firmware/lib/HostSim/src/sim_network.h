@@ -0,0 +1,269 @@
+/*
+ * Simulated WiFi/TCP/MQTT path for host runs of the firmware's network code
+ * (mqtt_link.h) on a virtual clock.
+ *
+ * SimMqttClient stands in for PubSubClient over WiFiClient. Its calls cost
+ * what the real ones block the loop for, and that time is added to the
+ * clock, so the loop replica sees the same control-step gaps:
+ *   connect(): TCP handshake (a lost SYN waits out the connect timeout),
+ *     CONNECT/CONNACK (retransmits, PubSubClient's socket timeout), broker
+ *     refusal (CONNACK with an error after one round trip)
+ *   publish(): a copy into the TCP send buffer. On a half-open connection
+ *     nothing is acked, the buffer fills, and the write then stalls for
+ *     WiFiClient's retry limit before the socket is closed.
+ *   loop(): keepalive ping; no answer within another keepalive drops it.
+ * SimBrokerLookup is broker_address.cpp's DNS lookup: on its own task, so it
+ * costs the loop nothing; its answer (or failure) is known that much later.
+ * SimNetwork decides the impairments: WiFi outages, half-open events
+ * (Poisson arrivals), loss, refusals and DNS failures (per lookup).
+ * Connect timeouts are the firmware's (main.cpp), the rest the
+ * Arduino-ESP32 / PubSubClient defaults.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include "sensor_trace.h" // TraceRng
+
+const uint32_t SIM_TCP_CONNECT_TIMEOUT_MS = 2000;   // MQTT_TCP_CONNECT_TIMEOUT_S
+const uint32_t SIM_TCP_SYN_RTO_MS = 3000;           // lwIP initial RTO: one lost SYN uses up the timeout
+const uint32_t SIM_TCP_RTO_MS = 1000;               // Retransmit on an established connection
+const uint32_t SIM_MQTT_SOCKET_TIMEOUT_MS = 2000;   // MQTT_SOCKET_TIMEOUT_S: CONNACK wait
+const uint32_t SIM_MQTT_KEEPALIVE_MS = 15000;
+const uint32_t SIM_DNS_MS = 30;                     // Lookup when it answers
+const uint32_t SIM_DNS_TIMEOUT_MS = 5000;           // ...when it does not
+const size_t SIM_TCP_SEND_BUFFER = 5744;            // lwIP TCP_SND_BUF
+const uint32_t SIM_WRITE_STALL_MS = 10000;          // WiFiClient: 10 write retries x 1 s select
+const uint32_t SIM_WRITE_US = 60;                   // Copy into the send buffer
+const size_t SIM_MQTT_OVERHEAD = 40;                // Fixed header + topic
+
+// PubSubClient state() codes
+const int SIM_MQTT_CONNECTION_TIMEOUT = -4;
+const int SIM_MQTT_CONNECTION_LOST = -3;
+const int SIM_MQTT_CONNECT_FAILED = -2;
+const int SIM_MQTT_DISCONNECTED = -1;
+const int SIM_MQTT_CONNECTED = 0;
+const int SIM_MQTT_CONNECT_UNAVAILABLE = 3;
+
+struct SimClock {
+    uint64_t us;
+    uint32_t ms() const { return (uint32_t)(us / 1000); }
+    void advanceMs(uint32_t ms) { us += (uint64_t)ms * 1000; }
+};
+
+struct NetImpairment {
+    uint32_t rttMs = 40;
+    uint32_t jitterMs = 20;        // Uniform, added to each round trip
+    double loss = 0;               // Per packet
+    double refuse = 0;             // Per CONNECT: broker answers "unavailable"
+    double dnsFail = 0;            // Per lookup
+    bool dns = false;              // Broker given by name (MQTT_SERVER_IP is an address: no lookup)
+    double halfOpenPerHour = 0;    // Connection silently dies (AP/NAT state lost)
+    double outagesPerHour = 0;     // WiFi association lost
+    uint32_t outageMeanS = 60;
+};
+
+struct SimNetwork {
+    NetImpairment imp;
+    SimClock* clock;
+    TraceRng rng;
+    uint64_t outageStartMs;
+    uint64_t outageEndMs;
+
+    void begin(const NetImpairment& impairment, SimClock* c, uint32_t seed) {
+        imp = impairment;
+        clock = c;
+        rng = {seed ? seed : 1};
+        scheduleOutage(0);
+    }
+
+    // Exponential inter-arrival at `perHour`; never if 0
+    uint64_t nextArrivalMs(uint64_t fromMs, double perHour) {
+        if (perHour <= 0) return UINT64_MAX;
+        return fromMs + (uint64_t)(-3600000.0 / perHour * log(1.0 - rng.uniform())) + 1;
+    }
+
+    void scheduleOutage(uint64_t fromMs) {
+        outageStartMs = nextArrivalMs(fromMs, imp.outagesPerHour);
+        if (outageStartMs == UINT64_MAX) {
+            outageEndMs = UINT64_MAX;
+            return;
+        }
+        outageEndMs = outageStartMs + (uint64_t)(-1000.0 * imp.outageMeanS * log(1.0 - rng.uniform())) + 1;
+    }
+
+    bool wifiUp() {
+        uint64_t now = clock->us / 1000;
+        while (now >= outageEndMs) scheduleOutage(outageEndMs);
+        return now < outageStartMs;
+    }
+
+    bool chance(double p) { return p > 0 && rng.uniform() < p; }
+    uint32_t roundTripMs() { return imp.rttMs + (imp.jitterMs ? rng.next() % (imp.jitterMs + 1) : 0); }
+};
+
+// broker_address.cpp: a name looked up off the loop, forgotten after a failed connect
+struct SimBrokerLookup {
+    SimNetwork* net;
+    bool known;
+    bool running;
+    bool found;
+    uint64_t doneAtMs;
+
+    void begin(SimNetwork* n) {
+        net = n;
+        known = !n->imp.dns;
+        running = found = false;
+        doneAtMs = 0;
+    }
+
+    bool start() {
+        if (known || running || found) return false;
+        running = true;
+        found = net->wifiUp() && !net->chance(net->imp.dnsFail);
+        doneAtMs = net->clock->us / 1000 + (found ? SIM_DNS_MS : SIM_DNS_TIMEOUT_MS);
+        return true;
+    }
+
+    bool busy() {
+        if (running && net->clock->us / 1000 >= doneAtMs) running = false;
+        return running;
+    }
+
+    bool done() {
+        if (running || !found) return false;
+        found = false;
+        known = true;
+        return true;
+    }
+
+    void forget() {
+        if (net->imp.dns) known = false;
+    }
+};
+
+// PubSubClient over WiFiClient, as far as the loop can tell
+struct SimMqttClient {
+    SimNetwork* net;
+    bool open;
+    bool halfOpen;
+    uint64_t halfOpenAtMs;      // When the current connection dies silently
+    size_t unacked;             // Bytes stuck in the send buffer (half-open)
+    uint64_t lastInMs;          // Last packet from the broker
+    bool pingOutstanding;
+    int rc;
+    uint32_t delivered;         // Publishes that reached the broker
+    uint32_t silentlyLost;      // Accepted into a half-open socket
+
+    void begin(SimNetwork* n) {
+        net = n;
+        open = halfOpen = pingOutstanding = false;
+        unacked = 0;
+        rc = SIM_MQTT_DISCONNECTED;
+        delivered = silentlyLost = 0;
+    }
+
+    uint64_t nowMs() const { return net->clock->us / 1000; }
+
+    void drop(int state) {
+        open = false;
+        rc = state;
+    }
+
+    bool connected() {
+        if (open && !net->wifiUp()) drop(SIM_MQTT_CONNECTION_LOST); // Link down closes the socket
+        if (open && !halfOpen && nowMs() >= halfOpenAtMs) halfOpen = true;
+        return open;
+    }
+
+    // Round trip that TCP retransmits until it gets through or `budgetMs` runs out
+    bool exchange(uint32_t& spentMs, uint32_t budgetMs, uint32_t rtoMs) {
+        for (;;) {
+            bool lost = net->chance(net->imp.loss) || net->chance(net->imp.loss); // Request or answer
+            uint32_t step = lost ? rtoMs : net->roundTripMs();
+            if (spentMs + step >= budgetMs) {
+                spentMs = budgetMs;
+                return false;
+            }
+            spentMs += step;
+            if (!lost) return true;
+            rtoMs *= 2;
+        }
+    }
+
+    bool connect(const char*) {
+        if (!net->wifiUp()) {
+            rc = SIM_MQTT_CONNECT_FAILED;
+            return false;
+        }
+        uint32_t spent = 0;
+        bool tcp = exchange(spent, SIM_TCP_CONNECT_TIMEOUT_MS, SIM_TCP_SYN_RTO_MS);
+        net->clock->advanceMs(spent);
+        if (!tcp) {
+            rc = SIM_MQTT_CONNECT_FAILED;
+            return false;
+        }
+        spent = 0;
+        bool connack = exchange(spent, SIM_MQTT_SOCKET_TIMEOUT_MS, SIM_TCP_RTO_MS);
+        net->clock->advanceMs(spent);
+        if (!connack) {
+            rc = SIM_MQTT_CONNECTION_TIMEOUT;
+            return false;
+        }
+        if (net->chance(net->imp.refuse)) {
+            rc = SIM_MQTT_CONNECT_UNAVAILABLE;
+            return false;
+        }
+        open = true;
+        halfOpen = false;
+        halfOpenAtMs = net->nextArrivalMs(nowMs(), net->imp.halfOpenPerHour);
+        unacked = 0;
+        lastInMs = nowMs();
+        pingOutstanding = false;
+        rc = SIM_MQTT_CONNECTED;
+        return true;
+    }
+
+    bool subscribe(const char*) { return write(SIM_MQTT_OVERHEAD); }
+
+    // Into the send buffer; stalls once a half-open socket has filled it
+    bool write(size_t bytes) {
+        if (!connected()) return false;
+        if (!halfOpen) {
+            net->clock->us += SIM_WRITE_US;
+            return true;
+        }
+        unacked += bytes;
+        if (unacked <= SIM_TCP_SEND_BUFFER) {
+            net->clock->us += SIM_WRITE_US;
+            return true;
+        }
+        net->clock->advanceMs(SIM_WRITE_STALL_MS);
+        drop(SIM_MQTT_CONNECTION_LOST);
+        return false;
+    }
+
+    bool publish(const char*, const uint8_t*, size_t length) {
+        bool wasHalfOpen = open && halfOpen;
+        if (!write(length + SIM_MQTT_OVERHEAD)) return false;
+        if (wasHalfOpen || halfOpen) silentlyLost++;
+        else delivered++;
+        return true;
+    }
+
+    // Keepalive: PINGREQ after a quiet keepalive interval, drop if unanswered for another
+    bool loop() {
+        if (!connected()) return false;
+        if (!halfOpen) lastInMs = nowMs(); // Broker traffic (PINGRESP, acks) keeps arriving
+        if (nowMs() - lastInMs < SIM_MQTT_KEEPALIVE_MS) return true;
+        if (pingOutstanding) {
+            drop(SIM_MQTT_CONNECTION_TIMEOUT);
+            return false;
+        }
+        pingOutstanding = true;
+        lastInMs = nowMs();
+        return write(2);
+    }
+
+    int state() const { return rc; }
+};
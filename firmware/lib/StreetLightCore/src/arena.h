@@ -0,0 +1,38 @@
+/*
+ * Boot arena - bump allocator for buffers that live until reset.
+ *
+ * Carved once from a block chosen at boot (PSRAM or a static array) and
+ * sealed when setup() ends, so nothing long-lived lands on the general heap
+ * after the device is running. There is no free().
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+struct MemoryArena {
+    uint8_t* base;
+    size_t capacity;
+    size_t used;
+    uint32_t failed;   // Requests refused (full or sealed)
+    bool sealed;
+
+    void begin(void* block, size_t bytes) {
+        base = (uint8_t*)block;
+        capacity = block ? bytes : 0;
+        used = 0;
+        failed = 0;
+        sealed = false;
+    }
+
+    void* alloc(size_t bytes, size_t align = 8) {
+        size_t start = (used + align - 1) & ~(align - 1);
+        if (sealed || start + bytes > capacity) {
+            failed++;
+            return nullptr;
+        }
+        used = start + bytes;
+        return base + start;
+    }
+
+    void seal() { sealed = true; }
+};
@@ -0,0 +1,66 @@
+/*
+ * Channel bank - one board driving up to MAX_CHANNELS lamp heads, each with
+ * its own PIR and retriggerable motion hold, sharing the LDR (day/night
+ * verdict of LightControllerT) and the network connection.
+ *
+ * Per-head state is a few compact arrays updated in one pass per loop():
+ * motion hold start, PWM, and a bitmask of heads in their hold. The
+ * controller itself keeps running as the "any head" view (its motion timer
+ * is retriggered by every head), so day/night, the RTC checkpoint and the
+ * top-level telemetry fields are unchanged; with one head the bank
+ * reproduces it exactly.
+ */
+#pragma once
+#include <stdint.h>
+#include "light_control.h"
+
+const int MAX_CHANNELS = 8; // LEDC channels on the ESP32-S3
+
+struct ChannelBank {
+    uint8_t count;
+    uint8_t activeMask;                  // Heads in their motion hold (at night)
+    uint8_t reportedMask;                // ...as of the last message sent
+    uint8_t pwm[MAX_CHANNELS];
+    uint32_t holdStartMs[MAX_CHANNELS];  // Last PIR trigger (millis, wraps)
+
+    // seedMs: hold start for every head (a restored checkpoint, or 0 like MotionTimer)
+    void reset(int heads, uint32_t seedMs = 0) {
+        count = heads < 1 ? 1 : (heads > MAX_CHANNELS ? MAX_CHANNELS : heads);
+        activeMask = reportedMask = 0;
+        for (int i = 0; i < MAX_CHANNELS; i++) {
+            pwm[i] = PWM_OFF;
+            holdStartMs[i] = seedMs;
+        }
+    }
+
+    // PIR edges since the last pass, one bit per head
+    void onMotion(unsigned long now, uint8_t heads) {
+        for (int i = 0; i < count; i++) {
+            if (heads & (1u << i)) holdStartMs[i] = (uint32_t)now;
+        }
+    }
+
+    // All heads against the shared day/night verdict
+    template <typename Policy>
+    void evaluate(unsigned long now, bool isNight, const Policy& policy) {
+        uint8_t mask = 0;
+        uint8_t dim = (uint8_t)selectPwm(isNight, false, policy.pwmFull, policy.pwmDim);
+        uint8_t full = (uint8_t)selectPwm(isNight, true, policy.pwmFull, policy.pwmDim);
+        for (int i = 0; i < count; i++) {
+            bool on = Policy::motionBoost && isNight && (uint32_t)now - holdStartMs[i] < policy.lightTimerMs;
+            mask |= (uint8_t)on << i;
+            pwm[i] = on ? full : dim;
+        }
+        activeMask = mask;
+    }
+
+    // A head started or ended its hold since the last message
+    bool changed() const { return activeMask != reportedMask; }
+    void markReported() { reportedMask = activeMask; }
+
+    float powerW() const {
+        float total = 0;
+        for (int i = 0; i < count; i++) total += pwmToPower(pwm[i]);
+        return total;
+    }
+};
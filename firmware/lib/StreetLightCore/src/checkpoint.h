@@ -0,0 +1,87 @@
+/*
+ * Controller checkpoint - survives warm resets (watchdog, brownout, panic)
+ * in RTC slow memory so a pole restarts at the level it had.
+ *
+ * Times are stored as ages relative to the checkpoint, since millis()
+ * restarts at 0 after reset. A CRC guards against the random contents RTC
+ * memory holds after power-on and against a reset mid-write.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "light_control.h"
+
+const uint32_t CHECKPOINT_MAGIC = 0x534C4331; // "SLC1", bump on layout change
+
+enum RestoreStatus {
+    RESTORE_COLD,    // Power-on reset: RTC memory not retained
+    RESTORE_INVALID, // Warm reset, but magic/CRC did not match
+    RESTORE_OK,
+};
+
+// CRC-32 (IEEE, reflected), bitwise: checkpoints are a few dozen bytes
+inline uint32_t crc32(const void* data, size_t length, uint32_t crc = 0) {
+    const uint8_t* p = (const uint8_t*)data;
+    crc = ~crc;
+    while (length--) {
+        crc ^= *p++;
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & (0u - (crc & 1)));
+    }
+    return ~crc;
+}
+
+template <typename Policy>
+struct ControllerCheckpoint {
+    uint32_t magic;
+    uint32_t bootCount;     // Boots since the last power-on (this one included)
+    uint8_t readings[Policy::windowSize];
+    uint8_t index;
+    uint8_t isNight;
+    uint8_t lastSentMotionState;
+    uint8_t lastSentNightMode;
+    uint32_t motionAgeMs;   // now - lastMotionSeenTime at checkpoint
+    uint32_t reportAgeMs;   // now - lastReportTime at checkpoint
+    uint32_t crc;           // Over everything above
+
+    uint32_t computeCrc() const { return crc32(this, offsetof(ControllerCheckpoint, crc)); }
+
+    bool valid() const { return magic == CHECKPOINT_MAGIC && crc == computeCrc(); }
+
+    void save(const LightControllerT<Policy>& controller, unsigned long now) {
+        magic = CHECKPOINT_MAGIC;
+        for (int i = 0; i < Policy::windowSize; i++) readings[i] = controller.ldr.readings[i];
+        index = controller.ldr.index;
+        isNight = controller.ldr.isNight;
+        lastSentMotionState = controller.report.lastSentMotionState;
+        lastSentNightMode = controller.report.lastSentNightMode;
+        motionAgeMs = (uint32_t)(now - controller.motion.lastMotionSeenTime);
+        reportAgeMs = (uint32_t)(now - controller.report.lastReportTime);
+        crc = computeCrc();
+    }
+
+    // Call once per boot before the first control pass. Counts the boot and,
+    // on a warm reset with a valid checkpoint, loads it into the controller.
+    RestoreStatus restore(LightControllerT<Policy>& controller, unsigned long now, bool warmReset) {
+        if (!warmReset || !valid()) {
+            RestoreStatus status = warmReset ? RESTORE_INVALID : RESTORE_COLD;
+            bootCount = 1;
+            save(controller, now);
+            return status;
+        }
+        controller.ldr.sum = 0;
+        for (int i = 0; i < Policy::windowSize; i++) {
+            controller.ldr.readings[i] = readings[i];
+            controller.ldr.sum += readings[i];
+        }
+        controller.ldr.index = index % Policy::windowSize;
+        controller.ldr.isNight = isNight;
+        controller.report.lastSentMotionState = lastSentMotionState;
+        controller.report.lastSentNightMode = lastSentNightMode;
+        controller.motion.lastMotionSeenTime = now - motionAgeMs;
+        controller.report.lastReportTime = now - reportAgeMs;
+        controller.lastLdrTime = now;
+        bootCount++;
+        save(controller, now);
+        return RESTORE_OK;
+    }
+};
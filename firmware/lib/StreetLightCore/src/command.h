@@ -0,0 +1,57 @@
+/*
+ * Downlink commands - JSON on smartcity/streetlight/<id>/command,
+ * e.g. {"cmd":"report"}, {"cmd":"profile","hz":1000,"s":10} or
+ * {"cmd":"ota","url":"http://<host>/streetlight-1.2-from-1.1.sld"} or
+ * {"cmd":"flight"}.
+ */
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <ArduinoJson.h>
+
+const size_t COMMAND_URL_MAX = 160;
+
+enum CommandType {
+    CMD_UNKNOWN,
+    CMD_REPORT,  // Send a heartbeat now
+    CMD_PROFILE, // Run the sampling profiler, then upload the samples
+    CMD_OTA,     // Download and apply a delta firmware patch
+    CMD_FLIGHT,  // Freeze and upload the flight recorder
+};
+
+struct Command {
+    CommandType type;
+    uint64_t sentEpochMs; // Optional "ts" from the sender, 0 if absent
+    uint32_t rateHz;      // CMD_PROFILE "hz", 0 = device default
+    uint32_t durationS;   // CMD_PROFILE "s", 0 = device default
+    char url[COMMAND_URL_MAX]; // CMD_OTA "url" of the patch, "" if absent/too long
+};
+
+// Returns false on malformed JSON or a missing "cmd"
+inline bool parseCommand(const uint8_t* payload, size_t length, Command& out) {
+    StaticJsonDocument<384> doc; // URL is copied in
+    out.type = CMD_UNKNOWN;
+    out.sentEpochMs = 0;
+    out.rateHz = 0;
+    out.durationS = 0;
+    out.url[0] = '\0';
+
+    if (deserializeJson(doc, payload, length)) return false;
+    const char* cmd = doc["cmd"];
+    if (!cmd) return false;
+
+    if (strcmp(cmd, "report") == 0) out.type = CMD_REPORT;
+    if (strcmp(cmd, "profile") == 0) {
+        out.type = CMD_PROFILE;
+        out.rateHz = doc["hz"] | (uint32_t)0;
+        out.durationS = doc["s"] | (uint32_t)0;
+    }
+    if (strcmp(cmd, "ota") == 0) {
+        out.type = CMD_OTA;
+        const char* url = doc["url"];
+        if (url && strlen(url) < COMMAND_URL_MAX) strcpy(out.url, url);
+    }
+    if (strcmp(cmd, "flight") == 0) out.type = CMD_FLIGHT;
+    out.sentEpochMs = doc["ts"] | (uint64_t)0;
+    return true;
+}
@@ -0,0 +1,170 @@
+/*
+ * Deflate (RFC 1951) in a zlib wrapper (RFC 1950) - what HTTP calls
+ * "Content-Encoding: deflate". Python's zlib.decompress() reads it as is.
+ *
+ * Sized for telemetry batches of a few KB: one block with the fixed Huffman
+ * code (no tree to build or send) and greedy LZ77 matching over a small
+ * hash table. JSON repeats its keys on every line, so LZ77 does most of
+ * the work (~5x on a heartbeat batch); zlib -9 gets ~7x with dynamic
+ * Huffman and lazy matching, for a lot more code and RAM.
+ * The caller owns every buffer; nothing is allocated.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+const int DEFLATE_HASH_BITS = 11;
+const size_t DEFLATE_HASH_SIZE = 1u << DEFLATE_HASH_BITS;
+const size_t DEFLATE_MAX_INPUT = 32768; // Whole input inside the 32 KB window
+const int DEFLATE_MIN_MATCH = 3;
+const int DEFLATE_MAX_MATCH = 258;
+
+// Worst case output: 9 bits per literal plus the wrapper
+inline size_t deflateBound(size_t length) {
+    return length + length / 8 + 16;
+}
+
+// Hash table for deflateCompress(), caller-owned (DEFLATE_HASH_SIZE * 2 B)
+struct DeflateState {
+    uint16_t head[DEFLATE_HASH_SIZE]; // Last position + 1 per hash, 0 = none
+};
+
+class DeflateBitWriter {
+public:
+    DeflateBitWriter(uint8_t* out, size_t capacity)
+        : out_(out), capacity_(capacity), length_(0), bits_(0), count_(0), overflow_(false) {}
+
+    // LSB first, as deflate packs everything but Huffman codes
+    void put(uint32_t value, int bits) {
+        bits_ |= value << count_;
+        count_ += bits;
+        while (count_ >= 8) {
+            byte((uint8_t)bits_);
+            bits_ >>= 8;
+            count_ -= 8;
+        }
+    }
+
+    // Huffman codes go MSB first
+    void putCode(uint32_t code, int bits) {
+        uint32_t reversed = 0;
+        for (int i = 0; i < bits; i++) reversed |= ((code >> i) & 1) << (bits - 1 - i);
+        put(reversed, bits);
+    }
+
+    void flush() {
+        if (count_) put(0, 8 - count_);
+    }
+
+    void byte(uint8_t b) {
+        if (length_ < capacity_) out_[length_++] = b;
+        else overflow_ = true;
+    }
+
+    size_t length() const { return length_; }
+    bool overflow() const { return overflow_; }
+
+private:
+    uint8_t* out_;
+    size_t capacity_;
+    size_t length_;
+    uint32_t bits_;
+    int count_;
+    bool overflow_;
+};
+
+// Fixed Huffman literal/length code (RFC 1951 3.2.6)
+inline void deflatePutLitLen(DeflateBitWriter& w, int symbol) {
+    if (symbol < 144) w.putCode(0x30 + symbol, 8);
+    else if (symbol < 256) w.putCode(0x190 + symbol - 144, 9);
+    else if (symbol < 280) w.putCode(symbol - 256, 7);
+    else w.putCode(0xC0 + symbol - 280, 8);
+}
+
+inline void deflatePutMatch(DeflateBitWriter& w, int length, int distance) {
+    static const uint16_t LENGTH_BASE[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                             31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                             2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const uint16_t DIST_BASE[30] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+                                           193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    static const uint8_t DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                           6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    int l = 28;
+    while (LENGTH_BASE[l] > length) l--;
+    deflatePutLitLen(w, 257 + l);
+    w.put(length - LENGTH_BASE[l], LENGTH_EXTRA[l]);
+    int d = 29;
+    while (DIST_BASE[d] > distance) d--;
+    w.putCode(d, 5);
+    w.put(distance - DIST_BASE[d], DIST_EXTRA[d]);
+}
+
+inline uint32_t adler32(const uint8_t* data, size_t length) {
+    uint32_t a = 1, b = 0;
+    while (length) {
+        size_t n = length < 5552 ? length : 5552; // Largest run without overflow
+        length -= n;
+        while (n--) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+// Returns the compressed length, 0 if `out` was too small or the input too
+// long (> DEFLATE_MAX_INPUT). deflateBound() is always enough.
+inline size_t deflateCompress(const uint8_t* in, size_t length, uint8_t* out, size_t capacity, DeflateState& state) {
+    if (length > DEFLATE_MAX_INPUT) return 0;
+    memset(state.head, 0, sizeof(state.head));
+    DeflateBitWriter w(out, capacity);
+    w.byte(0x78); // CM=8 (deflate), 32 KB window
+    w.byte(0x01); // Fastest level; header checksum
+    w.put(1, 1);  // BFINAL
+    w.put(1, 2);  // BTYPE=01: fixed Huffman
+
+    size_t pos = 0;
+    while (pos < length) {
+        int bestLength = 0;
+        size_t bestDistance = 0;
+        if (pos + DEFLATE_MIN_MATCH <= length) {
+            uint32_t h = ((uint32_t)in[pos] << 16 | (uint32_t)in[pos + 1] << 8 | in[pos + 2]) * 2654435761u;
+            h >>= 32 - DEFLATE_HASH_BITS;
+            size_t candidate = state.head[h];
+            state.head[h] = (uint16_t)(pos + 1);
+            if (candidate) {
+                candidate--;
+                size_t limit = length - pos < (size_t)DEFLATE_MAX_MATCH ? length - pos : DEFLATE_MAX_MATCH;
+                size_t n = 0;
+                while (n < limit && in[candidate + n] == in[pos + n]) n++;
+                if (n >= (size_t)DEFLATE_MIN_MATCH) {
+                    bestLength = (int)n;
+                    bestDistance = pos - candidate;
+                }
+            }
+        }
+        if (bestLength) {
+            deflatePutMatch(w, bestLength, (int)bestDistance);
+            // Index the skipped positions too, so the next line finds this one
+            for (size_t i = pos + 1; i < pos + bestLength && i + DEFLATE_MIN_MATCH <= length; i++) {
+                uint32_t h = ((uint32_t)in[i] << 16 | (uint32_t)in[i + 1] << 8 | in[i + 2]) * 2654435761u;
+                state.head[h >> (32 - DEFLATE_HASH_BITS)] = (uint16_t)(i + 1);
+            }
+            pos += bestLength;
+        } else {
+            deflatePutLitLen(w, in[pos++]);
+        }
+    }
+    deflatePutLitLen(w, 256); // End of block
+    w.flush();
+    uint32_t check = adler32(in, length);
+    w.byte(check >> 24);
+    w.byte(check >> 16);
+    w.byte(check >> 8);
+    w.byte(check);
+    return w.overflow() ? 0 : w.length();
+}
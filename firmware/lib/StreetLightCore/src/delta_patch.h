@@ -0,0 +1,273 @@
+/*
+ * Delta firmware patches (SLD1), bsdiff-style: the new image is rebuilt from
+ * the running one by COPY and ADD (old bytes plus a sparse difference, which
+ * absorbs shifted addresses) and INSERT (bytes with no counterpart).
+ *
+ * Decoded as a stream with any chunking, so a patch goes straight from the
+ * network into the OTA partition without either image in RAM.
+ *
+ * Layout (varints are LEB128, srcDelta is zigzag-encoded):
+ *   "SLD1" u32le oldSize u32le newSize sha256(old) sha256(new)
+ *   records until newSize bytes have been produced:
+ *     0x01 COPY   srcDelta len                          new = old
+ *     0x02 ADD    srcDelta len {zeros lits byte[lits]}  new = old + diff
+ *     0x03 INSERT len byte[len]
+ *   srcDelta moves the old-image cursor before the record; COPY and ADD
+ *   then advance it by len. In ADD, runs of `zeros` unchanged bytes
+ *   alternate with `lits` difference bytes until len is covered.
+ * Built by delta/mkdelta.cpp.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+const uint8_t DELTA_MAGIC[4] = {'S', 'L', 'D', '1'};
+const size_t DELTA_HEADER_BYTES = 4 + 4 + 4 + 32 + 32;
+
+enum DeltaOp { DELTA_COPY = 0x01, DELTA_ADD = 0x02, DELTA_INSERT = 0x03 };
+
+enum DeltaStatus {
+    DELTA_MORE,  // Feed more input
+    DELTA_DONE,  // newSize bytes produced
+    DELTA_ERROR, // Malformed patch, or the source/sink failed
+};
+
+struct DeltaHeader {
+    uint32_t oldSize;
+    uint32_t newSize;
+    uint8_t oldSha[32];
+    uint8_t newSha[32];
+};
+
+inline void putLe32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+inline uint32_t getLe32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+inline void encodeDeltaHeader(const DeltaHeader& h, uint8_t out[DELTA_HEADER_BYTES]) {
+    memcpy(out, DELTA_MAGIC, 4);
+    putLe32(out + 4, h.oldSize);
+    putLe32(out + 8, h.newSize);
+    memcpy(out + 12, h.oldSha, 32);
+    memcpy(out + 44, h.newSha, 32);
+}
+
+// Old: bool read(uint32_t offset, uint8_t* buffer, size_t length)  (running image)
+// Out: bool write(const uint8_t* data, size_t length)               (new image, in order)
+template <typename Old, typename Out>
+class DeltaPatcher {
+public:
+    static const size_t OLD_CACHE = 256;
+    static const size_t OUT_BUFFER = 512;
+
+    DeltaHeader header;
+
+    void begin() {
+        state = ST_HEADER;
+        got = 0;
+        produced = 0;
+        src = 0;
+        outLen = 0;
+        oldCacheLen = 0;
+        oldCacheStart = 0;
+    }
+
+    bool headerReady() const { return state != ST_HEADER; }
+    uint32_t bytesProduced() const { return produced; }
+
+    DeltaStatus feed(const uint8_t* data, size_t length, Old& old, Out& out) {
+        for (size_t i = 0; i < length; i++) {
+            if (state == ST_DONE || state == ST_ERROR) break;
+            if (!consume(data[i], old, out)) state = ST_ERROR;
+        }
+        if (state == ST_ERROR) return DELTA_ERROR;
+        if (state == ST_DONE) return DELTA_DONE;
+        return DELTA_MORE;
+    }
+
+private:
+    enum State {
+        ST_HEADER,
+        ST_OP,
+        ST_SRC_DELTA,
+        ST_LEN,
+        ST_ADD_ZEROS,
+        ST_ADD_LITS,
+        ST_ADD_BYTES,
+        ST_INSERT_BYTES,
+        ST_DONE,
+        ST_ERROR
+    };
+
+    State state;
+    uint8_t headerBytes[DELTA_HEADER_BYTES];
+    size_t got;          // Header bytes so far
+    uint8_t op;
+    uint32_t varint;     // Varint being accumulated
+    int shift;
+    uint32_t produced;   // New-image bytes emitted
+    uint32_t src;        // Old-image cursor
+    uint32_t remaining;  // Bytes left in the current record
+    uint32_t run;        // Bytes left in the current ADD literal run / INSERT
+    uint8_t out[OUT_BUFFER];
+    size_t outLen;
+    uint8_t oldCache[OLD_CACHE];
+    uint32_t oldCacheStart;
+    size_t oldCacheLen;
+
+    // LEB128: returns true when the varint is complete
+    bool varintByte(uint8_t b, bool& complete) {
+        if (shift > 28) return false;
+        varint |= (uint32_t)(b & 0x7F) << shift;
+        shift += 7;
+        complete = !(b & 0x80);
+        return true;
+    }
+
+    void startVarint(State next) {
+        varint = 0;
+        shift = 0;
+        state = next;
+    }
+
+    bool oldByte(uint32_t pos, Old& old, uint8_t& value) {
+        if (pos >= header.oldSize) return false;
+        if (pos < oldCacheStart || pos >= oldCacheStart + oldCacheLen) {
+            oldCacheStart = pos;
+            oldCacheLen = header.oldSize - pos < OLD_CACHE ? header.oldSize - pos : OLD_CACHE;
+            if (!old.read(oldCacheStart, oldCache, oldCacheLen)) {
+                oldCacheLen = 0;
+                return false;
+            }
+        }
+        value = oldCache[pos - oldCacheStart];
+        return true;
+    }
+
+    bool emit(uint8_t b, Out& sink) {
+        if (produced >= header.newSize) return false;
+        out[outLen++] = b;
+        produced++;
+        if (outLen == OUT_BUFFER || produced == header.newSize) {
+            if (!sink.write(out, outLen)) return false;
+            outLen = 0;
+        }
+        return true;
+    }
+
+    // Unchanged bytes from the old image
+    bool emitOld(uint32_t count, Old& old, Out& sink) {
+        for (uint32_t i = 0; i < count; i++) {
+            uint8_t b;
+            if (!oldByte(src++, old, b) || !emit(b, sink)) return false;
+        }
+        return true;
+    }
+
+    // After a record (or run) completes: next record, or the end
+    void recordDone() { state = produced == header.newSize ? ST_DONE : ST_OP; }
+
+    bool parseHeader() {
+        if (memcmp(headerBytes, DELTA_MAGIC, 4) != 0) return false;
+        header.oldSize = getLe32(headerBytes + 4);
+        header.newSize = getLe32(headerBytes + 8);
+        memcpy(header.oldSha, headerBytes + 12, 32);
+        memcpy(header.newSha, headerBytes + 44, 32);
+        return true;
+    }
+
+    bool consume(uint8_t b, Old& old, Out& sink) {
+        bool complete = false;
+        switch (state) {
+        case ST_HEADER:
+            headerBytes[got++] = b;
+            if (got < DELTA_HEADER_BYTES) return true;
+            if (!parseHeader()) return false;
+            recordDone();
+            return true;
+
+        case ST_OP:
+            op = b;
+            if (op == DELTA_COPY || op == DELTA_ADD) {
+                startVarint(ST_SRC_DELTA);
+                return true;
+            }
+            if (op == DELTA_INSERT) {
+                startVarint(ST_LEN);
+                return true;
+            }
+            return false;
+
+        case ST_SRC_DELTA:
+            if (!varintByte(b, complete)) return false;
+            if (complete) {
+                int32_t delta = (int32_t)(varint >> 1) ^ -(int32_t)(varint & 1);
+                src += (uint32_t)delta;
+                startVarint(ST_LEN);
+            }
+            return true;
+
+        case ST_LEN:
+            if (!varintByte(b, complete)) return false;
+            if (!complete) return true;
+            remaining = varint;
+            if (remaining == 0 || remaining > header.newSize - produced) return false;
+            if (op == DELTA_COPY) {
+                if (!emitOld(remaining, old, sink)) return false;
+                recordDone();
+            } else if (op == DELTA_ADD) {
+                startVarint(ST_ADD_ZEROS);
+            } else {
+                run = remaining;
+                state = ST_INSERT_BYTES;
+            }
+            return true;
+
+        case ST_ADD_ZEROS:
+            if (!varintByte(b, complete)) return false;
+            if (!complete) return true;
+            if (varint > remaining) return false;
+            if (!emitOld(varint, old, sink)) return false;
+            remaining -= varint;
+            if (remaining == 0) {
+                recordDone();
+            } else {
+                startVarint(ST_ADD_LITS);
+            }
+            return true;
+
+        case ST_ADD_LITS:
+            if (!varintByte(b, complete)) return false;
+            if (!complete) return true;
+            if (varint == 0 || varint > remaining) return false;
+            run = varint;
+            state = ST_ADD_BYTES;
+            return true;
+
+        case ST_ADD_BYTES: {
+            uint8_t base;
+            if (!oldByte(src++, old, base) || !emit((uint8_t)(base + b), sink)) return false;
+            remaining--;
+            if (--run) return true;
+            if (remaining == 0) {
+                recordDone();
+            } else {
+                startVarint(ST_ADD_ZEROS);
+            }
+            return true;
+        }
+
+        case ST_INSERT_BYTES:
+            if (!emit(b, sink)) return false;
+            if (--run == 0) recordDone();
+            return true;
+
+        default:
+            return false;
+        }
+    }
+};
@@ -0,0 +1,192 @@
+/*
+ * Diagnostics payload - JSON on smartcity/streetlight/<id>/diag, sent every
+ * DIAG_INTERVAL_MS so flat memory over months of uptime can be shown.
+ */
+#pragma once
+#include <stdint.h>
+#include <ArduinoJson.h>
+#include "loop_slo.h"
+#include "radio_schedule.h"
+#include "transport.h"
+#include "gateway.h"
+
+const unsigned long DIAG_INTERVAL_MS = 60000;
+const size_t DIAG_MAX_BYTES = 1536; // Worst case with every block present is ~1490; = LOCAL_MESSAGE_MAX
+const size_t DIAG_JSON_CAPACITY = 2048;
+const int DIAG_MAX_TASKS = 8;
+
+struct TaskStackStat {
+    const char* name;
+    uint32_t freeBytes; // Stack high-water mark: least free ever
+};
+
+struct MemoryStats {
+    uint32_t freeHeap;         // Internal 8-bit capable heap
+    uint32_t minFreeHeap;      // Lowest since boot
+    uint32_t largestFreeBlock; // Fragmentation: drops while freeHeap holds
+    uint32_t freePsram;        // 0 without PSRAM
+    uint32_t arenaUsed;
+    uint32_t arenaCapacity;
+    uint32_t arenaFailed;
+    int taskCount;
+    TaskStackStat tasks[DIAG_MAX_TASKS];
+};
+
+// MQTT TLS handshakes since boot (STREETLIGHT_MQTT_TLS)
+struct TlsStats {
+    uint32_t handshakes;     // Completed
+    uint32_t resumed;        // ...of which abbreviated (session ticket/ID accepted)
+    uint32_t failures;
+    uint32_t fullMsTotal;    // Handshake time, full and resumed separately
+    uint32_t resumedMsTotal;
+    uint32_t lastMs;
+    uint32_t fullLoopMaxUs;  // Longest loop step from handshake start to CONNECT done
+    uint32_t resumedLoopMaxUs;
+};
+
+struct DiagnosticsSample {
+    uint32_t bootId;
+    uint64_t uptimeMs;
+    bool staticMemory; // Built with STREETLIGHT_STATIC_MEMORY
+    MemoryStats mem;
+    const LoopSlo* slo; // Loop latency SLO, omitted when null
+    uint32_t ldrSamples;      // LDR samples since boot (adaptive rate)
+    uint32_t ldrEdgeSamples;  // ...woken by an LDR pin edge
+    const TlsStats* tls;      // Omitted when null (plain MQTT)
+    const RadioStats* radio;  // WiFi power save and downlink latency, omitted when null
+    const UploadStats* upload; // Store-and-forward / HTTP fallback, omitted when null
+    const LocalLinkStats* local; // Gateway or neighbour local link, omitted when null
+};
+
+// Returns the payload length, 0 if it did not fit. doc is scratch space
+// (cleared here), so a caller can keep one off the stack
+inline size_t serializeDiagnostics(const DiagnosticsSample& s, JsonDocument& doc, char* buffer, size_t capacity) {
+    doc.clear();
+    doc["boot"] = s.bootId;
+    doc["up"] = s.uptimeMs / 1000;
+    doc["mem_mode"] = s.staticMemory ? "static" : "heap";
+
+    JsonObject heap = doc.createNestedObject("heap");
+    heap["free"] = s.mem.freeHeap;
+    heap["min"] = s.mem.minFreeHeap;
+    heap["big"] = s.mem.largestFreeBlock;
+    heap["psram"] = s.mem.freePsram;
+
+    JsonObject arena = doc.createNestedObject("arena");
+    arena["used"] = s.mem.arenaUsed;
+    arena["cap"] = s.mem.arenaCapacity;
+    arena["fail"] = s.mem.arenaFailed;
+
+    // Projected per day, to compare with the fixed 100ms rate (864000/day)
+    JsonObject ldr = doc.createNestedObject("ldr");
+    ldr["n"] = s.ldrSamples;
+    ldr["edge"] = s.ldrEdgeSamples;
+    if (s.uptimeMs) ldr["per_day"] = (uint32_t)((uint64_t)s.ldrSamples * 86400000ULL / s.uptimeMs);
+
+    // Averages in ms; a resumed handshake skips the certificate chain and ECDHE.
+    // *_loop_us: worst loop step while a connection of that kind came up
+    if (s.tls) {
+        JsonObject tls = doc.createNestedObject("tls");
+        uint32_t full = s.tls->handshakes - s.tls->resumed;
+        tls["n"] = s.tls->handshakes;
+        tls["resumed"] = s.tls->resumed;
+        tls["fail"] = s.tls->failures;
+        if (full) tls["full_ms"] = s.tls->fullMsTotal / full;
+        if (s.tls->resumed) tls["resume_ms"] = s.tls->resumedMsTotal / s.tls->resumed;
+        tls["last_ms"] = s.tls->lastMs;
+        if (full) tls["full_loop_us"] = s.tls->fullLoopMaxUs;
+        if (s.tls->resumed) tls["resume_loop_us"] = s.tls->resumedLoopMaxUs;
+    }
+
+    // Radio time per hour of uptime (s); "cmd" is [n, avg, max, last] downlink ms
+    if (s.radio) {
+        JsonObject radio = doc.createNestedObject("radio");
+        radio["ps"] = radioModeName(s.radio->mode);
+        radio["li"] = s.radio->listenInterval;
+        radio["sw"] = s.radio->switches;
+        if (s.uptimeMs) {
+            radio["awake_s_h"] = (uint32_t)(s.radio->msInMode[RADIO_AWAKE] * 3600 / s.uptimeMs);
+            radio["on_s_h"] = (uint32_t)(radioOnMsEstimate(*s.radio) * 3600 / s.uptimeMs);
+        }
+        if (s.radio->cmdCount) {
+            JsonArray cmd = radio.createNestedArray("cmd");
+            cmd.add(s.radio->cmdCount);
+            cmd.add(s.radio->cmdLatencyMsTotal / s.radio->cmdCount);
+            cmd.add(s.radio->cmdLatencyMsMax);
+            cmd.add(s.radio->cmdLatencyMsLast);
+        }
+    }
+
+    // Buffered telemetry and the HTTP fallback; "x" = compression ratio
+    if (s.upload) {
+        JsonObject up = doc.createNestedObject("fwd");
+        up["tr"] = transportName(s.upload->transport);
+        up["fo"] = s.upload->failovers;
+        up["q"] = s.upload->queued;
+        up["sent"] = s.upload->sent;
+        up["drop"] = s.upload->dropped;
+        up["post"] = s.upload->batches;
+        up["fail"] = s.upload->failures;
+        if (s.upload->wireBytes) up["x"] = (float)s.upload->rawBytes / s.upload->wireBytes;
+    }
+
+    // Local link (gateway.h): each role reports its own side
+    if (s.local) {
+        JsonObject local = doc.createNestedObject("local");
+        local["role"] = localRoleName(s.local->role);
+        local["rx"] = s.local->rxFrames;
+        local["bad"] = s.local->badFrames;
+        if (s.local->role == STREETLIGHT_ROLE_NODE) {
+            local["q"] = s.local->queued;
+            local["sent"] = s.local->sent;
+            local["retry"] = s.local->retries;
+            local["bo"] = s.local->backoffs;
+            local["drop"] = s.local->dropped;
+        } else {
+            local["nodes"] = s.local->nodes;
+            local["msgs"] = s.local->messages;
+            local["dup"] = s.local->duplicates;
+            local["held"] = s.local->held;
+            local["pub"] = s.local->batches;
+            local["fail"] = s.local->publishFailures;
+            local["dlf"] = s.local->downFailed;
+        }
+        local["dl"] = s.local->downlinks;
+    }
+
+    JsonObject stack = doc.createNestedObject("stack");
+    for (int i = 0; i < s.mem.taskCount; i++) {
+        stack[s.mem.tasks[i].name] = s.mem.tasks[i].freeBytes;
+    }
+
+    // Gaps in ms; "last" holds [stage, gap, uptime ms] newest first
+    if (s.slo) {
+        JsonObject slo = doc.createNestedObject("slo");
+        slo["budget"] = s.slo->budgetUs / 1000;
+        slo["n"] = s.slo->violations;
+        if (s.slo->violations) {
+            slo["max"] = s.slo->maxGapUs / 1000;
+            slo["max_st"] = loopStageName(s.slo->maxGapStage);
+            JsonObject byStage = slo.createNestedObject("by");
+            for (int i = 0; i < STAGE_COUNT; i++) {
+                if (s.slo->byStage[i]) byStage[loopStageName(i)] = s.slo->byStage[i];
+            }
+            JsonArray last = slo.createNestedArray("last");
+            for (int i = 1; i <= SLO_RECENT && i <= (int)s.slo->violations; i++) {
+                const SloViolation& v = s.slo->recent[(s.slo->recentHead + SLO_RECENT - i) % SLO_RECENT];
+                JsonArray entry = last.createNestedArray();
+                entry.add(loopStageName(v.stage));
+                entry.add(v.gapUs / 1000);
+                entry.add(v.atMs);
+            }
+        }
+    }
+
+    if (measureJson(doc) >= capacity) return 0;
+    return serializeJson(doc, buffer, capacity);
+}
+
+inline size_t serializeDiagnostics(const DiagnosticsSample& s, char* buffer, size_t capacity) {
+    StaticJsonDocument<DIAG_JSON_CAPACITY> doc;
+    return serializeDiagnostics(s, doc, buffer, capacity);
+}
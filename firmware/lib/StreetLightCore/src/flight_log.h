@@ -0,0 +1,155 @@
+/*
+ * Flight recorder log - the last minutes of full-rate control history in a
+ * ring of packed 8-byte records, continuously overwritten:
+ *   LDR samples (reading, window sum), PIR edges, PWM changes, loop timing
+ *   (longest gap per FLIGHT_LOOP_WINDOW_US) and marks (why it was frozen).
+ * Recording is a bounds check and one 8-byte store. On an anomaly, a reset
+ * or a request the ring is frozen, uploaded in chunks, then resumed.
+ *
+ * Upload chunk (little-endian): "SLF1", u32 bootId, u16 dump, u16 chunk,
+ * u16 chunks, u8 reason, u8 record size, then whole records oldest first:
+ *   u32 micros (low 32 bits), u8 type, u8 a, u16 b
+ * app/backend.py reassembles and decodes them (/api/flight).
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+enum FlightRecordType : uint8_t {
+    FR_LDR = 1,  // a = reading (1 = dark), b = window sum
+    FR_PIR = 2,  // PIR edge (time of the ISR)
+    FR_PWM = 3,  // b = new PWM duty
+    FR_LOOP = 4, // b = longest loop gap in the window, in a's unit (FlightLoopUnit)
+    FR_MARK = 5, // a = FlightReason
+};
+
+// FR_LOOP units: us while the gap fits 16 bits, ms beyond (saturates past 65 s)
+enum FlightLoopUnit : uint8_t { FR_LOOP_US = 0, FR_LOOP_MS = 1 };
+
+enum FlightReason : uint8_t {
+    FLIGHT_NONE,
+    FLIGHT_ANOMALY, // Loop overran its latency budget
+    FLIGHT_RESET,   // Warm reset: history up to it (when PSRAM kept it)
+    FLIGHT_REQUEST, // "flight" command or 'f' on Serial
+    FLIGHT_REASON_COUNT
+};
+
+inline const char* flightReasonName(int reason) {
+    static const char* const NAMES[FLIGHT_REASON_COUNT] = {"none", "anomaly", "reset", "request"};
+    return reason >= 0 && reason < FLIGHT_REASON_COUNT ? NAMES[reason] : "unknown";
+}
+
+struct FlightRecord {
+    uint32_t tUs;
+    uint8_t type;
+    uint8_t a;
+    uint16_t b;
+};
+static_assert(sizeof(FlightRecord) == 8, "FlightRecord is packed by hand");
+
+const uint32_t FLIGHT_MAGIC = 0x31464C53; // "SLF1"
+const uint32_t FLIGHT_LOOP_WINDOW_US = 100000;
+const size_t FLIGHT_CHUNK_HEADER = 16;
+
+struct FlightLog {
+    uint32_t magic;        // Set by begin(); checked when the ring survived a reset
+    uint32_t bootId;       // Boot the records belong to
+    FlightRecord* records;
+    uint32_t capacity;
+    uint32_t head;         // Next slot written
+    uint32_t count;
+    bool frozen;
+    uint32_t windowStartUs;
+    uint32_t lastPassUs;
+    uint32_t maxGapUs;
+
+    void begin(FlightRecord* storage, uint32_t slots, uint32_t boot) {
+        records = storage;
+        capacity = storage ? slots : 0;
+        bootId = boot;
+        head = 0;
+        count = 0;
+        frozen = false;
+        windowStartUs = lastPassUs = maxGapUs = 0;
+        magic = FLIGHT_MAGIC;
+    }
+
+    // Plausible after a warm reset (random contents after power-on)
+    bool intact(FlightRecord* storage, uint32_t slots) const {
+        return magic == FLIGHT_MAGIC && records == storage && capacity == slots && head < slots && count <= slots;
+    }
+
+    inline void record(uint32_t tUs, uint8_t type, uint8_t a = 0, uint16_t b = 0) {
+        if (frozen || !capacity) return;
+        FlightRecord& r = records[head];
+        r.tUs = tUs;
+        r.type = type;
+        r.a = a;
+        r.b = b;
+        head = head + 1 == capacity ? 0 : head + 1;
+        if (count < capacity) count++;
+    }
+
+    // Once per loop pass: one FR_LOOP record per window, not per pass
+    inline void loopPass(uint32_t nowUs) {
+        uint32_t gap = nowUs - lastPassUs;
+        lastPassUs = nowUs;
+        if (gap > maxGapUs) maxGapUs = gap;
+        if (nowUs - windowStartUs >= FLIGHT_LOOP_WINDOW_US) {
+            if (maxGapUs <= 0xFFFF) {
+                record(nowUs, FR_LOOP, FR_LOOP_US, maxGapUs);
+            } else {
+                uint32_t ms = maxGapUs / 1000;
+                record(nowUs, FR_LOOP, FR_LOOP_MS, ms > 0xFFFF ? 0xFFFF : ms);
+            }
+            windowStartUs = nowUs;
+            maxGapUs = 0;
+        }
+    }
+
+    void freeze(uint32_t tUs, uint8_t reason) {
+        record(tUs, FR_MARK, reason);
+        frozen = true;
+    }
+
+    void resume() { frozen = false; }
+
+    const FlightRecord& at(uint32_t i) const { // 0 = oldest
+        return records[(head + capacity - count + i) % capacity];
+    }
+};
+
+inline uint32_t flightChunkCount(const FlightLog& log, size_t chunkBytes) {
+    uint32_t perChunk = (chunkBytes - FLIGHT_CHUNK_HEADER) / sizeof(FlightRecord);
+    return (log.count + perChunk - 1) / perChunk;
+}
+
+// Chunk `chunk` of a frozen log into `out`; returns its length, 0 past the end
+inline size_t encodeFlightChunk(const FlightLog& log, uint16_t dump, uint8_t reason, uint32_t chunk, uint8_t* out,
+                                size_t chunkBytes) {
+    uint32_t perChunk = (chunkBytes - FLIGHT_CHUNK_HEADER) / sizeof(FlightRecord);
+    uint32_t chunks = flightChunkCount(log, chunkBytes);
+    if (chunk >= chunks) return 0;
+    uint32_t first = chunk * perChunk;
+    uint32_t n = log.count - first < perChunk ? log.count - first : perChunk;
+
+    uint8_t* p = out;
+    auto put16 = [&p](uint16_t v) { *p++ = v; *p++ = v >> 8; };
+    auto put32 = [&p](uint32_t v) { for (int i = 0; i < 4; i++) *p++ = v >> (8 * i); };
+    put32(FLIGHT_MAGIC);
+    put32(log.bootId);
+    put16(dump);
+    put16(chunk);
+    put16(chunks);
+    *p++ = reason;
+    *p++ = sizeof(FlightRecord);
+    for (uint32_t i = 0; i < n; i++) {
+        const FlightRecord& r = log.at(first + i);
+        put32(r.tUs);
+        *p++ = r.type;
+        *p++ = r.a;
+        put16(r.b);
+    }
+    return p - out;
+}
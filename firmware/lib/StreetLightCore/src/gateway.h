@@ -0,0 +1,524 @@
+/*
+ * Gateway aggregation - one pole holds the MQTT connection for its
+ * neighbours, which reach it over a local link (local_frame.h).
+ *
+ * Link is duck-typed (ESP-NOW or UART/RS-485 on the device, simulated
+ * media in gwsim/):
+ *   bool send(uint8_t to, const uint8_t* frame, size_t length); // Queues it, never waits for air
+ *   size_t receive(uint8_t* frame, size_t capacity);            // One frame, 0 if none
+ *   bool busy();                                                // Queued frames not sent yet
+ * Ack timers start once the link has sent the last fragment, so a busy
+ * medium delays a retransmit instead of queueing a second copy.
+ *
+ * LocalNodeT (neighbour): telemetry and diagnostics go into an outbox ring
+ * and are sent one message at a time, stop-and-wait: the same seq is
+ * retransmitted until the gateway acknowledges it, with a randomised
+ * timeout so neighbours on a shared bus fall out of step, and a longer
+ * backoff once the gateway has been silent for LOCAL_UPLINK_TRIES tries.
+ * Nothing leaves the outbox before its ack; when full, the oldest goes.
+ *
+ * GatewayT: reassembles uplinks, drops retransmits of what it already has
+ * (re-acking them), and appends each message to one batch, a line each:
+ *   {"gw":"<id>"}
+ *   {"d":"<node>","m":<telemetry>}
+ *   {"d":"<node>","k":"diag","m":<diag>}
+ * Each line parses on its own, so one malformed message costs only its own
+ * entry; newlines inside a message become spaces (JSON whitespace; a raw
+ * newline in a string is invalid either way).
+ * The batch is published once its oldest heartbeat has waited
+ * GATEWAY_BATCH_WINDOW_MS, an event GATEWAY_EVENT_WINDOW_MS (neighbours
+ * tripped by the same car share it), or the next message would not fit.
+ * A message is acked once it is in the batch. While the batch cannot be
+ * published and is full, uplinks go unacknowledged, so the neighbours keep
+ * them in their outboxes until the broker is back.
+ * Downlink: a command for a known neighbour waits in a slot and is sent
+ * until the neighbour acks its seq (one in flight per neighbour, in order).
+ * A neighbour is known from its first uplink until GATEWAY_NODE_EXPIRY_MS
+ * of silence; syncSubscriptions() keeps the gateway's MQTT command
+ * subscriptions to exactly the known neighbours' topics.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "local_frame.h"
+#include "message_ring.h"
+
+// STREETLIGHT_ROLE values (preprocessor-visible)
+#define STREETLIGHT_ROLE_POLE 0     // Own MQTT connection (default)
+#define STREETLIGHT_ROLE_GATEWAY 1  // Own connection, plus batches for its neighbours
+#define STREETLIGHT_ROLE_NODE 2     // Uplink through a gateway only
+
+inline const char* localRoleName(int role) {
+    static const char* const NAMES[] = {"pole", "gateway", "node"};
+    return role >= 0 && role <= STREETLIGHT_ROLE_NODE ? NAMES[role] : "unknown";
+}
+
+const unsigned long LOCAL_ACK_TIMEOUT_MS = 40;      // After the last fragment left: a 250 B frame is ~22 ms on RS-485 at 115200
+const int LOCAL_UPLINK_TRIES = 8;
+const unsigned long LOCAL_BACKOFF_MS = 2000;        // Gateway silent: outbox kept, try again later
+const size_t LOCAL_OUTBOX_BYTES = 16384;            // Neighbour: ~80 s of heartbeats while the gateway is away
+
+const int GATEWAY_MAX_NODES = 32;
+const int GATEWAY_REASSEMBLY_SLOTS = 4;             // Neighbours mid-message at once
+const int GATEWAY_DOWNLINK_SLOTS = 4;
+const size_t GATEWAY_DOWNLINK_MAX = 256;            // Command JSON
+const int GATEWAY_DOWNLINK_TRIES = 10;
+const size_t GATEWAY_BATCH_MAX_BYTES = 4096;
+const unsigned long GATEWAY_BATCH_WINDOW_MS = 1000;
+const unsigned long GATEWAY_EVENT_WINDOW_MS = 50;
+const unsigned long GATEWAY_RETRY_MS = 1000;        // Between publish attempts while the broker is away
+const uint32_t GATEWAY_NODE_EXPIRY_MS = 600000;     // Silent this long: forgotten, command topic unsubscribed
+
+const size_t LOCAL_NODE_STORAGE_BYTES = 2 * LOCAL_MESSAGE_MAX + 1 + LOCAL_OUTBOX_BYTES;
+const size_t GATEWAY_STORAGE_BYTES = GATEWAY_REASSEMBLY_SLOTS * LOCAL_MESSAGE_MAX +
+                                     GATEWAY_DOWNLINK_SLOTS * GATEWAY_DOWNLINK_MAX + GATEWAY_BATCH_MAX_BYTES;
+
+// Reported in diagnostics ("local"); a role uses its own subset
+struct LocalLinkStats {
+    uint8_t role;
+    uint32_t rxFrames;
+    uint32_t badFrames;        // CRC or header
+    // Neighbour
+    uint32_t queued;           // In the outbox now
+    uint32_t sent;             // Acked by the gateway
+    uint32_t retries;
+    uint32_t backoffs;         // Gateway silent for LOCAL_UPLINK_TRIES tries
+    uint32_t dropped;          // Overwritten in the outbox
+    // Gateway
+    uint8_t nodes;             // Neighbours known (heard from within GATEWAY_NODE_EXPIRY_MS)
+    uint32_t messages;         // Uplinks put in a batch
+    uint32_t duplicates;       // Retransmits of a message it already had
+    uint32_t held;             // Uplinks left unacked: batch full and unpublished
+    uint32_t batches;
+    uint32_t publishFailures;
+    // Both
+    uint32_t downlinks;        // Commands delivered (neighbour: received)
+    uint32_t downFailed;       // Gateway: gave up, or no such neighbour
+};
+
+// Device number from ".../<n>/command", -1 if none
+inline int topicDeviceNumber(const char* topic) {
+    const char* end = strrchr(topic, '/');
+    if (!end || end == topic) return -1;
+    const char* start = end - 1;
+    while (start > topic && start[-1] != '/') start--;
+    int n = 0;
+    for (const char* p = start; p < end; p++) {
+        if (*p < '0' || *p > '9' || n > 255) return -1;
+        n = n * 10 + (*p - '0');
+    }
+    return start < end ? n : -1;
+}
+
+template <typename Link>
+struct LocalNodeT {
+    Link* link;
+    uint8_t id;
+    MessageRing outbox;        // [flags][message] records
+    uint8_t* pending;          // Message in flight, flags byte first
+    size_t pendingLength;
+    uint32_t pendingRingSeq;
+    bool inFlight;
+    uint16_t seq;
+    uint16_t boot;             // Boot epoch in every uplink: seq alone may repeat across reboots
+    int tries;
+    uint32_t nextTryMs;
+    bool sending;              // Link still sending the last try: ack timer not started
+    uint32_t rng;
+    LocalReassembly down;
+    bool haveDownSeq;
+    uint16_t lastDownSeq;
+    uint16_t lastDownBoot;     // Gateway's boot epoch then: its numbering restarts each boot
+    LocalLinkStats stats;
+
+    // storage: LOCAL_NODE_STORAGE_BYTES (the outbox gets whatever is past the two message buffers)
+    bool begin(Link* l, uint8_t nodeId, uint8_t* storage, size_t bytes, uint32_t seed) {
+        link = l;
+        id = nodeId;
+        stats = {};
+        stats.role = STREETLIGHT_ROLE_NODE;
+        inFlight = haveDownSeq = false;
+        seq = (uint16_t)seed; // Fresh numbering each boot
+        boot = (uint16_t)(seed >> 16);
+        rng = seed | 1;
+        down = {};
+        if (!storage || bytes <= 2 * LOCAL_MESSAGE_MAX + 1) {
+            outbox.begin(nullptr, 0);
+            return false;
+        }
+        pending = storage;
+        down.buffer = storage + LOCAL_MESSAGE_MAX + 1;
+        outbox.begin(storage + 2 * LOCAL_MESSAGE_MAX + 1, bytes - 2 * LOCAL_MESSAGE_MAX - 1);
+        return true;
+    }
+
+    // flags: LF_EVENT / LF_DIAG
+    bool enqueue(const char* message, size_t length, uint8_t flags) {
+        if (length > LOCAL_MESSAGE_MAX) return false;
+        return outbox.push(&flags, 1, (const uint8_t*)message, length);
+    }
+
+    // onCommand(const uint8_t* json, size_t length) for each new downlink
+    template <typename CommandSink>
+    void poll(uint32_t now, CommandSink&& onCommand) {
+        uint8_t raw[LOCAL_FRAME_MAX];
+        size_t n;
+        while ((n = link->receive(raw, sizeof(raw))) != 0) {
+            stats.rxFrames++;
+            LocalFrame f;
+            if (!decodeLocalFrame(raw, n, f)) {
+                stats.badFrames++;
+                continue;
+            }
+            if (f.node != id) continue; // Another neighbour's
+            if (f.type == LF_ACK && inFlight && f.seq == seq && f.boot == boot) {
+                outbox.pop(pendingRingSeq + 1); // Unless it was overwritten meanwhile
+                inFlight = false;
+                stats.sent++;
+            } else if (f.type == LF_DOWNLINK && down.add(f, now)) {
+                LocalFrame ack = {LF_DOWN_ACK, id, f.seq, f.boot, 0, 1, 0, nullptr, 0};
+                sendLocalMessage(*link, LOCAL_GATEWAY_ID, ack, nullptr, 0);
+                if (!haveDownSeq || f.seq != lastDownSeq || f.boot != lastDownBoot) { // Not a retransmit of the last one
+                    haveDownSeq = true;
+                    lastDownSeq = f.seq;
+                    lastDownBoot = f.boot;
+                    stats.downlinks++;
+                    onCommand(down.buffer, down.length);
+                }
+            }
+        }
+
+        if (!inFlight && !outbox.empty()) {
+            pendingRingSeq = outbox.firstSeq;
+            pendingLength = outbox.front(pending, LOCAL_MESSAGE_MAX + 1);
+            if (!pendingLength) {
+                outbox.pop(pendingRingSeq + 1); // Cannot happen: enqueue() checked the length
+            } else {
+                inFlight = true;
+                sending = false;
+                seq++;
+                tries = 0;
+                nextTryMs = now;
+            }
+        }
+        if (inFlight && sending && !link->busy()) {
+            sending = false;
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            nextTryMs = now + LOCAL_ACK_TIMEOUT_MS + rng % LOCAL_ACK_TIMEOUT_MS;
+        }
+        if (inFlight && !sending && (int32_t)(now - nextTryMs) >= 0) transmit(now);
+        stats.queued = outbox.count();
+        stats.dropped = outbox.dropped;
+    }
+
+    void transmit(uint32_t now) {
+        if (tries == LOCAL_UPLINK_TRIES) {
+            tries = 0;
+            stats.backoffs++;
+            nextTryMs = now + LOCAL_BACKOFF_MS;
+            return;
+        }
+        if (tries++) stats.retries++;
+        LocalFrame f = {LF_UPLINK, id, seq, boot, 0, 1, pending[0], nullptr, 0};
+        sendLocalMessage(*link, LOCAL_GATEWAY_ID, f, pending + 1, pendingLength - 1);
+        sending = true;
+    }
+};
+
+struct GatewayNode {
+    uint8_t id;
+    bool haveSeq;
+    uint16_t lastSeq;          // Last uplink put in a batch
+    uint16_t lastBoot;         // ...and the neighbour's boot epoch then
+    uint32_t lastHeardMs;
+    bool subscribed;           // Its command topic, on the current MQTT session
+};
+
+struct GatewayDownlink {
+    bool used;
+    uint8_t node;
+    uint16_t seq;
+    uint32_t order;            // Queue order: one in flight per neighbour, oldest first
+    int tries;
+    uint32_t nextTryMs;
+    bool sending;              // Link still sending the last try: ack timer not started
+    size_t length;
+    uint8_t* data;             // GATEWAY_DOWNLINK_MAX
+};
+
+template <typename Link>
+struct GatewayT {
+    Link* link;
+    char id[8];                // Gateway's own device number, as in its topics
+    GatewayNode nodes[GATEWAY_MAX_NODES];
+    int nodeCount;
+    uint8_t unsubscribe[GATEWAY_MAX_NODES]; // Forgotten neighbours whose topic is still subscribed
+    int unsubscribeCount;
+    LocalReassembly slots[GATEWAY_REASSEMBLY_SLOTS];
+    GatewayDownlink downlinks[GATEWAY_DOWNLINK_SLOTS];
+    uint16_t downSeq;
+    uint16_t boot;             // Boot epoch in every downlink, as LocalNodeT::boot
+    uint32_t downOrder;
+    char* batch;
+    size_t batchLength;
+    int batchCount;
+    uint32_t batchDueMs;
+    uint32_t nextPublishMs;    // Retry spacing after a failed publish
+    LocalLinkStats stats;
+
+    // storage: GATEWAY_STORAGE_BYTES
+    bool begin(Link* l, int gatewayNumber, uint8_t* storage, size_t bytes, uint32_t seed) {
+        link = l;
+        snprintf(id, sizeof(id), "%d", gatewayNumber);
+        nodeCount = 0;
+        unsubscribeCount = 0;
+        batchLength = 0;
+        batchCount = 0;
+        downSeq = (uint16_t)seed; // Fresh numbering each boot
+        boot = (uint16_t)(seed >> 16);
+        downOrder = 0;
+        nextPublishMs = 0;
+        stats = {};
+        stats.role = STREETLIGHT_ROLE_GATEWAY;
+        if (!storage || bytes < GATEWAY_STORAGE_BYTES) {
+            batch = nullptr;
+            return false;
+        }
+        for (int i = 0; i < GATEWAY_REASSEMBLY_SLOTS; i++) {
+            slots[i] = {};
+            slots[i].buffer = storage;
+            storage += LOCAL_MESSAGE_MAX;
+        }
+        for (int i = 0; i < GATEWAY_DOWNLINK_SLOTS; i++) {
+            downlinks[i] = {};
+            downlinks[i].data = storage;
+            storage += GATEWAY_DOWNLINK_MAX;
+        }
+        batch = (char*)storage;
+        return true;
+    }
+
+    GatewayNode* findNode(uint8_t node) {
+        for (int i = 0; i < nodeCount; i++) {
+            if (nodes[i].id == node) return &nodes[i];
+        }
+        return nullptr;
+    }
+
+    // Table full: the neighbour heard from least recently makes room
+    GatewayNode* addNode(uint8_t node, uint32_t now) {
+        if (nodeCount == GATEWAY_MAX_NODES) {
+            int oldest = 0;
+            for (int i = 1; i < nodeCount; i++) {
+                if ((int32_t)(nodes[i].lastHeardMs - nodes[oldest].lastHeardMs) < 0) oldest = i;
+            }
+            forgetNode(oldest);
+        }
+        GatewayNode* n = &nodes[nodeCount++];
+        *n = {node, false, 0, 0, now, false};
+        stats.nodes = (uint8_t)nodeCount;
+        return n;
+    }
+
+    void forgetNode(int i) {
+        if (nodes[i].subscribed && unsubscribeCount < GATEWAY_MAX_NODES) unsubscribe[unsubscribeCount++] = nodes[i].id;
+        nodes[i] = nodes[--nodeCount];
+        stats.nodes = (uint8_t)nodeCount;
+    }
+
+    void expireNodes(uint32_t now) {
+        for (int i = nodeCount - 1; i >= 0; i--) {
+            if (now - nodes[i].lastHeardMs >= GATEWAY_NODE_EXPIRY_MS) forgetNode(i);
+        }
+    }
+
+    // While MQTT is up: subscribe(node, on) -> bool for each change, forgotten
+    // neighbours first; what MQTT refused is retried on the next call
+    template <typename Subscribe>
+    void syncSubscriptions(Subscribe&& subscribe) {
+        while (unsubscribeCount && subscribe(unsubscribe[unsubscribeCount - 1], false)) unsubscribeCount--;
+        for (int i = 0; i < nodeCount; i++) {
+            if (!nodes[i].subscribed) nodes[i].subscribed = subscribe(nodes[i].id, true);
+        }
+    }
+
+    // New MQTT session (clean): nothing is subscribed any more
+    void subscriptionsLost() {
+        for (int i = 0; i < nodeCount; i++) nodes[i].subscribed = false;
+        unsubscribeCount = 0;
+    }
+
+    // Slot already collecting this message, else a free one, else the oldest
+    LocalReassembly* slotFor(const LocalFrame& f) {
+        LocalReassembly* pick = nullptr;
+        for (int i = 0; i < GATEWAY_REASSEMBLY_SLOTS; i++) {
+            LocalReassembly& s = slots[i];
+            if (s.busy && s.node == f.node && s.seq == f.seq && s.boot == f.boot) return &s;
+            if (!pick || (pick->busy && (!s.busy || (int32_t)(s.startedMs - pick->startedMs) < 0))) pick = &s;
+        }
+        return pick;
+    }
+
+    // Command JSON for a neighbour; false if it is unknown, too long or the slots are full
+    bool queueDownlink(uint8_t node, const uint8_t* json, size_t length) {
+        if (!findNode(node) || length > GATEWAY_DOWNLINK_MAX) {
+            stats.downFailed++;
+            return false;
+        }
+        for (int i = 0; i < GATEWAY_DOWNLINK_SLOTS; i++) {
+            GatewayDownlink& d = downlinks[i];
+            if (d.used) continue;
+            d.used = true;
+            d.node = node;
+            d.seq = ++downSeq;
+            d.order = downOrder++;
+            d.tries = 0;
+            d.nextTryMs = 0;
+            d.sending = false;
+            d.length = length;
+            memcpy(d.data, json, length);
+            return true;
+        }
+        stats.downFailed++;
+        return false;
+    }
+
+    bool pendingBatch() const { return batchCount > 0; }
+
+    // publish(const char* json, size_t length) -> bool
+    template <typename Publish>
+    void poll(uint32_t now, Publish&& publish) {
+        if (!batch) return;
+        uint8_t raw[LOCAL_FRAME_MAX];
+        size_t n;
+        while ((n = link->receive(raw, sizeof(raw))) != 0) {
+            stats.rxFrames++;
+            LocalFrame f;
+            if (!decodeLocalFrame(raw, n, f)) {
+                stats.badFrames++;
+                continue;
+            }
+            if (f.type == LF_UPLINK) onUplink(f, now, publish);
+            else if (f.type == LF_DOWN_ACK) onDownAck(f);
+        }
+        if (batchCount && (int32_t)(now - batchDueMs) >= 0) flush(now, publish);
+        sendDownlinks(now);
+        expireNodes(now);
+    }
+
+    template <typename Publish>
+    void onUplink(const LocalFrame& f, uint32_t now, Publish& publish) {
+        if (f.node == LOCAL_GATEWAY_ID) return;
+        GatewayNode* node = findNode(f.node);
+        if (!node) node = addNode(f.node, now);
+        node->lastHeardMs = now;
+        if (node->haveSeq && f.seq == node->lastSeq && f.boot == node->lastBoot) {
+            // Our ack was lost: ack again (once per retransmitted message)
+            if (f.index + 1 == f.count) {
+                stats.duplicates++;
+                ack(f.node, f.seq, f.boot);
+            }
+            return;
+        }
+        LocalReassembly* slot = slotFor(f);
+        if (!slot->add(f, now)) return;
+        if (!append(f.node, slot->flags, slot->buffer, slot->length, now, publish)) {
+            stats.held++;
+            return;
+        }
+        node->haveSeq = true;
+        node->lastSeq = f.seq;
+        node->lastBoot = f.boot;
+        stats.messages++;
+        ack(f.node, f.seq, f.boot);
+    }
+
+    void onDownAck(const LocalFrame& f) {
+        for (int i = 0; i < GATEWAY_DOWNLINK_SLOTS; i++) {
+            GatewayDownlink& d = downlinks[i];
+            if (d.used && d.node == f.node && d.seq == f.seq && f.boot == boot) {
+                d.used = false;
+                stats.downlinks++;
+            }
+        }
+    }
+
+    void ack(uint8_t node, uint16_t seq, uint16_t nodeBoot) {
+        LocalFrame f = {LF_ACK, node, seq, nodeBoot, 0, 1, 0, nullptr, 0};
+        sendLocalMessage(*link, node, f, nullptr, 0);
+    }
+
+    // Into the open batch (publishing it first if full); false if it has to wait
+    template <typename Publish>
+    bool append(uint8_t node, uint8_t flags, const uint8_t* message, size_t length, uint32_t now, Publish& publish) {
+        char head[40];
+        int headLength = snprintf(head, sizeof(head), "\n{\"d\":\"%u\",%s\"m\":", node,
+                                  (flags & LF_DIAG) ? "\"k\":\"diag\"," : "");
+        size_t need = headLength + length + 1; // Entry, then "}"
+        if (batchCount && batchLength + need > GATEWAY_BATCH_MAX_BYTES) {
+            if (!flush(now, publish)) return false;
+        }
+        if (!batchCount) {
+            batchLength = snprintf(batch, GATEWAY_BATCH_MAX_BYTES, "{\"gw\":\"%s\"}", id);
+            batchDueMs = now + GATEWAY_BATCH_WINDOW_MS;
+        }
+        if (batchLength + need > GATEWAY_BATCH_MAX_BYTES) return false; // Cannot happen: a message is < the batch
+        memcpy(batch + batchLength, head, headLength);
+        batchLength += headLength;
+        for (size_t i = 0; i < length; i++) batch[batchLength++] = message[i] == '\n' ? ' ' : message[i];
+        batch[batchLength++] = '}';
+        batchCount++;
+        if ((flags & LF_EVENT) && (int32_t)(now + GATEWAY_EVENT_WINDOW_MS - batchDueMs) < 0) {
+            batchDueMs = now + GATEWAY_EVENT_WINDOW_MS;
+        }
+        return true;
+    }
+
+    template <typename Publish>
+    bool flush(uint32_t now, Publish& publish) {
+        if (!batchCount) return true;
+        if ((int32_t)(now - nextPublishMs) < 0) return false;
+        if (publish((const char*)batch, batchLength)) {
+            stats.batches++;
+            batchCount = 0;
+            batchLength = 0;
+            return true;
+        }
+        stats.publishFailures++;
+        nextPublishMs = now + GATEWAY_RETRY_MS;
+        batchDueMs = nextPublishMs;
+        return false;
+    }
+
+    void sendDownlinks(uint32_t now) {
+        for (int i = 0; i < GATEWAY_DOWNLINK_SLOTS; i++) {
+            GatewayDownlink& d = downlinks[i];
+            if (!d.used) continue;
+            if (d.sending) {
+                if (link->busy()) continue;
+                d.sending = false;
+                d.nextTryMs = now + LOCAL_ACK_TIMEOUT_MS;
+            }
+            if (d.tries && (int32_t)(now - d.nextTryMs) < 0) continue;
+            bool older = false;
+            for (int k = 0; k < GATEWAY_DOWNLINK_SLOTS; k++) {
+                const GatewayDownlink& o = downlinks[k];
+                if (o.used && o.node == d.node && (int32_t)(o.order - d.order) < 0) older = true;
+            }
+            if (older) continue;
+            if (d.tries == GATEWAY_DOWNLINK_TRIES) {
+                d.used = false;
+                stats.downFailed++;
+                continue;
+            }
+            d.tries++;
+            LocalFrame f = {LF_DOWNLINK, d.node, d.seq, boot, 0, 1, 0, nullptr, 0};
+            sendLocalMessage(*link, d.node, f, d.data, d.length);
+            d.sending = true;
+        }
+    }
+};
@@ -0,0 +1,273 @@
+/*
+ * Light control core - LDR smoothing/hysteresis, retriggerable motion
+ * timer, PWM selection and event/heartbeat scheduling.
+ *
+ * Hardware-free so the exact logic that runs in loop() can also be
+ * compiled for the host (benchmarks, trace replay, simulation) and into
+ * the backend's native extension (app/native).
+ * All times are millis()-style unsigned long and wrap safely.
+ *
+ * The controller is a template over a policy that supplies its constants.
+ * Constexpr policies (DefaultPolicy, ...) fold into the generated code and
+ * let the compiler drop branches a variant never takes; RuntimePolicy holds
+ * the same fields as data for parameter sweeps.
+ */
+#pragma once
+#include <stdint.h>
+
+// === CONTROL CONSTANTS ===
+const int WINDOW_SIZE = 10;                 // LDR sliding window (samples)
+const int NIGHT_THRESHOLD = 5;              // Night when >= 5/10 readings are dark
+const int DAY_THRESHOLD = 3;                // Day when <= 3/10 readings are dark
+const unsigned long LDR_INTERVAL_MS = 100;  // LDR sampling period near the thresholds
+const unsigned long LDR_IDLE_INTERVAL_MS = 1000; // ...while the window is saturated (pin edges still sample at once)
+const unsigned long LIGHT_TIMER_MS = 30000; // 30 seconds light duration
+const unsigned long REPORT_INTERVAL_MS = 2000;
+const int PWM_FULL = 255;                   // 100% on motion
+const int PWM_DIM = 77;                     // 30% standby at night
+const int PWM_OFF = 0;
+const float MAX_LED_POWER_W = 20.0;         // Maximum power consumption of LED strip at 100%
+
+// === CONTROLLER POLICIES ===
+// Firmware default: the constants above
+struct DefaultPolicy {
+    static constexpr int windowSize = WINDOW_SIZE;
+    static constexpr int nightThreshold = NIGHT_THRESHOLD;
+    static constexpr int dayThreshold = DAY_THRESHOLD;
+    static constexpr unsigned long lightTimerMs = LIGHT_TIMER_MS;
+    static constexpr int pwmFull = PWM_FULL;
+    static constexpr int pwmDim = PWM_DIM;
+    static constexpr bool motionBoost = true; // false: no PIR, standby level all night
+};
+
+// Quiet residential streets: longer hold after motion, dimmer standby (20%)
+struct ResidentialPolicy : DefaultPolicy {
+    static constexpr unsigned long lightTimerMs = 60000;
+    static constexpr int pwmDim = 51;
+};
+
+// Busy arterial roads: brighter standby (40%), short hold, wider window
+// so passing headlights do not flip day/night
+struct ArterialPolicy : DefaultPolicy {
+    static constexpr int windowSize = 16;
+    static constexpr int nightThreshold = 9;
+    static constexpr int dayThreshold = 5;
+    static constexpr unsigned long lightTimerMs = 15000;
+    static constexpr int pwmDim = 102;
+};
+
+// Poles without a PIR: fixed standby level at night, motion logic compiled out
+struct NoMotionPolicy : DefaultPolicy {
+    static constexpr int pwmDim = 128;
+    static constexpr bool motionBoost = false;
+};
+
+// Same fields as data (host energy simulator sweeps); window stays fixed
+struct RuntimePolicy {
+    static constexpr int windowSize = WINDOW_SIZE;
+    static constexpr bool motionBoost = true;
+    int nightThreshold;
+    int dayThreshold;
+    unsigned long lightTimerMs;
+    int pwmFull;
+    int pwmDim;
+
+    RuntimePolicy()
+        : nightThreshold(NIGHT_THRESHOLD), dayThreshold(DAY_THRESHOLD), lightTimerMs(LIGHT_TIMER_MS),
+          pwmFull(PWM_FULL), pwmDim(PWM_DIM) {}
+    RuntimePolicy(int night, int day, unsigned long timerMs, int full, int dim)
+        : nightThreshold(night), dayThreshold(day), lightTimerMs(timerMs), pwmFull(full), pwmDim(dim) {}
+};
+
+// Message class carried in every payload so the backend can prioritise
+// state changes over periodic heartbeats
+enum MessageClass { MSG_NONE, MSG_EVENT, MSG_HEARTBEAT };
+
+// Result of one control step
+struct LightOutput {
+    bool isNight;
+    bool isMotionActive;
+    int pwm;
+    int smoothedLdr;   // Sum of the window (0-10 for the digital LDR)
+    long countdownSec; // Remaining full-brightness time, 0 when idle
+};
+
+// === PWM SELECTION ===
+inline int selectPwm(bool isNight, bool isMotionActive, int pwmFull = PWM_FULL, int pwmDim = PWM_DIM) {
+    if (!isNight) return PWM_OFF;
+    return isMotionActive ? pwmFull : pwmDim;
+}
+
+// Duty cycle as the integer percentage reported in telemetry (255->100, 77->30)
+inline int brightnessPercent(int pwm) {
+    return (pwm * 100) / 255;
+}
+
+// Calculate actual power from PWM duty cycle
+inline float pwmToPower(int pwm) {
+    return (pwm / 255.0f) * MAX_LED_POWER_W;
+}
+
+// === LDR: Sliding window + hysteresis ===
+// Prevents flickering at sunrise/sunset by requiring multiple consistent readings
+template <int N>
+struct LdrWindow {
+    uint8_t readings[N];
+    uint8_t index;
+    int sum;
+    bool isNight;
+
+    void reset() {
+        for (int i = 0; i < N; i++) readings[i] = 0;
+        index = 0;
+        sum = 0;
+        isNight = false;
+    }
+
+    // raw: digital LDR output, 1=dark (night), 0=bright (day)
+    void push(int raw, int nightThreshold = NIGHT_THRESHOLD, int dayThreshold = DAY_THRESHOLD) {
+        sum -= readings[index];
+        readings[index] = (uint8_t)raw;
+        sum += raw;
+        index = (index + 1) % N;
+
+        if (sum >= nightThreshold) {
+            isNight = true;
+        } else if (sum <= dayThreshold) {
+            isNight = false;
+        }
+        // Between thresholds: maintain previous state (no change)
+    }
+
+    // Boot: the whole window takes one reading, so the verdict is immediate
+    void fill(int raw, int nightThreshold = NIGHT_THRESHOLD, int dayThreshold = DAY_THRESHOLD) {
+        reset();
+        for (int i = 0; i < N; i++) push(raw, nightThreshold, dayThreshold);
+    }
+
+    // Most recent raw reading
+    int latest() const { return readings[(index + N - 1) % N]; }
+
+    // All readings agree: as far from both thresholds as the window gets
+    bool saturated() const { return sum == 0 || sum == N; }
+};
+
+typedef LdrWindow<WINDOW_SIZE> LdrFilter;
+
+// === MOTION: Retriggerable timer ===
+struct MotionTimer {
+    unsigned long lastMotionSeenTime;
+
+    void reset() { lastMotionSeenTime = 0; }
+    void trigger(unsigned long now) { lastMotionSeenTime = now; }
+    bool isActive(unsigned long now, unsigned long timerMs = LIGHT_TIMER_MS) const {
+        return now - lastMotionSeenTime < timerMs;
+    }
+    long countdownSec(unsigned long now, unsigned long timerMs = LIGHT_TIMER_MS) const {
+        return isActive(now, timerMs) ? (long)((timerMs - (now - lastMotionSeenTime)) / 1000) : 0;
+    }
+};
+
+// === REPORTING: Event-driven + periodic heartbeat ===
+struct ReportScheduler {
+    unsigned long lastReportTime;
+    bool lastSentMotionState;
+    bool lastSentNightMode;
+
+    void reset() {
+        lastReportTime = 0;
+        lastSentMotionState = false;
+        lastSentNightMode = false;
+    }
+
+    // Which message (if any) this pass should send
+    MessageClass due(unsigned long now, const LightOutput& out) {
+        bool stateChanged = (out.isMotionActive != lastSentMotionState) || (out.isNight != lastSentNightMode);
+        MessageClass msg = MSG_NONE;
+        if (stateChanged) {
+            msg = MSG_EVENT;
+        } else if (now - lastReportTime > REPORT_INTERVAL_MS) {
+            msg = MSG_HEARTBEAT;
+        }
+        if (msg != MSG_NONE) {
+            lastSentMotionState = out.isMotionActive;
+            lastSentNightMode = out.isNight;
+            lastReportTime = now; // Events also reset the heartbeat timer
+        }
+        return msg;
+    }
+
+    // Until the next heartbeat falls due, 0 if it is due now
+    unsigned long heartbeatInMs(unsigned long now) const {
+        unsigned long elapsed = now - lastReportTime;
+        return elapsed > REPORT_INTERVAL_MS ? 0 : REPORT_INTERVAL_MS - elapsed + 1;
+    }
+};
+
+// === CONTROLLER: One loop() pass worth of decisions ===
+template <typename Policy>
+struct LightControllerT {
+    Policy policy;
+    LdrWindow<Policy::windowSize> ldr;
+    MotionTimer motion;
+    ReportScheduler report;
+    unsigned long lastLdrTime;
+    bool ldrEdgePending;     // LDR pin changed since the last sample
+    uint32_t ldrSamples;     // Since reset, for the sampling-rate report
+    uint32_t ldrEdgeSamples; // ...of which woken by a pin edge
+
+    void reset(const Policy& p = Policy()) {
+        policy = p;
+        ldr.reset();
+        motion.reset();
+        report.reset();
+        lastLdrTime = 0;
+        ldrEdgePending = false;
+        ldrSamples = 0;
+        ldrEdgeSamples = 0;
+    }
+
+    // Adaptive rate: slow while every reading agrees, fast once they start to
+    // disagree (approaching a threshold). A pin edge in the slow phase samples
+    // at once, so a transition starts no later than at the fixed 100ms rate;
+    // in the fast phase edges are left to the 100ms cadence (flicker).
+    unsigned long ldrIntervalMs() const { return ldr.saturated() ? LDR_IDLE_INTERVAL_MS : LDR_INTERVAL_MS; }
+
+    bool ldrEdgeWake() const { return ldrEdgePending && ldr.saturated(); }
+
+    bool ldrDue(unsigned long now) const { return ldrEdgeWake() || now - lastLdrTime > ldrIntervalMs(); }
+
+    // LDR pin interrupt (CHANGE)
+    void onLdrEdge() { ldrEdgePending = true; }
+
+    void sampleLdr(unsigned long now, int raw) {
+        if (ldrEdgeWake()) ldrEdgeSamples++;
+        ldrEdgePending = false;
+        ldrSamples++;
+        lastLdrTime = now;
+        ldr.push(raw, policy.nightThreshold, policy.dayThreshold);
+    }
+
+    // First LDR reading after reset (setup), instead of waiting for the window to fill
+    void primeLdr(unsigned long now, int raw) {
+        lastLdrTime = now;
+        ldrEdgePending = false;
+        ldr.fill(raw, policy.nightThreshold, policy.dayThreshold);
+    }
+
+    void onMotion(unsigned long now) {
+        if (Policy::motionBoost) motion.trigger(now);
+    }
+
+    LightOutput evaluate(unsigned long now) const {
+        LightOutput out;
+        out.isNight = ldr.isNight;
+        out.isMotionActive = Policy::motionBoost && ldr.isNight && motion.isActive(now, policy.lightTimerMs);
+        out.pwm = selectPwm(out.isNight, out.isMotionActive, policy.pwmFull, policy.pwmDim);
+        out.smoothedLdr = ldr.sum;
+        out.countdownSec = out.isMotionActive ? motion.countdownSec(now, policy.lightTimerMs) : 0;
+        return out;
+    }
+};
+
+typedef LightControllerT<DefaultPolicy> LightController;
@@ -0,0 +1,147 @@
+/*
+ * Local link frames - between a gateway pole and its neighbours
+ * (gateway.h), over ESP-NOW or a UART/RS-485 bus.
+ *
+ * Frame (little-endian), at most LOCAL_FRAME_MAX bytes (the ESP-NOW payload):
+ *   u8 type, u8 node, u16 seq, u16 boot, u8 frag, u8 flags, payload, u16 crc16
+ * node is always the neighbour's id (uplink sender, downlink recipient).
+ * boot is the sender's boot epoch - the neighbour's on uplinks, the gateway's
+ * on downlinks, echoed back in acks: with seq it keys the receiver's duplicate
+ * check, so a peer that rebooted never has its first message taken for a
+ * retransmit.
+ * A message longer than one frame is split into fragments sent back to
+ * back: frag is index << 4 | count, all with the message's seq. CRC and
+ * COBS are serial_frame.h's; ESP-NOW sends the frame as is, the UART link
+ * COBS-encodes it with a 0x00 delimiter.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "serial_frame.h"
+
+enum LocalFrameType : uint8_t {
+    LF_UPLINK = 1,    // Neighbour -> gateway: telemetry or diagnostics
+    LF_ACK = 2,       // Gateway -> neighbour: uplink seq accepted
+    LF_DOWNLINK = 3,  // Gateway -> neighbour: command
+    LF_DOWN_ACK = 4,  // Neighbour -> gateway: downlink seq received
+};
+
+enum LocalFrameFlags : uint8_t {
+    LF_EVENT = 1,     // Uplink of an event (flushed from the batch early)
+    LF_DIAG = 2,      // Uplink of a diagnostics message
+};
+
+const uint8_t LOCAL_GATEWAY_ID = 0;     // Link address of the gateway (node ids 1-254)
+const size_t LOCAL_FRAME_MAX = 250;     // ESP_NOW_MAX_DATA_LEN
+const size_t LOCAL_FRAME_HEADER = 8;
+const size_t LOCAL_FRAGMENT_MAX = LOCAL_FRAME_MAX - LOCAL_FRAME_HEADER - 2;
+const size_t LOCAL_MESSAGE_MAX = 1536;  // Diagnostics included: 7 fragments
+const size_t LOCAL_WIRE_MAX = LOCAL_FRAME_MAX + LOCAL_FRAME_MAX / 254 + 2; // COBS + delimiter
+
+// RS-485 listen-before-talk: bus idle this many byte times, plus a slot more -
+// 0 for the gateway (its acks go first), 1..SLOTS-1 at random for neighbours
+const uint32_t LOCAL_BUS_IDLE_BYTES = 3;
+const uint32_t LOCAL_BUS_SLOTS = 16;
+
+struct LocalFrame {
+    uint8_t type;
+    uint8_t node;
+    uint16_t seq;
+    uint16_t boot;
+    uint8_t index;    // Fragment index, 0..count-1
+    uint8_t count;
+    uint8_t flags;
+    const uint8_t* payload; // Into the decoded buffer
+    size_t length;
+};
+
+inline size_t encodeLocalFrame(const LocalFrame& f, uint8_t* out) {
+    out[0] = f.type;
+    out[1] = f.node;
+    out[2] = f.seq;
+    out[3] = f.seq >> 8;
+    out[4] = f.boot;
+    out[5] = f.boot >> 8;
+    out[6] = f.index << 4 | f.count;
+    out[7] = f.flags;
+    if (f.length) memcpy(out + LOCAL_FRAME_HEADER, f.payload, f.length);
+    size_t n = LOCAL_FRAME_HEADER + f.length;
+    uint16_t crc = crc16(out, n);
+    out[n++] = crc;
+    out[n++] = crc >> 8;
+    return n;
+}
+
+// False on a bad CRC or malformed header; payload points into `raw`
+inline bool decodeLocalFrame(const uint8_t* raw, size_t length, LocalFrame& f) {
+    if (length < LOCAL_FRAME_HEADER + 2 || length > LOCAL_FRAME_MAX) return false;
+    if (crc16(raw, length - 2) != (uint16_t)(raw[length - 2] | raw[length - 1] << 8)) return false;
+    f.type = raw[0];
+    f.node = raw[1];
+    f.seq = raw[2] | raw[3] << 8;
+    f.boot = raw[4] | raw[5] << 8;
+    f.index = raw[6] >> 4;
+    f.count = raw[6] & 0x0F;
+    f.flags = raw[7];
+    f.payload = raw + LOCAL_FRAME_HEADER;
+    f.length = length - LOCAL_FRAME_HEADER - 2;
+    return f.count && f.index < f.count;
+}
+
+// Sends a message as fragments over link.send(to, frame, length); false if
+// it is too long or the link refused a fragment
+template <typename Link>
+inline bool sendLocalMessage(Link& link, uint8_t to, LocalFrame f, const uint8_t* message, size_t length) {
+    size_t count = length ? (length + LOCAL_FRAGMENT_MAX - 1) / LOCAL_FRAGMENT_MAX : 1;
+    if (count > 15) return false;
+    uint8_t frame[LOCAL_FRAME_MAX];
+    f.count = (uint8_t)count;
+    for (size_t i = 0; i < count; i++) {
+        f.index = (uint8_t)i;
+        f.payload = message + i * LOCAL_FRAGMENT_MAX;
+        f.length = i + 1 < count ? LOCAL_FRAGMENT_MAX : length - i * LOCAL_FRAGMENT_MAX;
+        if (!link.send(to, frame, encodeLocalFrame(f, frame))) return false;
+    }
+    return true;
+}
+
+// One message being put back together from its fragments
+struct LocalReassembly {
+    uint8_t* buffer;    // LOCAL_MESSAGE_MAX bytes, caller-owned
+    uint8_t node;
+    uint16_t seq;
+    uint16_t boot;
+    uint8_t flags;
+    uint16_t have;      // Fragment bitmask
+    uint16_t want;
+    size_t length;
+    bool busy;
+    uint32_t startedMs;
+
+    // Returns true once the message is complete (buffer[0..length))
+    bool add(const LocalFrame& f, uint32_t nowMs) {
+        if (!busy || f.node != node || f.seq != seq || f.boot != boot || (uint16_t)((1u << f.count) - 1) != want) {
+            busy = true;
+            node = f.node;
+            seq = f.seq;
+            boot = f.boot;
+            flags = f.flags;
+            have = 0;
+            want = (uint16_t)((1u << f.count) - 1);
+            length = 0;
+            startedMs = nowMs;
+        }
+        size_t offset = (size_t)f.index * LOCAL_FRAGMENT_MAX;
+        if (offset + f.length > LOCAL_MESSAGE_MAX) {
+            busy = false;
+            return false;
+        }
+        memcpy(buffer + offset, f.payload, f.length);
+        have |= 1u << f.index;
+        if (f.index + 1 == f.count) length = offset + f.length;
+        if (have != want) return false;
+        busy = false;
+        return true;
+    }
+};
@@ -0,0 +1,106 @@
+/*
+ * Loop-latency SLO - the gap between consecutive control steps against a
+ * budget, blamed on the loop stage that was running when it overran.
+ *
+ * The loop marks its current stage (one byte store) and calls step() once
+ * per control step. A periodic monitor calls poll() from another context:
+ * it is what sees the stage while the loop is still stuck. Gaps that close
+ * between two polls fall back to the stage marked at the step.
+ */
+#pragma once
+#include <stdint.h>
+
+enum LoopStage {
+    STAGE_IDLE,          // Between loop() calls (Arduino core)
+    STAGE_WIFI,
+    STAGE_MQTT_CONNECT,
+    STAGE_MQTT_LOOP,
+    STAGE_LDR,
+    STAGE_MOTION,
+    STAGE_CONTROL,
+    STAGE_REPORT,
+    STAGE_PUBLISH,
+    STAGE_DIAG,
+    STAGE_PROFILE,       // Profiler upload
+    STAGE_OTA,           // OTA progress report (download runs on its own task)
+    STAGE_FLIGHT,        // Flight recorder upload
+    STAGE_LOCAL,         // Gateway/neighbour local link (gateway.h)
+    STAGE_COUNT
+};
+
+inline const char* loopStageName(uint8_t stage) {
+    static const char* const NAMES[STAGE_COUNT] = {"idle",   "wifi",    "mqtt_connect", "mqtt_loop", "ldr",    "motion",
+                                                   "control", "report", "publish",      "diag",      "profile",
+                                                   "ota",     "flight", "local"};
+    return stage < STAGE_COUNT ? NAMES[stage] : "unknown";
+}
+
+const int SLO_RECENT = 4; // Violations kept with full detail
+
+struct SloViolation {
+    uint32_t gapUs;
+    uint8_t stage;
+    uint32_t atMs; // Step time that closed it
+};
+
+struct LoopSlo {
+    uint32_t budgetUs;
+    volatile uint32_t lastStepUs;
+    volatile uint8_t stage;
+    volatile bool overrunning;       // Set by poll() while the loop is stuck
+    volatile uint8_t overrunStage;
+    uint32_t violations;
+    uint32_t byStage[STAGE_COUNT];
+    uint32_t maxGapUs;
+    uint8_t maxGapStage;
+    uint32_t lastGapUs;              // Gap closed by the latest step
+    SloViolation recent[SLO_RECENT];
+    uint8_t recentHead;
+
+    void begin(uint32_t budget, uint32_t nowUs) {
+        budgetUs = budget;
+        lastStepUs = nowUs;
+        stage = STAGE_IDLE;
+        overrunning = false;
+        overrunStage = STAGE_IDLE;
+        violations = 0;
+        for (int i = 0; i < STAGE_COUNT; i++) byStage[i] = 0;
+        maxGapUs = 0;
+        maxGapStage = STAGE_IDLE;
+        lastGapUs = 0;
+        recentHead = 0;
+        for (int i = 0; i < SLO_RECENT; i++) recent[i] = {0, STAGE_IDLE, 0};
+    }
+
+    void mark(LoopStage s) { stage = (uint8_t)s; }
+
+    // Monitor context: how long the loop has been away, latching its stage
+    uint32_t poll(uint32_t nowUs) {
+        uint32_t gap = nowUs - lastStepUs;
+        if (gap > budgetUs && !overrunning) {
+            overrunStage = stage;
+            overrunning = true;
+        }
+        return gap;
+    }
+
+    // Loop context, once per control step. Returns true on a violation.
+    bool step(uint32_t nowUs, uint32_t nowMs) {
+        uint32_t gap = nowUs - lastStepUs;
+        lastStepUs = nowUs;
+        lastGapUs = gap;
+        uint8_t blamed = overrunning ? overrunStage : stage;
+        overrunning = false;
+        if (gap <= budgetUs) return false;
+
+        violations++;
+        byStage[blamed]++;
+        if (gap > maxGapUs) {
+            maxGapUs = gap;
+            maxGapStage = blamed;
+        }
+        recent[recentHead] = {gap, blamed, nowMs};
+        recentHead = (recentHead + 1) % SLO_RECENT;
+        return true;
+    }
+};
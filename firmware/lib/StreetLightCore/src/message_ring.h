@@ -0,0 +1,120 @@
+/*
+ * Store-and-forward buffer - serialized messages held while MQTT is down,
+ * oldest dropped first when full.
+ *
+ * Records are [u16 length][bytes] in a byte ring over caller-owned storage.
+ * Each record has a sequence number, so a consumer can copy a batch out,
+ * upload it without holding any lock, and then release exactly what it
+ * sent with pop(upTo), even if the producer overwrote some of it meanwhile.
+ * Not thread-safe: the firmware wraps every call in a critical section.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+const size_t MESSAGE_RING_HEADER = 2;
+
+struct MessageRing {
+    uint8_t* data;
+    size_t capacity;
+    size_t head;         // Write offset
+    size_t tail;         // Oldest record
+    size_t used;
+    uint32_t firstSeq;   // Sequence number of the oldest record
+    uint32_t nextSeq;    // ...of the next record pushed
+    uint32_t dropped;    // Overwritten before they were sent
+
+    void begin(uint8_t* storage, size_t bytes) {
+        data = storage;
+        capacity = storage ? bytes : 0;
+        head = tail = used = 0;
+        firstSeq = nextSeq = 0;
+        dropped = 0;
+    }
+
+    uint32_t count() const { return nextSeq - firstSeq; }
+    bool empty() const { return nextSeq == firstSeq; }
+
+    // False only if the message can never fit
+    bool push(const uint8_t* message, size_t length) { return push(nullptr, 0, message, length); }
+
+    // Record = prefix + message (e.g. a flags byte), without a staging copy
+    bool push(const uint8_t* prefix, size_t prefixLength, const uint8_t* message, size_t length) {
+        size_t total = prefixLength + length;
+        size_t need = MESSAGE_RING_HEADER + total;
+        if (total > 0xFFFF || need > capacity) return false;
+        while (capacity - used < need) {
+            dropOldest();
+            dropped++;
+        }
+        uint8_t header[MESSAGE_RING_HEADER] = {(uint8_t)total, (uint8_t)(total >> 8)};
+        write(header, MESSAGE_RING_HEADER);
+        write(prefix, prefixLength);
+        write(message, length);
+        nextSeq++;
+        return true;
+    }
+
+    // Copies the oldest record; returns its length, 0 if empty or it does not fit
+    size_t front(uint8_t* out, size_t capacityOut) const {
+        if (empty()) return 0;
+        uint8_t header[MESSAGE_RING_HEADER];
+        read(tail, header, MESSAGE_RING_HEADER);
+        size_t length = header[0] | (size_t)header[1] << 8;
+        if (length > capacityOut) return 0;
+        read((tail + MESSAGE_RING_HEADER) % capacity, out, length);
+        return length;
+    }
+
+    // Copies records oldest first into `out`, each followed by `separator`,
+    // while they fit. Returns the bytes written; *endSeq is one past the last
+    // record copied (pass it to pop() once they are delivered).
+    size_t peek(uint8_t* out, size_t capacityOut, char separator, uint32_t* endSeq) const {
+        size_t offset = tail, written = 0;
+        uint32_t seq = firstSeq;
+        while (seq != nextSeq) {
+            uint8_t header[MESSAGE_RING_HEADER];
+            read(offset, header, MESSAGE_RING_HEADER);
+            size_t length = header[0] | (size_t)header[1] << 8;
+            if (written + length + 1 > capacityOut) break;
+            read((offset + MESSAGE_RING_HEADER) % capacity, out + written, length);
+            written += length;
+            out[written++] = (uint8_t)separator;
+            offset = (offset + MESSAGE_RING_HEADER + length) % capacity;
+            seq++;
+        }
+        *endSeq = seq;
+        return written;
+    }
+
+    // Releases records before endSeq (some may be gone already)
+    void pop(uint32_t endSeq) {
+        while (!empty() && (int32_t)(endSeq - firstSeq) > 0) dropOldest();
+    }
+
+private:
+    void write(const uint8_t* bytes, size_t length) {
+        if (!length) return;
+        size_t first = capacity - head < length ? capacity - head : length;
+        memcpy(data + head, bytes, first);
+        memcpy(data, bytes + first, length - first);
+        head = (head + length) % capacity;
+        used += length;
+    }
+
+    void read(size_t offset, uint8_t* out, size_t length) const {
+        size_t first = capacity - offset < length ? capacity - offset : length;
+        memcpy(out, data + offset, first);
+        memcpy(out + first, data, length - first);
+    }
+
+    void dropOldest() {
+        uint8_t header[MESSAGE_RING_HEADER];
+        read(tail, header, MESSAGE_RING_HEADER);
+        size_t length = MESSAGE_RING_HEADER + (header[0] | (size_t)header[1] << 8);
+        tail = (tail + length) % capacity;
+        used -= length;
+        firstSeq++;
+    }
+};
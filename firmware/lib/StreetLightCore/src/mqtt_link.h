@@ -0,0 +1,77 @@
+/*
+ * MQTT link - reconnectMQTT()'s policy and the publish path, shared by the
+ * firmware (PubSubClient) and the host network simulator (netsim/), so a
+ * change here can be measured for its worst-case loop impact before it
+ * ships.
+ *
+ * Client is duck-typed on PubSubClient: connected(), connect(id),
+ * subscribe(topic), publish(topic, data, length), state(). connect() and
+ * publish() block the caller (TCP connect, CONNACK wait, a full send
+ * buffer); everything else here is bookkeeping.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+const unsigned long RECONNECT_INTERVAL_MS = 5000; // One connect attempt per interval while down
+
+struct LinkStats {
+    uint32_t attempts;
+    uint32_t failures;        // connect() returned false
+    uint32_t drops;           // Was up, found down
+    uint32_t publishFailures; // publish() returned false (message goes to the buffer)
+    int lastState;            // Client state() after the last failure
+};
+
+template <typename Client>
+struct MqttLinkT {
+    Client* client;
+    const char* clientId;
+    const char* subscribeTopic;
+    unsigned long lastAttempt;
+    bool up;
+    LinkStats stats;
+
+    void begin(Client* c, const char* id, const char* topic) {
+        client = c;
+        clientId = id;
+        subscribeTopic = topic;
+        lastAttempt = 0;
+        up = false;
+        stats = {};
+    }
+
+    bool connected() {
+        bool now = client->connected();
+        if (up && !now) stats.drops++;
+        up = now;
+        return now;
+    }
+
+    // Down, and the retry interval has passed: claims the attempt
+    bool attemptDue(unsigned long now) {
+        if (connected() || now - lastAttempt <= RECONNECT_INTERVAL_MS) return false;
+        lastAttempt = now;
+        return true;
+    }
+
+    // MQTT CONNECT (plain TCP: the TCP connect too), then the command subscription
+    bool connect() {
+        stats.attempts++;
+        if (client->connect(clientId)) {
+            if (subscribeTopic) client->subscribe(subscribeTopic);
+            up = true;
+            return true;
+        }
+        stats.failures++;
+        stats.lastState = client->state();
+        return false;
+    }
+
+    bool publish(const char* topic, const uint8_t* data, size_t length) {
+        if (!connected()) return false;
+        if (client->publish(topic, data, length)) return true;
+        stats.publishFailures++;
+        return false;
+    }
+};
@@ -0,0 +1,55 @@
+/*
+ * OTA progress - JSON on smartcity/streetlight/<id>/ota while a delta update
+ * runs, e.g. {"boot":..,"st":"download","patch":[41233,78302],"image":[..],..}.
+ * "patch" counts bytes over the air, "image" bytes written to flash.
+ */
+#pragma once
+#include <stdint.h>
+#include <ArduinoJson.h>
+
+const size_t OTA_STATUS_MAX_BYTES = 256;
+
+enum OtaState {
+    OTA_IDLE,
+    OTA_BASE_CHECK, // Hashing the running image against the patch header
+    OTA_DOWNLOAD,   // Fetching and applying the patch
+    OTA_STAGED,     // New image verified and set as boot partition
+    OTA_FAILED,
+};
+
+inline const char* otaStateName(OtaState state) {
+    static const char* const NAMES[] = {"idle", "base_check", "download", "staged", "failed"};
+    return NAMES[state];
+}
+
+struct OtaStatus {
+    OtaState state;
+    uint32_t patchBytes;    // Patch size (from Content-Range), 0 until known
+    uint32_t received;      // Patch bytes applied so far (resume offset)
+    uint32_t imageBytes;    // New image size (patch header)
+    uint32_t written;       // New image bytes written to flash
+    uint32_t requests;      // HTTP range requests issued
+    uint32_t retries;       // ...of which resumed after a failure
+    uint32_t elapsedMs;
+    const char* error;      // Static string, null unless OTA_FAILED
+};
+
+// Returns the payload length, 0 if it did not fit
+inline size_t serializeOtaStatus(uint32_t bootId, const OtaStatus& s, char* buffer, size_t capacity) {
+    StaticJsonDocument<384> doc;
+    doc["boot"] = bootId;
+    doc["st"] = otaStateName(s.state);
+    JsonArray patch = doc.createNestedArray("patch");
+    patch.add(s.received);
+    patch.add(s.patchBytes);
+    JsonArray image = doc.createNestedArray("image");
+    image.add(s.written);
+    image.add(s.imageBytes);
+    doc["req"] = s.requests;
+    doc["retry"] = s.retries;
+    doc["ms"] = s.elapsedMs;
+    if (s.error) doc["err"] = s.error;
+
+    if (measureJson(doc) >= capacity) return 0;
+    return serializeJson(doc, buffer, capacity);
+}
@@ -0,0 +1,63 @@
+/*
+ * Sampling profiler capture - fixed-length buffer filled from a timer ISR,
+ * then uploaded as text lines "<pc> <caller> <task>" (hex, hex, name) that
+ * tools/profile_fold.py symbolizes against the firmware ELF.
+ */
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+
+struct ProfileSample {
+    uint32_t pc;     // Interrupted instruction
+    uint32_t caller; // Return address of the interrupted function (0 if unknown)
+    uint32_t task;   // Task handle, resolved to a name when uploading
+};
+
+// Single producer (ISR) while running, single consumer (loop) once stopped
+struct ProfileBuffer {
+    ProfileSample* samples;
+    uint32_t capacity;
+    volatile uint32_t count;
+    volatile uint32_t dropped;    // Ticks after the buffer filled up
+    volatile uint64_t isrCycles;  // Time spent in the sampling ISR
+
+    void begin(ProfileSample* storage, uint32_t slots) {
+        samples = storage;
+        capacity = storage ? slots : 0;
+        clear();
+    }
+
+    void clear() {
+        count = 0;
+        dropped = 0;
+        isrCycles = 0;
+    }
+
+    inline void push(uint32_t pc, uint32_t caller, uint32_t task) {
+        uint32_t n = count;
+        if (n >= capacity) {
+            dropped = dropped + 1;
+            return;
+        }
+        samples[n].pc = pc;
+        samples[n].caller = caller;
+        samples[n].task = task;
+        count = n + 1;
+    }
+};
+
+// Appends samples [first, first + n) as text lines. taskName maps a task
+// handle to a printable name. Returns the bytes written, 0 if it did not fit.
+template <typename TaskNameFn>
+inline size_t formatProfileLines(const ProfileBuffer& buffer, uint32_t first, uint32_t n, TaskNameFn taskName,
+                                 char* out, size_t capacity) {
+    size_t used = 0;
+    for (uint32_t i = first; i < first + n && i < buffer.count; i++) {
+        const ProfileSample& s = buffer.samples[i];
+        int written = snprintf(out + used, capacity - used, "%08lx %08lx %s\n", (unsigned long)s.pc,
+                               (unsigned long)s.caller, taskName(s.task));
+        if (written < 0 || (size_t)written >= capacity - used) return 0;
+        used += written;
+    }
+    return used;
+}
@@ -0,0 +1,95 @@
+/*
+ * Radio power schedule - WiFi modem sleep between planned publishes.
+ *
+ * Uplink is predictable: heartbeats follow the report scheduler, events are
+ * rare. So the radio sleeps (modem sleep, waking every listenInterval
+ * beacons for buffered downlink) except:
+ * - from RADIO_WAKE_LEAD_MS before a planned heartbeat until
+ *   RADIO_LINGER_MS after it went out (TCP ACKs, replies),
+ * - for RADIO_EVENT_HOLD_MS after an event (fast path: a command that
+ *   reacts to it gets through without waiting for a beacon),
+ * - while the caller forces it awake (link down, OTA download).
+ * Transmitting never waits for a wake: the station leaves power save to
+ * send. What sleep costs is downlink latency, up to listenInterval beacon
+ * periods, and the time accounting below makes that trade visible.
+ */
+#pragma once
+#include <stdint.h>
+
+enum RadioMode { RADIO_AWAKE, RADIO_SLEEP, RADIO_MODE_COUNT };
+
+inline const char* radioModeName(int mode) {
+    static const char* const NAMES[RADIO_MODE_COUNT] = {"awake", "sleep"};
+    return mode >= 0 && mode < RADIO_MODE_COUNT ? NAMES[mode] : "unknown";
+}
+
+const unsigned long RADIO_WAKE_LEAD_MS = 150;     // Awake before a planned heartbeat
+const unsigned long RADIO_LINGER_MS = 100;        // ...and after any publish
+const unsigned long RADIO_EVENT_HOLD_MS = 3000;   // After an event
+const uint8_t RADIO_LISTEN_INTERVAL = 3;          // Beacons (102.4 ms) between wakes while asleep
+const float RADIO_BEACON_PERIOD_MS = 102.4f;
+const float RADIO_BEACON_WAKE_MS = 3.0f;          // Radio on per beacon listened to (estimate)
+
+struct RadioStats {
+    uint8_t mode;                  // RadioMode now
+    uint8_t listenInterval;
+    uint32_t switches;             // Mode changes since boot
+    uint64_t msInMode[RADIO_MODE_COUNT];
+    // Downlink: commands carrying the sender's "ts", against our SNTP clock
+    uint32_t cmdCount;
+    uint32_t cmdLatencyMsTotal;
+    uint32_t cmdLatencyMsMax;
+    uint32_t cmdLatencyMsLast;
+};
+
+// Radio-on time: awake mode, plus the beacon listens while asleep
+inline uint64_t radioOnMsEstimate(const RadioStats& s) {
+    float sleepDuty = RADIO_BEACON_WAKE_MS / (RADIO_BEACON_PERIOD_MS * (s.listenInterval ? s.listenInterval : 1));
+    return s.msInMode[RADIO_AWAKE] + (uint64_t)(s.msInMode[RADIO_SLEEP] * sleepDuty);
+}
+
+struct RadioScheduler {
+    RadioStats stats;
+    unsigned long modeSince;
+    unsigned long holdUntil;
+    bool holding;
+    bool lastChanged;
+
+    void reset(unsigned long now, uint8_t listenInterval = RADIO_LISTEN_INTERVAL) {
+        stats = RadioStats();
+        stats.mode = RADIO_AWAKE; // Association and the first connect run awake
+        stats.listenInterval = listenInterval;
+        modeSince = now;
+        holdUntil = now;
+        holding = false;
+        lastChanged = false;
+    }
+
+    // Keep the radio awake for at least `ms` from now
+    void hold(unsigned long now, unsigned long ms) {
+        if (!holding || (long)(now + ms - holdUntil) > 0) holdUntil = now + ms;
+        holding = true;
+    }
+
+    // Once per loop pass. nextPublishMs: time to the next planned heartbeat.
+    // Returns the mode to apply; lastChanged tells whether it differs.
+    RadioMode update(unsigned long now, unsigned long nextPublishMs, bool forceAwake) {
+        if (holding && (long)(now - holdUntil) >= 0) holding = false;
+        RadioMode mode = (forceAwake || holding || nextPublishMs <= RADIO_WAKE_LEAD_MS) ? RADIO_AWAKE : RADIO_SLEEP;
+        stats.msInMode[stats.mode] += now - modeSince;
+        modeSince = now;
+        lastChanged = mode != stats.mode;
+        if (lastChanged) {
+            stats.mode = mode;
+            stats.switches++;
+        }
+        return mode;
+    }
+
+    void onCommandLatency(uint32_t ms) {
+        stats.cmdCount++;
+        stats.cmdLatencyMsTotal += ms;
+        stats.cmdLatencyMsLast = ms;
+        if (ms > stats.cmdLatencyMsMax) stats.cmdLatencyMsMax = ms;
+    }
+};
@@ -0,0 +1,141 @@
+/*
+ * Binary serial streaming - raw sensor samples for lab capture over USB CDC.
+ *
+ * Each frame is COBS-encoded and ends with a 0x00 delimiter, so a reader
+ * that starts mid-stream (or meets a stray text line) resynchronises at
+ * the next zero. The decoded frame is a payload plus CRC-16/CCITT-FALSE
+ * (little-endian) over it. Sample payload (little-endian):
+ *   u8 kind (STREAM_SAMPLE), u16 seq, u32 micros, u8 ldr, u8 pir, u16 pwm
+ * ldr/pir are the pin levels at sampling time; seq gaps are dropped frames.
+ * Text payload: u8 kind (STREAM_TEXT), up to STREAM_TEXT_MAX bytes of a log
+ * line (the device's human-readable output while it streams).
+ * capture/serial_capture.cpp turns the stream into a sensor trace.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+enum StreamFrameKind : uint8_t {
+    STREAM_SAMPLE = 1,
+    STREAM_TEXT = 2,
+};
+
+const size_t STREAM_SAMPLE_BYTES = 11;
+const size_t STREAM_TEXT_MAX = 96;                   // Longer text is split over frames
+const size_t STREAM_FRAME_MAX = 128;                 // Encoded, delimiter included
+const uint32_t STREAM_DEFAULT_RATE_HZ = 1000;
+
+struct StreamSample {
+    uint16_t seq;
+    uint32_t tUs;
+    uint8_t ldr;
+    uint8_t pir;
+    uint16_t pwm;
+};
+
+// CRC-16/CCITT-FALSE, bitwise: frames are a dozen bytes
+inline uint16_t crc16(const uint8_t* data, size_t length, uint16_t crc = 0xFFFF) {
+    for (size_t i = 0; i < length; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+// COBS: `length` bytes in, at most length + length / 254 + 1 out (no delimiter)
+inline size_t cobsEncode(const uint8_t* in, size_t length, uint8_t* out) {
+    size_t codeAt = 0, o = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < length; i++) {
+        if (in[i]) {
+            out[o++] = in[i];
+            code++;
+        }
+        if (!in[i] || code == 0xFF) {
+            out[codeAt] = code;
+            codeAt = o++;
+            code = 1;
+        }
+    }
+    out[codeAt] = code;
+    return o;
+}
+
+// Returns the decoded length, 0 if malformed (a zero inside, or truncated)
+inline size_t cobsDecode(const uint8_t* in, size_t length, uint8_t* out) {
+    size_t i = 0, o = 0;
+    while (i < length) {
+        uint8_t code = in[i++];
+        if (!code || i + code - 1 > length) return 0;
+        for (uint8_t k = 1; k < code; k++) {
+            if (!in[i]) return 0;
+            out[o++] = in[i++];
+        }
+        if (code != 0xFF && i < length) out[o++] = 0;
+    }
+    return o;
+}
+
+// Sample -> complete frame (COBS + delimiter); returns its length
+inline size_t encodeStreamSample(const StreamSample& s, uint8_t* out) {
+    uint8_t raw[STREAM_SAMPLE_BYTES + 2];
+    uint8_t* p = raw;
+    *p++ = STREAM_SAMPLE;
+    *p++ = s.seq;
+    *p++ = s.seq >> 8;
+    for (int i = 0; i < 4; i++) *p++ = s.tUs >> (8 * i);
+    *p++ = s.ldr;
+    *p++ = s.pir;
+    *p++ = s.pwm;
+    *p++ = s.pwm >> 8;
+    uint16_t crc = crc16(raw, STREAM_SAMPLE_BYTES);
+    *p++ = crc;
+    *p++ = crc >> 8;
+    size_t length = cobsEncode(raw, sizeof(raw), out);
+    out[length++] = 0;
+    return length;
+}
+
+// Up to STREAM_TEXT_MAX bytes of text -> complete frame; returns its length
+inline size_t encodeStreamText(const char* text, size_t length, uint8_t* out) {
+    uint8_t raw[1 + STREAM_TEXT_MAX + 2];
+    if (length > STREAM_TEXT_MAX) length = STREAM_TEXT_MAX;
+    raw[0] = STREAM_TEXT;
+    memcpy(raw + 1, text, length);
+    uint16_t crc = crc16(raw, 1 + length);
+    raw[1 + length] = crc;
+    raw[2 + length] = crc >> 8;
+    size_t n = cobsEncode(raw, length + 3, out);
+    out[n++] = 0;
+    return n;
+}
+
+enum StreamDecodeResult { STREAM_OK, STREAM_TEXT_OK, STREAM_BAD_FRAME, STREAM_BAD_CRC, STREAM_UNKNOWN_KIND };
+
+// One frame without its delimiter. A text frame fills `text` (NUL-terminated,
+// when given) and returns STREAM_TEXT_OK.
+inline StreamDecodeResult decodeStreamFrame(const uint8_t* frame, size_t length, StreamSample& out,
+                                            char* text = nullptr, size_t textCapacity = 0) {
+    uint8_t raw[STREAM_FRAME_MAX];
+    if (length > sizeof(raw)) return STREAM_BAD_FRAME;
+    size_t n = cobsDecode(frame, length, raw);
+    if (n < 3) return STREAM_BAD_FRAME;
+    if (crc16(raw, n - 2) != (uint16_t)(raw[n - 2] | raw[n - 1] << 8)) return STREAM_BAD_CRC;
+    if (raw[0] == STREAM_TEXT) {
+        if (text && textCapacity) {
+            size_t copy = n - 3 < textCapacity - 1 ? n - 3 : textCapacity - 1;
+            memcpy(text, raw + 1, copy);
+            text[copy] = '\0';
+        }
+        return STREAM_TEXT_OK;
+    }
+    if (raw[0] != STREAM_SAMPLE) return STREAM_UNKNOWN_KIND;
+    if (n != STREAM_SAMPLE_BYTES + 2) return STREAM_BAD_FRAME;
+    out.seq = raw[1] | raw[2] << 8;
+    out.tUs = (uint32_t)raw[3] | (uint32_t)raw[4] << 8 | (uint32_t)raw[5] << 16 | (uint32_t)raw[6] << 24;
+    out.ldr = raw[7];
+    out.pir = raw[8];
+    out.pwm = raw[9] | raw[10] << 8;
+    return STREAM_OK;
+}
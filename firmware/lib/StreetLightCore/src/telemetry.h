@@ -0,0 +1,139 @@
+/*
+ * Telemetry payload - one sample per message, serialized straight into a
+ * caller-owned buffer (no heap String per message). A multi-head board
+ * sends one message for all heads: the top-level fields are the "any head"
+ * view (power is the total), "heads" has the hold bitmask and each PWM.
+ */
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <ArduinoJson.h>
+#include "light_control.h"
+#include "channel_bank.h"
+#include "checkpoint.h"
+#include "loop_slo.h"
+
+const size_t TELEMETRY_MAX_BYTES = 640; // Boot message with 8 heads: ~560
+const size_t TELEMETRY_JSON_CAPACITY = 1024;
+
+// Motion-path latency offsets (micros relative to the PIR edge)
+struct TelemetryTrace {
+    uint32_t decisionUs;
+    uint32_t pwmUs;
+    uint32_t publishUs;
+    uint64_t publishEpochMs; // 0 until SNTP has synced
+};
+
+// Clock sync quality, attached to heartbeats
+struct TelemetryClock {
+    uint32_t syncCount;
+    uint32_t lastSyncAgeS;
+    int32_t lastCorrectionMs;
+    float driftPpm;
+};
+
+// Boot timeline (micros since reset, 0 = phase not reached yet), first message only
+struct TelemetryBoot {
+    uint8_t resetReason;    // esp_reset_reason()
+    uint32_t setupUs;       // setup() entered
+    uint32_t pwmUs;         // First PWM write at the decided level
+    uint32_t setupDoneUs;   // setup() returned
+    uint32_t wifiUs;        // WiFi associated
+    uint32_t mqttUs;        // MQTT connected
+    uint32_t sntpUs;        // First SNTP sync
+    uint32_t bootCount;     // Boots since power-on (RTC checkpoint)
+    RestoreStatus restore;
+    bool restoredNight;     // Restored state, RESTORE_OK only
+    int restoredLdr;
+    long restoredHoldS;     // Motion hold left after restore
+    int wdtStage;           // Loop stage that stalled into a task-WDT reset, -1 if none
+};
+
+struct TelemetrySample {
+    MessageClass msgClass;
+    uint32_t bootId;
+    uint32_t seq;
+    uint64_t captureEpochMs; // 0 until SNTP has synced
+    uint64_t captureMonoUs;
+    LightOutput out;
+    int rawLdr;              // Latest digital LDR reading (ldr = window sum)
+    bool hasTrace;
+    TelemetryTrace trace;
+    bool hasClock;
+    TelemetryClock clock;
+    bool hasBoot;
+    TelemetryBoot boot;
+    const ChannelBank* heads; // Multi-head boards only (count > 1)
+};
+
+// Returns the payload length, 0 if it did not fit. doc is scratch space
+// (cleared here), so a caller can keep one off the stack
+inline size_t serializeTelemetry(const TelemetrySample& s, JsonDocument& doc, char* buffer, size_t capacity) {
+    doc.clear();
+    doc["ldr"] = s.out.smoothedLdr;
+    doc["motion"] = s.out.isMotionActive ? 1 : 0;
+    doc["brightness"] = brightnessPercent(s.out.pwm);
+    doc["night"] = s.out.isNight ? 1 : 0;
+    doc["raw"] = s.rawLdr;
+    bool multiHead = s.heads && s.heads->count > 1;
+    doc["power"] = multiHead ? s.heads->powerW() : pwmToPower(s.out.pwm);
+    doc["class"] = (s.msgClass == MSG_EVENT) ? "event" : "heartbeat";
+    doc["boot"] = s.bootId;
+    doc["seq"] = s.seq;
+
+    // Capture time: SNTP epoch ms when synced, always the monotonic ms since boot
+    if (s.captureEpochMs) doc["ts"] = s.captureEpochMs;
+    doc["mono"] = s.captureMonoUs / 1000;
+
+    if (multiHead) {
+        JsonObject heads = doc.createNestedObject("heads");
+        heads["on"] = s.heads->activeMask;
+        JsonArray pwm = heads.createNestedArray("pwm");
+        for (int i = 0; i < s.heads->count; i++) pwm.add(s.heads->pwm[i]);
+    }
+
+    if (s.hasClock) {
+        JsonObject clock = doc.createNestedObject("clk");
+        clock["sync"] = s.clock.syncCount;
+        clock["age"] = s.clock.lastSyncAgeS;
+        clock["corr"] = s.clock.lastCorrectionMs;
+        clock["ppm"] = s.clock.driftPpm;
+    }
+
+    if (s.hasTrace) {
+        JsonObject trace = doc.createNestedObject("trace");
+        trace["dec"] = s.trace.decisionUs;
+        trace["pwm"] = s.trace.pwmUs;
+        trace["pub"] = s.trace.publishUs;
+        if (s.trace.publishEpochMs) trace["t"] = s.trace.publishEpochMs;
+    }
+
+    if (s.hasBoot) {
+        JsonObject boot = doc.createNestedObject("boot_tl");
+        boot["rst"] = s.boot.resetReason;
+        boot["setup"] = s.boot.setupUs;
+        boot["pwm"] = s.boot.pwmUs;
+        boot["ready"] = s.boot.setupDoneUs;
+        if (s.boot.wifiUs) boot["wifi"] = s.boot.wifiUs;
+        if (s.boot.mqttUs) boot["mqtt"] = s.boot.mqttUs;
+        if (s.boot.sntpUs) boot["sntp"] = s.boot.sntpUs;
+        if (s.boot.wdtStage >= 0) boot["wdt"] = loopStageName(s.boot.wdtStage);
+
+        JsonObject rtc = boot.createNestedObject("rtc");
+        rtc["n"] = s.boot.bootCount;
+        rtc["st"] = s.boot.restore == RESTORE_OK ? "ok" : (s.boot.restore == RESTORE_INVALID ? "invalid" : "cold");
+        if (s.boot.restore == RESTORE_OK) {
+            rtc["night"] = s.boot.restoredNight ? 1 : 0;
+            rtc["ldr"] = s.boot.restoredLdr;
+            rtc["hold"] = s.boot.restoredHoldS;
+        }
+    }
+
+    if (measureJson(doc) >= capacity) return 0;
+    return serializeJson(doc, buffer, capacity);
+}
+
+inline size_t serializeTelemetry(const TelemetrySample& s, char* buffer, size_t capacity) {
+    StaticJsonDocument<TELEMETRY_JSON_CAPACITY> doc;
+    return serializeTelemetry(s, doc, buffer, capacity);
+}
@@ -0,0 +1,71 @@
+/*
+ * Telemetry transport - MQTT live, HTTP bulk upload as the fallback.
+ *
+ * New messages go out over MQTT while it is the active transport and
+ * connected; otherwise they are buffered (message_ring.h). MQTT down for
+ * TRANSPORT_FAILOVER_MS makes HTTP active: the buffer is then uploaded in
+ * compressed batches. Until MQTT has connected once its state is unknown
+ * (association, SNTP and the first handshake are still running), so at
+ * boot only TRANSPORT_BOOT_GRACE_MS without a connection fails over. MQTT back and stable for TRANSPORT_FAILBACK_MS makes
+ * it active again (a flapping link does not bounce between the two), and
+ * whatever is still buffered drains over MQTT.
+ */
+#pragma once
+#include <stdint.h>
+
+enum Transport { TRANSPORT_MQTT, TRANSPORT_HTTP, TRANSPORT_COUNT };
+
+inline const char* transportName(int transport) {
+    static const char* const NAMES[TRANSPORT_COUNT] = {"mqtt", "http"};
+    return transport >= 0 && transport < TRANSPORT_COUNT ? NAMES[transport] : "unknown";
+}
+
+const unsigned long TRANSPORT_FAILOVER_MS = 30000;
+const unsigned long TRANSPORT_FAILBACK_MS = 60000;
+const unsigned long TRANSPORT_BOOT_GRACE_MS = 120000;
+
+enum MqttLinkState { MQTT_STATE_UNKNOWN, MQTT_STATE_DOWN, MQTT_STATE_UP };
+
+struct TransportSelector {
+    Transport active;
+    MqttLinkState mqtt;   // Unknown until the first connect
+    unsigned long since;  // Last MQTT state change (boot while unknown)
+    uint32_t failovers;
+
+    void reset(unsigned long now) {
+        active = TRANSPORT_MQTT;
+        mqtt = MQTT_STATE_UNKNOWN;
+        since = now;
+        failovers = 0;
+    }
+
+    Transport update(unsigned long now, bool mqttConnected) {
+        MqttLinkState seen = mqttConnected ? MQTT_STATE_UP
+                             : mqtt == MQTT_STATE_UNKNOWN ? MQTT_STATE_UNKNOWN : MQTT_STATE_DOWN;
+        if (seen != mqtt) {
+            mqtt = seen;
+            since = now;
+        }
+        unsigned long downLimit = mqtt == MQTT_STATE_UNKNOWN ? TRANSPORT_BOOT_GRACE_MS : TRANSPORT_FAILOVER_MS;
+        if (active == TRANSPORT_MQTT && mqtt != MQTT_STATE_UP && now - since >= downLimit) {
+            active = TRANSPORT_HTTP;
+            failovers++;
+        } else if (active == TRANSPORT_HTTP && mqtt == MQTT_STATE_UP && now - since >= TRANSPORT_FAILBACK_MS) {
+            active = TRANSPORT_MQTT;
+        }
+        return active;
+    }
+};
+
+// Reported in diagnostics
+struct UploadStats {
+    uint8_t transport;   // Transport active now
+    uint32_t failovers;
+    uint32_t queued;     // Messages buffered now
+    uint32_t dropped;    // Overwritten in the buffer (oldest first)
+    uint32_t sent;       // Delivered from the buffer, either transport
+    uint32_t batches;    // HTTP POSTs that succeeded
+    uint32_t failures;   // ...that did not
+    uint32_t rawBytes;   // Batch bytes before/after compression
+    uint32_t wireBytes;
+};
@@ -0,0 +1,339 @@
+/*
+ * Network impairment simulator - control-loop jitter and telemetry loss
+ * while the MQTT/WiFi path misbehaves.
+ *
+ *   pio run -e native_netsim
+ *   .pio/build/native_netsim/program                      # all presets
+ *   .pio/build/native_netsim/program --scenario=flaky_street --hours=24
+ *   .pio/build/native_netsim/program --loss=0.05 --half-open=2 --refuse=0.3 \
+ *       --dns --dns-fail=0.2 --outages=4 --outage-s=90 --rtt=80 --jitter=200
+ *
+ * Replays loop() on a virtual clock at one pass per millisecond: the
+ * network section runs reconnectMQTT()'s policy and the telemetry publish
+ * through the firmware's own MqttLinkT (mqtt_link.h) against
+ * SimMqttClient (sim_network.h), whose blocking calls advance the clock.
+ * Control, reporting and the store-and-forward buffer use the core code;
+ * the HTTP fallback task (core 0, never in the loop) is modelled as
+ * draining the buffer whenever HTTP is active and WiFi is up.
+ *
+ * Per scenario: control-step gaps (p50/p99/max, SLO violations per hour
+ * blamed on the stage that ran, gaps past the watchdog hard limit that
+ * would reset the device), telemetry delivered live or from the buffer,
+ * lost silently into half-open sockets, thinned, or overwritten, and the
+ * share of time the RadioScheduler (radio_schedule.h) keeps WiFi awake.
+ * Keep the replica in step with loop() (see loop_runner.h).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "light_control.h"
+#include "loop_slo.h"
+#include "message_ring.h"
+#include "mqtt_link.h"
+#include "radio_schedule.h"
+#include "transport.h"
+#include "sensor_trace.h"
+#include "sim_network.h"
+
+// Firmware defaults (loop_watchdog.h, http_uploader.h)
+const uint32_t LOOP_BUDGET_MS = 20;
+const uint32_t LOOP_HARD_LIMIT_MS = 5000;
+const size_t UPLOAD_BUFFER_BYTES = 32768;
+const unsigned long UPLOAD_HEARTBEAT_THIN_MS = 30000;
+const size_t SIM_MESSAGE_BYTES = 200;       // Typical serialized telemetry
+const uint32_t GAP_HISTOGRAM_MS = 60000;    // 1 ms buckets, longer gaps land in the last
+
+struct Scenario {
+    const char* name;
+    NetImpairment imp;
+};
+
+struct Delivery {
+    uint32_t generated[2];  // [heartbeat, event]
+    uint32_t live;
+    uint32_t backlogMqtt;
+    uint32_t backlogHttp;
+    uint32_t thinned;       // Heartbeats not buffered (one per UPLOAD_HEARTBEAT_THIN_MS)
+};
+
+struct RunResult {
+    LoopSlo slo;
+    std::vector<uint64_t> gaps;
+    uint64_t steps;
+    uint32_t wdtTrips;
+    Delivery tx;
+    uint32_t silentlyLost;
+    uint32_t overwritten;
+    uint32_t queuedAtEnd;
+    LinkStats link;
+    uint32_t failovers;
+    RadioStats radio;
+};
+
+static uint32_t percentileMs(const std::vector<uint64_t>& histogram, uint64_t total, double p) {
+    uint64_t target = (uint64_t)(total * p), seen = 0;
+    for (size_t ms = 0; ms < histogram.size(); ms++) {
+        seen += histogram[ms];
+        if (seen > target) return (uint32_t)ms;
+    }
+    return (uint32_t)histogram.size();
+}
+
+static void buildNight(SensorTrace& trace, uint32_t durationMs, uint32_t seed) {
+    TraceRng rng = {seed};
+    trace.durationMs = durationMs;
+    trace.events.push_back({0, 1, 0});
+    addPedestrians(trace, rng, 0, durationMs, 45000.0);
+    sortTrace(trace);
+}
+
+static RunResult run(const Scenario& scenario, const SensorTrace& trace, uint32_t seed) {
+    RunResult r = {};
+    r.gaps.assign(GAP_HISTOGRAM_MS + 1, 0);
+    SimClock clock = {0};
+    SimNetwork net;
+    net.begin(scenario.imp, &clock, seed);
+    SimMqttClient client;
+    client.begin(&net);
+    MqttLinkT<SimMqttClient> link;
+    link.begin(&client, "streetlight-sim", "command");
+    SimBrokerLookup broker;
+    broker.begin(&net);
+
+    LightControllerT<DefaultPolicy> controller;
+    controller.reset();
+    TransportSelector selector;
+    selector.reset(0);
+    static uint8_t storage[UPLOAD_BUFFER_BYTES];
+    MessageRing ring;
+    ring.begin(storage, sizeof(storage));
+    bool heartbeatQueued = false;
+    unsigned long lastHeartbeatQueued = 0;
+    r.slo.begin(LOOP_BUDGET_MS * 1000, 0);
+    RadioScheduler radio;
+    radio.reset(0);
+
+    uint8_t message[SIM_MESSAGE_BYTES];
+    memset(message, 'x', sizeof(message));
+    int ldrLevel = 0;
+    bool motionFlag = false;
+    size_t next = 0;
+    uint32_t lastStepUs = 0;
+
+    while (clock.ms() <= trace.durationMs) {
+        clock.advanceMs(1);
+        uint32_t now = clock.ms();
+        while (next < trace.events.size() && trace.events[next].tMs <= now) {
+            const TraceEvent& e = trace.events[next++];
+            if (e.ldr >= 0) ldrLevel = e.ldr;
+            if (e.pir) motionFlag = true;
+        }
+
+        // === NETWORKING (reconnectMQTT(), plain TCP) ===
+        r.slo.mark(STAGE_WIFI);
+        if (net.wifiUp()) {
+            if (!link.connected() && !broker.busy() && (broker.done() || link.attemptDue(now))) {
+                if (!broker.known) {
+                    broker.start();
+                } else {
+                    r.slo.mark(STAGE_MQTT_CONNECT);
+                    if (!link.connect()) broker.forget();
+                    r.slo.poll((uint32_t)clock.us); // The SLO monitor sees the loop stuck here
+                }
+            }
+            if (link.connected()) {
+                r.slo.mark(STAGE_MQTT_LOOP);
+                client.loop();
+                r.slo.poll((uint32_t)clock.us);
+            }
+        }
+        Transport transport = selector.update(clock.ms(), client.connected());
+
+        // === LDR, MOTION, CONTROL ===
+        r.slo.mark(STAGE_LDR);
+        now = clock.ms();
+        if (now <= 1) controller.primeLdr(now, ldrLevel);
+        else if (controller.ldrDue(now)) controller.sampleLdr(now, ldrLevel);
+        if (motionFlag) {
+            motionFlag = false;
+            controller.onMotion(now);
+        }
+        r.slo.mark(STAGE_CONTROL);
+        LightOutput out = controller.evaluate(now);
+        uint32_t stepUs = (uint32_t)clock.us;
+        r.slo.step(stepUs, now);
+        uint32_t gapUs = stepUs - lastStepUs;
+        lastStepUs = stepUs;
+        r.gaps[gapUs / 1000 < GAP_HISTOGRAM_MS ? gapUs / 1000 : GAP_HISTOGRAM_MS]++;
+        if (gapUs > LOOP_HARD_LIMIT_MS * 1000) r.wdtTrips++;
+        r.steps++;
+
+        // === REPORTING (sendTelemetry() / backlog drain) ===
+        r.slo.mark(STAGE_REPORT);
+        MessageClass msg = controller.report.due(now, out);
+        if (msg != MSG_NONE) {
+            r.slo.mark(STAGE_PUBLISH);
+            r.tx.generated[msg == MSG_EVENT]++;
+            bool live = transport == TRANSPORT_MQTT && link.connected();
+            uint32_t before = client.delivered;
+            bool sent = live && link.publish("data", message, sizeof(message));
+            r.slo.poll((uint32_t)clock.us);
+            if (sent) {
+                if (client.delivered != before) r.tx.live++;
+            } else if (msg == MSG_HEARTBEAT && heartbeatQueued && now - lastHeartbeatQueued < UPLOAD_HEARTBEAT_THIN_MS) {
+                r.tx.thinned++;
+            } else {
+                if (msg == MSG_HEARTBEAT) {
+                    heartbeatQueued = true;
+                    lastHeartbeatQueued = now;
+                }
+                ring.push(message, sizeof(message));
+            }
+        } else if (transport == TRANSPORT_MQTT && link.connected() && !ring.empty()) {
+            r.slo.mark(STAGE_PUBLISH);
+            uint32_t before = client.delivered;
+            bool sent = link.publish("data", message, sizeof(message));
+            r.slo.poll((uint32_t)clock.us);
+            if (sent) {
+                ring.pop(ring.firstSeq + 1);
+                if (client.delivered != before) r.tx.backlogMqtt++;
+            }
+        }
+        if (msg == MSG_EVENT) radio.hold(now, RADIO_EVENT_HOLD_MS);
+        if (msg != MSG_NONE) radio.hold(now, RADIO_LINGER_MS);
+        radio.update(now, controller.report.heartbeatInMs(now), !client.connected());
+        // HTTP fallback task (core 0): drains while HTTP is active and WiFi is up
+        if (transport == TRANSPORT_HTTP && net.wifiUp() && !ring.empty()) {
+            r.tx.backlogHttp += ring.count();
+            ring.pop(ring.nextSeq);
+        }
+        r.slo.mark(STAGE_IDLE);
+    }
+
+    r.silentlyLost = client.silentlyLost;
+    r.overwritten = ring.dropped;
+    r.queuedAtEnd = ring.count();
+    r.link = link.stats;
+    r.failovers = selector.failovers;
+    r.radio = radio.stats;
+    return r;
+}
+
+static void printResult(const Scenario& scenario, const RunResult& r, double hours) {
+    uint32_t generated = r.tx.generated[0] + r.tx.generated[1];
+    uint32_t delivered = r.tx.live + r.tx.backlogMqtt + r.tx.backlogHttp;
+    printf("%-14s %6u %6u %8u %9.1f %5u   %7u %6.2f%% %6u %6u %6u %6u   %5u %5u %5u %4u\n", scenario.name,
+           percentileMs(r.gaps, r.steps, 0.5), percentileMs(r.gaps, r.steps, 0.99), r.slo.maxGapUs / 1000,
+           r.slo.violations / hours, r.wdtTrips, generated, generated ? 100.0 * (generated - delivered) / generated : 0.0,
+           r.silentlyLost, r.overwritten, r.tx.thinned, r.queuedAtEnd, r.link.attempts, r.link.failures, r.link.drops,
+           r.failovers);
+    printf("  slo by stage:");
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        if (r.slo.byStage[s]) printf(" %s=%u", loopStageName(s), r.slo.byStage[s]);
+    }
+    printf("  (worst: %s)\n", r.slo.violations ? loopStageName(r.slo.maxGapStage) : "-");
+    uint64_t totalMs = r.radio.msInMode[RADIO_AWAKE] + r.radio.msInMode[RADIO_SLEEP];
+    if (totalMs) {
+        printf("  radio: awake %.1f%%, on ~%.1f%% (listen interval %u), %.0f switches/h\n",
+               100.0 * r.radio.msInMode[RADIO_AWAKE] / totalMs, 100.0 * radioOnMsEstimate(r.radio) / totalMs,
+               r.radio.listenInterval, r.radio.switches / hours);
+    }
+}
+
+static std::vector<Scenario> presets() {
+    std::vector<Scenario> list;
+    NetImpairment clean;
+    list.push_back({"clean", clean});
+    NetImpairment lossy;
+    lossy.loss = 0.05;
+    lossy.rttMs = 80;
+    lossy.jitterMs = 150;
+    list.push_back({"lossy", lossy});
+    NetImpairment halfOpen;
+    halfOpen.halfOpenPerHour = 2;
+    list.push_back({"half_open", halfOpen});
+    NetImpairment refused;
+    refused.refuse = 0.5;
+    refused.outagesPerHour = 1;
+    refused.outageMeanS = 30;
+    list.push_back({"broker_refuse", refused});
+    NetImpairment dns;
+    dns.dns = true;
+    dns.dnsFail = 0.3;
+    dns.outagesPerHour = 2;
+    list.push_back({"dns_fail", dns});
+    NetImpairment street;
+    street.loss = 0.03;
+    street.rttMs = 60;
+    street.jitterMs = 250;
+    street.halfOpenPerHour = 1;
+    street.refuse = 0.1;
+    street.dns = true;
+    street.dnsFail = 0.1;
+    street.outagesPerHour = 3;
+    street.outageMeanS = 90;
+    list.push_back({"flaky_street", street});
+    return list;
+}
+
+static void usage() {
+    printf("netsim [--scenario=NAME] [--hours=H] [--seed=N]\n"
+           "       [--rtt=MS] [--jitter=MS] [--loss=P] [--refuse=P] [--dns] [--dns-fail=P]\n"
+           "       [--half-open=PER_HOUR] [--outages=PER_HOUR] [--outage-s=MEAN]\n"
+           "presets:");
+    for (const Scenario& s : presets()) printf(" %s", s.name);
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    double hours = 6;
+    uint32_t seed = 0x5EED;
+    const char* only = nullptr;
+    NetImpairment custom;
+    bool isCustom = false;
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        if (strncmp(a, "--scenario=", 11) == 0) only = a + 11;
+        else if (strncmp(a, "--hours=", 8) == 0) hours = atof(a + 8);
+        else if (strncmp(a, "--seed=", 7) == 0) seed = (uint32_t)strtoul(a + 7, nullptr, 0);
+        else if (strncmp(a, "--rtt=", 6) == 0) custom.rttMs = (uint32_t)atol(a + 6), isCustom = true;
+        else if (strncmp(a, "--jitter=", 9) == 0) custom.jitterMs = (uint32_t)atol(a + 9), isCustom = true;
+        else if (strncmp(a, "--loss=", 7) == 0) custom.loss = atof(a + 7), isCustom = true;
+        else if (strncmp(a, "--refuse=", 9) == 0) custom.refuse = atof(a + 9), isCustom = true;
+        else if (strcmp(a, "--dns") == 0) custom.dns = isCustom = true;
+        else if (strncmp(a, "--dns-fail=", 11) == 0) custom.dnsFail = atof(a + 11), custom.dns = isCustom = true;
+        else if (strncmp(a, "--half-open=", 12) == 0) custom.halfOpenPerHour = atof(a + 12), isCustom = true;
+        else if (strncmp(a, "--outages=", 10) == 0) custom.outagesPerHour = atof(a + 10), isCustom = true;
+        else if (strncmp(a, "--outage-s=", 11) == 0) custom.outageMeanS = (uint32_t)atol(a + 11), isCustom = true;
+        else {
+            usage();
+            return strcmp(a, "--help") == 0 ? 0 : 1;
+        }
+    }
+
+    std::vector<Scenario> scenarios;
+    if (isCustom) {
+        scenarios.push_back({"custom", custom});
+    } else {
+        for (const Scenario& s : presets()) {
+            if (!only || strcmp(only, s.name) == 0) scenarios.push_back(s);
+        }
+        if (scenarios.empty()) {
+            usage();
+            return 1;
+        }
+    }
+
+    SensorTrace trace = {"night", 0, {}};
+    buildNight(trace, (uint32_t)(hours * 3600000.0), seed);
+
+    printf("%.1f h of night traffic per scenario, loop budget %u ms, watchdog %u ms\n", hours, LOOP_BUDGET_MS,
+           LOOP_HARD_LIMIT_MS);
+    printf("%-14s %6s %6s %8s %9s %5s   %7s %7s %6s %6s %6s %6s   %5s %5s %5s %4s\n", "scenario", "p50ms", "p99ms",
+           "max_ms", "slo/h", "wdt", "msgs", "undeliv", "silent", "overwr", "thin", "queued", "conn", "fail", "drop",
+           "fo");
+    for (const Scenario& s : scenarios) printResult(s, run(s, trace, seed), hours);
+    return 0;
+}
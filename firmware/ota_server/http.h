@@ -0,0 +1,277 @@
+/*
+ * Minimal HTTP/1.1 over POSIX sockets for the OTA server and its simulated
+ * devices: one request per connection (the device's HTTPClient closes after
+ * each), GET only, single "bytes=a-b" ranges.
+ */
+#pragma once
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+
+const size_t HTTP_MAX_HEADER_BYTES = 8192;
+
+struct HttpRequest {
+    std::string path;                         // Without the query
+    std::map<std::string, std::string> query; // Decoded ?a=b&c=d
+    bool hasRange = false;
+    uint64_t rangeFirst = 0;
+    uint64_t rangeLast = UINT64_MAX;          // Inclusive; open-ended "bytes=a-"
+};
+
+struct HttpResponse {
+    int status = 404;
+    std::string contentType = "text/plain";
+    std::string body;
+    // Alternatively a byte range of a resource that outlives the response
+    const uint8_t* data = nullptr;
+    uint64_t dataSize = 0;
+    uint64_t totalSize = 0;                   // For Content-Range on 206
+    uint64_t rangeFirst = 0;
+};
+
+typedef std::function<void(const HttpRequest&, HttpResponse&)> HttpHandler;
+
+inline const char* httpReason(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 416: return "Range Not Satisfiable";
+    default: return "Error";
+    }
+}
+
+inline std::string urlDecode(const std::string& s) {
+    std::string out;
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '%' && i + 2 < s.size()) {
+            out += (char)strtol(s.substr(i + 1, 2).c_str(), nullptr, 16);
+            i += 2;
+        } else {
+            out += s[i] == '+' ? ' ' : s[i];
+        }
+    }
+    return out;
+}
+
+inline bool sendAll(int fd, const void* data, size_t length) {
+    const char* p = (const char*)data;
+    while (length) {
+        ssize_t n = send(fd, p, length, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+// Reads up to the blank line; leftover body bytes stay in `rest`
+inline bool readHead(int fd, std::string& head, std::string& rest) {
+    char buffer[2048];
+    std::string data;
+    size_t end;
+    while ((end = data.find("\r\n\r\n")) == std::string::npos) {
+        if (data.size() > HTTP_MAX_HEADER_BYTES) return false;
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) return false;
+        data.append(buffer, n);
+    }
+    head = data.substr(0, end + 2);
+    rest = data.substr(end + 4);
+    return true;
+}
+
+inline std::string headerValue(const std::string& head, const char* name) {
+    size_t nameLen = strlen(name);
+    size_t pos = head.find("\r\n");
+    while (pos != std::string::npos && pos + 2 < head.size()) {
+        size_t lineEnd = head.find("\r\n", pos + 2);
+        std::string line = head.substr(pos + 2, lineEnd - pos - 2);
+        if (line.size() > nameLen && strncasecmp(line.c_str(), name, nameLen) == 0 && line[nameLen] == ':') {
+            size_t v = line.find_first_not_of(' ', nameLen + 1);
+            return v == std::string::npos ? "" : line.substr(v);
+        }
+        pos = lineEnd;
+    }
+    return "";
+}
+
+inline bool parseRequest(const std::string& head, HttpRequest& req) {
+    char method[8], target[1024];
+    if (sscanf(head.c_str(), "%7s %1023s", method, target) != 2 || strcmp(method, "GET") != 0) return false;
+    std::string t = target;
+    size_t q = t.find('?');
+    req.path = t.substr(0, q);
+    if (q != std::string::npos) {
+        std::string query = t.substr(q + 1);
+        size_t start = 0;
+        while (start <= query.size()) {
+            size_t amp = query.find('&', start);
+            std::string pair = query.substr(start, amp == std::string::npos ? std::string::npos : amp - start);
+            size_t eq = pair.find('=');
+            if (!pair.empty()) req.query[urlDecode(pair.substr(0, eq))] = eq == std::string::npos ? "" : urlDecode(pair.substr(eq + 1));
+            if (amp == std::string::npos) break;
+            start = amp + 1;
+        }
+    }
+    std::string range = headerValue(head, "Range");
+    unsigned long long first, last;
+    if (sscanf(range.c_str(), "bytes=%llu-%llu", &first, &last) == 2) {
+        req.hasRange = true;
+        req.rangeFirst = first;
+        req.rangeLast = last;
+    } else if (sscanf(range.c_str(), "bytes=%llu-", &first) == 1) {
+        req.hasRange = true;
+        req.rangeFirst = first;
+    }
+    return true;
+}
+
+// Serves `data` (size `total`) honouring the request's range
+inline void serveBytes(const HttpRequest& req, const uint8_t* data, uint64_t total, HttpResponse& res) {
+    res.contentType = "application/octet-stream";
+    res.totalSize = total;
+    if (!req.hasRange) {
+        res.status = 200;
+        res.data = data;
+        res.dataSize = total;
+        return;
+    }
+    if (req.rangeFirst >= total || req.rangeLast < req.rangeFirst) {
+        res.status = 416;
+        return;
+    }
+    uint64_t last = req.rangeLast < total ? req.rangeLast : total - 1;
+    res.status = 206;
+    res.rangeFirst = req.rangeFirst;
+    res.data = data + req.rangeFirst;
+    res.dataSize = last - req.rangeFirst + 1;
+}
+
+inline void writeResponse(int fd, const HttpResponse& res) {
+    char head[512];
+    uint64_t length = res.data ? res.dataSize : res.body.size();
+    int n = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %llu\r\n"
+                     "Accept-Ranges: bytes\r\nConnection: close\r\n",
+                     res.status, httpReason(res.status), res.contentType.c_str(), (unsigned long long)length);
+    if (res.status == 206) {
+        n += snprintf(head + n, sizeof(head) - n, "Content-Range: bytes %llu-%llu/%llu\r\n",
+                      (unsigned long long)res.rangeFirst, (unsigned long long)(res.rangeFirst + length - 1),
+                      (unsigned long long)res.totalSize);
+    } else if (res.status == 416) {
+        n += snprintf(head + n, sizeof(head) - n, "Content-Range: bytes */%llu\r\n", (unsigned long long)res.totalSize);
+    }
+    n += snprintf(head + n, sizeof(head) - n, "\r\n");
+    if (!sendAll(fd, head, n)) return;
+    if (res.status == 204) return;
+    if (res.data) sendAll(fd, res.data, (size_t)res.dataSize);
+    else sendAll(fd, res.body.data(), res.body.size());
+}
+
+// Accepts on 127.0.0.1/0.0.0.0:port, one thread per connection
+class HttpServer {
+public:
+    bool listen(uint16_t port, bool loopbackOnly) {
+        fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(loopbackOnly ? INADDR_LOOPBACK : INADDR_ANY);
+        if (bind(fd_, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(fd_, 512) != 0) {
+            perror("listen");
+            return false;
+        }
+        socklen_t len = sizeof(addr);
+        getsockname(fd_, (sockaddr*)&addr, &len);
+        port_ = ntohs(addr.sin_port);
+        return true;
+    }
+
+    uint16_t port() const { return port_; }
+
+    // Blocks; run on its own thread for the simulation
+    void serve(const HttpHandler& handler) {
+        for (;;) {
+            int client = accept(fd_, nullptr, nullptr);
+            if (client < 0) continue;
+            std::thread([client, handler] {
+                std::string head, rest;
+                HttpRequest req;
+                HttpResponse res;
+                if (!readHead(client, head, rest) || !parseRequest(head, req)) {
+                    res.status = 400;
+                } else {
+                    handler(req, res);
+                }
+                writeResponse(client, res);
+                close(client);
+            }).detach();
+        }
+    }
+
+private:
+    int fd_ = -1;
+    uint16_t port_ = 0;
+};
+
+// === CLIENT (simulated devices) ===
+struct HttpResult {
+    int status = 0;
+    std::string head;
+    std::string body;
+    bool complete = false; // Body matched Content-Length
+};
+
+// GET http://127.0.0.1:<port><target>. rangeFirst < 0: no Range header.
+// dropAfter > 0 closes the connection after that many body bytes (a link drop).
+inline HttpResult httpGet(uint16_t port, const std::string& target, int64_t rangeFirst = -1, int64_t rangeLast = -1,
+                          size_t dropAfter = 0) {
+    HttpResult result;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return result;
+    }
+    std::string request = "GET " + target + " HTTP/1.1\r\nHost: 127.0.0.1\r\n";
+    if (rangeFirst >= 0) {
+        request += "Range: bytes=" + std::to_string(rangeFirst) + "-" + (rangeLast >= 0 ? std::to_string(rangeLast) : "") +
+                   "\r\n";
+    }
+    request += "Connection: close\r\n\r\n";
+    std::string rest;
+    if (!sendAll(fd, request.data(), request.size()) || !readHead(fd, result.head, rest)) {
+        close(fd);
+        return result;
+    }
+    result.status = atoi(result.head.c_str() + 9); // "HTTP/1.1 200"
+    size_t expected = strtoull(headerValue(result.head, "Content-Length").c_str(), nullptr, 10);
+    result.body = rest;
+    char buffer[16384];
+    while (result.body.size() < expected && (dropAfter == 0 || result.body.size() < dropAfter)) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) break;
+        result.body.append(buffer, n);
+    }
+    if (dropAfter && result.body.size() > dropAfter) result.body.resize(dropAfter);
+    result.complete = result.body.size() == expected;
+    close(fd);
+    return result;
+}
@@ -0,0 +1,526 @@
+/*
+ * OTA distribution server with staged rollout waves.
+ *
+ *   pio run -e native_ota_server
+ *   .pio/build/native_ota_server/program --image=new.bin --delta=from-1.1.sld,from-1.0.sld --port=8070
+ *
+ * Serves one release: the full image, plus delta patches (delta/mkdelta)
+ * from the bases the fleet runs. Devices check in with the SHA-256 of the
+ * image they run and their health:
+ *   GET /ota/check?device=<id>&image=<sha256 hex>&healthy=1[&failed=1]
+ *     204: nothing to do
+ *     200: {"url":"/ota/file/<name>?device=<id>","sha":"<new image>","size":N,"kind":"delta"|"full"}
+ *   GET /ota/file/<name>   Range requests (the device fetches 16 KB at a time)
+ *   GET /ota/health?device=<id>&ok=0|1   health verdict from the backend
+ *   GET /ota/status        rollout state per wave, bytes served
+ * A delta is offered when one exists for the device's base, the full image
+ * otherwise. Who is offered and when follows the rollout state machine in
+ * rollout.h. Rollout state is in memory only.
+ *
+ * --simulate=N runs the same server on localhost against N simulated
+ * devices speaking the device protocol over real sockets, on a virtual
+ * clock (one round of check-ins per --sim-interval seconds):
+ *   .pio/build/native_ota_server/program --image=new.bin --delta=old.sld \
+ *       --simulate=2000 --sim-base=old.bin --sim-drop=0.1 --sim-regression=0.05
+ * Each device applies what it downloads with the device's delta decoder
+ * and verifies the SHA-256 before it "reboots" into the new image.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "delta_patch.h"
+#include "sha256.h"
+#include "http.h"
+#include "rollout.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+const uint32_t OTA_RANGE_BYTES = 16384; // As the firmware requests (ota_delta.h)
+
+static bool readFile(const char* path, Bytes& out) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+    uint8_t buffer[65536];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) out.insert(out.end(), buffer, buffer + n);
+    fclose(f);
+    return true;
+}
+
+static std::string hex(const uint8_t* digest, size_t length = SHA256_BYTES) {
+    static const char DIGITS[] = "0123456789abcdef";
+    std::string out;
+    for (size_t i = 0; i < length; i++) {
+        out += DIGITS[digest[i] >> 4];
+        out += DIGITS[digest[i] & 15];
+    }
+    return out;
+}
+
+static std::string sha256Hex(const uint8_t* data, size_t length) {
+    Sha256 h;
+    h.begin();
+    h.update(data, length);
+    uint8_t digest[SHA256_BYTES];
+    h.finish(digest);
+    return hex(digest);
+}
+
+static std::vector<std::string> splitList(const char* s) {
+    std::vector<std::string> out;
+    std::string item;
+    for (const char* p = s;; p++) {
+        if (*p == ',' || *p == '\0') {
+            if (!item.empty()) out.push_back(item);
+            item.clear();
+            if (!*p) break;
+        } else {
+            item += *p;
+        }
+    }
+    return out;
+}
+
+// === RELEASE (what is served) ===
+struct Artifact {
+    std::string name; // /ota/file/<name>
+    bool delta;
+    Bytes data;
+};
+
+struct Release {
+    std::string imageSha;                           // Target image id
+    Artifact full;
+    std::map<std::string, Artifact> deltasByBase;   // Base image sha -> patch
+
+    bool load(const char* imagePath, const std::vector<std::string>& deltaPaths) {
+        full.name = "full.bin";
+        full.delta = false;
+        if (!readFile(imagePath, full.data) || full.data.empty()) return false;
+        imageSha = sha256Hex(full.data.data(), full.data.size());
+        for (const std::string& path : deltaPaths) {
+            Artifact a;
+            a.delta = true;
+            if (!readFile(path.c_str(), a.data)) return false;
+            if (a.data.size() < DELTA_HEADER_BYTES || memcmp(a.data.data(), DELTA_MAGIC, 4) != 0) {
+                fprintf(stderr, "%s is not a delta patch\n", path.c_str());
+                return false;
+            }
+            std::string base = hex(a.data.data() + 12), target = hex(a.data.data() + 44);
+            if (target != imageSha) {
+                fprintf(stderr, "%s does not produce %s\n", path.c_str(), imagePath);
+                return false;
+            }
+            a.name = base.substr(0, 16) + ".sld";
+            deltasByBase[base] = std::move(a);
+        }
+        return true;
+    }
+
+    const Artifact* find(const std::string& name) const {
+        if (name == full.name) return &full;
+        for (const auto& entry : deltasByBase) {
+            if (entry.second.name == name) return &entry.second;
+        }
+        return nullptr;
+    }
+};
+
+// === CLOCK (wall time, or the simulation's virtual time) ===
+struct Clock {
+    bool simulated = false;
+    std::atomic<uint64_t> virtualS{0};
+    uint64_t now() const {
+        if (simulated) return virtualS.load();
+        return (uint64_t)std::chrono::duration_cast<std::chrono::seconds>(
+                   std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+};
+
+// === SERVER ===
+struct OtaServer {
+    const Release& release;
+    Rollout rollout;
+    Clock& clock;
+    std::mutex mutex;
+    uint64_t lastEvaluated = 0;
+    uint64_t bytesFull = 0, bytesDelta = 0;
+    uint64_t checkIns = 0, offers = 0, fileRequests = 0;
+    bool verbose;
+
+    OtaServer(const Release& r, const RolloutConfig& config, Clock& c, bool log)
+        : release(r), rollout(config, r.imageSha, c.now()), clock(c), verbose(log) {}
+
+    void evaluate(uint64_t now) {
+        if (now == lastEvaluated) return;
+        lastEvaluated = now;
+        rollout.evaluate(now);
+    }
+
+    void handle(const HttpRequest& req, HttpResponse& res) {
+        auto arg = [&](const char* key) {
+            auto it = req.query.find(key);
+            return it == req.query.end() ? std::string() : it->second;
+        };
+        std::string device = arg("device");
+        uint64_t now = clock.now();
+
+        if (req.path == "/ota/check") {
+            if (device.empty() || arg("image").size() != 2 * SHA256_BYTES) {
+                res.status = 400;
+                return;
+            }
+            std::string image = arg("image");
+            bool offer;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                checkIns++;
+                evaluate(now);
+                offer = rollout.checkIn(device, image, arg("healthy") != "0", arg("failed") == "1", now);
+                offers += offer;
+            }
+            if (!offer) {
+                res.status = 204;
+                return;
+            }
+            auto it = release.deltasByBase.find(image);
+            const Artifact& a = it != release.deltasByBase.end() ? it->second : release.full;
+            char body[512];
+            snprintf(body, sizeof(body), "{\"url\":\"/ota/file/%s?device=%s\",\"sha\":\"%s\",\"size\":%zu,\"kind\":\"%s\"}",
+                     a.name.c_str(), device.c_str(), release.imageSha.c_str(), a.data.size(),
+                     a.delta ? "delta" : "full");
+            if (verbose) printf("offer %s: %s (%zu B)\n", device.c_str(), a.name.c_str(), a.data.size());
+            res.status = 200;
+            res.contentType = "application/json";
+            res.body = body;
+            return;
+        }
+
+        if (req.path.compare(0, 10, "/ota/file/") == 0) {
+            const Artifact* a = release.find(req.path.substr(10));
+            if (!a) return; // 404
+            serveBytes(req, a->data.data(), a->data.size(), res);
+            std::lock_guard<std::mutex> lock(mutex);
+            fileRequests++;
+            (a->delta ? bytesDelta : bytesFull) += res.dataSize;
+            if (!device.empty()) rollout.onDownload(device, res.dataSize);
+            return;
+        }
+
+        if (req.path == "/ota/health") {
+            std::lock_guard<std::mutex> lock(mutex);
+            rollout.onHealth(device, arg("ok") != "0");
+            res.status = 204;
+            return;
+        }
+
+        if (req.path == "/ota/status") {
+            res.status = 200;
+            res.contentType = "application/json";
+            res.body = statusJson();
+        }
+    }
+
+    std::string statusJson() {
+        std::lock_guard<std::mutex> lock(mutex);
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer), "{\"image\":\"%s\",\"halted\":%s,\"open_waves\":%d,\"bytes\":{\"full\":%llu,\"delta\":%llu},\"waves\":[",
+                 release.imageSha.c_str(), rollout.halted() ? "true" : "false", rollout.openWaves(),
+                 (unsigned long long)bytesFull, (unsigned long long)bytesDelta);
+        std::string out = buffer;
+        std::vector<WaveStats> waves = rollout.stats();
+        for (size_t w = 0; w < waves.size(); w++) {
+            snprintf(buffer, sizeof(buffer), "%s{\"pct\":%d,\"open\":%s,\"devices\":%d", w ? "," : "", waves[w].percent,
+                     waves[w].open ? "true" : "false", waves[w].devices);
+            out += buffer;
+            for (int s = 0; s < DEV_STATE_COUNT; s++) {
+                snprintf(buffer, sizeof(buffer), ",\"%s\":%d", deviceStateName(s), waves[w].count[s]);
+                out += buffer;
+            }
+            out += "}";
+        }
+        return out + "]}";
+    }
+};
+
+// === SIMULATED DEVICES ===
+struct SimConfig {
+    int devices = 0;
+    const char* basePath = nullptr;
+    double otherBase = 0.0;   // Share on a base without a delta (get the full image)
+    double drop = 0.0;        // Per range request: link drops mid-body
+    double regression = 0.0;  // Share unhealthy once on the new image
+    double applyFail = 0.0;   // Share whose update fails (e.g. flash error)
+    uint64_t intervalS = 3600;
+    uint64_t maxDays = 30;
+    unsigned threads = 0;
+};
+
+struct MemoryOld {
+    const Bytes* data;
+    bool read(uint32_t offset, uint8_t* buffer, size_t length) {
+        if (!data || offset + length > data->size()) return false;
+        memcpy(buffer, data->data() + offset, length);
+        return true;
+    }
+};
+
+struct MemoryOut {
+    Sha256 sha;
+    uint32_t written = 0;
+    bool write(const uint8_t* buffer, size_t length) {
+        sha.update(buffer, length);
+        written += length;
+        return true;
+    }
+};
+
+struct SimDevice {
+    std::string id;
+    const Bytes* image;    // Running image (shared)
+    std::string imageSha;
+    bool regressed;        // Unhealthy once on the new image
+    bool failsApply;
+    bool lastOtaFailed = false;
+    uint64_t bytes = 0;
+    uint32_t requests = 0;
+    uint32_t drops = 0;
+};
+
+struct SimTotals {
+    std::atomic<uint64_t> bytes{0}, requests{0}, drops{0}, updated{0};
+};
+
+// One check-in; downloads and applies an offered update the way the firmware does
+static void simCheckIn(SimDevice& dev, uint16_t port, const Bytes& target, const std::string& targetSha,
+                       const SimConfig& cfg, std::mt19937& rng, SimTotals& totals) {
+    bool onTarget = dev.imageSha == targetSha;
+    std::string query = "/ota/check?device=" + dev.id + "&image=" + dev.imageSha +
+                        "&healthy=" + (onTarget && dev.regressed ? "0" : "1") + (dev.lastOtaFailed ? "&failed=1" : "");
+    HttpResult check = httpGet(port, query);
+    if (check.status != 200) return;
+    dev.lastOtaFailed = false;
+
+    auto field = [&](const char* key) {
+        std::string pattern = std::string("\"") + key + "\":";
+        size_t p = check.body.find(pattern);
+        if (p == std::string::npos) return std::string();
+        p += pattern.size();
+        if (check.body[p] == '"') return check.body.substr(p + 1, check.body.find('"', p + 1) - p - 1);
+        return check.body.substr(p, check.body.find_first_of(",}", p) - p);
+    };
+    std::string url = field("url"), sha = field("sha"), kind = field("kind");
+    uint32_t size = (uint32_t)strtoul(field("size").c_str(), nullptr, 10);
+    bool delta = kind == "delta";
+
+    static thread_local DeltaPatcher<MemoryOld, MemoryOut> patcher;
+    MemoryOld old = {dev.image};
+    MemoryOut out;
+    out.sha.begin();
+    patcher.begin();
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    uint32_t received = 0;
+    DeltaStatus status = DELTA_MORE;
+    int failures = 0;
+    while (received < size && status == DELTA_MORE) {
+        uint32_t last = std::min(size, received + OTA_RANGE_BYTES) - 1;
+        size_t dropAfter = uniform(rng) < cfg.drop ? 1 + rng() % (last - received + 1) : 0;
+        HttpResult part = httpGet(port, url, received, last, dropAfter);
+        dev.requests++;
+        totals.requests++;
+        if (part.status != 206 && part.status != 200) {
+            if (++failures > 10) break;
+            continue;
+        }
+        dev.bytes += part.body.size();
+        totals.bytes += part.body.size();
+        const uint8_t* data = (const uint8_t*)part.body.data();
+        if (delta) status = patcher.feed(data, part.body.size(), old, out);
+        else out.write(data, part.body.size());
+        received += part.body.size();
+        if (!part.complete) {
+            dev.drops++;
+            totals.drops++; // Resume from `received` on the next request
+        }
+    }
+    uint8_t digest[SHA256_BYTES];
+    out.sha.finish(digest);
+    bool ok = (delta ? status == DELTA_DONE : received == size) && hex(digest) == sha && !dev.failsApply;
+    if (!ok) {
+        dev.lastOtaFailed = true;
+        return;
+    }
+    dev.image = &target; // Reboot into it
+    dev.imageSha = sha;
+    totals.updated++;
+}
+
+static int simulate(OtaServer& server, Clock& clock, uint16_t port, const Bytes& target, const SimConfig& cfg) {
+    Bytes base, otherBase;
+    if (!readFile(cfg.basePath, base)) return 1;
+    otherBase = base;
+    otherBase[otherBase.size() / 2] ^= 0xFF; // Some unrecorded build: no delta for it
+    std::string baseSha = sha256Hex(base.data(), base.size());
+    std::string otherSha = sha256Hex(otherBase.data(), otherBase.size());
+    const std::string& targetSha = server.rollout.target();
+
+    std::mt19937 setup(7);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<SimDevice> devices(cfg.devices);
+    for (int i = 0; i < cfg.devices; i++) {
+        char id[32];
+        snprintf(id, sizeof(id), "sim-%05d", i);
+        bool other = uniform(setup) < cfg.otherBase;
+        devices[i] = {id, other ? &otherBase : &base, other ? otherSha : baseSha, uniform(setup) < cfg.regression,
+                      uniform(setup) < cfg.applyFail};
+    }
+
+    unsigned threads = cfg.threads ? cfg.threads : std::max(4u, std::thread::hardware_concurrency() * 4);
+    SimTotals totals;
+    uint64_t fullCost = (uint64_t)cfg.devices * target.size();
+    printf("%d devices (%zu-byte image), check-in every %llus, %u client threads\n", cfg.devices, target.size(),
+           (unsigned long long)cfg.intervalS, threads);
+    printf("%8s %5s %7s %7s %7s %7s %7s %7s %12s %7s\n", "hours", "waves", "pending", "offered", "dl", "updated",
+           "healthy", "failed", "bytes", "drops");
+
+    auto start = std::chrono::steady_clock::now();
+    std::string lastLine;
+    uint64_t rounds = cfg.maxDays * 86400 / cfg.intervalS;
+    for (uint64_t round = 0; round <= rounds; round++) {
+        clock.virtualS = round * cfg.intervalS;
+        std::atomic<size_t> next(0);
+        auto worker = [&](unsigned seed) {
+            std::mt19937 rng(seed * 7919 + (unsigned)round);
+            for (size_t i; (i = next++) < devices.size();) simCheckIn(devices[i], port, target, targetSha, cfg, rng, totals);
+        };
+        std::vector<std::thread> pool;
+        for (unsigned t = 0; t < threads; t++) pool.emplace_back(worker, t);
+        for (auto& t : pool) t.join();
+
+        int count[DEV_STATE_COUNT] = {};
+        int open, waves;
+        bool halted;
+        {
+            std::lock_guard<std::mutex> lock(server.mutex);
+            server.evaluate(clock.now());
+            for (const WaveStats& w : server.rollout.stats())
+                for (int s = 0; s < DEV_STATE_COUNT; s++) count[s] += w.count[s];
+            open = server.rollout.openWaves();
+            waves = (int)server.rollout.stats().size();
+            halted = server.rollout.halted();
+        }
+        char line[160];
+        snprintf(line, sizeof(line), "%5s %7d %7d %7d %7d %7d %7d %12llu %7llu", "", count[DEV_PENDING],
+                 count[DEV_OFFERED], count[DEV_DOWNLOADING], count[DEV_UPDATED], count[DEV_HEALTHY], count[DEV_FAILED],
+                 (unsigned long long)totals.bytes.load(), (unsigned long long)totals.drops.load());
+        if (line != lastLine) {
+            printf("%8.0f %2d/%-2d%s\n", clock.now() / 3600.0, open, waves, line + 5);
+            lastLine = line;
+        }
+        if (halted) {
+            printf("Rollout HALTED: failures above the limit in the open waves\n");
+            break;
+        }
+        if (count[DEV_HEALTHY] + count[DEV_FAILED] == cfg.devices && open == waves) break;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("\n%llu of %d devices updated in %.0f h (virtual), %llu range requests, %llu link drops resumed\n",
+           (unsigned long long)totals.updated.load(), cfg.devices, clock.now() / 3600.0,
+           (unsigned long long)totals.requests.load(), (unsigned long long)totals.drops.load());
+    uint64_t air = totals.bytes.load();
+    printf("Over the air %llu B (server: %llu delta, %llu full); full images for all would be %llu B (%.1fx)\n",
+           (unsigned long long)air, (unsigned long long)server.bytesDelta, (unsigned long long)server.bytesFull,
+           (unsigned long long)fullCost, (double)fullCost / std::max<uint64_t>(1, air));
+    printf("%llu check-ins, %.1f s wall\n", (unsigned long long)server.checkIns, seconds);
+    printf("%s\n", server.statusJson().c_str());
+    return server.rollout.halted() ? 2 : 0;
+}
+
+static void usage() {
+    printf("ota_server --image=new.bin [--delta=a.sld,...] [--port=8070] [--local] [--verbose]\n"
+           "           [--waves=1,10,50,100] [--soak=S] [--confirm=S] [--min-healthy=0.95] [--max-failed=0.02]\n"
+           "           [--simulate=N --sim-base=old.bin [--sim-other-base=P] [--sim-drop=P]\n"
+           "            [--sim-regression=P] [--sim-apply-fail=P] [--sim-interval=S] [--sim-days=N] [--threads=N]]\n");
+}
+
+int main(int argc, char** argv) {
+    const char* imagePath = nullptr;
+    std::vector<std::string> deltas;
+    uint16_t port = 8070;
+    bool local = false, verbose = false;
+    RolloutConfig config;
+    SimConfig sim;
+
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        if (strncmp(a, "--image=", 8) == 0) imagePath = a + 8;
+        else if (strncmp(a, "--delta=", 8) == 0) deltas = splitList(a + 8);
+        else if (strncmp(a, "--port=", 7) == 0) port = (uint16_t)atoi(a + 7);
+        else if (strcmp(a, "--local") == 0) local = true;
+        else if (strcmp(a, "--verbose") == 0) verbose = true;
+        else if (strncmp(a, "--waves=", 8) == 0) {
+            config.wavePercent.clear();
+            for (const std::string& w : splitList(a + 8)) config.wavePercent.push_back(atoi(w.c_str()));
+        }
+        else if (strncmp(a, "--soak=", 7) == 0) config.soakS = strtoull(a + 7, nullptr, 10);
+        else if (strncmp(a, "--confirm=", 10) == 0) config.healthConfirmS = strtoull(a + 10, nullptr, 10);
+        else if (strncmp(a, "--min-healthy=", 14) == 0) config.minHealthy = atof(a + 14);
+        else if (strncmp(a, "--max-failed=", 13) == 0) config.maxFailed = atof(a + 13);
+        else if (strncmp(a, "--simulate=", 11) == 0) sim.devices = atoi(a + 11);
+        else if (strncmp(a, "--sim-base=", 11) == 0) sim.basePath = a + 11;
+        else if (strncmp(a, "--sim-other-base=", 17) == 0) sim.otherBase = atof(a + 17);
+        else if (strncmp(a, "--sim-drop=", 11) == 0) sim.drop = atof(a + 11);
+        else if (strncmp(a, "--sim-regression=", 17) == 0) sim.regression = atof(a + 17);
+        else if (strncmp(a, "--sim-apply-fail=", 17) == 0) sim.applyFail = atof(a + 17);
+        else if (strncmp(a, "--sim-interval=", 15) == 0) sim.intervalS = strtoull(a + 15, nullptr, 10);
+        else if (strncmp(a, "--sim-days=", 11) == 0) sim.maxDays = strtoull(a + 11, nullptr, 10);
+        else if (strncmp(a, "--threads=", 10) == 0) sim.threads = (unsigned)atoi(a + 10);
+        else {
+            usage();
+            return strcmp(a, "--help") == 0 ? 0 : 1;
+        }
+    }
+    if (!imagePath || config.wavePercent.empty() || config.wavePercent.back() != 100 ||
+        (sim.devices > 0 && (!sim.basePath || sim.intervalS == 0))) {
+        usage();
+        return 1;
+    }
+
+    Release release;
+    if (!release.load(imagePath, deltas)) return 1;
+    printf("Release %s: full %zu B, %zu delta(s)\n", release.imageSha.substr(0, 16).c_str(), release.full.data.size(),
+           release.deltasByBase.size());
+    for (const auto& entry : release.deltasByBase) {
+        printf("  from %s: %zu B\n", entry.first.substr(0, 16).c_str(), entry.second.data.size());
+    }
+
+    Clock clock;
+    clock.simulated = sim.devices > 0;
+    OtaServer server(release, config, clock, verbose);
+    HttpServer http;
+    // The simulation picks a free loopback port
+    if (!http.listen(clock.simulated ? 0 : port, local || clock.simulated)) return 1;
+    std::thread serving([&] { http.serve([&](const HttpRequest& req, HttpResponse& res) { server.handle(req, res); }); });
+    serving.detach();
+
+    if (clock.simulated) {
+        int rc = simulate(server, clock, http.port(), release.full.data, sim);
+        fflush(stdout);
+        _exit(rc); // The accept thread never returns
+    }
+    printf("Listening on port %u\n", http.port());
+    for (;;) std::this_thread::sleep_for(std::chrono::hours(1));
+}
@@ -0,0 +1,185 @@
+/*
+ * Staged rollout - per-device update state and wave gating.
+ *
+ * A device's wave follows from a stable hash of its id, so the same 1% of
+ * poles are always the canaries. Waves are cumulative fleet percentages
+ * (default 1, 10, 50, 100). Wave N+1 opens only when the devices of waves
+ * 0..N that have checked in are mostly confirmed healthy on the new image,
+ * and the last wave has soaked for a while. Too many failures halt the
+ * rollout: no more offers until an operator restarts the server.
+ *
+ * Per device:
+ *   PENDING -> OFFERED -> DOWNLOADING -> UPDATED -> HEALTHY
+ *   any of OFFERED..HEALTHY -> FAILED (apply failed, never came back,
+ *   or unhealthy on the new image)
+ * Health is the check-in's "healthy" flag (the device's own telemetry
+ * verdict) or an external report from the backend (/ota/health).
+ *
+ * Not thread-safe: the server serializes calls.
+ */
+#pragma once
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+enum DeviceState {
+    DEV_PENDING,     // Not offered yet (its wave is closed, or the rollout halted)
+    DEV_OFFERED,
+    DEV_DOWNLOADING, // Fetched at least one byte
+    DEV_UPDATED,     // Checked in on the new image, health not confirmed yet
+    DEV_HEALTHY,     // Stayed healthy on it for healthConfirmS
+    DEV_FAILED,
+    DEV_STATE_COUNT
+};
+
+inline const char* deviceStateName(int state) {
+    static const char* const NAMES[DEV_STATE_COUNT] = {"pending", "offered", "downloading",
+                                                       "updated", "healthy", "failed"};
+    return state >= 0 && state < DEV_STATE_COUNT ? NAMES[state] : "unknown";
+}
+
+struct RolloutConfig {
+    std::vector<int> wavePercent = {1, 10, 50, 100}; // Cumulative share of the fleet
+    uint64_t soakS = 4 * 3600;        // A wave runs at least this long before the next opens
+    uint64_t healthConfirmS = 3600;   // Healthy this long on the new image -> HEALTHY
+    uint64_t offerTimeoutS = 2 * 86400; // Offered, never seen on the new image -> FAILED
+    double minHealthy = 0.95;         // Share of the open waves' devices needed to advance
+    double maxFailed = 0.02;          // Share of them that halts the rollout
+};
+
+struct DeviceRecord {
+    DeviceState state = DEV_PENDING;
+    int wave = 0;
+    uint64_t offeredAt = 0;
+    uint64_t updatedAt = 0;
+    uint64_t lastSeen = 0;
+    uint64_t bytesServed = 0;
+};
+
+struct WaveStats {
+    int percent;
+    bool open;
+    int devices;                  // Known (checked in at least once)
+    int count[DEV_STATE_COUNT];
+};
+
+// FNV-1a, stable across runs and platforms
+inline uint32_t deviceBucket(const std::string& id) {
+    uint32_t h = 2166136261u;
+    for (unsigned char c : id) h = (h ^ c) * 16777619u;
+    return h % 100;
+}
+
+class Rollout {
+public:
+    Rollout(const RolloutConfig& config, const std::string& targetImage, uint64_t now)
+        : config_(config), target_(targetImage), waveOpenedAt_(now) {}
+
+    // A device checking in with the image id it runs. True = offer the update.
+    bool checkIn(const std::string& id, const std::string& image, bool healthy, bool otaFailed, uint64_t now) {
+        DeviceRecord& d = record(id);
+        d.lastSeen = now;
+        if (image == target_) {
+            if (d.state < DEV_UPDATED) {
+                d.state = DEV_UPDATED;
+                d.updatedAt = now;
+            }
+            if (!healthy && d.state != DEV_FAILED) d.state = DEV_FAILED;
+            if (healthy && d.state == DEV_UPDATED && now - d.updatedAt >= config_.healthConfirmS) d.state = DEV_HEALTHY;
+            return false;
+        }
+        if ((d.state == DEV_OFFERED || d.state == DEV_DOWNLOADING) && otaFailed) d.state = DEV_FAILED;
+        // Back on the old image after reaching the new one: rolled back
+        if (d.state == DEV_UPDATED || d.state == DEV_HEALTHY) d.state = DEV_FAILED;
+        if (halted_ || d.state == DEV_FAILED || d.wave >= openWaves_) return false;
+        if (d.state == DEV_PENDING) {
+            d.state = DEV_OFFERED;
+            d.offeredAt = now;
+        }
+        return true; // Offered again until it arrives (resumes the download)
+    }
+
+    void onDownload(const std::string& id, uint64_t bytes) {
+        DeviceRecord& d = record(id);
+        d.bytesServed += bytes;
+        if (d.state == DEV_OFFERED) d.state = DEV_DOWNLOADING;
+    }
+
+    // External telemetry verdict (e.g. the backend saw a device go silent)
+    void onHealth(const std::string& id, bool healthy) {
+        DeviceRecord& d = record(id);
+        if (!healthy && (d.state == DEV_UPDATED || d.state == DEV_HEALTHY)) d.state = DEV_FAILED;
+    }
+
+    // Timeouts, halt and wave advance. O(devices): the server calls it at
+    // most once per second, not per check-in.
+    void evaluate(uint64_t now) {
+        for (auto& entry : devices_) {
+            DeviceRecord& d = entry.second;
+            if ((d.state == DEV_OFFERED || d.state == DEV_DOWNLOADING) && now - d.offeredAt >= config_.offerTimeoutS) {
+                d.state = DEV_FAILED;
+            }
+        }
+        if (halted_) return;
+        int cohort = 0, healthy = 0, failed = 0;
+        for (const auto& entry : devices_) {
+            const DeviceRecord& d = entry.second;
+            if (d.wave >= openWaves_) continue;
+            cohort++;
+            healthy += d.state == DEV_HEALTHY;
+            failed += d.state == DEV_FAILED;
+        }
+        if (cohort && failed > config_.maxFailed * cohort) {
+            halted_ = true;
+            return;
+        }
+        // An empty wave passes once soaked (nothing to judge)
+        if (openWaves_ < (int)config_.wavePercent.size() && now - waveOpenedAt_ >= config_.soakS &&
+            healthy >= config_.minHealthy * cohort) {
+            openWaves_++;
+            waveOpenedAt_ = now;
+        }
+    }
+
+    bool halted() const { return halted_; }
+    int openWaves() const { return openWaves_; }
+    const std::string& target() const { return target_; }
+    const std::map<std::string, DeviceRecord>& devices() const { return devices_; }
+
+    std::vector<WaveStats> stats() const {
+        std::vector<WaveStats> waves(config_.wavePercent.size());
+        for (size_t w = 0; w < waves.size(); w++) {
+            waves[w] = {config_.wavePercent[w], (int)w < openWaves_, 0, {}};
+        }
+        for (const auto& entry : devices_) {
+            WaveStats& w = waves[entry.second.wave];
+            w.devices++;
+            w.count[entry.second.state]++;
+        }
+        return waves;
+    }
+
+private:
+    RolloutConfig config_;
+    std::string target_;
+    std::map<std::string, DeviceRecord> devices_;
+    int openWaves_ = 1;
+    uint64_t waveOpenedAt_;
+    bool halted_ = false;
+
+    DeviceRecord& record(const std::string& id) {
+        auto it = devices_.find(id);
+        if (it != devices_.end()) return it->second;
+        DeviceRecord& d = devices_[id];
+        uint32_t bucket = deviceBucket(id);
+        d.wave = (int)config_.wavePercent.size() - 1;
+        for (size_t w = 0; w < config_.wavePercent.size(); w++) {
+            if ((int)bucket < config_.wavePercent[w]) {
+                d.wave = (int)w;
+                break;
+            }
+        }
+        return d;
+    }
+};
@@ -0,0 +1,372 @@
+/*
+ * Discrete-event energy simulator for control-policy what-if studies.
+ *
+ *   pio run -e native_sim
+ *   .pio/build/native_sim/program --poles=1000 --days=365 \
+ *       --timer=15000,30000,60000 --dim=51,77,102 --out=sweep.csv
+ *
+ * Runs LightControllerT (the code loop() runs) for many poles over synthetic
+ * years of daylight and pedestrian traffic, once per point of the parameter
+ * grid, spread across all cores. Only instants where the controller can
+ * change output are simulated:
+ * - LDR samples, but only inside the noisy twilight windows (outside them
+ *   the window is saturated and sampling cannot change the state),
+ * - pedestrian arrivals (PIR edges) and motion-timer expiries,
+ * - the true ambient dark/light crossings (for coverage accounting).
+ * Energy is integrated exactly between events. Every pole sees the same
+ * weather and traffic for every grid point (common random numbers), so
+ * differences between rows come from the policy alone.
+ */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "light_control.h"
+
+// === MODEL CONSTANTS ===
+const double TRADITIONAL_LIGHT_POWER_W = 100.0; // Same baseline as the backend analytics
+const uint64_t DAY_MS = 86400000ULL;
+const uint64_t SIM_EPOCH_MS = DAY_MS;           // Day 0 starts here (keeps the boot-time timer idle)
+const uint64_t TWILIGHT_RAMP_MS = 3 * 60000ULL; // LDR flickers +/-3 min around the crossing
+const uint64_t LDR_PERIOD_MS = LDR_INTERVAL_MS + 1; // ldrDue() is strict: samples land every 101 ms
+const double DEFAULT_LATITUDE_DEG = 5.4;        // Penang
+const double SOLAR_NOON_HOUR = 13.3;            // UTC+8 at ~100 E
+const double POLE_SHADE_SPREAD_MIN = 10.0;      // Per-pole offset of the LDR crossing
+const double WEATHER_SPREAD_MIN = 6.0;          // Per-day jitter (cloud cover)
+const double PEAK_PEDESTRIANS_PER_HOUR = 12.0;
+
+// Relative pedestrian rate by local hour (evening peak, quiet small hours)
+const double HOURLY_TRAFFIC[24] = {
+    0.25, 0.15, 0.08, 0.05, 0.05, 0.15, 0.50, 0.80, 0.70, 0.50, 0.45, 0.50,
+    0.55, 0.50, 0.45, 0.50, 0.60, 0.75, 0.90, 1.00, 0.95, 0.80, 0.60, 0.40};
+
+// === RNG: splitmix64 (seedable per pole/day -> common random numbers) ===
+struct SimRng {
+    uint64_t state;
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+    double gaussian() {
+        double u1 = uniform() + 1e-12, u2 = uniform();
+        return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+    }
+};
+
+static uint64_t seedFor(uint32_t pole, uint32_t day, uint32_t stream) {
+    return ((uint64_t)pole << 40) ^ ((uint64_t)day << 8) ^ stream ^ 0xA5A5A5A5ULL;
+}
+
+// Sunrise/sunset (hours, local) from latitude and day of year
+static void sunTimes(double latitudeDeg, int dayOfYear, double& sunrise, double& sunset) {
+    double decl = 23.44 * M_PI / 180.0 * sin(2.0 * M_PI * (284 + dayOfYear) / 365.0);
+    double lat = latitudeDeg * M_PI / 180.0;
+    double cosH = -tan(lat) * tan(decl);
+    cosH = std::max(-1.0, std::min(1.0, cosH));
+    double halfDayHours = acos(cosH) * 180.0 / M_PI / 15.0;
+    sunrise = SOLAR_NOON_HOUR - halfDayHours;
+    sunset = SOLAR_NOON_HOUR + halfDayHours;
+}
+
+// === SWEEP DEFINITION ===
+struct SimConfig {
+    uint32_t poles = 1000;
+    uint32_t days = 365;
+    double latitudeDeg = DEFAULT_LATITUDE_DEG;
+    unsigned threads = 0;
+    std::vector<RuntimePolicy> grid;
+};
+
+struct PoleResult {
+    double smartWh = 0;
+    double traditionalWh = 0;
+    double darkMs = 0;        // Truly dark time
+    double darkLitMs = 0;     // ...with the light on (any level)
+    uint64_t arrivals = 0;    // Pedestrians during true dark
+    uint64_t arrivalsFull = 0; // ...that got full brightness
+    uint64_t switches = 0;    // PWM level changes
+    uint64_t steps = 0;       // Controller steps executed
+
+    void add(const PoleResult& o) {
+        smartWh += o.smartWh;
+        traditionalWh += o.traditionalWh;
+        darkMs += o.darkMs;
+        darkLitMs += o.darkLitMs;
+        arrivals += o.arrivals;
+        arrivalsFull += o.arrivalsFull;
+        switches += o.switches;
+        steps += o.steps;
+    }
+};
+
+// Everything that happens to one pole on one day, in absolute sim ms
+struct PoleDay {
+    uint64_t dawnMs;  // Ambient turns light for this pole's LDR
+    uint64_t duskMs;  // Ambient turns dark
+    std::vector<uint64_t> arrivals;
+};
+
+static PoleDay makePoleDay(const SimConfig& cfg, uint32_t pole, uint32_t day, double poleShadeMin, double trafficScale) {
+    PoleDay pd;
+    double sunrise, sunset;
+    sunTimes(cfg.latitudeDeg, (int)(day % 365), sunrise, sunset);
+
+    SimRng weather = {seedFor(pole / 50, day, 1)}; // Weather shared by neighbouring poles
+    uint64_t dayStart = SIM_EPOCH_MS + (uint64_t)day * DAY_MS;
+    double dawnMin = sunrise * 60.0 + poleShadeMin + weather.gaussian() * WEATHER_SPREAD_MIN;
+    double duskMin = sunset * 60.0 - poleShadeMin + weather.gaussian() * WEATHER_SPREAD_MIN;
+    pd.dawnMs = dayStart + (uint64_t)(dawnMin * 60000.0);
+    pd.duskMs = dayStart + (uint64_t)(duskMin * 60000.0);
+
+    // Pedestrians only matter while the light can be on (dark +/- the ramp)
+    SimRng traffic = {seedFor(pole, day, 2)};
+    uint64_t nightEnd = pd.dawnMs + TWILIGHT_RAMP_MS;
+    uint64_t nightStart = pd.duskMs - TWILIGHT_RAMP_MS;
+    for (int hour = 0; hour < 24; hour++) {
+        uint64_t hStart = dayStart + (uint64_t)hour * 3600000ULL, hEnd = hStart + 3600000ULL;
+        if (hStart >= nightEnd && hEnd <= nightStart) continue;
+        double ratePerMs = PEAK_PEDESTRIANS_PER_HOUR * trafficScale * HOURLY_TRAFFIC[hour] / 3600000.0;
+        double t = (double)hStart;
+        for (;;) {
+            t += -log(1.0 - traffic.uniform()) / ratePerMs;
+            if (t >= (double)hEnd) break;
+            uint64_t at = (uint64_t)t;
+            if (at < nightEnd || at >= nightStart) pd.arrivals.push_back(at);
+        }
+    }
+    return pd;
+}
+
+// Probability that the digital LDR reads dark at time t (linear ramp around crossings)
+static double darkProbability(const PoleDay& pd, uint64_t t) {
+    if (t + TWILIGHT_RAMP_MS <= pd.dawnMs) return 1.0;
+    if (t < pd.dawnMs + TWILIGHT_RAMP_MS) return 0.5 - 0.5 * ((double)t - (double)pd.dawnMs) / TWILIGHT_RAMP_MS;
+    if (t + TWILIGHT_RAMP_MS <= pd.duskMs) return 0.0;
+    if (t < pd.duskMs + TWILIGHT_RAMP_MS) return 0.5 + 0.5 * ((double)t - (double)pd.duskMs) / TWILIGHT_RAMP_MS;
+    return 1.0;
+}
+
+static bool inTwilight(const PoleDay& pd, uint64_t t) {
+    return (t + TWILIGHT_RAMP_MS > pd.dawnMs && t < pd.dawnMs + TWILIGHT_RAMP_MS) ||
+           (t + TWILIGHT_RAMP_MS > pd.duskMs && t < pd.duskMs + TWILIGHT_RAMP_MS);
+}
+
+// Next LDR sample instant >= from that falls inside a twilight window, or UINT64_MAX
+static uint64_t nextTwilightSample(const PoleDay& pd, uint64_t from, uint64_t dayEnd) {
+    if (inTwilight(pd, from)) return from;
+    uint64_t windows[2] = {pd.dawnMs - TWILIGHT_RAMP_MS, pd.duskMs - TWILIGHT_RAMP_MS};
+    for (uint64_t start : windows) {
+        if (start >= from && start < dayEnd) {
+            // Keep the 101 ms sampling phase
+            uint64_t k = (start - from + LDR_PERIOD_MS - 1) / LDR_PERIOD_MS;
+            return from + k * LDR_PERIOD_MS;
+        }
+    }
+    return UINT64_MAX;
+}
+
+static PoleResult simulatePole(const SimConfig& cfg, const RuntimePolicy& params, uint32_t pole) {
+    PoleResult r;
+    SimRng poleRng = {seedFor(pole, 0xFFFFFF, 3)};
+    double poleShadeMin = (poleRng.uniform() * 2.0 - 1.0) * POLE_SHADE_SPREAD_MIN;
+    double trafficScale = 0.2 + 2.8 * poleRng.uniform() * poleRng.uniform(); // Mostly quiet, a few busy
+
+    LightControllerT<RuntimePolicy> controller;
+    controller.reset(params);
+    // Start of day 0 is midnight: prime the window as fully dark
+    for (int i = 0; i < WINDOW_SIZE; i++) controller.sampleLdr(SIM_EPOCH_MS, 1);
+
+    uint64_t now = SIM_EPOCH_MS;
+    int pwm = controller.evaluate(now).pwm;
+    uint64_t nextSample = now + LDR_PERIOD_MS;
+    double pwmMs = 0; // Integral of pwm over time
+
+    for (uint32_t day = 0; day < cfg.days; day++) {
+        PoleDay pd = makePoleDay(cfg, pole, day, poleShadeMin, trafficScale);
+        SimRng ldrNoise = {seedFor(pole, day, 4)};
+        uint64_t dayEnd = SIM_EPOCH_MS + (uint64_t)(day + 1) * DAY_MS;
+        size_t nextArrival = 0;
+        nextSample = nextTwilightSample(pd, nextSample, dayEnd);
+
+        for (;;) {
+            // Earliest pending event
+            uint64_t expiry = controller.motion.isActive(now, params.lightTimerMs)
+                                  ? controller.motion.lastMotionSeenTime + params.lightTimerMs
+                                  : UINT64_MAX;
+            uint64_t arrival = nextArrival < pd.arrivals.size() ? pd.arrivals[nextArrival] : UINT64_MAX;
+            uint64_t crossing = now < pd.dawnMs ? pd.dawnMs : (now < pd.duskMs ? pd.duskMs : UINT64_MAX);
+            uint64_t t = std::min(std::min(expiry, arrival), std::min(std::min(nextSample, crossing), dayEnd));
+
+            // Integrate the constant segment [now, t)
+            double dt = (double)(t - now);
+            bool dark = now < pd.dawnMs || now >= pd.duskMs;
+            pwmMs += pwm * dt;
+            if (dark) {
+                r.darkMs += dt;
+                if (pwm > 0) r.darkLitMs += dt;
+            }
+            now = t;
+            if (t == dayEnd) break;
+
+            if (t == nextSample) {
+                int raw = ldrNoise.uniform() < darkProbability(pd, t) ? 1 : 0;
+                controller.sampleLdr(t, raw);
+                nextSample = nextTwilightSample(pd, t + LDR_PERIOD_MS, dayEnd);
+            }
+            bool arrived = false;
+            while (nextArrival < pd.arrivals.size() && pd.arrivals[nextArrival] == t) {
+                controller.onMotion(t);
+                nextArrival++;
+                arrived = true;
+            }
+
+            LightOutput out = controller.evaluate(t);
+            r.steps++;
+            if (out.pwm != pwm) {
+                pwm = out.pwm;
+                r.switches++;
+            }
+            if (arrived && (t < pd.dawnMs || t >= pd.duskMs)) {
+                r.arrivals++;
+                if (out.pwm == params.pwmFull) r.arrivalsFull++;
+            }
+        }
+        // Samples never carry across midnight (no twilight there)
+        if (nextSample == UINT64_MAX) nextSample = dayEnd;
+    }
+
+    r.smartWh = pwmMs / 255.0 * MAX_LED_POWER_W / 3600000.0;
+    r.traditionalWh = r.darkMs * TRADITIONAL_LIGHT_POWER_W / 3600000.0;
+    return r;
+}
+
+// === PARALLEL SWEEP ===
+static std::vector<PoleResult> runSweep(const SimConfig& cfg) {
+    const uint32_t CHUNK = 16; // Poles per job
+    uint32_t chunksPerPoint = (cfg.poles + CHUNK - 1) / CHUNK;
+    uint64_t jobs = (uint64_t)cfg.grid.size() * chunksPerPoint;
+
+    std::vector<PoleResult> results(cfg.grid.size());
+    std::vector<std::vector<PoleResult>> partial(cfg.grid.size(), std::vector<PoleResult>(chunksPerPoint));
+    std::atomic<uint64_t> nextJob(0);
+
+    auto worker = [&]() {
+        for (;;) {
+            uint64_t job = nextJob.fetch_add(1);
+            if (job >= jobs) return;
+            size_t point = job / chunksPerPoint;
+            uint32_t chunk = job % chunksPerPoint;
+            PoleResult acc;
+            for (uint32_t pole = chunk * CHUNK; pole < std::min(cfg.poles, (chunk + 1) * CHUNK); pole++) {
+                acc.add(simulatePole(cfg, cfg.grid[point], pole));
+            }
+            partial[point][chunk] = acc;
+        }
+    };
+
+    unsigned threads = cfg.threads ? cfg.threads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; i++) pool.emplace_back(worker);
+    for (auto& t : pool) t.join();
+
+    // Fixed reduction order -> results independent of thread count
+    for (size_t p = 0; p < cfg.grid.size(); p++) {
+        for (const PoleResult& c : partial[p]) results[p].add(c);
+    }
+    return results;
+}
+
+// === CLI ===
+static std::vector<long> parseList(const char* text) {
+    std::vector<long> values;
+    while (*text) {
+        char* end;
+        values.push_back(strtol(text, &end, 10));
+        text = (*end == ',') ? end + 1 : end;
+        if (end == text && *end != ',') break;
+    }
+    return values;
+}
+
+static void usage() {
+    printf("energy_sim [--poles=N] [--days=N] [--lat=DEG] [--threads=N] [--out=file.csv]\n"
+           "           [--timer=MS,...] [--full=PWM,...] [--dim=PWM,...] [--night=N,...] [--day=N,...]\n"
+           "Lists are swept as a full grid. Defaults are the firmware constants.\n");
+}
+
+int main(int argc, char** argv) {
+    SimConfig cfg;
+    const char* outPath = nullptr;
+    std::vector<long> timers = {(long)LIGHT_TIMER_MS}, fulls = {PWM_FULL}, dims = {PWM_DIM};
+    std::vector<long> nights = {NIGHT_THRESHOLD}, daysTh = {DAY_THRESHOLD};
+
+    for (int i = 1; i < argc; i++) {
+        const char* a = argv[i];
+        if (strncmp(a, "--poles=", 8) == 0) cfg.poles = (uint32_t)atol(a + 8);
+        else if (strncmp(a, "--days=", 7) == 0) cfg.days = (uint32_t)atol(a + 7);
+        else if (strncmp(a, "--lat=", 6) == 0) cfg.latitudeDeg = atof(a + 6);
+        else if (strncmp(a, "--threads=", 10) == 0) cfg.threads = (unsigned)atol(a + 10);
+        else if (strncmp(a, "--out=", 6) == 0) outPath = a + 6;
+        else if (strncmp(a, "--timer=", 8) == 0) timers = parseList(a + 8);
+        else if (strncmp(a, "--full=", 7) == 0) fulls = parseList(a + 7);
+        else if (strncmp(a, "--dim=", 6) == 0) dims = parseList(a + 6);
+        else if (strncmp(a, "--night=", 8) == 0) nights = parseList(a + 8);
+        else if (strncmp(a, "--day=", 6) == 0) daysTh = parseList(a + 6);
+        else {
+            usage();
+            return strcmp(a, "--help") == 0 ? 0 : 1;
+        }
+    }
+
+    for (long timer : timers)
+        for (long full : fulls)
+            for (long dim : dims)
+                for (long night : nights)
+                    for (long dayTh : daysTh) {
+                        if (dayTh >= night || night > WINDOW_SIZE) continue; // Not a hysteresis band
+                        cfg.grid.push_back({(int)night, (int)dayTh, (unsigned long)timer, (int)full, (int)dim});
+                    }
+    if (cfg.grid.empty()) {
+        fprintf(stderr, "Empty parameter grid\n");
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<PoleResult> results = runSweep(cfg);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    FILE* out = outPath ? fopen(outPath, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Cannot write %s\n", outPath);
+        return 1;
+    }
+    fprintf(out, "timer_ms,pwm_full,pwm_dim,night_th,day_th,kwh_per_pole_year,traditional_kwh_per_pole_year,"
+                 "energy_saved_pct,dark_lit_pct,arrivals_full_pct,switches_per_pole_day\n");
+    double poleYears = (double)cfg.poles * cfg.days / 365.0;
+    uint64_t steps = 0;
+    for (size_t p = 0; p < cfg.grid.size(); p++) {
+        const RuntimePolicy& g = cfg.grid[p];
+        const PoleResult& r = results[p];
+        steps += r.steps;
+        fprintf(out, "%lu,%d,%d,%d,%d,%.2f,%.2f,%.2f,%.3f,%.3f,%.3f\n", g.lightTimerMs, g.pwmFull, g.pwmDim,
+                g.nightThreshold, g.dayThreshold, r.smartWh / 1000.0 / poleYears,
+                r.traditionalWh / 1000.0 / poleYears, 100.0 * (1.0 - r.smartWh / r.traditionalWh),
+                100.0 * r.darkLitMs / r.darkMs, r.arrivals ? 100.0 * r.arrivalsFull / r.arrivals : 100.0,
+                (double)r.switches / ((double)cfg.poles * cfg.days));
+    }
+    if (out != stdout) fclose(out);
+
+    fprintf(stderr, "%zu grid points x %u poles x %u days: %.1f s, %.1f M controller steps/s\n", cfg.grid.size(),
+            cfg.poles, cfg.days, seconds, steps / seconds / 1e6);
+    return 0;
+}
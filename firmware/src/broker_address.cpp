@@ -0,0 +1,62 @@
+#include "broker_address.h"
+#include <WiFi.h>
+
+const uint32_t BROKER_TASK_STACK = 3072;
+const UBaseType_t BROKER_TASK_PRIORITY = 1; // Below WiFi/lwIP on core 0
+const BaseType_t BROKER_TASK_CORE = 0;      // loop() runs on core 1
+
+enum LookupState : uint8_t { LOOKUP_IDLE, LOOKUP_RUNNING, LOOKUP_FOUND };
+
+static const char* host = nullptr;
+static bool isAddress = false;
+static IPAddress address;                   // Written by the task only while LOOKUP_RUNNING
+static volatile LookupState lookup = LOOKUP_IDLE;
+static bool known = false;
+
+static void lookupTask(void*) {
+    IPAddress found;
+    bool ok = WiFi.hostByName(host, found) == 1;
+    if (ok) address = found;
+    lookup = ok ? LOOKUP_FOUND : LOOKUP_IDLE;
+    vTaskDelete(nullptr);
+}
+
+void brokerBegin(const char* server) {
+    host = server;
+    isAddress = address.fromString(server);
+    known = isAddress;
+}
+
+bool brokerKnown() {
+    return known;
+}
+
+IPAddress brokerIp() {
+    return address;
+}
+
+bool brokerLookupStart() {
+    if (known || lookup != LOOKUP_IDLE) return false;
+    lookup = LOOKUP_RUNNING;
+    if (xTaskCreatePinnedToCore(lookupTask, "mqtt_dns", BROKER_TASK_STACK, nullptr, BROKER_TASK_PRIORITY, nullptr,
+                                BROKER_TASK_CORE) != pdPASS) {
+        lookup = LOOKUP_IDLE;
+        return false;
+    }
+    return true;
+}
+
+bool brokerLookupBusy() {
+    return lookup == LOOKUP_RUNNING;
+}
+
+bool brokerLookupDone() {
+    if (lookup != LOOKUP_FOUND) return false;
+    lookup = LOOKUP_IDLE;
+    known = true;
+    return true;
+}
+
+void brokerForget() {
+    if (!isAddress) known = false;
+}
@@ -0,0 +1,127 @@
+#include "flight_recorder.h"
+#include "esp_heap_caps.h"
+#include "memory_mode.h"
+#include "serial_stream.h"
+
+enum FlightState { FLIGHT_RECORDING, FLIGHT_ARMED, FLIGHT_UPLOADING };
+
+#if CONFIG_SPIRAM_ALLOW_NOINIT_SEG_EXTERNAL_MEMORY
+// Survives warm resets; validated by FlightLog::intact()
+EXT_RAM_NOINIT_ATTR static FlightRecord noinitRecords[FLIGHT_RECORD_SLOTS];
+EXT_RAM_NOINIT_ATTR FlightLog flightLog;
+#else
+FlightLog flightLog = {};
+#endif
+
+static FlightState state = FLIGHT_RECORDING;
+static FlightLog parked = {};              // A dump MQTT could not take in time, copied out
+static uint8_t reason = FLIGHT_NONE;       // Of the dump being uploaded
+static unsigned long freezeAtMs = 0;
+static unsigned long lastAnomalyMs = 0;
+static bool anomalySeen = false;
+static uint16_t dumpId = 0;
+static uint32_t chunk = 0;
+static unsigned long lastChunkMs = 0;      // Upload progress (or its start)
+static uint32_t currentBootId = 0;
+
+// Recording carries on in flightLog: a fresh history after a reset dump
+static void restartRecording() {
+    if (reason == FLIGHT_RESET) {
+        flightLog.begin(flightLog.records, FLIGHT_RECORD_SLOTS, currentBootId); // Start this boot's history
+    } else {
+        flightLog.resume();
+    }
+}
+
+// Upload stalled (MQTT down): copy the frozen dump to PSRAM for later and
+// record again. Without room for the copy the dump is dropped instead.
+static void parkUpload() {
+    size_t bytes = flightLog.count * sizeof(FlightRecord);
+    FlightRecord* copy = (FlightRecord*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (copy) {
+        for (uint32_t i = 0; i < flightLog.count; i++) copy[i] = flightLog.at(i);
+        parked.begin(copy, flightLog.count, flightLog.bootId);
+        parked.count = flightLog.count; // Full ring, oldest first from slot 0
+        parked.frozen = true;
+        logPrintf("Flight recorder: dump %u waits for MQTT, recording again\n", dumpId);
+    } else {
+        logPrintf("Flight recorder: dump %u dropped, MQTT down and no PSRAM to keep it\n", dumpId);
+        dumpId++;
+    }
+    restartRecording();
+}
+
+void flightBegin(uint32_t bootId, bool warmReset) {
+    currentBootId = bootId;
+#if CONFIG_SPIRAM_ALLOW_NOINIT_SEG_EXTERNAL_MEMORY
+    if (warmReset && flightLog.intact(noinitRecords, FLIGHT_RECORD_SLOTS) && flightLog.count) {
+        // Upload the previous boot's history before recording this one
+        flightLog.freeze(flightLog.lastPassUs, FLIGHT_RESET);
+        reason = FLIGHT_RESET;
+        chunk = 0;
+        lastChunkMs = millis();
+        state = FLIGHT_UPLOADING;
+        logPrintf("Flight recorder: %lu records from before the reset\n", (unsigned long)flightLog.count);
+        return;
+    }
+    flightLog.begin(noinitRecords, FLIGHT_RECORD_SLOTS, bootId);
+#else
+    FlightRecord* storage = (FlightRecord*)bootAlloc(FLIGHT_RECORD_SLOTS * sizeof(FlightRecord));
+    flightLog.begin(storage, FLIGHT_RECORD_SLOTS, bootId);
+    if (!storage) logPrintf("Flight recorder disabled: no buffer\n");
+#endif
+}
+
+bool flightTrigger(uint8_t why) {
+    if (state != FLIGHT_RECORDING || parked.records || !flightLog.capacity) return false;
+    unsigned long now = millis();
+    if (why == FLIGHT_ANOMALY) {
+        if (anomalySeen && now - lastAnomalyMs < FLIGHT_ANOMALY_MIN_INTERVAL_MS) return false;
+        anomalySeen = true;
+        lastAnomalyMs = now;
+    }
+    reason = why;
+    flightLog.record(micros(), FR_MARK, why); // The trigger itself; the freeze adds a second mark
+    freezeAtMs = now + (why == FLIGHT_ANOMALY ? FLIGHT_POST_TRIGGER_MS : 0);
+    state = FLIGHT_ARMED;
+    return true;
+}
+
+void flightPoll(FlightChunkSink sink) {
+    if (state == FLIGHT_ARMED) {
+        if ((long)(millis() - freezeAtMs) < 0) return;
+        flightLog.freeze(micros(), reason);
+        chunk = 0;
+        lastChunkMs = millis();
+        state = FLIGHT_UPLOADING;
+    }
+    FlightLog* dump = state == FLIGHT_UPLOADING ? &flightLog : parked.records ? &parked : nullptr;
+    if (!dump) return;
+
+    uint8_t data[FLIGHT_CHUNK_BYTES];
+    size_t length = encodeFlightChunk(*dump, dumpId, reason, chunk, data, sizeof(data));
+    if (length && !sink(data, length)) {
+        // Not connected: same chunk next pass, but do not stop recording for it
+        if (dump == &flightLog && millis() - lastChunkMs >= FLIGHT_UPLOAD_TIMEOUT_MS) {
+            parkUpload();
+            state = FLIGHT_RECORDING;
+        }
+        return;
+    }
+    if (length) {
+        chunk++;
+        lastChunkMs = millis();
+    }
+    if (chunk < flightChunkCount(*dump, FLIGHT_CHUNK_BYTES)) return;
+
+    logPrintf("Flight recorder: dump %u (%s) uploaded, %lu chunks\n", dumpId, flightReasonName(reason),
+                  (unsigned long)chunk);
+    dumpId++;
+    if (dump == &parked) {
+        heap_caps_free(parked.records);
+        parked = {};
+        return;
+    }
+    state = FLIGHT_RECORDING;
+    restartRecording();
+}
@@ -0,0 +1,188 @@
+#include "http_uploader.h"
+#include <WiFi.h>
+#include <HTTPClient.h>
+#include "deflate.h"
+#include "message_ring.h"
+#include "memory_mode.h"
+#include "telemetry.h"
+#include "serial_stream.h"
+
+const uint32_t UPLOAD_TASK_STACK = 6144;
+const UBaseType_t UPLOAD_TASK_PRIORITY = 1; // Below WiFi/lwIP on core 0
+const BaseType_t UPLOAD_TASK_CORE = 0;      // loop() runs on core 1
+const uint32_t UPLOAD_POLL_MS = 500;
+
+// Who is sending the backlog: the oldest records are copied out, sent, and
+// only then released, so one owner at a time (claimed under ringLock)
+enum BacklogOwner { OWNER_NONE, OWNER_TASK, OWNER_LOOP };
+
+// A mutex, not a spinlock: peek() copies up to a batch (4 KB) under it
+static StaticSemaphore_t ringLockBuffer;
+static SemaphoreHandle_t ringLock = nullptr;
+static MessageRing ring = {};
+static TransportSelector selector;
+static UploadStats stats = {};             // Written by the task only
+static uint32_t drained = 0;               // Sent over MQTT by loop()
+static volatile bool httpActive = false;
+static BacklogOwner owner = OWNER_NONE;    // Guarded by ringLock
+static unsigned long lastHeartbeatQueued = 0;
+static bool heartbeatQueued = false;
+static const char* uploadUrl = nullptr;
+
+static uint8_t* batch = nullptr;           // Raw NDJSON
+static uint8_t* packed = nullptr;          // Compressed
+static DeflateState* deflateState = nullptr;
+
+static void lockRing() {
+    xSemaphoreTake(ringLock, portMAX_DELAY);
+}
+
+static void unlockRing() {
+    xSemaphoreGive(ringLock);
+}
+
+static void uploadTask(void*) {
+    HTTPClient http;
+    http.setReuse(true); // HTTP/1.1 keep-alive: one TCP connection for the whole backlog
+    http.setConnectTimeout(UPLOAD_TIMEOUT_MS);
+    http.setTimeout(UPLOAD_TIMEOUT_MS);
+    uint32_t backoffMs = 0;
+    unsigned long lastPost = 0;
+    bool open = false;
+
+    for (;;) {
+        // Claim the backlog and copy a batch out; compress and send unlocked
+        uint32_t endSeq = 0;
+        size_t rawLength = 0;
+        bool claimed = false;
+        if (httpActive && WiFi.status() == WL_CONNECTED) {
+            lockRing();
+            claimed = owner == OWNER_NONE && !ring.empty();
+            if (claimed) {
+                owner = OWNER_TASK;
+                rawLength = ring.peek(batch, UPLOAD_BATCH_BYTES, '\n', &endSeq);
+            }
+            unlockRing();
+        }
+
+        if (!claimed) {
+            if (open && millis() - lastPost > UPLOAD_IDLE_CLOSE_MS) {
+                WiFiClient* stream = http.getStreamPtr();
+                if (stream) stream->stop();
+                open = false;
+            }
+            vTaskDelay(pdMS_TO_TICKS(UPLOAD_POLL_MS));
+            continue;
+        }
+
+        size_t packedLength = deflateCompress(batch, rawLength, packed, deflateBound(UPLOAD_BATCH_BYTES), *deflateState);
+
+        http.begin(uploadUrl);
+        http.addHeader("Content-Type", "application/x-ndjson");
+        http.addHeader("Content-Encoding", "deflate");
+        int code = http.POST(packed, packedLength);
+        http.end(); // Keeps the connection (setReuse) unless the server closed it
+        open = true;
+        lastPost = millis();
+
+        bool ok = code >= 200 && code < 300;
+        // Records overwritten during the POST were counted as dropped
+        lockRing();
+        uint32_t firstSeq = ring.firstSeq;
+        if (ok) ring.pop(endSeq);
+        uint32_t released = ring.firstSeq - firstSeq;
+        owner = OWNER_NONE;
+        unlockRing();
+
+        if (ok) {
+            stats.sent += released;
+            stats.batches++;
+            stats.rawBytes += rawLength;
+            stats.wireBytes += packedLength;
+            backoffMs = 0;
+        } else {
+            stats.failures++;
+            backoffMs = backoffMs ? min(backoffMs * 2, UPLOAD_RETRY_MAX_MS) : 1000;
+            logPrintf("Upload: POST failed (%d), retry in %u ms\n", code, backoffMs);
+        }
+        if (backoffMs) vTaskDelay(pdMS_TO_TICKS(backoffMs));
+    }
+}
+
+void uploaderBegin(const char* url) {
+    uploadUrl = url;
+    selector.reset(millis());
+    ringLock = xSemaphoreCreateMutexStatic(&ringLockBuffer);
+    uint8_t* storage = (uint8_t*)bootAlloc(UPLOAD_BUFFER_BYTES);
+    batch = (uint8_t*)bootAlloc(UPLOAD_BATCH_BYTES);
+    packed = (uint8_t*)bootAlloc(deflateBound(UPLOAD_BATCH_BYTES));
+    deflateState = (DeflateState*)bootAlloc(sizeof(DeflateState));
+    if (!storage || !batch || !packed || !deflateState) {
+        logPrintf("Upload: no buffer, telemetry is dropped while MQTT is down\n");
+        return;
+    }
+    ring.begin(storage, UPLOAD_BUFFER_BYTES);
+    if (xTaskCreatePinnedToCore(uploadTask, "http_up", UPLOAD_TASK_STACK, nullptr, UPLOAD_TASK_PRIORITY, nullptr,
+                                UPLOAD_TASK_CORE) != pdPASS) {
+        logPrintf("Upload: task not started\n");
+    }
+}
+
+Transport uploaderUpdate(unsigned long now, bool mqttConnected) {
+    Transport active = selector.update(now, mqttConnected);
+    if (httpActive != (active == TRANSPORT_HTTP)) {
+        logPrintf("Telemetry transport: %s\n", transportName(active));
+    }
+    httpActive = active == TRANSPORT_HTTP;
+    return active;
+}
+
+bool uploaderEnqueue(const char* json, size_t length, bool heartbeat, unsigned long now) {
+    if (!ring.capacity) return false;
+    if (heartbeat && heartbeatQueued && now - lastHeartbeatQueued < UPLOAD_HEARTBEAT_THIN_MS) return false;
+    if (heartbeat) {
+        heartbeatQueued = true;
+        lastHeartbeatQueued = now;
+    }
+    lockRing();
+    bool queued = ring.push((const uint8_t*)json, length);
+    unlockRing();
+    return queued;
+}
+
+bool uploaderDrainOne(UploadSink sink) {
+    if (!ring.capacity || httpActive) return false; // The task owns the backlog
+    char message[TELEMETRY_MAX_BYTES + 1];
+    uint32_t endSeq;
+    size_t length = 0;
+    lockRing();
+    uint32_t firstSeq = ring.firstSeq;
+    bool claimed = owner == OWNER_NONE;
+    if (claimed) {
+        owner = OWNER_LOOP;
+        length = ring.peek((uint8_t*)message, sizeof(message), '\0', &endSeq);
+    }
+    unlockRing();
+    if (!claimed) return false;
+    // peek() copies whole records while they fit: keep only the first
+    bool sent = length && sink(message, strlen(message));
+    lockRing();
+    if (sent) ring.pop(firstSeq + 1);
+    owner = OWNER_NONE;
+    unlockRing();
+    if (sent) drained++;
+    return sent;
+}
+
+void uploaderStats(UploadStats& out) {
+    out = stats;
+    out.sent += drained;
+    if (ringLock) {
+        lockRing();
+        out.queued = ring.count();
+        out.dropped = ring.dropped;
+        unlockRing();
+    }
+    out.transport = selector.active;
+    out.failovers = selector.failovers;
+}
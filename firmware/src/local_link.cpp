@@ -0,0 +1,322 @@
+#include "local_link.h"
+#include "memory_mode.h"
+#include "serial_stream.h"
+
+#if STREETLIGHT_LOCAL_LINK == LOCAL_LINK_ESPNOW
+#include <WiFi.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+#else
+#include <driver/uart.h>
+#endif
+
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_POLE
+// No local link
+#elif STREETLIGHT_LOCAL_LINK == LOCAL_LINK_ESPNOW
+
+const int ESPNOW_RX_QUEUE_DEPTH = 16;  // A diagnostics message is 7 frames
+const int ESPNOW_PEERS = ESP_NOW_MAX_TOTAL_PEER_NUM - 1; // Broadcast takes one; later neighbours get broadcast
+static const uint8_t BROADCAST_MAC[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+struct EspNowFrame {
+    uint8_t mac[6];
+    uint8_t length;
+    uint8_t data[LOCAL_FRAME_MAX];
+};
+
+// Link for gateway.h over ESP-NOW: link address -> MAC from received frames
+struct EspNowLink {
+    QueueHandle_t rx;
+    volatile int sending;                // esp_now_send() not yet confirmed by the send callback
+    uint8_t peerAddress[ESPNOW_PEERS];
+    uint8_t peerMac[ESPNOW_PEERS][6];
+    int peerCount;
+
+    bool begin();
+    bool send(uint8_t to, const uint8_t* frame, size_t length);
+    size_t receive(uint8_t* frame, size_t capacity);
+    bool busy() { return sending > 0; }
+    void learn(uint8_t address, const uint8_t* mac);
+    const uint8_t* macFor(uint8_t address) const;
+};
+
+static EspNowLink localLink;
+
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 3
+static void onEspNowRecv(const esp_now_recv_info_t* info, const uint8_t* data, int length) {
+    const uint8_t* mac = info->src_addr;
+#else
+static void onEspNowRecv(const uint8_t* mac, const uint8_t* data, int length) {
+#endif
+    if (length <= 0 || length > (int)LOCAL_FRAME_MAX) return;
+    EspNowFrame f;
+    memcpy(f.mac, mac, 6);
+    f.length = (uint8_t)length;
+    memcpy(f.data, data, length);
+    xQueueSend(localLink.rx, &f, 0); // Full: dropped, the sender retransmits
+}
+
+static void onEspNowSent(const uint8_t*, esp_now_send_status_t) {
+    if (localLink.sending > 0) localLink.sending--;
+}
+
+bool EspNowLink::begin() {
+    rx = xQueueCreate(ESPNOW_RX_QUEUE_DEPTH, sizeof(EspNowFrame));
+    sending = 0;
+    peerCount = 0;
+    WiFi.mode(WIFI_STA);
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_NODE
+    // Not associated: stay on the gateway's channel
+    esp_wifi_set_promiscuous(true);
+    esp_wifi_set_channel(LOCAL_LINK_CHANNEL, WIFI_SECOND_CHAN_NONE);
+    esp_wifi_set_promiscuous(false);
+#endif
+    if (!rx || esp_now_init() != ESP_OK) return false;
+    esp_now_register_recv_cb(onEspNowRecv);
+    esp_now_register_send_cb(onEspNowSent);
+    esp_now_peer_info_t peer = {};
+    memcpy(peer.peer_addr, BROADCAST_MAC, 6);
+    peer.ifidx = WIFI_IF_STA;
+    return esp_now_add_peer(&peer) == ESP_OK;
+}
+
+void EspNowLink::learn(uint8_t address, const uint8_t* mac) {
+    for (int i = 0; i < peerCount; i++) {
+        if (peerAddress[i] != address) continue;
+        if (memcmp(peerMac[i], mac, 6) == 0) return;
+        esp_now_del_peer(peerMac[i]); // Board swapped: same address, new MAC
+        memcpy(peerMac[i], mac, 6);
+        esp_now_peer_info_t peer = {};
+        memcpy(peer.peer_addr, mac, 6);
+        peer.ifidx = WIFI_IF_STA;
+        esp_now_add_peer(&peer);
+        return;
+    }
+    if (peerCount == ESPNOW_PEERS) return; // Stays on broadcast
+    esp_now_peer_info_t peer = {};
+    memcpy(peer.peer_addr, mac, 6);
+    peer.ifidx = WIFI_IF_STA;
+    if (esp_now_add_peer(&peer) != ESP_OK) return;
+    peerAddress[peerCount] = address;
+    memcpy(peerMac[peerCount], mac, 6);
+    peerCount++;
+}
+
+const uint8_t* EspNowLink::macFor(uint8_t address) const {
+    for (int i = 0; i < peerCount; i++) {
+        if (peerAddress[i] == address) return peerMac[i];
+    }
+    return BROADCAST_MAC;
+}
+
+bool EspNowLink::send(uint8_t to, const uint8_t* frame, size_t length) {
+    sending++;
+    if (esp_now_send(macFor(to), frame, length) == ESP_OK) return true;
+    sending--;
+    return false;
+}
+
+size_t EspNowLink::receive(uint8_t* frame, size_t capacity) {
+    EspNowFrame f;
+    if (xQueueReceive(rx, &f, 0) != pdTRUE || f.length > capacity) return 0;
+    // Uplinks name their sender; anything else comes from the gateway.
+    // A neighbour only needs the gateway's MAC, the gateway its neighbours'
+    LocalFrame decoded;
+    if (decodeLocalFrame(f.data, f.length, decoded)) {
+        bool fromNode = decoded.type == LF_UPLINK || decoded.type == LF_DOWN_ACK;
+        if (fromNode == (STREETLIGHT_ROLE == STREETLIGHT_ROLE_GATEWAY)) {
+            learn(fromNode ? decoded.node : LOCAL_GATEWAY_ID, f.mac);
+        }
+    }
+    memcpy(frame, f.data, f.length);
+    return f.length;
+}
+
+#else
+
+const uart_port_t RS485_UART = UART_NUM_1;
+const size_t RS485_TX_BUFFER = 8 * LOCAL_WIRE_MAX;  // A diagnostics message plus acks, written at once
+const uint32_t RS485_BYTE_US = 10000000 / LOCAL_RS485_BAUD + 1;
+
+// Link for gateway.h over a half-duplex RS-485 bus (everyone hears every frame)
+struct Rs485Link {
+    uint8_t rxWire[LOCAL_WIRE_MAX];
+    size_t rxLength;
+    bool rxOverflow;
+    uint8_t tx[RS485_TX_BUFFER];          // COBS frames waiting for the bus
+    size_t txLength;
+    uint32_t lastActivityUs;              // Last byte heard or sent
+    int slot;                             // Backoff slot for this wait, -1 = none drawn
+
+    bool begin();
+    bool send(uint8_t to, const uint8_t* frame, size_t length);
+    size_t receive(uint8_t* frame, size_t capacity);
+    bool busy();
+    void flush();
+};
+
+static Rs485Link localLink;
+
+bool Rs485Link::begin() {
+    rxLength = txLength = 0;
+    rxOverflow = false;
+    slot = -1;
+    lastActivityUs = micros();
+    Serial1.setTxBufferSize(RS485_TX_BUFFER); // write() copies, never waits for the wire
+    Serial1.begin(LOCAL_RS485_BAUD, SERIAL_8N1, LOCAL_RS485_RX_PIN, LOCAL_RS485_TX_PIN);
+    return uart_set_pin(RS485_UART, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, LOCAL_RS485_DE_PIN,
+                        UART_PIN_NO_CHANGE) == ESP_OK &&
+           uart_set_mode(RS485_UART, UART_MODE_RS485_HALF_DUPLEX) == ESP_OK;
+}
+
+bool Rs485Link::send(uint8_t, const uint8_t* frame, size_t length) {
+    if (txLength + LOCAL_WIRE_MAX > sizeof(tx)) return false;
+    txLength += cobsEncode(frame, length, tx + txLength);
+    tx[txLength++] = 0;
+    flush();
+    return true;
+}
+
+// Listen before talk: idle LOCAL_BUS_IDLE_BYTES byte times plus a slot
+// (local_frame.h), measured from the last byte this loop saw, so it is as
+// coarse as one loop pass. Queued frames go out in one write.
+void Rs485Link::flush() {
+    if (!txLength) return;
+    if (Serial1.available()) return; // Someone is talking
+    if (uart_wait_tx_done(RS485_UART, 0) != ESP_OK) return; // Our last write still on the wire
+    if (slot < 0) {
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_GATEWAY
+        slot = 0;
+#else
+        slot = 1 + esp_random() % (LOCAL_BUS_SLOTS - 1);
+#endif
+    }
+    if (micros() - lastActivityUs < (LOCAL_BUS_IDLE_BYTES + slot) * RS485_BYTE_US) return;
+    Serial1.write(tx, txLength);
+    txLength = 0;
+    slot = -1;
+    lastActivityUs = micros();
+}
+
+bool Rs485Link::busy() {
+    flush();
+    return txLength || uart_wait_tx_done(RS485_UART, 0) != ESP_OK;
+}
+
+size_t Rs485Link::receive(uint8_t* frame, size_t capacity) {
+    while (Serial1.available()) {
+        uint8_t b = Serial1.read();
+        lastActivityUs = micros();
+        slot = -1; // Bus was busy: a fresh slot for the next idle period
+        if (b) {
+            if (rxLength < sizeof(rxWire)) rxWire[rxLength++] = b;
+            else rxOverflow = true;
+            continue;
+        }
+        size_t wire = rxLength;
+        bool overflow = rxOverflow;
+        rxLength = 0;
+        rxOverflow = false;
+        if (!wire || overflow || wire > LOCAL_WIRE_MAX || capacity < LOCAL_FRAME_MAX + 1) continue;
+        size_t length = cobsDecode(rxWire, wire, frame);
+        if (length) return length;
+    }
+    flush();
+    return 0;
+}
+
+#endif
+
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_NODE
+static LocalNodeT<decltype(localLink)> node;
+#elif STREETLIGHT_ROLE == STREETLIGHT_ROLE_GATEWAY
+static GatewayT<decltype(localLink)> gateway;
+#endif
+static bool active = false;
+
+bool localBegin(int deviceNumber, uint32_t seed) {
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_POLE
+    (void)deviceNumber;
+    (void)seed;
+    return false;
+#else
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_NODE
+    const size_t bytes = LOCAL_NODE_STORAGE_BYTES;
+#else
+    const size_t bytes = GATEWAY_STORAGE_BYTES;
+#endif
+    uint8_t* storage = (uint8_t*)bootAlloc(bytes);
+    if (!storage || !localLink.begin()) {
+        logPrintf("Local link: not started, no buffer or link\n");
+        return false;
+    }
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_NODE
+    active = node.begin(&localLink, (uint8_t)deviceNumber, storage, bytes, seed);
+#else
+    active = gateway.begin(&localLink, deviceNumber, storage, bytes, seed);
+#endif
+    logPrintf("Local link: %s, id %d\n", localRoleName(STREETLIGHT_ROLE), deviceNumber);
+    return active;
+#endif
+}
+
+bool localActive() {
+    return active;
+}
+
+bool localUplink(const char* json, size_t length, uint8_t flags) {
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_NODE
+    return active && node.enqueue(json, length, flags);
+#else
+    (void)json;
+    (void)length;
+    (void)flags;
+    return false;
+#endif
+}
+
+bool localDownlink(uint8_t to, const uint8_t* json, size_t length) {
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_GATEWAY
+    return active && gateway.queueDownlink(to, json, length);
+#else
+    (void)to;
+    (void)json;
+    (void)length;
+    return false;
+#endif
+}
+
+void localPoll(uint32_t now, LocalPublish publish, LocalCommandSink onCommand) {
+    if (!active) return;
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_NODE
+    (void)publish;
+    node.poll(now, onCommand);
+#elif STREETLIGHT_ROLE == STREETLIGHT_ROLE_GATEWAY
+    (void)onCommand;
+    gateway.poll(now, publish);
+#endif
+}
+
+void localSubscriptions(LocalSubscribe subscribe) {
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_GATEWAY
+    if (active) gateway.syncSubscriptions(subscribe);
+#else
+    (void)subscribe;
+#endif
+}
+
+void localSubscriptionsLost() {
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_GATEWAY
+    if (active) gateway.subscriptionsLost();
+#endif
+}
+
+void localStats(LocalLinkStats& out) {
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_NODE
+    out = node.stats;
+#elif STREETLIGHT_ROLE == STREETLIGHT_ROLE_GATEWAY
+    out = gateway.stats;
+#else
+    out = {};
+#endif
+}
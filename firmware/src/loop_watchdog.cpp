@@ -0,0 +1,63 @@
+#include "loop_watchdog.h"
+#include "esp_timer.h"
+#include "esp_task_wdt.h"
+
+const uint32_t STALL_MAGIC = 0x57445447; // "WDTG"
+
+LoopSlo loopSlo;
+
+// Written by the monitor during a stall, read back after the WDT reset
+RTC_NOINIT_ATTR static uint32_t rtcStallMagic;
+RTC_NOINIT_ATTR static uint32_t rtcStallStage;
+
+static esp_timer_handle_t monitorTimer = nullptr;
+static int resetStage = -1;
+
+// esp_timer task: sees the stage the loop is stuck in
+static void onMonitorTick(void*) {
+    loopSlo.poll((uint32_t)esp_timer_get_time());
+    if (loopSlo.overrunning) {
+        rtcStallStage = loopSlo.overrunStage;
+        rtcStallMagic = STALL_MAGIC;
+    }
+}
+
+void watchdogBegin() {
+    if (rtcStallMagic == STALL_MAGIC && esp_reset_reason() == ESP_RST_TASK_WDT) {
+        resetStage = (int)rtcStallStage;
+    }
+    rtcStallMagic = 0;
+
+    loopSlo.begin(LOOP_BUDGET_MS * 1000UL, (uint32_t)esp_timer_get_time());
+
+    // Poll at a quarter of the budget so the stalled stage is caught early
+    esp_timer_create_args_t args = {};
+    args.callback = onMonitorTick;
+    args.name = "loop_slo";
+    if (esp_timer_create(&args, &monitorTimer) == ESP_OK) {
+        esp_timer_start_periodic(monitorTimer, LOOP_BUDGET_MS * 1000ULL / 4);
+    }
+
+    // Task WDT: hard limit, panic -> reset. Idle task of core 0 stays watched.
+#if ESP_IDF_VERSION_MAJOR >= 5
+    esp_task_wdt_config_t config = {};
+    config.timeout_ms = LOOP_HARD_LIMIT_S * 1000;
+    config.idle_core_mask = 1 << 0;
+    config.trigger_panic = true;
+    esp_task_wdt_reconfigure(&config);
+#else
+    esp_task_wdt_init(LOOP_HARD_LIMIT_S, true); // Reconfigures when already running
+#endif
+    esp_task_wdt_add(NULL);
+}
+
+bool watchdogStep() {
+    esp_task_wdt_reset();
+    bool violated = loopSlo.step((uint32_t)esp_timer_get_time(), millis());
+    if (rtcStallMagic == STALL_MAGIC) rtcStallMagic = 0; // Recovered before the hard limit
+    return violated;
+}
+
+int watchdogResetStage() {
+    return resetStage;
+}
@@ -8,14 +8,39 @@
  * - PWM: 100% Brightness on Motion, 30% on Standby (Night only).
  * - Connectivity: WiFi, MQTT (GCP), HTTP (Local).
  * - NETWORK FIX: Reconnects only every 5s to prevent freezing existing logic.
+ * - BOOT: Light first (PWM within ms of reset), network comes up from loop().
+ *
+ * The control logic itself lives in lib/StreetLightCore (hardware-free, also
+ * built for the host by [env:native]); this file only wires it to pins/network.
  */
 
 #include <Arduino.h>
+#include <new>
 #include <WiFi.h>
+#include "esp_wifi.h"
 #include <HTTPClient.h>
 #include <PubSubClient.h>
 #include <ArduinoJson.h>
 #include "secrets.h"
+#include "timekeeping.h"
+#include "memory_mode.h"
+#include "loop_watchdog.h"
+#include "profiler.h"
+#include "ota_delta.h"
+#include "http_uploader.h"
+#include "flight_recorder.h"
+#include "serial_stream.h"
+#include "local_link.h"
+#include "tls_client.h"
+#include "broker_address.h"
+#include "light_control.h"
+#include "channel_bank.h"
+#include "telemetry.h"
+#include "command.h"
+#include "checkpoint.h"
+#include "diagnostics.h"
+#include "radio_schedule.h"
+#include "mqtt_link.h"
 
 // === WI-FI CONFIGURATION ===
 const char* ssid = WIFI_SSID;
@@ -23,268 +48,760 @@ const char* password = WIFI_PASSWORD;
 
 
 // === LOCAL HTTP CONFIGURATION ===
-const char* serverUrl = "http://10.174.2.145:5000/data"; 
+// Bulk upload of buffered telemetry while MQTT is down (http_uploader.h)
+const char* serverUrl = "http://10.174.2.145:5000/data/1";
 
 // === MQTT CONFIGURATION (GCP VM) ===
 const char* mqtt_server = MQTT_SERVER_IP;
 
+#if STREETLIGHT_MQTT_TLS
+const int mqtt_port = 8883; // TLS (env streetlight_tls), CA from secrets.h
+#ifdef MQTT_TLS_HOSTNAME
+const char* mqtt_tls_hostname = MQTT_TLS_HOSTNAME; // Certificate name when MQTT_SERVER_IP is an address
+#else
+const char* mqtt_tls_hostname = nullptr;
+#endif
+#else
 const int mqtt_port = 1883;
+#endif
+// A connect runs on the loop (plain TCP: the TCP connect too), so each
+// blocking step is capped under the watchdog's hard limit; the broker's
+// name, if it has one, is looked up off the loop (broker_address.h)
+const uint32_t MQTT_TCP_CONNECT_TIMEOUT_S = 2;  // WiFiClient default 3 s
+const uint16_t MQTT_SOCKET_TIMEOUT_S = 2;       // CONNACK wait; PubSubClient default 15 s
+static_assert(MQTT_TCP_CONNECT_TIMEOUT_S + MQTT_SOCKET_TIMEOUT_S < LOOP_HARD_LIMIT_S,
+              "an MQTT connect must not outlast the loop watchdog");
 const char* mqtt_topic = "smartcity/streetlight/1/data";
+const char* mqtt_command_topic = "smartcity/streetlight/1/command";
+const char* mqtt_diag_topic = "smartcity/streetlight/1/diag";
+const char* mqtt_profile_topic = "smartcity/streetlight/1/profile";
+const char* mqtt_ota_topic = "smartcity/streetlight/1/ota";
+const char* mqtt_flight_topic = "smartcity/streetlight/1/flight";
 const char* device_id = "streetlight-001";
 
+// === GATEWAY AGGREGATION (local_link.h: -DSTREETLIGHT_ROLE=..., envs streetlight_gateway/_node) ===
+// The gateway also takes its neighbours' commands (a subscription per known
+// neighbour) and publishes their batches
+const char* mqtt_batch_topic = "smartcity/streetlight/1/batch";
+const char* mqtt_neighbour_command_topic = "smartcity/streetlight/%u/command";
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_NODE
+const int device_number = STREETLIGHT_NODE_ID; // Backend sees its messages under this number
+#else
+const int device_number = 1;                   // As in the topics above
+#endif
+
+// === OTA SERVER (optional, ota_server/: -DOTA_SERVER_URL=\"http://host:8070\") ===
+#ifdef OTA_SERVER_URL
+const char* ota_server_url = OTA_SERVER_URL;
+#else
+const char* ota_server_url = nullptr; // Updates only by the "ota" command
+#endif
+
+// === SNTP CONFIGURATION ===
+const char* ntp_server_1 = "pool.ntp.org";
+const char* ntp_server_2 = "time.google.com";
+
 // === PIN CONFIGURATION ===
 const int PIR_PIN = A2;     
 const int MOSFET_PIN = 14; 
 const int LDR_PIN = 4;      
 const int LED_PIN = 46;     
 
+// === LAMP HEADS (one LEDC channel + PIR each; LDR and network shared) ===
+// -DSTREETLIGHT_CHANNELS=N (1-8); head 0 is MOSFET_PIN/PIR_PIN. Override the
+// pin lists to match the wiring, e.g. -DSTREETLIGHT_HEAD_PWM_PINS="{14,21}"
+#ifndef STREETLIGHT_CHANNELS
+#define STREETLIGHT_CHANNELS 1
+#endif
+#ifndef STREETLIGHT_HEAD_PWM_PINS
+#define STREETLIGHT_HEAD_PWM_PINS {MOSFET_PIN, 21, 47, 48, 38, 39, 40, 41}
+#endif
+#ifndef STREETLIGHT_HEAD_PIR_PINS
+#define STREETLIGHT_HEAD_PIR_PINS {PIR_PIN, 5, 6, 7, 15, 16, 17, 18}
+#endif
+static_assert(STREETLIGHT_CHANNELS >= 1 && STREETLIGHT_CHANNELS <= MAX_CHANNELS, "1-8 lamp heads");
+const int HEAD_PWM_PINS[MAX_CHANNELS] = STREETLIGHT_HEAD_PWM_PINS;
+const int HEAD_PIR_PINS[MAX_CHANNELS] = STREETLIGHT_HEAD_PIR_PINS;
+
 // === PWM CONFIGURATION ===
-const int PWM_CHANNEL = 0;
+const int PWM_CHANNEL = 0; // Head i uses PWM_CHANNEL + i (core 2.x)
 const int PWM_FREQ = 5000;    
 const int PWM_RESOLUTION = 8; 
 
+// === CONTROLLER VARIANT ===
+// Street type is picked at build time (-DSTREETLIGHT_POLICY=..., see the
+// streetlight_* envs in platformio.ini); policies live in light_control.h
+#ifndef STREETLIGHT_POLICY
+#define STREETLIGHT_POLICY DefaultPolicy
+#endif
+
+// === RADIO POWER SAVE ===
+// 1: modem sleep between planned publishes (radio_schedule.h); 0: radio
+// always awake, same accounting (baseline for the energy/latency trade-off)
+#ifndef STREETLIGHT_RADIO_SLEEP
+#define STREETLIGHT_RADIO_SLEEP 1
+#endif
+
 // === TIMING CONSTANTS ===
-const unsigned long LIGHT_TIMER_MS = 30000;   // 30 seconds light duration
-const unsigned long REPORT_INTERVAL_MS = 2000;
-const unsigned long RECONNECT_INTERVAL_MS = 5000; // Try reconnecting every 5s
-const float MAX_LED_POWER_W = 20.0; // Maximum power consumption of LED strip at 100%
+// (Control timings: see light_control.h, MQTT reconnect: mqtt_link.h)
+const unsigned long SLO_REPORT_MIN_MS = 10000;    // Early diagnostics after a loop overrun, at most every 10s
 
 // === STATE VARIABLES ===
-unsigned long lastMotionSeenTime = 0;  
-unsigned long lastReportTime = 0;
-unsigned long lastLdrTime = 0;
-unsigned long lastReconnectAttempt = 0; // For non-blocking MQTT
-
-bool isNightMode = false;
-volatile bool motionDetectedFlag = false; // Volatile for ISR 
-
-// Sliding Window for LDR
-const int WINDOW_SIZE = 10;
-int ldrReadings[WINDOW_SIZE];
-int ldrIndex = 0;
-long ldrSum = 0;
-
-// State tracking for event-driven reporting
-bool lastSentMotionState = false;
-bool lastSentNightMode = false;
-
-// Forward declaration for helper function
-void sendTelemetry(bool isNightMode, bool isMotionActive, int pwmValue, int ldrValue, long countdownSec);
-
-// === PIR Interrupt Handler ===
-void IRAM_ATTR onMotionDetected() {
-    motionDetectedFlag = true;
+LightControllerT<STREETLIGHT_POLICY> controller; // LDR window, "any head" motion timer, report state
+ChannelBank heads;                      // Per-head motion hold and PWM
+RadioScheduler radio;                   // WiFi modem sleep around planned publishes
+Transport telemetryTransport = TRANSPORT_MQTT; // MQTT live, or HTTP bulk upload (failover)
+unsigned long lastDiagTime = 0;         // Last diagnostics message
+bool sloReportPending = false;          // Loop overran since the last diagnostics
+unsigned long lastOtaCheck = 0;         // Last OTA server check-in
+bool otaCheckedIn = false;              // At least one check-in this boot
+int recordedPwm[MAX_CHANNELS] = {-1, -1, -1, -1, -1, -1, -1, -1}; // Flight recorder logs PWM changes only
+
+volatile uint8_t motionPendingHeads = 0;  // PIR edges since the last pass, one bit per head
+portMUX_TYPE motionMux = portMUX_INITIALIZER_UNLOCKED;
+volatile uint32_t motionEdgeUs = 0;       // micros() of the last PIR edge
+volatile bool ldrEdgeFlag = false;        // LDR pin changed (wakes slow-phase sampling)
+volatile bool reportRequested = false;    // Set by the "report" command
+
+// Per-boot message numbering so the backend can detect gaps and duplicates
+uint32_t bootId = 0;        // Random per boot, distinguishes seq restarts
+uint32_t telemetrySeq = 0;  // Incremented for every message, sent or not
+
+// Latency trace for the motion path (all micros(), relative to the PIR edge)
+struct MotionTrace {
+    bool pending;        // Edge seen, not yet reported
+    uint32_t edgeUs;     // ISR edge
+    uint32_t decisionUs; // Loop consumed the flag
+    uint32_t pwmUs;      // First PWM write after the decision
+};
+MotionTrace motionTrace = {false, 0, 0, 0};
+
+// Controller state in RTC slow memory: kept across warm resets, not zeroed at boot
+RTC_NOINIT_ATTR ControllerCheckpoint<STREETLIGHT_POLICY> rtcCheckpoint;
+
+// Boot phase timestamps, sent with the first published message after reset
+TelemetryBoot bootTimeline = {};
+bool bootReported = false;     // A message got out this boot
+bool bootTimelineTried = false; // boot_tl attached to a message (once, sent or not)
+
+// Telemetry and diagnostics are serialized from loop(), never at once: one
+// JSON document and payload buffer for both, from the boot arena instead of
+// ~3.5 KB of loopTask's stack
+struct PublishScratch {
+    StaticJsonDocument<DIAG_JSON_CAPACITY> doc;
+    char payload[DIAG_MAX_BYTES > TELEMETRY_MAX_BYTES ? DIAG_MAX_BYTES : TELEMETRY_MAX_BYTES];
+};
+static_assert(DIAG_JSON_CAPACITY >= TELEMETRY_JSON_CAPACITY, "telemetry shares the diagnostics document");
+static_assert(sizeof(PublishScratch) < BOOT_ARENA_INTERNAL_BYTES / 2, "first boot allocation must always fit");
+PublishScratch* scratch = nullptr;
+
+// Forward declarations for helper functions
+void writeLight(const LightOutput& out);
+void sendTelemetry(MessageClass msgClass, uint64_t captureUs, const LightOutput& out);
+void sendDiagnostics();
+bool sendProfileChunk(const char* text, size_t length);
+bool sendOtaStatus(const char* json, size_t length);
+bool publishBuffered(const char* json, size_t length);
+bool sendFlightChunk(const uint8_t* data, size_t length);
+bool publishBatch(const char* json, size_t length);
+bool subscribeNeighbour(uint8_t node, bool subscribe);
+void handleCommand(const uint8_t* payload, size_t length);
+void applyRadioMode(RadioMode mode);
+
+// === PIR Interrupt Handler (arg = head index) ===
+void IRAM_ATTR onMotionDetected(void* head) {
+    motionEdgeUs = micros();
+    portENTER_CRITICAL_ISR(&motionMux);
+    motionPendingHeads |= (uint8_t)(1u << (uintptr_t)head);
+    portEXIT_CRITICAL_ISR(&motionMux);
+}
+
+// === LDR Interrupt Handler ===
+void IRAM_ATTR onLdrChange() {
+    ldrEdgeFlag = true;
 }
 
 // === Clients ===
+#if STREETLIGHT_MQTT_TLS
+TlsSessionClient espClient; // Handshakes on its own task, resumes sessions
+#else
 WiFiClient espClient;
+#endif
 PubSubClient mqttClient(espClient);
+MqttLinkT<PubSubClient> mqttLink;      // Reconnect policy + telemetry publish (netsim/ runs the same code)
 
 void reconnectMQTT() {
-  if (mqttClient.connected()) return; // Already connected
+  if (mqttLink.connected()) return; // Already connected
 
   unsigned long now = millis();
-  if (now - lastReconnectAttempt > RECONNECT_INTERVAL_MS) {
-    lastReconnectAttempt = now;
-    
-    Serial.print("Attempting MQTT connection... ");
-    // Attempt to connect
-    if (mqttClient.connect(device_id)) {
-      Serial.println("connected");
-    } else {
-      Serial.print("failed, rc=");
-      Serial.println(mqttClient.state());
-      Serial.println(" (retrying in 5 seconds)");
+#if STREETLIGHT_MQTT_TLS
+  // TCP + TLS handshake run on the mqtt_tls task; once the session is up,
+  // PubSubClient reuses the connected client and only CONNECT runs here
+  if (espClient.busy()) return;
+  if (!espClient.connected()) {
+    if (mqttLink.attemptDue(now)) {
+      espClient.connectInBackground(mqtt_server, mqtt_port);
     }
+    return;
+  }
+#else
+  if (brokerLookupBusy()) return;
+  // A lookup that just answered is used at once, not an interval later
+  if (!brokerLookupDone() && !mqttLink.attemptDue(now)) return;
+  if (!brokerKnown()) {
+    brokerLookupStart();
+    return;
+  }
+  mqttClient.setServer(brokerIp(), mqtt_port);
+#endif
+
+  logPrintf("Attempting MQTT connection... ");
+  // Attempt to connect (plain TCP: blocks on the TCP connect, the usual SLO offender)
+  loopStage(STAGE_MQTT_CONNECT);
+  bool connected = mqttLink.connect();
+#if STREETLIGHT_MQTT_TLS
+  espClient.connectDone(); // Handshake + CONNECT are now measured on the loop
+#endif
+  if (connected) {
+    logPrintf("connected\n");
+    if (!bootTimeline.mqttUs) bootTimeline.mqttUs = micros();
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_GATEWAY
+    localSubscriptionsLost(); // Clean session: neighbours' topics are subscribed again
+#endif
+  } else {
+    logPrintf("failed, rc=%d (retrying in 5 seconds)\n", mqttLink.stats.lastState);
+#if !STREETLIGHT_MQTT_TLS
+    brokerForget();
+#endif
   }
 }
 
-void setup() {
-  Serial.begin(115200);
-  delay(1000); 
+// === MQTT Command Handler ===
+void onMqttCommand(char* topic, byte* payload, unsigned int length) {
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_GATEWAY
+  // A neighbour's command goes down the local link
+  int target = topicDeviceNumber(topic);
+  if (target >= 0 && target != device_number) {
+    if (!localDownlink((uint8_t)target, payload, length)) {
+      logPrintf("No route to neighbour %d\n", target);
+    }
+    return;
+  }
+#endif
+  handleCommand(payload, length);
+}
 
-  Serial.println("\n--- Smart Street Light (Non-Blocking) ---");
+// === Command (from MQTT, or from the gateway on a neighbour) ===
+void handleCommand(const uint8_t* payload, size_t length) {
+  Command command;
+  if (!parseCommand(payload, length, command)) {
+    logPrintf("Ignoring malformed command\n");
+    return;
+  }
+  // Downlink latency: sender's "ts" against our SNTP clock (skew clamps to 0)
+  if (command.sentEpochMs && timeSynced()) {
+    int64_t latencyMs = (int64_t)(epochMs() - command.sentEpochMs);
+    radio.onCommandLatency(latencyMs > 0 ? (uint32_t)latencyMs : 0);
+  }
+  if (command.type == CMD_REPORT) {
+    reportRequested = true;
+  }
+  if (command.type == CMD_PROFILE && !profilerStart(command.rateHz, command.durationS)) {
+    logPrintf("Profiler busy or unavailable\n");
+  }
+  if (command.type == CMD_OTA && !otaStart(command.url)) {
+    logPrintf("OTA busy or no URL\n");
+  }
+  if (command.type == CMD_FLIGHT && !flightTrigger(FLIGHT_REQUEST)) {
+    logPrintf("Flight recorder busy or unavailable\n");
+  }
+}
+
+void setup() {
+  bootTimeline.setupUs = micros();
+  bootTimeline.resetReason = (uint8_t)esp_reset_reason();
 
-  pinMode(PIR_PIN, INPUT_PULLDOWN); 
+  // === BOOT PHASE 1: LIGHT (no delays, no network) ===
+  for (int i = 0; i < STREETLIGHT_CHANNELS; i++) {
+    pinMode(HEAD_PIR_PINS[i], INPUT_PULLDOWN);
+  }
   pinMode(LDR_PIN, INPUT); 
   pinMode(LED_PIN, OUTPUT);
   
-  // === PIR INTERRUPT SETUP ===
-  attachInterrupt(digitalPinToInterrupt(PIR_PIN), onMotionDetected, RISING);
-  
-  // === PWM SETUP ===
+  // === PWM SETUP (one LEDC channel per head) ===
+  for (int i = 0; i < STREETLIGHT_CHANNELS; i++) {
   #ifdef ESP_ARDUINO_VERSION_MAJOR
     #if ESP_ARDUINO_VERSION_MAJOR >= 3
-      ledcAttach(MOSFET_PIN, PWM_FREQ, PWM_RESOLUTION);
+      ledcAttach(HEAD_PWM_PINS[i], PWM_FREQ, PWM_RESOLUTION);
     #else
-      ledcSetup(PWM_CHANNEL, PWM_FREQ, PWM_RESOLUTION);
-      ledcAttachPin(MOSFET_PIN, PWM_CHANNEL);
+      ledcSetup(PWM_CHANNEL + i, PWM_FREQ, PWM_RESOLUTION);
+      ledcAttachPin(HEAD_PWM_PINS[i], PWM_CHANNEL + i);
     #endif
   #else
-    ledcSetup(PWM_CHANNEL, PWM_FREQ, PWM_RESOLUTION);
-    ledcAttachPin(MOSFET_PIN, PWM_CHANNEL);
+    ledcSetup(PWM_CHANNEL + i, PWM_FREQ, PWM_RESOLUTION);
+    ledcAttachPin(HEAD_PWM_PINS[i], PWM_CHANNEL + i);
   #endif
+  }
   
-  // Initialize LDR buffer
-  for(int i=0; i<WINDOW_SIZE; i++) ldrReadings[i] = 0;
+  // Initialize motion timer and report state, then take the day/night verdict
+  // from one reading instead of waiting ~1s for the LDR window to fill.
+  // After a warm reset (WDT, brownout, panic) the RTC checkpoint wins.
+  controller.reset();
+  controller.primeLdr(millis(), digitalRead(LDR_PIN));
+  bool warmReset = bootTimeline.resetReason != ESP_RST_POWERON && bootTimeline.resetReason != ESP_RST_UNKNOWN;
+  bootTimeline.restore = rtcCheckpoint.restore(controller, millis(), warmReset);
+  bootTimeline.bootCount = rtcCheckpoint.bootCount;
+  // The checkpoint holds the "any head" hold: every head resumes it
+  heads.reset(STREETLIGHT_CHANNELS, controller.motion.lastMotionSeenTime);
+  LightOutput bootOut = controller.evaluate(millis());
+  heads.evaluate(millis(), bootOut.isNight, controller.policy);
+  writeLight(bootOut);
+  bootTimeline.pwmUs = micros();
+  if (bootTimeline.restore == RESTORE_OK) {
+      bootTimeline.restoredNight = bootOut.isNight;
+      bootTimeline.restoredLdr = bootOut.smoothedLdr;
+      bootTimeline.restoredHoldS = bootOut.countdownSec;
+  }
 
-  // === WiFi Setup ===
-  Serial.print("Connecting to WiFi: ");
-  WiFi.begin(ssid, password);
-  // Initial blocking wait for WiFi is okay in setup, but if it fails we continue
-  int wifi_timeout = 20; 
-  while (WiFi.status() != WL_CONNECTED && wifi_timeout > 0) {
-    delay(500);
-    Serial.print(".");
-    wifi_timeout--;
+  // === PIR + LDR INTERRUPT SETUP ===
+  for (int i = 0; i < STREETLIGHT_CHANNELS; i++) {
+    attachInterruptArg(digitalPinToInterrupt(HEAD_PIR_PINS[i]), onMotionDetected, (void*)(uintptr_t)i, RISING);
   }
-  
-  if (WiFi.status() == WL_CONNECTED) {
-      Serial.println("\nWiFi Connected!");
-  } else {
-      Serial.println("\nWiFi Not Connected (will try in background)");
+  attachInterrupt(digitalPinToInterrupt(LDR_PIN), onLdrChange, CHANGE);
+
+  // === BOOT PHASE 2: DIAGNOSTICS ===
+  // No wait for the USB host: output before it attaches is simply lost
+  Serial.begin(115200);
+  logPrintf("\n--- Smart Street Light (Non-Blocking) ---\n");
+
+  bootId = esp_random();
+
+  // Long-lived buffers: boot arena (static memory mode) or heap
+  memoryBegin();
+  scratch = new (bootAlloc(sizeof(PublishScratch))) PublishScratch(); // First: always fits
+  flightBegin(bootId, warmReset); // Ring in PSRAM; uploads what survived a warm reset
+#if STREETLIGHT_ROLE != STREETLIGHT_ROLE_NODE
+  uploaderBegin(serverUrl); // Store-and-forward buffer, HTTP fallback task
+
+  // === BOOT PHASE 3: NETWORK (started here, completed in the background) ===
+  // WiFi associates on its own task; loop() connects MQTT once it is up
+  logPrintf("Connecting to WiFi in the background...\n");
+  WiFi.begin(ssid, password);
+  // Listen interval is part of the association: only touch it when tuned
+  // away from the IDF default (3), since changing it reconnects
+  wifi_config_t wifiConfig;
+  if (esp_wifi_get_config(WIFI_IF_STA, &wifiConfig) == ESP_OK &&
+      (wifiConfig.sta.listen_interval ? wifiConfig.sta.listen_interval : 3) != RADIO_LISTEN_INTERVAL) {
+    wifiConfig.sta.listen_interval = RADIO_LISTEN_INTERVAL;
+    esp_wifi_set_config(WIFI_IF_STA, &wifiConfig);
   }
+  radio.reset(millis());
+  applyRadioMode(RADIO_AWAKE);
+
+  // === SNTP Setup (device-side capture timestamps) ===
+  timeBegin(ntp_server_1, ntp_server_2);
 
   // === MQTT Setup ===
+#if STREETLIGHT_MQTT_TLS
+  if (!espClient.begin(MQTT_CA_CERT, mqtt_tls_hostname)) {
+    logPrintf("MQTT TLS unavailable\n");
+  }
+#endif
+#else
+  espClient.setTimeout(MQTT_TCP_CONNECT_TIMEOUT_S); // Seconds; the connect timeout too
+  brokerBegin(mqtt_server);
+#endif
   mqttClient.setServer(mqtt_server, mqtt_port);
+  mqttClient.setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
+  mqttClient.setCallback(onMqttCommand);
+  mqttLink.begin(&mqttClient, device_id, mqtt_command_topic); // Gateway: plus its neighbours' (subscribeNeighbour)
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_GATEWAY
+  mqttClient.setBufferSize(max(max(TELEMETRY_MAX_BYTES, DIAG_MAX_BYTES), GATEWAY_BATCH_MAX_BYTES) + 64);
+#else
+  // Default 256 B cannot hold a boot or diagnostics message
+  mqttClient.setBufferSize(max(TELEMETRY_MAX_BYTES, DIAG_MAX_BYTES) + 64);
+#endif
+#else
+  // Neighbour: no association, SNTP or MQTT; the radio only carries the local link
+  radio.reset(millis());
+  applyRadioMode(RADIO_AWAKE);
+#endif
+
+  // === LOCAL LINK (gateway or neighbour; nothing for a standalone pole) ===
+  localBegin(device_number, bootId);
+
+  memorySeal(); // Everything long-lived is allocated by now
+
+  // === LOOP WATCHDOG (latency SLO + task WDT hard limit) ===
+  watchdogBegin();
+  bootTimeline.wdtStage = watchdogResetStage();
+
+  bootTimeline.setupDoneUs = micros();
 }
 
 void loop() {
   unsigned long now = millis();
+  uint64_t captureUs = monoUs(); // Capture time of everything decided in this pass
 
   // === NETWORKING ===
   // Only handle network if WiFi is connected, otherwise ESP usually auto-reconnects in background
+#if STREETLIGHT_ROLE != STREETLIGHT_ROLE_NODE
+  loopStage(STAGE_WIFI);
   if (WiFi.status() == WL_CONNECTED) {
+      if (!bootTimeline.wifiUs) {
+          bootTimeline.wifiUs = micros();
+          logPrintf("WiFi Connected!\n");
+      }
       reconnectMQTT(); // Non-blocking check
       if (mqttClient.connected()) {
+          loopStage(STAGE_MQTT_LOOP);
           mqttClient.loop();
       }
   }
+  // Failover to HTTP bulk upload after a long MQTT outage, failback once stable
+  telemetryTransport = uploaderUpdate(now, mqttClient.connected());
+  if (!bootTimeline.sntpUs && timeSynced()) {
+      bootTimeline.sntpUs = micros();
+  }
+#endif
+  // Gateway: neighbours' uplinks into the batch, batches out, their commands
+  // down. Neighbour: outbox to the gateway, commands back from it
+  loopStage(STAGE_LOCAL);
+  localPoll(now, publishBatch, handleCommand);
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_GATEWAY
+  if (mqttClient.connected()) localSubscriptions(subscribeNeighbour);
+#endif
 
   // === 1. LDR READING ===
-  // Option A: Simple instant logic (currently active)
   // Digital output: 1=dark (night), 0=bright (day)
-  // static int smoothedLdr = 0;
-  
-  // int rawLdr = digitalRead(LDR_PIN);
-  // smoothedLdr = rawLdr; // Store for telemetry
-  // isNightMode = (rawLdr == 1); // Instant reaction: 1=night, 0=day
-  
-  // --- Option B: HYSTERESIS 
-  // Prevents flickering at sunrise/sunset by requiring multiple consistent readings
-  
-  static int smoothedLdr = 0;
-  if (now - lastLdrTime > 100) {
-      lastLdrTime = now;
-      
-      int rawLdr = digitalRead(LDR_PIN);
-      
-      ldrSum -= ldrReadings[ldrIndex];
-      ldrReadings[ldrIndex] = rawLdr;
-      ldrSum += rawLdr;
-      ldrIndex = (ldrIndex + 1) % WINDOW_SIZE;
-      
-      smoothedLdr = ldrSum; // Sum of 10 readings (0-10)
-      
-      // Hysteresis thresholds: Night when >=5/10 dark, Day when <=3/10 dark
-      if (smoothedLdr >= 5) {
-          isNightMode = true;
-      } else if (smoothedLdr <= 3) {
-          isNightMode = false;
-      }
-      // Between 4: maintain previous state (no change)
+  // Sliding window + hysteresis: Night when >=5/10 dark, Day when <=3/10 dark
+  // Adaptive rate: 1s while all readings agree, 100ms near the thresholds
+  loopStage(STAGE_LDR);
+  bool stateChanged = false; // Needs a new RTC checkpoint
+  if (ldrEdgeFlag) {
+      ldrEdgeFlag = false;
+      controller.onLdrEdge();
+  }
+  if (controller.ldrDue(now)) {
+      int reading = digitalRead(LDR_PIN);
+      controller.sampleLdr(now, reading);
+      flightLog.record(micros(), FR_LDR, reading, controller.ldr.sum);
+      stateChanged = true;
   }
 
-  // === 2. MOTION LOGIC (Interrupt + Retriggerable Timer) ===
-  // Check interrupt flag (set by ISR)
-  if (motionDetectedFlag) {
-      motionDetectedFlag = false; // Clear flag
-      lastMotionSeenTime = now;
+  // === 2. MOTION LOGIC (Interrupt + Retriggerable Timer per head) ===
+  // Take the heads flagged by the PIR ISRs
+  loopStage(STAGE_MOTION);
+  portENTER_CRITICAL(&motionMux);
+  uint8_t motionHeads = motionPendingHeads;
+  motionPendingHeads = 0;
+  portEXIT_CRITICAL(&motionMux);
+  if (motionHeads) {
+      controller.onMotion(now); // "Any head" timer: report state, RTC checkpoint
+      heads.onMotion(now, motionHeads);
+      stateChanged = true;
+      motionTrace.pending = true;
+      motionTrace.edgeUs = motionEdgeUs;
+      for (int i = 0; i < heads.count; i++) {
+          if (motionHeads & (1u << i)) flightLog.record(motionTrace.edgeUs, FR_PIR, i);
+      }
+      motionTrace.decisionUs = micros();
+      motionTrace.pwmUs = 0;
   }
-  
-  bool isMotionActive = isNightMode && (now - lastMotionSeenTime < LIGHT_TIMER_MS);
 
   // === 3. CONTROL LOGIC ===
   // YES, this is affected by ANY delay in the loop. 
   // By making reconnectMQTT non-blocking, we ensure this runs thousands of times per second.
-  int pwmValue = 0;
-
-  if (isNightMode) {
-      if (isMotionActive) {
-         pwmValue = 255; 
-         digitalWrite(LED_PIN, HIGH);
-      } else {
-         pwmValue = 77; 
-         digitalWrite(LED_PIN, LOW);
+  loopStage(STAGE_CONTROL);
+  LightOutput out = controller.evaluate(now);
+  heads.evaluate(now, out.isNight, controller.policy); // All heads in one pass
+  writeLight(out);
+  for (int i = 0; i < heads.count; i++) {
+      if (heads.pwm[i] != recordedPwm[i]) {
+          recordedPwm[i] = heads.pwm[i];
+          flightLog.record(micros(), FR_PWM, i, heads.pwm[i]);
       }
-  } else {
-      pwmValue = 0;     
-      digitalWrite(LED_PIN, LOW);
   }
+  flightLog.loopPass(micros());
+  uint32_t streamUs = micros();
+  if (streamDue(streamUs)) {
+      streamSample(streamUs, digitalRead(LDR_PIN), digitalRead(PIR_PIN), heads.pwm[0]); // Head 0
+  }
+  if (watchdogStep()) {
+      sloReportPending = true;
+      flightTrigger(FLIGHT_ANOMALY); // Keeps the next few seconds too
+  }
+#if STREETLIGHT_MQTT_TLS
+  espClient.noteLoopGap(loopSlo.lastGapUs);
+#endif
+  if (motionTrace.pending && motionTrace.pwmUs == 0) {
+      motionTrace.pwmUs = micros();
+  }
+
+  // === 4. EVENT-DRIVEN REPORTING + 5. PERIODIC HEARTBEAT (Every 2s) ===
+  // State changes are sent immediately and reset the heartbeat timer
+  loopStage(STAGE_REPORT);
+  MessageClass msg = controller.report.due(now, out);
+  if (msg == MSG_NONE && heads.changed()) {
+      msg = MSG_EVENT; // One head started/ended its hold while another kept "any head" unchanged
+      controller.report.lastReportTime = now;
+  }
+  if (msg == MSG_NONE && reportRequested) {
+      msg = MSG_HEARTBEAT;
+      controller.report.lastReportTime = now;
+  }
+  reportRequested = false;
+  if (msg != MSG_NONE) {
+      heads.markReported(); // All heads ride in the one message
+  }
+  if (msg == MSG_EVENT) {
+      logPrintf(">>> STATE CHANGE DETECTED! Sending immediately...\n");
+  }
+  // Radio: awake ahead of the next heartbeat, briefly after each publish and
+  // for a while after an event (fast path); modem sleep otherwise
+  if (msg == MSG_EVENT) radio.hold(now, RADIO_EVENT_HOLD_MS);
+  if (msg != MSG_NONE) radio.hold(now, RADIO_LINGER_MS);
+  // Gateway and neighbours keep listening for the local link
+  bool radioForced = !STREETLIGHT_RADIO_SLEEP || !mqttClient.connected() || otaActive() ||
+                     telemetryTransport == TRANSPORT_HTTP || STREETLIGHT_ROLE != STREETLIGHT_ROLE_POLE;
+  RadioMode radioMode = radio.update(now, controller.report.heartbeatInMs(now), radioForced);
+  if (radio.lastChanged) applyRadioMode(radioMode);
+  if (msg != MSG_NONE) {
+      sendTelemetry(msg, captureUs, out);
+      stateChanged = true;
+  } else if (telemetryTransport == TRANSPORT_MQTT && mqttClient.connected()) {
+      uploaderDrainOne(publishBuffered); // Backlog from an outage, one per pass
+  }
+  if (stateChanged) {
+      rtcCheckpoint.save(controller, now);
+  }
+  // A retrigger that changed nothing has no event to ride on
+  motionTrace.pending = false;
+
+  // === 6. DIAGNOSTICS (Every 60s: heap, arena, stack high-water marks, loop SLO) ===
+  // Sent early (rate-limited) after a loop overrun
+  if (now - lastDiagTime >= DIAG_INTERVAL_MS || (sloReportPending && now - lastDiagTime >= SLO_REPORT_MIN_MS)) {
+      loopStage(STAGE_DIAG);
+      lastDiagTime = now;
+      sloReportPending = false;
+      sendDiagnostics();
+  }
+
+  // === 7. PROFILER (start on 'p' over Serial or the "profile" command; chunked upload) ===
+  // ('s' toggles binary sample streaming for lab capture)
+  loopStage(STAGE_PROFILE);
+  int key = Serial.available() ? Serial.read() : -1;
+  if (key == 'p') {
+      profilerStart(0, 0);
+  }
+  if (key == 's') {
+      streamToggle();
+  }
+  profilerPoll(sendProfileChunk);
+
+  // === 7b. FLIGHT RECORDER (frozen on an overrun, a reset, 'f' or the "flight" command; chunked upload) ===
+  loopStage(STAGE_FLIGHT);
+  if (key == 'f') {
+      flightTrigger(FLIGHT_REQUEST);
+  }
+  flightPoll(sendFlightChunk);
+
+  // === 8. DELTA OTA (download runs on its own task; progress here, reboot once staged) ===
+  // Server check-in soon after boot (confirms a new image), then hourly.
+  // Healthy = telemetry got out this boot, and it did not follow a loop stall.
+  loopStage(STAGE_OTA);
+  if (ota_server_url && mqttClient.connected() &&
+      now - lastOtaCheck >= (otaCheckedIn ? OTA_CHECK_INTERVAL_MS : OTA_FIRST_CHECK_MS)) {
+      lastOtaCheck = now;
+      otaCheckedIn = true;
+      otaCheckIn(ota_server_url, device_id, bootReported && bootTimeline.wdtStage < 0);
+  }
+  if (otaPoll(bootId, sendOtaStatus)) {
+      rtcCheckpoint.save(controller, now); // Light state survives the restart
+      logPrintf("Rebooting into the new firmware...\n");
+      mqttClient.disconnect();
+      ESP.restart();
+  }
+  loopStage(STAGE_IDLE);
+}
+
+// === HELPER: Drive the indicator LED (any head held) and every head's PWM ===
+void writeLight(const LightOutput& out) {
+  digitalWrite(LED_PIN, out.isMotionActive ? HIGH : LOW);
   
+  for (int i = 0; i < heads.count; i++) {
   #ifdef ESP_ARDUINO_VERSION_MAJOR
     #if ESP_ARDUINO_VERSION_MAJOR >= 3
-      ledcWrite(MOSFET_PIN, pwmValue);
+      ledcWrite(HEAD_PWM_PINS[i], heads.pwm[i]);
     #else
-      ledcWrite(PWM_CHANNEL, pwmValue);
+      ledcWrite(PWM_CHANNEL + i, heads.pwm[i]);
     #endif
   #else
-     ledcWrite(PWM_CHANNEL, pwmValue);
+     ledcWrite(PWM_CHANNEL + i, heads.pwm[i]);
   #endif
-
-  // === 4. EVENT-DRIVEN REPORTING (Runs every loop!) ===
-  // Calculate countdown (only valid when motion is active)
-  long countdown = isMotionActive ? (LIGHT_TIMER_MS - (now - lastMotionSeenTime)) / 1000 : 0;
-  
-  bool stateChanged = (isMotionActive != lastSentMotionState) || (isNightMode != lastSentNightMode);
-  if (stateChanged) {
-      Serial.println(">>> STATE CHANGE DETECTED! Sending immediately...");
-      sendTelemetry(isNightMode, isMotionActive, pwmValue, smoothedLdr, countdown);
-      lastSentMotionState = isMotionActive;
-      lastSentNightMode = isNightMode;
-      lastReportTime = now; // Reset heartbeat timer
-  }
-
-  // === 5. PERIODIC HEARTBEAT (Every 2s) ===
-  if (now - lastReportTime > REPORT_INTERVAL_MS) {
-    lastReportTime = now;
-    sendTelemetry(isNightMode, isMotionActive, pwmValue, smoothedLdr, countdown);
-    lastSentMotionState = isMotionActive;
-    lastSentNightMode = isNightMode;
   }
 }
 
 // === HELPER: Send telemetry data ===
-void sendTelemetry(bool isNight, bool isMotion, int pwm, int ldrValue, long countdownSec) {
-    // Calculate actual power from PWM duty cycle
-    float power = (pwm / 255.0) * MAX_LED_POWER_W;
-    
-    // Serial Reporting
-    Serial.print("M: "); Serial.print(isNight ? "NIGHT" : "DAY");
-    Serial.print(" | Motion: "); Serial.print(isMotion ? "ACTIVE" : "idle");
-    Serial.print(" | LDR: "); Serial.print(ldrValue);
-    Serial.print(" | PWM: "); Serial.print(pwm);
-    Serial.print(" | Power: "); Serial.print(power, 1); Serial.print("W");
+void sendTelemetry(MessageClass msgClass, uint64_t captureUs, const LightOutput& out) {
+    loopStage(STAGE_PUBLISH);
+    float power = heads.powerW(); // All heads (one head: pwmToPower(out.pwm))
     
+    // Serial Reporting (text frames while binary streaming owns the port)
+    char countdown[24] = "";
     // Show countdown if motion is active
-    if (isMotion && countdownSec > 0) {
-        Serial.print(" | Off in: "); Serial.print(countdownSec); Serial.println("s");
-    } else {
-        Serial.println("");
+    if (out.isMotionActive && out.countdownSec > 0) {
+        snprintf(countdown, sizeof(countdown), " | Off in: %lds", out.countdownSec);
     }
+    logPrintf("M: %s | Motion: %s | LDR: %d | PWM: %d | Power: %.1fW%s\n", out.isNight ? "NIGHT" : "DAY",
+              out.isMotionActive ? "ACTIVE" : "idle", out.smoothedLdr, out.pwm, power, countdown);
     
-    // Prepare JSON
-    StaticJsonDocument<200> doc;
-    doc["ldr"] = ldrValue; 
-    doc["motion"] = isMotion ? 1 : 0;
-    doc["brightness"] = (pwm * 100) / 255;
-    doc["power"] = power; 
-
-    String jsonPayload;
-    serializeJson(doc, jsonPayload);
-
-    // Send to MQTT only (HTTP removed to prevent blocking lag)
-    if (mqttClient.connected()) {
-      mqttClient.publish(mqtt_topic, jsonPayload.c_str());
+    // Prepare sample
+    TelemetrySample sample = {};
+    sample.msgClass = msgClass;
+    sample.bootId = bootId;
+    sample.seq = telemetrySeq++; // Unsent messages still consume a number (counted as loss)
+    sample.captureEpochMs = monoToEpochMs(captureUs);
+    sample.captureMonoUs = captureUs;
+    sample.out = out;
+    sample.rawLdr = controller.ldr.latest();
+    sample.heads = &heads;
+
+    if (msgClass == MSG_HEARTBEAT) {
+        ClockStats clk = clockStats();
+        sample.hasClock = true;
+        sample.clock = {clk.syncCount, clk.lastSyncAgeS, clk.lastCorrectionMs, clk.driftPpm};
+    }
+
+    // Attach the motion trace to the event it caused
+    if (msgClass == MSG_EVENT && motionTrace.pending) {
+        sample.hasTrace = true;
+        sample.trace.decisionUs = motionTrace.decisionUs - motionTrace.edgeUs;
+        sample.trace.pwmUs = motionTrace.pwmUs - motionTrace.edgeUs;
+        sample.trace.publishUs = micros() - motionTrace.edgeUs;
+        sample.trace.publishEpochMs = epochMs(); // 0 until SNTP has synced
+        motionTrace.pending = false;
+    }
+
+    // Boot timeline rides on one message only: if that one does not fit or
+    // does not go out, the timeline is dropped rather than holding back
+    // every later message
+    if (!bootTimelineTried) {
+        bootTimelineTried = true;
+        sample.hasBoot = true;
+        sample.boot = bootTimeline;
     }
-}
\ No newline at end of file
+
+    char* payload = scratch->payload;
+    size_t length = serializeTelemetry(sample, scratch->doc, payload, TELEMETRY_MAX_BYTES);
+    if (!length && sample.hasBoot) {
+        sample.hasBoot = false;
+        length = serializeTelemetry(sample, scratch->doc, payload, TELEMETRY_MAX_BYTES);
+    }
+
+    if (!length) return;
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_NODE
+    // Neighbour: through the gateway, kept in the outbox until it acks
+    if (localUplink(payload, length, msgClass == MSG_EVENT ? LF_EVENT : 0)) {
+        bootReported = true;
+    }
+#else
+    // MQTT when it is the live path; otherwise (or if the publish fails) the
+    // store-and-forward buffer, uploaded over HTTP by its own task
+    bool live = telemetryTransport == TRANSPORT_MQTT && mqttClient.connected();
+    if (live && mqttLink.publish(mqtt_topic, (const uint8_t*)payload, length)) {
+        bootReported = true;
+    } else if (uploaderEnqueue(payload, length, msgClass == MSG_HEARTBEAT, millis())) {
+        bootReported = true;
+    }
+#endif
+}
+
+// === HELPER: Send memory diagnostics ===
+void sendDiagnostics() {
+    DiagnosticsSample sample = {};
+    sample.bootId = bootId;
+    sample.uptimeMs = monoUs() / 1000;
+    sample.staticMemory = STREETLIGHT_STATIC_MEMORY;
+    memoryStats(sample.mem);
+    sample.slo = &loopSlo;
+    sample.ldrSamples = controller.ldrSamples;
+    sample.ldrEdgeSamples = controller.ldrEdgeSamples;
+#if STREETLIGHT_MQTT_TLS
+    sample.tls = &espClient.stats();
+#endif
+    sample.radio = &radio.stats;
+#if STREETLIGHT_ROLE != STREETLIGHT_ROLE_NODE
+    UploadStats upload;
+    uploaderStats(upload);
+    sample.upload = &upload;
+#endif
+    LocalLinkStats local;
+    if (localActive()) {
+        localStats(local);
+        sample.local = &local;
+    }
+
+    logPrintf("Heap free: %lu | Largest block: %lu | Min free: %lu\n", (unsigned long)sample.mem.freeHeap,
+              (unsigned long)sample.mem.largestFreeBlock, (unsigned long)sample.mem.minFreeHeap);
+
+    char* payload = scratch->payload;
+    size_t length = serializeDiagnostics(sample, scratch->doc, payload, DIAG_MAX_BYTES);
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_NODE
+    if (length) localUplink(payload, length, LF_DIAG);
+#else
+    if (length && mqttClient.connected()) {
+      mqttClient.publish(mqtt_diag_topic, (const uint8_t*)payload, length);
+    }
+#endif
+}
+
+// === HELPER: Upload one profiler chunk (Serial always, MQTT when connected) ===
+bool sendProfileChunk(const char* text, size_t length) {
+    logWrite(text, length);
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_NODE
+    return true; // Serial is its only output
+#else
+    return mqttClient.connected() && mqttClient.publish(mqtt_profile_topic, (const uint8_t*)text, length);
+#endif
+}
+
+// === HELPER: Publish one buffered telemetry message (backlog after an outage) ===
+bool publishBuffered(const char* json, size_t length) {
+    loopStage(STAGE_PUBLISH);
+    return mqttLink.publish(mqtt_topic, (const uint8_t*)json, length);
+}
+
+// === HELPER: Publish one binary flight recorder chunk ===
+bool sendFlightChunk(const uint8_t* data, size_t length) {
+#if STREETLIGHT_ROLE == STREETLIGHT_ROLE_NODE
+    return true; // No binary uplink through the gateway: dropped, so recording resumes
+#else
+    return mqttClient.connected() && mqttClient.publish(mqtt_flight_topic, data, length);
+#endif
+}
+
+// === HELPER: Publish one batch of neighbours' messages (gateway) ===
+bool publishBatch(const char* json, size_t length) {
+    loopStage(STAGE_PUBLISH);
+    return mqttLink.publish(mqtt_batch_topic, (const uint8_t*)json, length);
+}
+
+// === HELPER: Follow the neighbour table with command subscriptions (gateway) ===
+bool subscribeNeighbour(uint8_t node, bool subscribe) {
+    char topic[48];
+    snprintf(topic, sizeof(topic), mqtt_neighbour_command_topic, node);
+    return subscribe ? mqttClient.subscribe(topic) : mqttClient.unsubscribe(topic);
+}
+
+// === HELPER: Publish OTA progress (Serial always, MQTT when connected) ===
+bool sendOtaStatus(const char* json, size_t length) {
+    logWrite(json, length);
+    logPrintf("\n");
+    return mqttClient.connected() && mqttClient.publish(mqtt_ota_topic, (const uint8_t*)json, length);
+}
+
+// === HELPER: WiFi power save (modem sleep wakes every listen interval for downlink) ===
+void applyRadioMode(RadioMode mode) {
+    WiFi.setSleep(mode == RADIO_SLEEP ? WIFI_PS_MAX_MODEM : WIFI_PS_NONE);
+}
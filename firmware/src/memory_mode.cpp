@@ -0,0 +1,60 @@
+#include "memory_mode.h"
+#include "arena.h"
+#include "esp_heap_caps.h"
+
+// Tasks whose stack high-water marks are reported (missing ones are skipped)
+static const char* const WATCHED_TASKS[] = {"loopTask", "tiT", "wifi", "sys_evt", "arduino_events", "esp_timer", "ota",
+                                             "mqtt_tls"};
+
+static MemoryArena arena = {nullptr, 0, 0, 0, false};
+
+#if STREETLIGHT_STATIC_MEMORY
+static uint8_t internalArena[BOOT_ARENA_INTERNAL_BYTES] __attribute__((aligned(8)));
+#endif
+
+void memoryBegin() {
+#if STREETLIGHT_STATIC_MEMORY
+    void* block = nullptr;
+    if (psramFound()) {
+        block = heap_caps_malloc(BOOT_ARENA_PSRAM_BYTES, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        heap_caps_malloc_extmem_enable(PSRAM_MALLOC_THRESHOLD);
+    }
+    if (block) {
+        arena.begin(block, BOOT_ARENA_PSRAM_BYTES);
+    } else {
+        arena.begin(internalArena, sizeof(internalArena));
+    }
+#endif
+}
+
+void* bootAlloc(size_t bytes) {
+#if STREETLIGHT_STATIC_MEMORY
+    return arena.alloc(bytes);
+#else
+    return malloc(bytes);
+#endif
+}
+
+void memorySeal() {
+    arena.seal();
+}
+
+void memoryStats(MemoryStats& out) {
+    out.freeHeap = heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    out.minFreeHeap = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    out.largestFreeBlock = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    out.freePsram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    out.arenaUsed = arena.used;
+    out.arenaCapacity = arena.capacity;
+    out.arenaFailed = arena.failed;
+
+    out.taskCount = 0;
+    for (const char* name : WATCHED_TASKS) {
+        TaskHandle_t task = xTaskGetHandle(name);
+        if (!task || out.taskCount >= DIAG_MAX_TASKS) continue;
+        // ESP-IDF reports the high-water mark in bytes
+        out.tasks[out.taskCount].name = name;
+        out.tasks[out.taskCount].freeBytes = uxTaskGetStackHighWaterMark(task);
+        out.taskCount++;
+    }
+}
@@ -0,0 +1,452 @@
+#include "ota_delta.h"
+#include <HTTPClient.h>
+#include <ArduinoJson.h>
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_image_format.h"
+#include "mbedtls/sha256.h"
+#include "command.h"
+#include "delta_patch.h"
+#include "serial_stream.h"
+
+const uint32_t OTA_TASK_STACK = 8192;
+const UBaseType_t OTA_TASK_PRIORITY = 1; // Below WiFi/lwIP on core 0
+const BaseType_t OTA_TASK_CORE = 0;      // loop() runs on core 1
+const size_t OTA_READ_BYTES = 1024;
+const uint32_t OTA_READ_TIMEOUT_MS = 10000;
+const size_t OTA_HASH_BLOCK = 1024;
+const uint32_t OTA_HASH_YIELD_BYTES = 32768; // Let IDLE0 feed the task WDT while hashing the base
+
+// mbedtls 3 (IDF 5) dropped the _ret variants
+static void shaBegin(mbedtls_sha256_context* ctx) {
+    mbedtls_sha256_init(ctx);
+#if ESP_IDF_VERSION_MAJOR >= 5
+    mbedtls_sha256_starts(ctx, 0);
+#else
+    mbedtls_sha256_starts_ret(ctx, 0);
+#endif
+}
+
+static void shaUpdate(mbedtls_sha256_context* ctx, const uint8_t* data, size_t length) {
+#if ESP_IDF_VERSION_MAJOR >= 5
+    mbedtls_sha256_update(ctx, data, length);
+#else
+    mbedtls_sha256_update_ret(ctx, data, length);
+#endif
+}
+
+static void shaFinish(mbedtls_sha256_context* ctx, uint8_t digest[32]) {
+#if ESP_IDF_VERSION_MAJOR >= 5
+    mbedtls_sha256_finish(ctx, digest);
+#else
+    mbedtls_sha256_finish_ret(ctx, digest);
+#endif
+    mbedtls_sha256_free(ctx);
+}
+
+// Written by the OTA task, copied by loop(): word-sized fields, no lock
+static OtaStatus status = {OTA_IDLE};
+static volatile bool busy = false; // OTA task alive
+
+// Base of the patch: the image we are running
+struct RunningImage {
+    const esp_partition_t* partition;
+    bool read(uint32_t offset, uint8_t* buffer, size_t length) {
+        return esp_partition_read(partition, offset, buffer, length) == ESP_OK;
+    }
+};
+
+// Patch output: the next OTA slot, hashed on the way to flash
+struct OtaSlot {
+    const esp_partition_t* partition;
+    esp_ota_handle_t handle;
+    bool open;
+    mbedtls_sha256_context sha;
+    bool write(const uint8_t* data, size_t length) {
+        shaUpdate(&sha, data, length);
+        if (esp_ota_write(handle, data, length) != ESP_OK) return false;
+        status.written += length;
+        return true;
+    }
+};
+
+static DeltaPatcher<RunningImage, OtaSlot> patcher; // Decoder state: survives dropped connections
+static RunningImage running;
+static OtaSlot slot;
+static bool patchDone = false;
+static bool fullImage = false;      // Plain ESP image instead of a patch
+static char patchUrl[COMMAND_URL_MAX];
+static uint8_t offeredSha[32];      // New image SHA-256 from the server's offer
+static bool haveOfferedSha = false;
+
+// Check-in with the OTA server (ota_server/)
+static bool checkInPending = false;
+static char serverBase[COMMAND_URL_MAX];
+static char checkInDevice[32];
+static bool checkInHealthy = false;
+static bool lastUpdateFailed = false; // Told to the server at the next check-in
+static char runningImageId[65] = "";  // SHA-256 hex of the running image, once computed
+static uint8_t readBuffer[OTA_READ_BYTES];
+static unsigned long startMs = 0;
+
+// loop() side reporting state
+static OtaState attemptedState = OTA_IDLE;
+static OtaState reportedState = OTA_IDLE;
+static unsigned long lastReportMs = 0;
+static unsigned long stagedMs = 0;
+
+static void fail(const char* error) {
+    status.error = error;
+    status.state = OTA_FAILED;
+}
+
+// SHA-256 of the first `length` bytes of the running partition
+static bool hashRunning(uint32_t length, uint8_t digest[32]) {
+    if (length > running.partition->size) return false;
+    mbedtls_sha256_context sha;
+    shaBegin(&sha);
+    uint8_t block[OTA_HASH_BLOCK];
+    for (uint32_t offset = 0; offset < length; offset += OTA_HASH_BLOCK) {
+        size_t n = min((size_t)(length - offset), OTA_HASH_BLOCK);
+        if (!running.read(offset, block, n)) {
+            mbedtls_sha256_free(&sha);
+            return false;
+        }
+        shaUpdate(&sha, block, n);
+        if (offset % OTA_HASH_YIELD_BYTES == 0) vTaskDelay(1);
+    }
+    shaFinish(&sha, digest);
+    return true;
+}
+
+static bool baseMatches(const DeltaHeader& header) {
+    uint8_t digest[32];
+    return hashRunning(header.oldSize, digest) && memcmp(digest, header.oldSha, sizeof(digest)) == 0;
+}
+
+// Image id the server knows: SHA-256 of the firmware.bin we run (the image
+// length comes from its header and segments, including the appended hash)
+static bool identifyRunningImage() {
+    if (runningImageId[0]) return true;
+    esp_partition_pos_t pos = {running.partition->address, running.partition->size};
+    esp_image_metadata_t meta;
+    uint8_t digest[32];
+    if (esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &pos, &meta) != ESP_OK || !hashRunning(meta.image_len, digest)) {
+        return false;
+    }
+    for (int i = 0; i < 32; i++) sprintf(runningImageId + 2 * i, "%02x", digest[i]);
+    return true;
+}
+
+// Nothing touches flash until a patch's base is verified
+static bool openSlot() {
+    if (!fullImage) {
+        status.state = OTA_BASE_CHECK;
+        if (!baseMatches(patcher.header)) {
+            fail("base mismatch");
+            return false;
+        }
+    }
+    slot.partition = esp_ota_get_next_update_partition(nullptr);
+    if (!slot.partition || status.imageBytes > slot.partition->size) {
+        fail("no ota slot");
+        return false;
+    }
+    // Erase sector by sector as data arrives, not the whole slot up front
+    // (that is one flash operation of seconds, stalling both cores' caches)
+#ifdef OTA_WITH_SEQUENTIAL_WRITES
+    size_t eraseSize = OTA_WITH_SEQUENTIAL_WRITES;
+#else
+    size_t eraseSize = status.imageBytes;
+#endif
+    if (esp_ota_begin(slot.partition, eraseSize, &slot.handle) != ESP_OK) {
+        fail("ota begin");
+        return false;
+    }
+    slot.open = true;
+    shaBegin(&slot.sha);
+    status.state = OTA_DOWNLOAD;
+    return true;
+}
+
+// Applies downloaded bytes; false on a fatal error (status set)
+static bool applyPatch(const uint8_t* data, size_t length) {
+    // A full image (for a base without a patch) goes to flash as is
+    if (status.received == 0 && data[0] == ESP_IMAGE_HEADER_MAGIC) {
+        fullImage = true;
+        status.imageBytes = status.patchBytes;
+        if (!status.imageBytes) {
+            fail("image size unknown");
+            return false;
+        }
+        if (!openSlot()) return false;
+    }
+    if (fullImage) {
+        length = min(length, (size_t)(status.imageBytes - status.received));
+        if (!slot.write(data, length)) {
+            fail("flash write");
+            return false;
+        }
+        status.received += length;
+        patchDone = status.received == status.imageBytes;
+        return true;
+    }
+    if (!patcher.headerReady()) {
+        size_t take = min(length, DELTA_HEADER_BYTES - status.received);
+        if (patcher.feed(data, take, running, slot) == DELTA_ERROR) {
+            fail("not a delta patch");
+            return false;
+        }
+        status.received += take;
+        data += take;
+        length -= take;
+        if (!patcher.headerReady()) return true;
+        status.imageBytes = patcher.header.newSize;
+        if (!openSlot()) return false;
+    }
+    if (!length) return true;
+    DeltaStatus result = patcher.feed(data, length, running, slot);
+    status.received += length;
+    if (result == DELTA_ERROR) {
+        fail("patch corrupt");
+        return false;
+    }
+    patchDone = result == DELTA_DONE;
+    return true;
+}
+
+// One Range request from the resume offset. False if it ended early.
+static bool fetchRange() {
+    HTTPClient http;
+    http.setTimeout(OTA_READ_TIMEOUT_MS);
+    if (!http.begin(patchUrl)) return false;
+    const char* headers[] = {"Content-Range"};
+    http.collectHeaders(headers, 1);
+    char range[40];
+    snprintf(range, sizeof(range), "bytes=%lu-%lu", (unsigned long)status.received,
+             (unsigned long)(status.received + OTA_RANGE_BYTES - 1));
+    http.addHeader("Range", range);
+    status.requests++;
+
+    int code = http.GET();
+    uint32_t skip = 0;
+    if (code == HTTP_CODE_PARTIAL_CONTENT) {
+        // "bytes <first>-<last>/<total>"
+        String contentRange = http.header("Content-Range");
+        int slash = contentRange.lastIndexOf('/');
+        if (slash >= 0) status.patchBytes = contentRange.substring(slash + 1).toInt();
+    } else if (code == HTTP_CODE_OK) {
+        // Server ignores Range: the whole patch again, skip what is applied
+        skip = status.received;
+        if (http.getSize() > 0) status.patchBytes = http.getSize();
+    } else {
+        http.end();
+        return false;
+    }
+
+    // Raw stream below: chunked encoding would need de-framing, and static
+    // file servers send a length anyway
+    int expected = http.getSize();
+    if (expected <= 0) {
+        http.end();
+        return false;
+    }
+    WiFiClient* stream = http.getStreamPtr();
+    int got = 0;
+    unsigned long lastDataMs = millis();
+    while (!patchDone && got < expected && (http.connected() || stream->available())) {
+        int available = stream->available();
+        if (available <= 0) {
+            if (millis() - lastDataMs > OTA_READ_TIMEOUT_MS) break;
+            vTaskDelay(1);
+            continue;
+        }
+        int n = stream->read(readBuffer, min((size_t)available, sizeof(readBuffer)));
+        if (n <= 0) break;
+        lastDataMs = millis();
+        got += n;
+        const uint8_t* data = readBuffer;
+        size_t length = n;
+        if (skip) {
+            size_t skipped = min((size_t)skip, length);
+            skip -= skipped;
+            data += skipped;
+            length -= skipped;
+        }
+        if (length && !applyPatch(data, length)) break;
+    }
+    http.end();
+    return patchDone || got == expected;
+}
+
+// Image complete: only a verified image becomes the boot partition. A full
+// image pushed without an offer is checked by esp_ota_end() alone.
+static void stageImage() {
+    uint8_t digest[32];
+    shaFinish(&slot.sha, digest);
+    const uint8_t* expected = fullImage ? (haveOfferedSha ? offeredSha : digest) : patcher.header.newSha;
+    if (memcmp(digest, expected, sizeof(digest)) != 0 ||
+        (haveOfferedSha && memcmp(digest, offeredSha, sizeof(digest)) != 0)) {
+        fail("image sha mismatch");
+        return;
+    }
+    slot.open = false;
+    if (esp_ota_end(slot.handle) != ESP_OK) { // Also checks the image format
+        fail("image invalid");
+        return;
+    }
+    if (esp_ota_set_boot_partition(slot.partition) != ESP_OK) {
+        fail("set boot partition");
+        return;
+    }
+    status.state = OTA_STAGED;
+}
+
+static void beginDownload() {
+    status = {};
+    status.state = OTA_DOWNLOAD;
+    slot.open = false;
+    patcher.begin();
+    patchDone = false;
+    fullImage = false;
+    startMs = millis();
+}
+
+// Asks the server whether to update; true with patchUrl/offeredSha set
+static bool fetchOffer() {
+    if (!identifyRunningImage()) return false;
+    char url[2 * COMMAND_URL_MAX];
+    snprintf(url, sizeof(url), "%s/ota/check?device=%s&image=%s&healthy=%d%s", serverBase, checkInDevice,
+             runningImageId, checkInHealthy ? 1 : 0, lastUpdateFailed ? "&failed=1" : "");
+    HTTPClient http;
+    http.setTimeout(OTA_READ_TIMEOUT_MS);
+    if (!http.begin(url)) return false;
+    int code = http.GET();
+    if (code == HTTP_CODE_NO_CONTENT || code == HTTP_CODE_OK) lastUpdateFailed = false; // Delivered
+    if (code != HTTP_CODE_OK) {
+        http.end();
+        return false;
+    }
+    // {"url":"/ota/file/...","sha":"<hex>","size":N,"kind":"delta"|"full"}
+    StaticJsonDocument<512> doc;
+    DeserializationError error = deserializeJson(doc, http.getString());
+    http.end();
+    const char* path = doc["url"];
+    const char* sha = doc["sha"];
+    if (error || !path || !sha || strlen(sha) != 64) return false;
+    if (snprintf(patchUrl, sizeof(patchUrl), "%s%s", serverBase, path) >= (int)sizeof(patchUrl)) return false;
+    for (int i = 0; i < 32; i++) {
+        unsigned int byte;
+        if (sscanf(sha + 2 * i, "%2x", &byte) != 1) return false;
+        offeredSha[i] = (uint8_t)byte;
+    }
+    haveOfferedSha = true;
+    return true;
+}
+
+static void otaTask(void*) {
+    if (checkInPending) {
+        checkInPending = false;
+        if (!fetchOffer()) {
+            busy = false;
+            vTaskDelete(nullptr);
+            return;
+        }
+        beginDownload();
+    }
+    uint32_t failures = 0;
+    while (!patchDone && status.state != OTA_FAILED) {
+        uint32_t before = status.received;
+        bool complete = fetchRange();
+        if (status.state == OTA_FAILED) break;
+        if (status.patchBytes && status.received >= status.patchBytes && !patchDone) {
+            fail("patch truncated");
+            break;
+        }
+        if (complete || status.received > before) {
+            failures = 0;
+            if (complete) continue;
+        }
+        // Resume from status.received on the next request
+        if (++failures > OTA_MAX_FAILURES) {
+            fail("download");
+            break;
+        }
+        status.retries++;
+        vTaskDelay(pdMS_TO_TICKS(OTA_RETRY_DELAY_MS));
+    }
+    if (patchDone && status.state != OTA_FAILED) stageImage();
+    if (slot.open) {
+        esp_ota_abort(slot.handle);
+        mbedtls_sha256_free(&slot.sha);
+        slot.open = false;
+    }
+    if (status.state == OTA_FAILED) lastUpdateFailed = true;
+    status.elapsedMs = millis() - startMs;
+    busy = false;
+    vTaskDelete(nullptr);
+}
+
+static bool spawnTask() {
+    running.partition = esp_ota_get_running_partition();
+    attemptedState = OTA_IDLE;
+    reportedState = OTA_IDLE;
+    busy = true;
+    if (xTaskCreatePinnedToCore(otaTask, "ota", OTA_TASK_STACK, nullptr, OTA_TASK_PRIORITY, nullptr,
+                                OTA_TASK_CORE) != pdPASS) {
+        busy = false;
+        status.state = OTA_IDLE;
+        checkInPending = false;
+        return false;
+    }
+    return true;
+}
+
+bool otaActive() {
+    return busy;
+}
+
+bool otaStart(const char* url) {
+    if (busy || status.state != OTA_IDLE || !url || !url[0] || strlen(url) >= sizeof(patchUrl)) return false;
+    strcpy(patchUrl, url);
+    haveOfferedSha = false;
+    beginDownload();
+    if (!spawnTask()) return false;
+    logPrintf("OTA: update from %s\n", url);
+    return true;
+}
+
+bool otaCheckIn(const char* serverUrl, const char* deviceId, bool healthy) {
+    if (busy || status.state != OTA_IDLE || strlen(serverUrl) >= sizeof(serverBase) ||
+        strlen(deviceId) >= sizeof(checkInDevice)) {
+        return false;
+    }
+    strcpy(serverBase, serverUrl);
+    strcpy(checkInDevice, deviceId);
+    checkInHealthy = healthy;
+    checkInPending = true;
+    return spawnTask();
+}
+
+bool otaPoll(uint32_t bootId, OtaStatusSink sink) {
+    OtaStatus snapshot = status;
+    if (snapshot.state == OTA_IDLE) return false;
+    unsigned long now = millis();
+    if (busy) snapshot.elapsedMs = now - startMs;
+
+    // On every state change, then every OTA_REPORT_INTERVAL_MS
+    if (snapshot.state != attemptedState || now - lastReportMs >= OTA_REPORT_INTERVAL_MS) {
+        if (snapshot.state == OTA_STAGED && attemptedState != OTA_STAGED) stagedMs = now;
+        attemptedState = snapshot.state;
+        lastReportMs = now;
+        char json[OTA_STATUS_MAX_BYTES];
+        size_t length = serializeOtaStatus(bootId, snapshot, json, sizeof(json));
+        if (length && sink(json, length)) reportedState = snapshot.state;
+    }
+
+    if (snapshot.state == OTA_FAILED && !busy && reportedState == OTA_FAILED) {
+        status.state = OTA_IDLE; // Reported; a new "ota" command may retry
+    }
+    if (snapshot.state != OTA_STAGED) return false;
+    return reportedState == OTA_STAGED || now - stagedMs >= OTA_REBOOT_GRACE_MS;
+}
@@ -0,0 +1,139 @@
+#include "profiler.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "serial_stream.h"
+#if __has_include("xtensa_context.h")
+#include "xtensa_context.h"
+#else
+#include "freertos/xtensa_context.h"
+#endif
+#if ESP_IDF_VERSION_MAJOR >= 5
+#include "esp_cpu.h"
+static inline uint32_t IRAM_ATTR cycleCount() { return esp_cpu_get_cycle_count(); }
+#else
+#include "xtensa/hal.h"
+static inline uint32_t IRAM_ATTR cycleCount() { return xthal_get_ccount(); }
+#endif
+
+enum ProfilerState { PROF_IDLE, PROF_RUNNING, PROF_UPLOADING };
+
+static ProfileBuffer buffer;
+static volatile ProfilerState state = PROF_IDLE;
+static hw_timer_t* timer = nullptr;
+static uint32_t rate = 0;
+static int64_t startUs = 0;
+static int64_t stopAtUs = 0;
+static int64_t elapsedUs = 0;
+static uint32_t uploaded = 0;   // Samples already sent
+static uint32_t chunk = 0;
+static uint32_t unsent = 0;    // Chunks the sink did not publish
+
+// Level-1 timer ISR on the loop core. At the first nesting level the port
+// has saved the interrupted task's registers as an XtExcFrame at the top of
+// its stack and stored that SP in the TCB's first word (pxTopOfStack).
+static void IRAM_ATTR onProfileTick() {
+    uint32_t entry = cycleCount();
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    const XtExcFrame* frame = task ? *(const XtExcFrame* const*)task : nullptr;
+    if (frame) {
+        uint32_t pc = frame->pc;
+        // Windowed ABI: top 2 bits of a0 hold the call size, not the address
+        uint32_t caller = frame->a0 ? ((frame->a0 & 0x3FFFFFFF) | (pc & 0xC0000000)) : 0;
+        buffer.push(pc, caller, (uint32_t)task);
+    }
+    buffer.isrCycles = buffer.isrCycles + (cycleCount() - entry);
+}
+
+static void stopTimer() {
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+    timerStop(timer);
+#else
+    timerAlarmDisable(timer);
+#endif
+}
+
+// Freed after the upload (the timer is stopped by then)
+static void releaseBuffer() {
+    heap_caps_free(buffer.samples);
+    buffer.begin(nullptr, 0);
+}
+
+bool profilerStart(uint32_t rateHz, uint32_t durationS) {
+    if (state != PROF_IDLE) return false;
+    const size_t bytes = PROFILE_CAPACITY * sizeof(ProfileSample);
+    ProfileSample* storage = (ProfileSample*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!storage) storage = (ProfileSample*)malloc(bytes); // Without PSRAM only if internal RAM allows
+    if (!storage) return false;
+    buffer.begin(storage, PROFILE_CAPACITY);
+    rate = rateHz ? min(rateHz, PROFILE_MAX_HZ) : PROFILE_DEFAULT_HZ;
+    uint32_t seconds = durationS ? durationS : PROFILE_DEFAULT_S;
+
+    buffer.clear();
+    uploaded = 0;
+    chunk = 0;
+    unsent = 0;
+    // Created here, on the loop task, so the interrupt lands on the loop core
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+    if (!timer) {
+        timer = timerBegin(1000000); // 1 MHz ticks
+        timerAttachInterrupt(timer, onProfileTick);
+    }
+    timerAlarm(timer, 1000000 / rate, true, 0);
+    timerRestart(timer);
+    timerStart(timer);
+#else
+    if (!timer) {
+        timer = timerBegin(0, 80, true); // APB 80 MHz / 80 = 1 MHz ticks
+        timerAttachInterrupt(timer, onProfileTick, true);
+    }
+    timerAlarmWrite(timer, 1000000 / rate, true);
+    timerWrite(timer, 0);
+    timerAlarmEnable(timer);
+#endif
+    startUs = esp_timer_get_time();
+    stopAtUs = startUs + (int64_t)seconds * 1000000;
+    state = PROF_RUNNING;
+    logPrintf("Profiler: %lu Hz for %lu s\n", (unsigned long)rate, (unsigned long)seconds);
+    return true;
+}
+
+static const char* taskName(uint32_t task) {
+    const char* name = task ? pcTaskGetName((TaskHandle_t)task) : nullptr;
+    return name && name[0] ? name : "?";
+}
+
+void profilerPoll(ProfileChunkSink sink) {
+    if (state == PROF_RUNNING) {
+        int64_t now = esp_timer_get_time();
+        if (now < stopAtUs && buffer.count < buffer.capacity) return;
+        stopTimer();
+        elapsedUs = now - startUs;
+        state = PROF_UPLOADING;
+    }
+    if (state != PROF_UPLOADING) return;
+
+    char text[PROFILE_LINES_PER_CHUNK * 40 + 128];
+    size_t length = 0;
+    if (uploaded == 0) {
+        // Header: ISR share of the loop core over the capture
+        double cpuCycles = (double)elapsedUs * getCpuFrequencyMhz();
+        uint32_t overheadPpm = cpuCycles > 0 ? (uint32_t)(buffer.isrCycles * 1e6 / cpuCycles) : 0;
+        length = snprintf(text, sizeof(text), "# profile hz=%lu samples=%lu dropped=%lu ms=%lu overhead_ppm=%lu\n",
+                          (unsigned long)rate, (unsigned long)buffer.count, (unsigned long)buffer.dropped,
+                          (unsigned long)(elapsedUs / 1000), (unsigned long)overheadPpm);
+    }
+    length += snprintf(text + length, sizeof(text) - length, "# chunk %lu\n", (unsigned long)chunk++);
+    length += formatProfileLines(buffer, uploaded, PROFILE_LINES_PER_CHUNK, taskName, text + length,
+                                 sizeof(text) - length);
+    uploaded += PROFILE_LINES_PER_CHUNK;
+    if (uploaded < buffer.count) {
+        if (!sink(text, length)) unsent++;
+        return;
+    }
+    // unsent= cannot cover this chunk: whoever reads it has it
+    length += snprintf(text + length, sizeof(text) - length, "# end chunks=%lu unsent=%lu\n",
+                       (unsigned long)chunk, (unsigned long)unsent);
+    state = PROF_IDLE;
+    sink(text, length);
+    releaseBuffer();
+}
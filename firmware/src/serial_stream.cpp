@@ -0,0 +1,63 @@
+#include "serial_stream.h"
+#include <stdarg.h>
+
+const uint32_t STREAM_PERIOD_US = 1000000 / STREAM_RATE_HZ;
+const size_t LOG_LINE_MAX = 256;  // logPrintf() truncates beyond
+
+static volatile bool active = false;
+static uint16_t seq = 0;
+static uint32_t nextDueUs = 0;
+static uint32_t sent = 0;
+static uint32_t dropped = 0;
+
+void streamToggle() {
+    active = !active;
+    if (active) {
+        seq = 0;
+        sent = dropped = 0;
+        nextDueUs = micros();
+        return;
+    }
+    logPrintf("\nStream stopped: %lu frames, %lu dropped\n", (unsigned long)sent, (unsigned long)dropped);
+}
+
+bool streamDue(uint32_t nowUs) {
+    return active && (int32_t)(nowUs - nextDueUs) >= 0;
+}
+
+void streamSample(uint32_t tUs, uint8_t ldr, uint8_t pir, uint16_t pwm) {
+    // Fixed grid; after a stall, skip ahead instead of bursting to catch up
+    nextDueUs += STREAM_PERIOD_US;
+    if ((int32_t)(tUs - nextDueUs) >= 0) nextDueUs = tUs + STREAM_PERIOD_US;
+
+    uint8_t frame[STREAM_FRAME_MAX];
+    size_t length = encodeStreamSample({seq++, tUs, ldr, pir, pwm}, frame);
+    if ((size_t)Serial.availableForWrite() < length) {
+        dropped++;
+        return;
+    }
+    Serial.write(frame, length);
+    sent++;
+}
+
+void logWrite(const char* text, size_t length) {
+    if (!active) {
+        Serial.write((const uint8_t*)text, length);
+        return;
+    }
+    // Like samples, a frame the CDC buffer cannot take is dropped
+    uint8_t frame[STREAM_FRAME_MAX];
+    for (size_t at = 0; at < length; at += STREAM_TEXT_MAX) {
+        size_t n = encodeStreamText(text + at, length - at, frame);
+        if ((size_t)Serial.availableForWrite() >= n) Serial.write(frame, n);
+    }
+}
+
+void logPrintf(const char* format, ...) {
+    char line[LOG_LINE_MAX];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (n > 0) logWrite(line, min((size_t)n, sizeof(line) - 1));
+}
@@ -0,0 +1,67 @@
+#include "timekeeping.h"
+#include <sys/time.h>
+#include "esp_sntp.h"
+#include "esp_timer.h"
+
+// Anchor of the last sync: wall clock and monotonic time at that instant
+static volatile bool synced = false;
+static int64_t anchorEpochUs = 0;
+static int64_t anchorMonoUs = 0;
+static ClockStats stats = {false, 0, 0, 0, 0.0f};
+
+static int64_t wallUs() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+// Runs in the SNTP (lwIP) task after settimeofday()
+static void onTimeSync(struct timeval* tv) {
+    int64_t nowMono = esp_timer_get_time();
+    int64_t nowEpoch = (int64_t)tv->tv_sec * 1000000LL + tv->tv_usec;
+
+    if (synced) {
+        int64_t elapsedUs = nowMono - anchorMonoUs;
+        int64_t predictedUs = anchorEpochUs + elapsedUs;
+        int64_t correctionUs = nowEpoch - predictedUs;
+        stats.lastCorrectionMs = (int32_t)(correctionUs / 1000);
+        if (elapsedUs > 0) {
+            stats.driftPpm = (float)((double)correctionUs * 1e6 / (double)elapsedUs);
+        }
+    }
+
+    anchorEpochUs = nowEpoch;
+    anchorMonoUs = nowMono;
+    stats.syncCount++;
+    synced = true;
+}
+
+void timeBegin(const char* ntpServer1, const char* ntpServer2) {
+    sntp_set_time_sync_notification_cb(onTimeSync);
+    configTime(0, 0, ntpServer1, ntpServer2);
+}
+
+uint64_t monoUs() {
+    return (uint64_t)esp_timer_get_time();
+}
+
+bool timeSynced() {
+    return synced;
+}
+
+uint64_t epochMs() {
+    return synced ? (uint64_t)(wallUs() / 1000) : 0;
+}
+
+uint64_t monoToEpochMs(uint64_t captureUs) {
+    if (!synced) return 0;
+    int64_t ageUs = esp_timer_get_time() - (int64_t)captureUs;
+    return (uint64_t)((wallUs() - ageUs) / 1000);
+}
+
+ClockStats clockStats() {
+    ClockStats s = stats;
+    s.synced = synced;
+    s.lastSyncAgeS = synced ? (uint32_t)((esp_timer_get_time() - anchorMonoUs) / 1000000LL) : 0;
+    return s;
+}
@@ -0,0 +1,301 @@
+#include "tls_client.h"
+#include <new>
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/error.h"
+#include "esp_timer.h"
+#include "memory_mode.h"
+#include "loop_watchdog.h"
+#include "serial_stream.h"
+
+const uint32_t TLS_TASK_STACK = 8192;           // Certificate chain verification is stack hungry
+const UBaseType_t TLS_TASK_PRIORITY = 1;        // Below WiFi/lwIP on core 0
+const BaseType_t TLS_TASK_CORE = 0;             // loop() runs on core 1
+const uint32_t TLS_READ_TIMEOUT_MS = 5000;      // Per handshake record
+
+// write() runs on the loop task, which feeds the task WDT only between steps
+static_assert(TLS_WRITE_TIMEOUT_MS <= 1000 && TLS_WRITE_TIMEOUT_MS < LOOP_HARD_LIMIT_S * 1000UL,
+              "a stalled write must not trip the loop watchdog");
+
+// ECDHE for forward secrecy, AES-GCM and SHA-256 run on the S3's AES/SHA
+// blocks, the ECDHE/RSA bignum math on its MPI block (mbedtls hardware
+// acceleration is on in the Arduino sdkconfig)
+static const int CIPHERSUITES[] = {
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+    MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384,
+    MBEDTLS_TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384,
+    0
+};
+
+struct TlsContext {
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_x509_crt ca;
+    mbedtls_ssl_config conf;
+    mbedtls_ssl_context ssl;
+    mbedtls_net_context net;
+    mbedtls_ssl_session session; // Last negotiated, offered on the next connect
+    bool haveSession;
+    bool open;                   // ssl/net set up (needs freeing)
+    bool verified;               // Certificate checked: this was a full handshake
+};
+
+// Only runs when the server sends its certificate, i.e. not on resumption
+static int onVerify(void* arg, mbedtls_x509_crt* crt, int depth, uint32_t* flags) {
+    (void)crt;
+    (void)depth;
+    (void)flags;
+    ((TlsContext*)arg)->verified = true;
+    return 0; // Keep mbedtls' own verdict in *flags
+}
+
+TlsSessionClient::TlsSessionClient()
+    : ctx_(nullptr), state_(TLS_IDLE), stats_(), port_(0), hostname_(nullptr), rxLen_(0), rxPos_(0),
+      window_(WINDOW_NONE), windowMaxUs_(0), lastResumed_(false) {
+    host_[0] = '\0';
+}
+
+bool TlsSessionClient::begin(const char* caPem, const char* hostname) {
+    void* block = bootAlloc(sizeof(TlsContext));
+    if (!block) return false;
+    ctx_ = new (block) TlsContext();
+    hostname_ = hostname;
+
+    mbedtls_entropy_init(&ctx_->entropy);
+    mbedtls_ctr_drbg_init(&ctx_->drbg);
+    mbedtls_x509_crt_init(&ctx_->ca);
+    mbedtls_ssl_config_init(&ctx_->conf);
+    mbedtls_ssl_session_init(&ctx_->session);
+
+    // PEM must include its terminating NUL in the length
+    if (mbedtls_ctr_drbg_seed(&ctx_->drbg, mbedtls_entropy_func, &ctx_->entropy, nullptr, 0) != 0 ||
+        mbedtls_x509_crt_parse(&ctx_->ca, (const unsigned char*)caPem, strlen(caPem) + 1) != 0 ||
+        mbedtls_ssl_config_defaults(&ctx_->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+        logPrintf("TLS: setup failed (CA certificate?)\n");
+        return false;
+    }
+    mbedtls_ssl_conf_authmode(&ctx_->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(&ctx_->conf, &ctx_->ca, nullptr);
+    mbedtls_ssl_conf_rng(&ctx_->conf, mbedtls_ctr_drbg_random, &ctx_->drbg);
+    mbedtls_ssl_conf_verify(&ctx_->conf, onVerify, ctx_);
+    mbedtls_ssl_conf_read_timeout(&ctx_->conf, TLS_READ_TIMEOUT_MS);
+    mbedtls_ssl_conf_ciphersuites(&ctx_->conf, CIPHERSUITES);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(&ctx_->conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+    // TLS 1.3 resumes from post-handshake tickets that get_session() may not
+    // have yet; 1.2 tickets/IDs are known the moment the handshake ends
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3)
+    mbedtls_ssl_conf_max_tls_version(&ctx_->conf, MBEDTLS_SSL_VERSION_TLS1_2);
+#endif
+    return true;
+}
+
+bool TlsSessionClient::connectInBackground(const char* host, uint16_t port) {
+    if (!ctx_ || state_ != TLS_IDLE || strlen(host) >= sizeof(host_)) return false;
+    strcpy(host_, host);
+    port_ = port;
+    window_ = WINDOW_OPEN; // A failed attempt's window is dropped here too
+    windowMaxUs_ = 0;
+    state_ = TLS_CONNECTING;
+    if (xTaskCreatePinnedToCore(taskEntry, "mqtt_tls", TLS_TASK_STACK, this, TLS_TASK_PRIORITY, nullptr,
+                                TLS_TASK_CORE) != pdPASS) {
+        state_ = TLS_IDLE;
+        window_ = WINDOW_NONE;
+        return false;
+    }
+    return true;
+}
+
+void TlsSessionClient::connectDone() {
+    if (window_ == WINDOW_OPEN) window_ = WINDOW_CLOSING;
+}
+
+// The step after connectDone() closes the gap that contains CONNECT itself
+void TlsSessionClient::noteLoopGap(uint32_t gapUs) {
+    if (window_ == WINDOW_NONE) return;
+    if (gapUs > windowMaxUs_) windowMaxUs_ = gapUs;
+    if (window_ != WINDOW_CLOSING) return;
+    uint32_t& worst = lastResumed_ ? stats_.resumedLoopMaxUs : stats_.fullLoopMaxUs;
+    if (windowMaxUs_ > worst) worst = windowMaxUs_;
+    window_ = WINDOW_NONE;
+}
+
+void TlsSessionClient::taskEntry(void* self) {
+    TlsSessionClient* client = (TlsSessionClient*)self;
+    client->state_ = client->handshake() ? TLS_READY : TLS_IDLE;
+    vTaskDelete(nullptr);
+}
+
+// Runs on the TLS task (or the caller of connect()); the loop does not touch
+// the client until state_ leaves TLS_CONNECTING
+bool TlsSessionClient::handshake() {
+    TlsContext* c = ctx_;
+    int64_t startUs = esp_timer_get_time();
+    char port[6];
+    snprintf(port, sizeof(port), "%u", port_);
+
+    mbedtls_ssl_init(&c->ssl);
+    mbedtls_net_init(&c->net);
+    c->open = true;
+    c->verified = false;
+    rxLen_ = rxPos_ = 0;
+
+    int ret = mbedtls_ssl_setup(&c->ssl, &c->conf);
+    if (ret == 0) ret = mbedtls_ssl_set_hostname(&c->ssl, hostname_ ? hostname_ : host_);
+    // A stale session is harmless: the server answers with a full handshake
+    if (ret == 0 && c->haveSession) mbedtls_ssl_set_session(&c->ssl, &c->session);
+    if (ret == 0) ret = mbedtls_net_connect(&c->net, host_, port, MBEDTLS_NET_PROTO_TCP);
+    bool tcpUp = ret == 0;
+    if (tcpUp) {
+        mbedtls_ssl_set_bio(&c->ssl, &c->net, mbedtls_net_send, mbedtls_net_recv, mbedtls_net_recv_timeout);
+        while ((ret = mbedtls_ssl_handshake(&c->ssl)) != 0) {
+            bool retry = ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE;
+            if (!retry || esp_timer_get_time() - startUs > (int64_t)TLS_HANDSHAKE_TIMEOUT_MS * 1000) break;
+        }
+    }
+    uint32_t elapsedMs = (uint32_t)((esp_timer_get_time() - startUs) / 1000);
+    if (ret != 0) {
+        char reason[96];
+        mbedtls_strerror(ret, reason, sizeof(reason));
+        logPrintf("TLS: handshake failed after %u ms: -0x%04x %s\n", elapsedMs, -ret, reason);
+        stats_.failures++;
+        // The server may have refused the session: start over with a full
+        // handshake (a TCP failure says nothing about it, keep it then)
+        if (tcpUp && c->haveSession) {
+            mbedtls_ssl_session_free(&c->session);
+            mbedtls_ssl_session_init(&c->session);
+            c->haveSession = false;
+        }
+        close(false);
+        return false;
+    }
+
+    bool resumed = c->haveSession && !c->verified;
+    lastResumed_ = resumed;
+    stats_.handshakes++;
+    stats_.lastMs = elapsedMs;
+    if (resumed) {
+        stats_.resumed++;
+        stats_.resumedMsTotal += elapsedMs;
+    } else {
+        stats_.fullMsTotal += elapsedMs;
+    }
+    logPrintf("TLS: %s handshake in %u ms (%s)\n", resumed ? "resumed" : "full", elapsedMs,
+                  mbedtls_ssl_get_ciphersuite(&c->ssl));
+
+    // Keep the new ticket/ID for the next reconnect
+    mbedtls_ssl_session_free(&c->session);
+    mbedtls_ssl_session_init(&c->session);
+    c->haveSession = mbedtls_ssl_get_session(&c->ssl, &c->session) == 0;
+
+    // From here on loop() drives the socket: never block it on a read
+    mbedtls_net_set_nonblock(&c->net);
+    mbedtls_ssl_set_bio(&c->ssl, &c->net, mbedtls_net_send, mbedtls_net_recv, nullptr);
+    return true;
+}
+
+void TlsSessionClient::close(bool notify) {
+    TlsContext* c = ctx_;
+    if (!c->open) return;
+    if (notify) mbedtls_ssl_close_notify(&c->ssl); // Best effort, non-blocking
+    mbedtls_net_free(&c->net);
+    mbedtls_ssl_free(&c->ssl); // Releases the record buffers while disconnected
+    c->open = false;
+    rxLen_ = rxPos_ = 0;
+}
+
+// Blocking fallback for callers that connect() directly
+int TlsSessionClient::connect(const char* host, uint16_t port) {
+    if (!ctx_ || state_ == TLS_CONNECTING || strlen(host) >= sizeof(host_)) return 0;
+    if (state_ == TLS_READY) stop();
+    strcpy(host_, host);
+    port_ = port;
+    state_ = TLS_CONNECTING;
+    state_ = handshake() ? TLS_READY : TLS_IDLE;
+    return state_ == TLS_READY;
+}
+
+int TlsSessionClient::connect(IPAddress ip, uint16_t port) {
+    return connect(ip.toString().c_str(), port);
+}
+
+uint8_t TlsSessionClient::connected() {
+    if (state_ != TLS_READY) return 0;
+    fill(); // Notices a close from the server
+    return state_ == TLS_READY;
+}
+
+bool TlsSessionClient::fill() {
+    if (state_ != TLS_READY) return false;
+    if (rxPos_ < rxLen_) return true;
+    int ret = mbedtls_ssl_read(&ctx_->ssl, rx_, sizeof(rx_));
+    if (ret > 0) {
+        rxLen_ = ret;
+        rxPos_ = 0;
+        return true;
+    }
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) return false;
+    // 0 or close_notify: server closed; anything else: link or record error
+    close(false);
+    state_ = TLS_IDLE;
+    return false;
+}
+
+int TlsSessionClient::available() {
+    return fill() ? (int)(rxLen_ - rxPos_) : 0;
+}
+
+int TlsSessionClient::read() {
+    return fill() ? rx_[rxPos_++] : -1;
+}
+
+int TlsSessionClient::read(uint8_t* buf, size_t size) {
+    if (!fill()) return -1;
+    size_t n = min(size, rxLen_ - rxPos_);
+    memcpy(buf, rx_ + rxPos_, n);
+    rxPos_ += n;
+    return n;
+}
+
+int TlsSessionClient::peek() {
+    return fill() ? rx_[rxPos_] : -1;
+}
+
+size_t TlsSessionClient::write(uint8_t b) {
+    return write(&b, 1);
+}
+
+// MQTT packets are small: the socket buffer takes them at once unless the
+// link is stalled, which the timeout turns into a disconnect (short: loop()
+// and the control step wait on it)
+size_t TlsSessionClient::write(const uint8_t* buf, size_t size) {
+    if (state_ != TLS_READY) return 0;
+    size_t written = 0;
+    unsigned long startMs = millis();
+    while (written < size) {
+        int ret = mbedtls_ssl_write(&ctx_->ssl, buf + written, size - written);
+        if (ret > 0) {
+            written += ret;
+        } else if ((ret == MBEDTLS_ERR_SSL_WANT_WRITE || ret == MBEDTLS_ERR_SSL_WANT_READ) &&
+                   millis() - startMs < TLS_WRITE_TIMEOUT_MS) {
+            delay(1);
+        } else {
+            close(false);
+            state_ = TLS_IDLE;
+            break;
+        }
+    }
+    return written;
+}
+
+void TlsSessionClient::stop() {
+    if (state_ != TLS_READY) return; // Never pull the context from under the TLS task
+    close(true);
+    state_ = TLS_IDLE;
+}
@@ -0,0 +1,133 @@
+"""Symbolize sampling-profiler output into folded stacks for flame graphs.
+
+Capture the upload (Serial log, or MQTT), then fold against the ELF of the
+same build:
+
+    mosquitto_sub -h <broker> -t smartcity/streetlight/1/profile > profile.txt
+    mosquitto_pub -h <broker> -t smartcity/streetlight/1/command -m '{"cmd":"profile","hz":1000,"s":10}'
+    python tools/profile_fold.py .pio/build/cytron_maker_feather_aiot_s3/firmware.elf profile.txt > out.folded
+    flamegraph.pl out.folded > profile.svg
+
+Each output line is "task;caller;function count". The device records only
+the interrupted PC and its return address, so stacks are two frames deep.
+
+A capture with samples missing (chunks MQTT did not take while the broker
+was away, or a dump cut short) is refused unless --partial is given; the
+Serial log always has every chunk.
+"""
+import argparse
+import collections
+import os
+import re
+import subprocess
+import sys
+
+SAMPLE_LINE = re.compile(r"^([0-9a-f]{8}) ([0-9a-f]{8}) (\S+)$")
+HEADER_LINE = re.compile(r"^# profile (.*)$")
+END_LINE = re.compile(r"^# end(.*)$")
+DEFAULT_ADDR2LINE = os.path.expanduser(
+    "~/.platformio/packages/toolchain-xtensa-esp32s3/bin/xtensa-esp32s3-elf-addr2line")
+
+
+def fields(text):
+    """key=value pairs of a header or end line."""
+    return dict(item.split("=", 1) for item in text.split() if "=" in item)
+
+
+def read_samples(paths):
+    """(pc, caller, task) tuples, the capture headers, and what is missing from each capture."""
+    samples, headers, problems = [], [], []
+    capture = None  # [header, samples seen, end line seen, chunks the device did not publish]
+
+    def close():
+        if capture is None:
+            return
+        header, seen, ended, unsent = capture
+        expected = int(fields(header).get("samples", seen))
+        if seen < expected:
+            reason = f" ({unsent} chunks not published over MQTT)" if unsent else ""
+            problems.append(f"{header}: {expected - seen} of {expected} samples missing{reason}")
+        elif not ended:
+            problems.append(f"{header}: no end line")
+
+    for path in paths:
+        with (sys.stdin if path == "-" else open(path, errors="replace")) as f:
+            for line in f:
+                line = line.strip()
+                match = SAMPLE_LINE.match(line)
+                if match:
+                    samples.append((int(match.group(1), 16), int(match.group(2), 16), match.group(3)))
+                    if capture is None:
+                        capture = ["(no header)", 0, False, 0]
+                        problems.append("samples without a capture header: its first chunk is missing")
+                    capture[1] += 1
+                    continue
+                match = HEADER_LINE.match(line)
+                if match:
+                    close()
+                    headers.append(match.group(1))
+                    capture = [match.group(1), 0, False, 0]
+                    continue
+                match = END_LINE.match(line)
+                if match and capture is not None:
+                    capture[2] = True
+                    capture[3] = int(fields(match.group(1)).get("unsent", 0))
+    close()
+    return samples, headers, problems
+
+
+def symbolize(addr2line, elf, addresses):
+    """Function name per address, one addr2line run for all of them."""
+    addresses = sorted(addresses)
+    query = "".join(f"0x{a:08x}\n" for a in addresses)
+    result = subprocess.run([addr2line, "-f", "-C", "-e", elf], input=query, capture_output=True,
+                            text=True, check=True)
+    lines = result.stdout.splitlines()
+    # Two lines per address: function, file:line
+    names = {}
+    for i, address in enumerate(addresses):
+        name = lines[2 * i] if 2 * i < len(lines) else "??"
+        names[address] = f"0x{address:08x}" if name == "??" else name
+    return names
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="firmware.elf of the build that produced the samples")
+    parser.add_argument("dumps", nargs="+", help="captured profiler output ('-' for stdin)")
+    parser.add_argument("--addr2line", default=DEFAULT_ADDR2LINE)
+    parser.add_argument("--no-caller", action="store_true", help="fold as task;function only")
+    parser.add_argument("--partial", action="store_true", help="fold a capture with samples missing")
+    args = parser.parse_args()
+
+    samples, headers, problems = read_samples(args.dumps)
+    if not samples:
+        print("No samples found", file=sys.stderr)
+        return 1
+    for header in headers:
+        print(f"capture: {header}", file=sys.stderr)
+    for problem in problems:
+        print(f"incomplete: {problem}", file=sys.stderr)
+    if problems and not args.partial:
+        print("Refusing to fold an incomplete profile (use the Serial log, or --partial)", file=sys.stderr)
+        return 1
+
+    addresses = {pc for pc, _, _ in samples}
+    if not args.no_caller:
+        addresses |= {caller for _, caller, _ in samples if caller}
+    names = symbolize(args.addr2line, args.elf, addresses)
+
+    folded = collections.Counter()
+    for pc, caller, task in samples:
+        frames = [task]
+        if not args.no_caller and caller:
+            frames.append(names[caller])
+        frames.append(names[pc])
+        folded[";".join(frames)] += 1
+    for stack, count in folded.most_common():
+        print(f"{stack} {count}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())